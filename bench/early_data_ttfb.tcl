@@ -0,0 +1,129 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the time to first byte of requests on resumed tls 1.3 connections, with the request
+# sent as early data along with the ClientHello or after the handshake. The client connects
+# through a proxy that delays what it forwards by delay_millis each way, like a network with
+# a round trip of twice that. The time is from when the proxy accepted the connection until
+# s_client printed the status line of the response.
+#
+# Usage: tclsh early_data_ttfb.tcl ?mode? ?num_requests? ?delay_millis?
+#   mode: early (tls_max_early_data 16384 and s_client -early_data) or after (no early data)
+
+package require twebserver
+
+set mode [expr { [llength $argv] > 0 ? [lindex $argv 0] : "early" }]
+set num_requests [expr { [llength $argv] > 1 ? [lindex $argv 1] : 50 }]
+set delay_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 20 }]
+set port 10092
+set proxy_port 10093
+
+if { [lindex $argv 3] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain ok]
+        }
+    }
+    set certs_dir [file join [file dirname [info script]] .. certs host1]
+    set config_dict [dict create tls_max_early_data [expr { $mode eq "early" ? 16384 : 0 }]]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::add_context $server_handle localhost [file join $certs_dir key.pem] [file join $certs_dir cert.pem]
+    ::twebserver::listen_server -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+proc proxy_accept {client addr port} {
+    set ::accepted_micros [clock microseconds]
+    set server [socket localhost $::port]
+    fconfigure $client -translation binary -blocking 0 -buffering none
+    fconfigure $server -translation binary -blocking 0 -buffering none
+    fileevent $client readable [list proxy_forward $client $server]
+    fileevent $server readable [list proxy_forward $server $client]
+}
+
+proc proxy_forward {from to} {
+    set data [read $from]
+    if { $data ne {} } {
+        after $::delay_millis [list catch [list puts -nonewline $to $data]]
+    }
+    if { [eof $from] } {
+        fileevent $from readable {}
+        after [expr { $::delay_millis + 1 }] [list catch [list close $from]]
+        after [expr { $::delay_millis + 1 }] [list catch [list close $to]]
+    }
+}
+
+proc client_readable {fp} {
+    append ::output [read $fp]
+    if { ![info exists ::first_byte_micros] && [string first "HTTP/1.1" $::output] != -1 } {
+        set ::first_byte_micros [clock microseconds]
+    }
+    if { [eof $fp] } {
+        fileevent $fp readable {}
+        set ::done 1
+    }
+}
+
+proc percentile {sorted p} {
+    return [lindex $sorted [expr { int(ceil([llength $sorted] * $p / 100.0)) - 1 }]]
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $mode $num_requests $delay_millis server &]
+sleep 1000
+
+set request "GET / HTTP/1.1\r\nConnection: close\r\n\r\n"
+set request_file [file join /tmp early_data_ttfb_request.txt]
+set session_file [file join /tmp early_data_ttfb_session.pem]
+set fp [open $request_file w]
+fconfigure $fp -translation binary
+puts -nonewline $fp $request
+close $fp
+
+# the tls 1.3 tickets come after the handshake, s_client waits for the server to close the conn
+set cmd "openssl s_client -connect localhost:$port -servername localhost -tls1_3 -ign_eof -sess_out $session_file"
+exec {*}$cmd < $request_file > /dev/null 2> /dev/null
+
+set proxy [socket -server proxy_accept $proxy_port]
+set cmd "openssl s_client -connect localhost:$proxy_port -servername localhost -tls1_3 -ign_eof -sess_in $session_file"
+if { $mode eq "early" } {
+    # the request goes as early data and not from stdin
+    set cmd "$cmd -early_data $request_file < /dev/null"
+} else {
+    set cmd "$cmd < $request_file"
+}
+
+set latencies [list]
+set num_early 0
+for {set i 0} {$i < $num_requests} {incr i} {
+    unset -nocomplain ::first_byte_micros
+    set ::output ""
+    set fp [open "|$cmd 2> /dev/null" r]
+    fconfigure $fp -blocking 0 -translation binary
+    fileevent $fp readable [list client_readable $fp]
+    vwait ::done
+    catch {close $fp}
+    if { [info exists ::first_byte_micros] } {
+        lappend latencies [expr { $::first_byte_micros - $::accepted_micros }]
+    }
+    if { [string first "Early data was accepted" $::output] != -1 } {
+        incr num_early
+    }
+}
+
+close $proxy
+exec kill -9 $server_pid
+file delete $request_file $session_file
+
+set latencies [lsort -integer $latencies]
+puts [format "mode: %s delay: %d ms each way requests: %d early data accepted: %d ttfb p50: %d us p99: %d us" \
+    $mode $delay_millis [llength $latencies] $num_early [percentile $latencies 50] [percentile $latencies 99]]
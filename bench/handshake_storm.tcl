@@ -0,0 +1,104 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the latency of the requests of a keepalive client while a storm of new TLS
+# connections hits the same server. The server has a TLS listener with num_threads conn
+# threads and tls_handshake_threads handshake threads, 0 for handshakes on the conn threads.
+# num_storm_clients processes of tls_storm_client open connections one after the other, each
+# with a full handshake, while the keepalive client sends num_requests requests one after
+# the other on a connection that it opened before the storm. The percentiles are of the
+# time from sending a request until its response was read.
+#
+# Usage: cmake --build build --target tls_storm_client
+#        tclsh handshake_storm.tcl ?tls_handshake_threads? ?num_storm_clients? ?num_requests? ?num_threads? ?storm_client?
+
+package require twebserver
+
+set tls_handshake_threads [expr { [llength $argv] > 0 ? [lindex $argv 0] : 0 }]
+set num_storm_clients [expr { [llength $argv] > 1 ? [lindex $argv 1] : 4 }]
+set num_requests [expr { [llength $argv] > 2 ? [lindex $argv 2] : 2000 }]
+set num_threads [expr { [llength $argv] > 3 ? [lindex $argv 3] : 1 }]
+set storm_client [expr { [llength $argv] > 4 ? [lindex $argv 4] : [file join [file dirname [info script]] .. build tls_storm_client] }]
+set port 10091
+
+if { [lindex $argv 5] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            if { [dict get $req path] eq "/info-tls" } {
+                set body [::twebserver::info_tls]
+            } else {
+                set body ok
+            }
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain $body]
+        }
+    }
+    set certs_dir [file join [file dirname [info script]] .. certs host1]
+    set config_dict [dict create num_threads $num_threads tls_handshake_threads $tls_handshake_threads]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::add_context $server_handle localhost [file join $certs_dir key.pem] [file join $certs_dir cert.pem]
+    ::twebserver::listen_server -num_threads $num_threads $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+# sends a keepalive request and returns the body of the response
+proc keepalive_request {fp path} {
+    puts -nonewline $fp "GET $path HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+    flush $fp
+    set content_length 0
+    gets $fp
+    while {[set line [string trimright [gets $fp]]] ne {}} {
+        regexp -nocase {^content-length: (\d+)} $line -> content_length
+    }
+    return [read $fp $content_length]
+}
+
+proc percentile {sorted p} {
+    return [lindex $sorted [expr { int(ceil([llength $sorted] * $p / 100.0)) - 1 }]]
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $tls_handshake_threads $num_storm_clients $num_requests $num_threads $storm_client server &]
+sleep 1000
+
+set cmd "openssl s_client -connect localhost:$port -servername localhost -quiet"
+set fp [open "|$cmd 2> /dev/null" r+]
+fconfigure $fp -translation binary
+keepalive_request $fp /
+
+set storm_pids [list]
+for {set i 0} {$i < $num_storm_clients} {incr i} {
+    lappend storm_pids [exec $storm_client $port &]
+}
+sleep 500
+set handshakes_before [dict get [keepalive_request $fp /info-tls] handshakes]
+
+set latencies [list]
+set start [clock milliseconds]
+for {set i 0} {$i < $num_requests} {incr i} {
+    set t [clock microseconds]
+    keepalive_request $fp /
+    lappend latencies [expr { [clock microseconds] - $t }]
+}
+set elapsed [expr { [clock milliseconds] - $start }]
+set info [keepalive_request $fp /info-tls]
+
+exec kill -9 {*}$storm_pids
+exec kill [pid $fp]
+catch {close $fp}
+exec kill -9 $server_pid
+
+set latencies [lsort -integer $latencies]
+set handshakes [expr { [dict get $info handshakes] - $handshakes_before }]
+puts [format "handshake threads: %d storm clients: %d keepalive requests/sec: %.1f p50: %d us p99: %d us max: %d us handshakes/sec: %.1f" \
+    $tls_handshake_threads $num_storm_clients [expr { 1000.0 * $num_requests / $elapsed }] \
+    [percentile $latencies 50] [percentile $latencies 99] [lindex $latencies end] \
+    [expr { 1000.0 * $handshakes / $elapsed }]]
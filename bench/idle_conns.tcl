@@ -0,0 +1,96 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the latency of keepalive requests while many idle connections are open
+# and how many of the idle connections the server closes once they time out.
+#
+# Usage: tclsh idle_conns.tcl ?num_idle_conns? ?num_requests? ?conn_timeout_millis?
+
+package require twebserver
+
+set num_idle_conns [expr { [llength $argv] > 0 ? [lindex $argv 0] : 10000 }]
+set num_requests [expr { [llength $argv] > 1 ? [lindex $argv 1] : 50000 }]
+set conn_timeout_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 20000 }]
+set port 10084
+
+if { [lindex $argv 3] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain "hello"]
+        }
+    }
+    set config_dict [dict create num_threads 1 conn_timeout_millis $conn_timeout_millis]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $num_idle_conns $num_requests $conn_timeout_millis server &]
+sleep 1000
+
+# no file events on the idle conns, the select based notifier of tclsh cannot watch that many
+set idle_socks [list]
+for {set i 0} {$i < $num_idle_conns} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary
+    lappend idle_socks $sock
+    if { $i % 500 == 499 } {
+        # let the server keep up with accepting them, so that the listen backlog does not overflow
+        sleep 100
+    }
+}
+set idle_start [clock milliseconds]
+sleep 1000
+
+set sock [socket localhost $port]
+fconfigure $sock -translation binary -buffering none
+set latencies [list]
+for {set i 0} {$i < $num_requests} {incr i} {
+    set start [clock microseconds]
+    puts -nonewline $sock "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+    read $sock 66
+    lappend latencies [expr { [clock microseconds] - $start }]
+}
+close $sock
+set latencies [lsort -integer $latencies]
+set n [llength $latencies]
+puts [format "idle conns: %d requests: %d p50: %.3f ms p99.9: %.3f ms max: %.3f ms" $num_idle_conns $num_requests \
+    [expr { [lindex $latencies [expr { $n / 2 }]] / 1000.0 }] \
+    [expr { [lindex $latencies [expr { $n * 999 / 1000 }]] / 1000.0 }] \
+    [expr { [lindex $latencies end] / 1000.0 }]]
+
+# wait for the idle conns to time out on a server that receives no requests
+set ticks_before [cpu_ticks $server_pid]
+sleep [expr { max(0, $idle_start + $conn_timeout_millis - [clock milliseconds]) + 3000 }]
+set ticks_after [cpu_ticks $server_pid]
+
+
+set num_closed 0
+foreach sock $idle_socks {
+    if { [catch {read $sock}] || [eof $sock] } {
+        incr num_closed
+    }
+}
+
+exec kill -9 $server_pid
+
+puts [format "idle conns closed by the server %d ms after the timeout: %d of %d, server cpu while idle: %d ms" \
+    3000 $num_closed $num_idle_conns [expr { ($ticks_after - $ticks_before) * 10 }]]
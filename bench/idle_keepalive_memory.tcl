@@ -0,0 +1,67 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the resident memory of the server while many keepalive
+# connections sit idle after their first request.
+#
+# Usage: tclsh idle_keepalive_memory.tcl ?num_conns? ?body_size?
+
+package require twebserver
+
+set num_conns [expr { [llength $argv] > 0 ? [lindex $argv 0] : 10000 }]
+set body_size [expr { [llength $argv] > 1 ? [lindex $argv 1] : 0 }]
+set port 10085
+
+if { [lindex $argv 2] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain "hello"]
+        }
+    }
+    set config_dict [dict create num_threads 1 gzip off]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc rss_kb {pid} {
+    set fp [open /proc/$pid/status]
+    set status [read $fp]
+    close $fp
+    regexp {VmRSS:\s+(\d+)} $status -> rss
+    return $rss
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $num_conns $body_size server &]
+sleep 1000
+set rss_before [rss_kb $server_pid]
+
+# no file events on the conns, the select based notifier of tclsh cannot watch that many
+set body [string repeat x $body_size]
+set socks [list]
+set start [clock microseconds]
+for {set i 0} {$i < $num_conns} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -translation binary -buffering none
+    puts -nonewline $sock "POST / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nContent-Length: $body_size\r\n\r\n$body"
+    read $sock 66
+    lappend socks $sock
+}
+set elapsed [expr { [clock microseconds] - $start }]
+sleep 1000
+
+puts [format "idle keepalive conns: %d body: %d bytes first request: %.1f us server rss: %d KB (%.1f KB per conn)" \
+    $num_conns $body_size [expr { double($elapsed) / $num_conns }] [rss_kb $server_pid] \
+    [expr { double([rss_kb $server_pid] - $rss_before) / $num_conns }]]
+
+exec kill -9 $server_pid
@@ -0,0 +1,94 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the requests per second and the server CPU per request
+# over keepalive connections for the given event loop.
+#
+# Usage: tclsh keepalive_requests.tcl ?event_loop? ?num_clients? ?duration_millis?
+
+package require twebserver
+
+set event_loop [expr { [llength $argv] > 0 ? [lindex $argv 0] : "tcl" }]
+set num_clients [expr { [llength $argv] > 1 ? [lindex $argv 1] : 50 }]
+set duration_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 10000 }]
+set port 10082
+
+if { [lindex $argv 3] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain "hello"]
+        }
+    }
+    set config_dict [dict create num_threads 1 event_loop $event_loop]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+proc send_request {sock} {
+    puts -nonewline $sock "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+    flush $sock
+}
+
+# the response has a fixed size, send the next request as soon as it is complete
+proc on_response {sock} {
+    if { [catch {append ::buffer($sock) [read $sock]}] || [eof $sock] } {
+        close $sock
+        return
+    }
+    set end [string first "\r\n\r\n" $::buffer($sock)]
+    if { $end == -1 || [string length $::buffer($sock)] < $end + 4 + 5 } {
+        return
+    }
+    set ::buffer($sock) [string range $::buffer($sock) [expr { $end + 4 + 5 }] end]
+    if { $::measuring } {
+        incr ::num_responses
+    }
+    send_request $sock
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $event_loop $num_clients $duration_millis server &]
+sleep 1000
+
+set ::measuring 0
+set ::num_responses 0
+for {set i 0} {$i < $num_clients} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary -buffering none
+    set ::buffer($sock) ""
+    fileevent $sock readable [list on_response $sock]
+    send_request $sock
+}
+
+sleep 1000
+set ticks_before [cpu_ticks $server_pid]
+set ::measuring 1
+sleep $duration_millis
+set ::measuring 0
+set ticks_after [cpu_ticks $server_pid]
+
+exec kill -9 $server_pid
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "event_loop: %s clients: %d requests/sec: %.0f server cpu: %.1f us/request" \
+    $event_loop $num_clients [expr { 1000.0 * $::num_responses / $duration_millis }] \
+    [expr { $::num_responses ? 1000.0 * $cpu_millis / $::num_responses : 0 }]]
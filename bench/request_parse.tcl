@@ -0,0 +1,150 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the cost of parsing a typical browser request with 15 headers and of the
+# first access of the handler to the request dict. The handler times its first access
+# and sends the time back in the body, the server CPU per request covers the parsing.
+# The access is one of "dict" (dict get $req headers user-agent), "get_header"
+# (::twebserver::get_header $req user-agent), "query" (::twebserver::get_query_param
+# $req page), "path" (dict get $req path), "upload", which sends a 64KB binary body
+# along and looks at the path only, or "cookies", which sends bench/requests/cookie_heavy.http
+# with a 3KB cookie header and looks at the path only.
+#
+# Usage: tclsh request_parse.tcl ?event_loop? ?num_clients? ?duration_millis? ?access?
+
+package require twebserver
+
+set event_loop [expr { [llength $argv] > 0 ? [lindex $argv 0] : "epoll" }]
+set num_clients [expr { [llength $argv] > 1 ? [lindex $argv 1] : 20 }]
+set duration_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 10000 }]
+set access [expr { [llength $argv] > 3 ? [lindex $argv 3] : "dict" }]
+set port 10086
+
+array set access_scripts {
+    dict {dict get $req headers user-agent}
+    get_header {::twebserver::get_header $req user-agent}
+    query {::twebserver::get_query_param $req page}
+    path {dict get $req path}
+    upload {dict get $req path}
+    cookies {dict get $req path}
+}
+
+if { [lindex $argv 4] eq "server" } {
+    set init_script [string map [list %ACCESS% $access_scripts($access)] {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set start [clock microseconds]
+            set value [%ACCESS%]
+            set elapsed [expr { [clock microseconds] - $start }]
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain [format %08d $elapsed]]
+        }
+    }]
+    set config_dict [dict create num_threads 1 event_loop $event_loop]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set request [join {
+    "GET /products/list?category=books&sort=price&page=2 HTTP/1.1"
+    "Host: www.example.com"
+    "Connection: keep-alive"
+    "Cache-Control: max-age=0"
+    "sec-ch-ua: \"Chromium\";v=\"122\", \"Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\""
+    "sec-ch-ua-mobile: ?0"
+    "sec-ch-ua-platform: \"Linux\""
+    "Upgrade-Insecure-Requests: 1"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8"
+    "Sec-Fetch-Site: same-origin"
+    "Sec-Fetch-Mode: navigate"
+    "Sec-Fetch-User: ?1"
+    "Sec-Fetch-Dest: document"
+    "Accept-Encoding: gzip, deflate, br"
+    "Accept-Language: en-US,en;q=0.9,el;q=0.8"
+    "" ""
+} "\r\n"]
+
+if { $access eq "cookies" } {
+    set fp [open [file join [file dirname [info script]] requests cookie_heavy.http]]
+    fconfigure $fp -translation binary
+    set request [read $fp]
+    close $fp
+}
+
+if { $access eq "upload" } {
+    set body [string repeat [binary format c* {0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15}] 4096]
+    set request [string map [list "GET " "POST " "\r\n\r\n" \
+        "\r\nContent-Type: application/octet-stream\r\nContent-Length: [string length $body]\r\n\r\n$body"] $request]
+}
+
+proc send_request {sock} {
+    puts -nonewline $sock $::request
+    flush $sock
+}
+
+# the response has a fixed size, the body is the time of the first access in microseconds
+proc on_response {sock} {
+    if { [catch {append ::buffer($sock) [read $sock]}] || [eof $sock] } {
+        close $sock
+        return
+    }
+    set end [string first "\r\n\r\n" $::buffer($sock)]
+    if { $end == -1 || [string length $::buffer($sock)] < $end + 4 + 8 } {
+        return
+    }
+    set elapsed [scan [string range $::buffer($sock) [expr { $end + 4 }] [expr { $end + 4 + 7 }]] %d]
+    set ::buffer($sock) [string range $::buffer($sock) [expr { $end + 4 + 8 }] end]
+    if { $::measuring } {
+        incr ::num_responses
+        incr ::first_access_micros $elapsed
+    }
+    send_request $sock
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $event_loop $num_clients $duration_millis $access server &]
+sleep 1000
+
+set ::measuring 0
+set ::num_responses 0
+set ::first_access_micros 0
+for {set i 0} {$i < $num_clients} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary -buffering none
+    set ::buffer($sock) ""
+    fileevent $sock readable [list on_response $sock]
+    send_request $sock
+}
+
+sleep 1000
+set ticks_before [cpu_ticks $server_pid]
+set ::measuring 1
+sleep $duration_millis
+set ::measuring 0
+set ticks_after [cpu_ticks $server_pid]
+
+exec kill -9 $server_pid
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "event_loop: %s access: %s clients: %d requests/sec: %.0f server cpu: %.1f us/request first access: %.2f us" \
+    $event_loop $access $num_clients [expr { 1000.0 * $::num_responses / $duration_millis }] \
+    [expr { $::num_responses ? 1000.0 * $cpu_millis / $::num_responses : 0 }] \
+    [expr { $::num_responses ? double($::first_access_micros) / $::num_responses : 0 }]]
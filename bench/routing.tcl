@@ -0,0 +1,122 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the cost of routing with a router of num_routes routes. For every resource
+# there is a static route "GET /resourceN/list" and a route with a path parameter
+# "GET /resourceN/:id", and the last route is a catch-all "GET *". The target is the
+# route that the requests go to, one of "first" (/resource0/list), "static" and "param"
+# (the routes of the resource in the middle), "params", which goes to the path parameter
+# routes of all the resources in turn, or "catchall", which goes through all the routes
+# with the linear scan. The server CPU per request covers the whole request. The id_pattern
+# is appended to ":id", e.g. "(\d+)" makes the path parameter routes regexp routes.
+#
+# Usage: tclsh routing.tcl ?num_routes? ?target? ?num_clients? ?duration_millis? ?id_pattern?
+
+package require twebserver
+
+set num_routes [expr { [llength $argv] > 0 ? [lindex $argv 0] : 100 }]
+set target [expr { [llength $argv] > 1 ? [lindex $argv 1] : "catchall" }]
+set num_clients [expr { [llength $argv] > 2 ? [lindex $argv 2] : 20 }]
+set duration_millis [expr { [llength $argv] > 3 ? [lindex $argv 3] : 10000 }]
+set id_pattern [expr { [llength $argv] > 4 ? [lindex $argv 4] : "" }]
+set port 10087
+
+set num_resources [expr { max(1, ($num_routes - 1) / 2) }]
+set middle [expr { $num_resources / 2 }]
+array set target_paths [list \
+    first /resource0/list \
+    static /resource${middle}/list \
+    param /resource${middle}/12345 \
+    params /resource%d/12345 \
+    catchall /does/not/exist]
+
+if { [lindex $argv 5] eq "server" } {
+    set init_script [string map [list %NUM_RESOURCES% $num_resources %ID_PATTERN% [list $id_pattern]] {
+        package require twebserver
+
+        ::twebserver::create_router -command_name process_conn router
+        set id_pattern %ID_PATTERN%
+        for {set i 0} {$i < %NUM_RESOURCES%} {incr i} {
+            ::twebserver::add_route -strict $router GET /resource${i}/list handler
+            ::twebserver::add_route -strict $router GET /resource${i}/:id$id_pattern handler
+        }
+        ::twebserver::add_route $router GET "*" handler
+
+        proc handler {ctx req} {
+            return [::twebserver::build_response 200 text/plain ok]
+        }
+    }]
+    set config_dict [dict create num_threads 1]
+    set server_handle [::twebserver::create_server -with_router $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set request "GET $target_paths($target) HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+set next_resource 0
+
+proc send_request {sock} {
+    puts -nonewline $sock [format $::request [expr { [incr ::next_resource] % $::num_resources }]]
+    flush $sock
+}
+
+# the response has a fixed size, the body is "ok"
+proc on_response {sock} {
+    if { [catch {append ::buffer($sock) [read $sock]}] || [eof $sock] } {
+        close $sock
+        return
+    }
+    set end [string first "\r\n\r\n" $::buffer($sock)]
+    if { $end == -1 || [string length $::buffer($sock)] < $end + 4 + 2 } {
+        return
+    }
+    set ::buffer($sock) [string range $::buffer($sock) [expr { $end + 4 + 2 }] end]
+    if { $::measuring } {
+        incr ::num_responses
+    }
+    send_request $sock
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $num_routes $target $num_clients $duration_millis $id_pattern server &]
+sleep 1000
+
+set ::measuring 0
+set ::num_responses 0
+for {set i 0} {$i < $num_clients} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary -buffering none
+    set ::buffer($sock) ""
+    fileevent $sock readable [list on_response $sock]
+    send_request $sock
+}
+
+sleep 1000
+set ticks_before [cpu_ticks $server_pid]
+set ::measuring 1
+sleep $duration_millis
+set ::measuring 0
+set ticks_after [cpu_ticks $server_pid]
+
+exec kill -9 $server_pid
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "routes: %d target: %s clients: %d requests/sec: %.0f server cpu: %.1f us/request" \
+    [expr { 2 * $num_resources + 1 }] $target $num_clients [expr { 1000.0 * $::num_responses / $duration_millis }] \
+    [expr { $::num_responses ? 1000.0 * $cpu_millis / $::num_responses : 0 }]]
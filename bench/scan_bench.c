@@ -0,0 +1,150 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+// Measures the scanners of src/scan.c over a set of requests. For each request it
+// looks for the blank line and then walks the request line and the headers the way
+// tws_ParseHeaders does, once with the byte loops that were used before the scanners
+// and once with each of the scanner implementations.
+//
+// Usage: cmake --build build --target scan_bench && ./build/scan_bench bench/requests/*.http
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tcl.h>
+#include "../src/scan.h"
+
+#define NUM_ITERATIONS 200000
+
+static const char *bytewise_find_blank_line(const char *p, const char *end) {
+    while (p < end) {
+        if ((p < end - 3 && *p == '\r' && *(p + 1) == '\n' && *(p + 2) == '\r' && *(p + 3) == '\n')) {
+            return p + 4;
+        }
+        if (p < end - 1 && *p == '\n' && *(p + 1) == '\n') {
+            return p + 2;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static const char *bytewise_find_header_key_end(const char *p, const char *end) {
+    while (p < end && isspace((unsigned char) *p) == 0 && *p != ':') {
+        p++;
+    }
+    return p;
+}
+
+static const char *bytewise_find_line_end(const char *p, const char *end) {
+    while (p < end && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+static const tws_scan_impl_t bytewise_impl = {
+        "bytewise", bytewise_find_blank_line, bytewise_find_header_key_end, bytewise_find_line_end
+};
+
+static const char *skip_line_end(const char *p, const char *end) {
+    if (p + 1 < end && *p == '\r' && *(p + 1) == '\n') {
+        return p + 2;
+    }
+    if (p < end && (*p == '\r' || *p == '\n')) {
+        return p + 1;
+    }
+    return p;
+}
+
+// returns a checksum of the offsets that were found, so that the implementations can be compared
+static size_t walk_request(const tws_scan_impl_t *impl, const char *request, size_t length) {
+    const char *end = request + length;
+    const char *blank_line_end = impl->find_blank_line(request, end);
+    if (blank_line_end == NULL) {
+        return 0;
+    }
+    size_t checksum = blank_line_end - request;
+
+    const char *p = skip_line_end(impl->find_line_end(request, blank_line_end), blank_line_end);
+    while (p < blank_line_end && *p != '\r' && *p != '\n') {
+        const char *key_end = impl->find_header_key_end(p, blank_line_end);
+        p = key_end + 1;
+        while (p < blank_line_end && *p == ' ') {
+            p++;
+        }
+        const char *value_end = impl->find_line_end(p, blank_line_end);
+        checksum = checksum * 31 + (key_end - request) * 7 + (value_end - request);
+        p = skip_line_end(value_end, blank_line_end);
+    }
+    return checksum;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *filename, size_t *length) {
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = malloc(*length);
+    if (fread(data, 1, *length, fp) != *length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    const char *impl_names[] = {"scalar", "sse2", "avx2"};
+    const tws_scan_impl_t *impls[4] = {&bytewise_impl};
+    int num_impls = 1;
+    for (size_t i = 0; i < sizeof(impl_names) / sizeof(impl_names[0]); i++) {
+        if (TCL_OK == tws_SetScanImpl(impl_names[i])) {
+            impls[num_impls++] = tws_scan;
+        }
+    }
+    tws_InitScan();
+    printf("selected at runtime: %s\n", tws_scan->name);
+
+    for (int i = 1; i < argc; i++) {
+        size_t length;
+        char *request = read_file(argv[i], &length);
+        if (request == NULL) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 1;
+        }
+
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        size_t expected = walk_request(&bytewise_impl, request, length);
+        for (int j = 0; j < num_impls; j++) {
+            size_t checksum = 0;
+            double start = now_seconds();
+            for (int k = 0; k < NUM_ITERATIONS; k++) {
+                checksum += walk_request(impls[j], request, length);
+            }
+            double elapsed = now_seconds() - start;
+            if (checksum != expected * NUM_ITERATIONS) {
+                fprintf(stderr, "%s: %s does not agree with bytewise\n", name, impls[j]->name);
+                return 1;
+            }
+            printf("%-18s %6zu bytes %-8s %8.1f ns/request %8.0f MB/s\n", name, length, impls[j]->name,
+                   1e9 * elapsed / NUM_ITERATIONS, length * NUM_ITERATIONS / elapsed / 1e6);
+        }
+        free(request);
+    }
+    return 0;
+}
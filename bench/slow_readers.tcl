@@ -0,0 +1,79 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the CPU used by the server while many clients download a large
+# response body slower than the server can write it.
+#
+# Usage: tclsh slow_readers.tcl ?num_clients? ?body_size? ?duration_millis?
+
+package require twebserver
+
+set num_clients [expr { [llength $argv] > 0 ? [lindex $argv 0] : 1000 }]
+set body_size [expr { [llength $argv] > 1 ? [lindex $argv 1] : 1048576 }]
+set duration_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 10000 }]
+set port 10080
+
+if { [lindex $argv 3] eq "server" } {
+    set init_script [format {
+        package require twebserver
+        set ::body [string repeat x %d]
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain $::body]
+        }
+    } $body_size]
+    set config_dict [dict create gzip off num_threads 1 conn_timeout_millis 600000]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+# read a little from each socket every 100ms, well below the server's write rate
+proc trickle {sock} {
+    if { [catch {read $sock 1024}] || [eof $sock] } {
+        close $sock
+        return
+    }
+    fileevent $sock readable {}
+    after 100 [list fileevent $sock readable [list trickle $sock]]
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $num_clients $body_size $duration_millis server &]
+sleep 1000
+
+for {set i 0} {$i < $num_clients} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary -buffersize 1024
+    puts -nonewline $sock "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    flush $sock
+    fileevent $sock readable [list trickle $sock]
+}
+
+# let the server fill the socket buffers before measuring
+sleep 2000
+set ticks_before [cpu_ticks $server_pid]
+sleep $duration_millis
+set ticks_after [cpu_ticks $server_pid]
+
+exec kill -9 $server_pid
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "clients: %d body_size: %d server cpu: %d ms over %d ms (%.1f%%)" \
+    $num_clients $body_size $cpu_millis $duration_millis [expr { 100.0 * $cpu_millis / $duration_millis }]]
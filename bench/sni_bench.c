@@ -0,0 +1,224 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+// Measures the ClientHello callback of the TLS listeners from num_threads threads at once,
+// as the conn threads of a server run it. There are num_host_names contexts, each with the
+// certificate of certs/host1 and a client CA list of certs/ca/ca.crt. The callback that was
+// used before looks up the server name in a Tcl hash table under a mutex and copies the CA
+// list of the context for the conn, the callback of the library looks it up in the table of
+// sni.c without a lock. "lookup" runs only the lookups, "handshake" runs whole handshakes
+// with a client over a BIO pair, most of their time goes to the public key operations.
+//
+// Usage: cmake --build build --target sni_bench && ./build/sni_bench ?num_threads? ?num_host_names? ?certs_dir?
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tcl.h>
+#include "../src/https.h"
+#include "../src/sni.h"
+
+#define NUM_LOOKUPS 1000000
+#define NUM_HANDSHAKES 200
+
+static Tcl_HashTable before_HT;
+static Tcl_Mutex before_HT_Mutex;
+static int num_host_names;
+static char (*host_names)[64];
+
+static SSL_CTX *before_Lookup(const char *servername) {
+    SSL_CTX *ctx = NULL;
+    Tcl_MutexLock(&before_HT_Mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&before_HT, servername);
+    if (entryPtr != NULL) {
+        ctx = (SSL_CTX *) Tcl_GetHashValue(entryPtr);
+    }
+    Tcl_MutexUnlock(&before_HT_Mutex);
+    return ctx;
+}
+
+static int before_ClientHelloCallback(SSL *ssl, int *al, void *arg) {
+    (void) arg;
+    const unsigned char *extension_data;
+    size_t extension_len;
+    if (!SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_server_name, &extension_data, &extension_len) || extension_len <= 5) {
+        *al = SSL_AD_UNRECOGNIZED_NAME;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
+    size_t len = (extension_data[3] << 8) + extension_data[4];
+    char servername[TLSEXT_MAXLEN_host_name + 1];
+    memcpy(servername, extension_data + 5, len);
+    servername[len] = '\0';
+    SSL_CTX *ctx = before_Lookup(servername);
+    if (!ctx) {
+        *al = SSL_AD_UNRECOGNIZED_NAME;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
+    SSL_set_verify(ssl, SSL_CTX_get_verify_mode(ctx), NULL);
+    SSL_set_client_CA_list(ssl, SSL_dup_CA_list(SSL_CTX_get_client_CA_list(ctx)));
+    SSL_set_SSL_CTX(ssl, ctx);
+    return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    int before_p;
+    int thread_index;
+    SSL_CTX *accept_ctx;
+    SSL_CTX *client_ctx;
+    int num_done;
+} bench_thread_t;
+
+static void *lookup_thread(void *arg) {
+    bench_thread_t *t = (bench_thread_t *) arg;
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+        const char *servername = host_names[(i + t->thread_index) % num_host_names];
+        if (t->before_p) {
+            SSL_CTX *ctx = before_Lookup(servername);
+            // the copy of the CA list that the conn took over and freed
+            sk_X509_NAME_pop_free(SSL_dup_CA_list(SSL_CTX_get_client_CA_list(ctx)), X509_NAME_free);
+        } else {
+            SSL_CTX *ctx;
+            int verify_mode;
+            if (!tws_GetHostName(servername, (Tcl_Size) strlen(servername), &ctx, &verify_mode)) {
+                abort();
+            }
+            SSL_CTX_free(ctx);
+        }
+        t->num_done++;
+    }
+    return NULL;
+}
+
+static int handshake(SSL_CTX *accept_ctx, SSL_CTX *client_ctx, const char *servername) {
+    SSL *server = SSL_new(accept_ctx);
+    SSL *client = SSL_new(client_ctx);
+    BIO *server_bio, *client_bio;
+    BIO_new_bio_pair(&server_bio, 0, &client_bio, 0);
+    SSL_set_bio(server, server_bio, server_bio);
+    SSL_set_bio(client, client_bio, client_bio);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    SSL_set_tlsext_host_name(client, servername);
+
+    int server_done = 0, client_done = 0, rc = 0;
+    for (int i = 0; i < 100 && !(server_done && client_done); i++) {
+        if (!client_done) {
+            int r = SSL_do_handshake(client);
+            if (r == 1) {
+                client_done = 1;
+            } else if (SSL_get_error(client, r) != SSL_ERROR_WANT_READ) {
+                break;
+            }
+        }
+        if (!server_done) {
+            int r = SSL_do_handshake(server);
+            if (r == 1) {
+                server_done = 1;
+            } else if (SSL_get_error(server, r) != SSL_ERROR_WANT_READ) {
+                break;
+            }
+        }
+    }
+    rc = server_done && client_done;
+    SSL_free(server);
+    SSL_free(client);
+    return rc;
+}
+
+static void *handshake_thread(void *arg) {
+    bench_thread_t *t = (bench_thread_t *) arg;
+    for (int i = 0; i < NUM_HANDSHAKES; i++) {
+        if (!handshake(t->accept_ctx, t->client_ctx, host_names[(i + t->thread_index) % num_host_names])) {
+            fprintf(stderr, "handshake failed\n");
+            ERR_print_errors_fp(stderr);
+            abort();
+        }
+        t->num_done++;
+    }
+    return NULL;
+}
+
+static double run(int num_threads, int before_p, int handshake_p, int *num_done) {
+    bench_thread_t *threads = calloc(num_threads, sizeof(bench_thread_t));
+    pthread_t *thread_ids = calloc(num_threads, sizeof(pthread_t));
+    for (int i = 0; i < num_threads; i++) {
+        threads[i].before_p = before_p;
+        threads[i].thread_index = i;
+        if (handshake_p) {
+            // every conn thread has its own accept context
+            threads[i].accept_ctx = SSL_CTX_new(TLS_server_method());
+            SSL_CTX_set_client_hello_cb(threads[i].accept_ctx,
+                                        before_p ? before_ClientHelloCallback : tws_ClientHelloCallback, NULL);
+            SSL_CTX_set_options(threads[i].accept_ctx, SSL_OP_NO_TICKET);
+            threads[i].client_ctx = SSL_CTX_new(TLS_client_method());
+        }
+    }
+    double start = now_seconds();
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&thread_ids[i], NULL, handshake_p ? handshake_thread : lookup_thread, &threads[i]);
+    }
+    *num_done = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(thread_ids[i], NULL);
+        *num_done += threads[i].num_done;
+        SSL_CTX_free(threads[i].accept_ctx);
+        SSL_CTX_free(threads[i].client_ctx);
+    }
+    double elapsed = now_seconds() - start;
+    free(threads);
+    free(thread_ids);
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int num_threads = argc > 1 ? atoi(argv[1]) : 4;
+    num_host_names = argc > 2 ? atoi(argv[2]) : 64;
+    const char *certs_dir = argc > 3 ? argv[3] : "certs";
+
+    Tcl_FindExecutable(argv[0]);
+    Tcl_InitHashTable(&before_HT, TCL_STRING_KEYS);
+
+    char key_file[1024], cert_file[1024], ca_file[1024];
+    snprintf(key_file, sizeof(key_file), "%s/host1/key.pem", certs_dir);
+    snprintf(cert_file, sizeof(cert_file), "%s/host1/cert.pem", certs_dir);
+    snprintf(ca_file, sizeof(ca_file), "%s/ca/ca.crt", certs_dir);
+
+    host_names = calloc(num_host_names, sizeof(*host_names));
+    for (int i = 0; i < num_host_names; i++) {
+        snprintf(host_names[i], sizeof(host_names[i]), "host%d.example.com", i);
+        SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+        if (SSL_CTX_use_certificate_file(ctx, cert_file, SSL_FILETYPE_PEM) <= 0
+            || SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) <= 0) {
+            fprintf(stderr, "could not load %s and %s\n", key_file, cert_file);
+            return 1;
+        }
+        SSL_CTX_set_client_CA_list(ctx, SSL_load_client_CA_file(ca_file));
+        int newEntry;
+        Tcl_SetHashValue(Tcl_CreateHashEntry(&before_HT, host_names[i], &newEntry), ctx);
+        SSL_CTX_up_ref(ctx);
+        tws_RegisterHostName(host_names[i], ctx);
+    }
+
+    int num_done;
+    double before = run(num_threads, 1, 0, &num_done);
+    double after = run(num_threads, 0, 0, &num_done);
+    printf("lookup threads: %d host names: %d before: %.1f ns/lookup after: %.1f ns/lookup\n",
+           num_threads, num_host_names, 1e9 * before / num_done, 1e9 * after / num_done);
+
+    before = run(num_threads, 1, 1, &num_done);
+    after = run(num_threads, 0, 1, &num_done);
+    printf("handshake threads: %d host names: %d before: %.1f handshakes/sec after: %.1f handshakes/sec\n",
+           num_threads, num_host_names, num_done / before, num_done / after);
+    return 0;
+}
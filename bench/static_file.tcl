@@ -0,0 +1,163 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the throughput of serving a static file of file_size bytes with
+# "build_response -return_file" over keepalive http conns. The file is created in a
+# temporary directory and filled with the bytes 0 to 255 over and over. The clients
+# count the bytes of the bodies and throw them away, the server CPU per request
+# covers reading the request, building the response and sending the file. Responses
+# of servers that send large bodies with chunked encoding end with the last chunk.
+# With the source "memory" the body is instead a text/plain string of file_size bytes
+# that the handler holds in a variable, as a dynamic response would be.
+#
+# Usage: tclsh static_file.tcl ?file_size? ?num_clients? ?duration_millis? ?mimetype? ?source?
+
+package require twebserver
+
+set file_size [expr { [llength $argv] > 0 ? [lindex $argv 0] : 4096 }]
+set num_clients [expr { [llength $argv] > 1 ? [lindex $argv 1] : 4 }]
+set duration_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 10000 }]
+set mimetype [expr { [llength $argv] > 3 ? [lindex $argv 3] : "application/octet-stream" }]
+set source [expr { [llength $argv] > 4 ? [lindex $argv 4] : "file" }]
+set port 10088
+
+if { [lindex $argv 6] eq "server" } {
+    if { $source eq "memory" } {
+        set init_script [string map [list %FILE_SIZE% $file_size] {
+            package require twebserver
+            set ::body [string range [string repeat "0123456789abcdef" [expr { %FILE_SIZE% / 16 + 1 }]] 0 %FILE_SIZE%-1]
+            proc process_conn {ctx req} {
+                set conn [dict get $ctx conn]
+                ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain $::body]
+            }
+        }]
+    } else {
+        set init_script [string map [list %MIMETYPE% [list $mimetype] %FILENAME% [list [lindex $argv 5]]] {
+            package require twebserver
+            proc process_conn {ctx req} {
+                set conn [dict get $ctx conn]
+                ::twebserver::return_response $conn [::twebserver::build_response -return_file 200 %MIMETYPE% %FILENAME%]
+            }
+        }]
+    }
+    set config_dict [dict create num_threads 1]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set dir [file join [expr { [info exists ::env(TMPDIR)] ? $::env(TMPDIR) : "/tmp" }] twebserver_static_file_[pid]]
+file mkdir $dir
+set filename [file join $dir file.bin]
+set bytes {}
+for {set i 0} {$i < 256} {incr i} {
+    lappend bytes $i
+}
+set block [string repeat [binary format c* $bytes] 4096]
+set fp [open $filename wb]
+for {set written 0} {$written < $file_size} {incr written [string length $block]} {
+    puts -nonewline $fp [string range $block 0 [expr { min([string length $block], $file_size - $written) - 1 }]]
+}
+close $fp
+
+set request "GET /file HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+
+proc send_request {sock} {
+    set ::head($sock) ""
+    set ::body_remaining($sock) -1
+    puts -nonewline $sock $::request
+    flush $sock
+}
+
+proc on_response_done {sock} {
+    if { $::measuring } {
+        incr ::num_responses
+    }
+    send_request $sock
+}
+
+# a body_remaining of -1 means that the head of the response is being read and
+# -2 that the body is chunked and goes on until the last chunk
+proc on_readable {sock} {
+    if { [catch {set data [read $sock]}] || [eof $sock] } {
+        close $sock
+        return
+    }
+    if { $::body_remaining($sock) == -1 } {
+        append ::head($sock) $data
+        set end [string first "\r\n\r\n" $::head($sock)]
+        if { $end == -1 } {
+            return
+        }
+        set data [string range $::head($sock) [expr { $end + 4 }] end]
+        if { [string match -nocase "*\r\nTransfer-Encoding: chunked*" [string range $::head($sock) 0 $end]] } {
+            set ::body_remaining($sock) -2
+            set ::tail($sock) ""
+        } else {
+            set ::body_remaining($sock) $::file_size
+        }
+    }
+    if { $::measuring } {
+        incr ::num_bytes [string length $data]
+    }
+    if { $::body_remaining($sock) == -2 } {
+        set ::tail($sock) [string range "$::tail($sock)$data" end-6 end]
+        if { $::tail($sock) eq "\r\n0\r\n\r\n" } {
+            on_response_done $sock
+        }
+        return
+    }
+    incr ::body_remaining($sock) -[string length $data]
+    if { $::body_remaining($sock) == 0 } {
+        on_response_done $sock
+    }
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $file_size $num_clients $duration_millis $mimetype $source $filename server &]
+sleep 1000
+
+set ::measuring 0
+set ::num_responses 0
+set ::num_bytes 0
+for {set i 0} {$i < $num_clients} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary -buffering none -buffersize 1048576
+    fileevent $sock readable [list on_readable $sock]
+    send_request $sock
+}
+
+sleep 1000
+set ticks_before [cpu_ticks $server_pid]
+set ::measuring 1
+sleep $duration_millis
+set ::measuring 0
+set ticks_after [cpu_ticks $server_pid]
+
+if { [catch {exec kill -9 $server_pid}] } {
+    puts "the server exited during the run"
+}
+file delete -force $dir
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "source: %s file_size: %d clients: %d requests/sec: %.1f MB/s: %.1f server cpu: %.1f us/request %.1f ms/GB" \
+    $source $file_size $num_clients [expr { 1000.0 * $::num_responses / $duration_millis }] \
+    [expr { 1000.0 * $::num_bytes / $duration_millis / 1e6 }] \
+    [expr { $::num_responses ? 1000.0 * $cpu_millis / $::num_responses : 0 }] \
+    [expr { $::num_bytes ? 1e9 * $cpu_millis / $::num_bytes : 0 }]]
@@ -0,0 +1,166 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+// Counts the system calls of a server process for bench/syscall_requests.tcl, where strace
+// and perf are not available. It is preloaded into the server and wraps the libc functions
+// that the event loops call, io_uring_enter included, which goes through syscall(). Reads and
+// writes are counted apart for sockets and for other descriptors, the latter are mostly the
+// notifier pipe of Tcl. SIGUSR2 resets the counts and SIGUSR1 writes them to the file named
+// by the TWS_SYSCALL_COUNT_FILE environment variable, one "name count" line each.
+//
+// Usage: cmake --build build --target syscall_count
+//        LD_PRELOAD=./build/libsyscall_count.so TWS_SYSCALL_COUNT_FILE=/tmp/counts tclsh server.tcl
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+enum {
+    COUNT_ACCEPT4,
+    COUNT_READ_SOCKET,
+    COUNT_WRITE_SOCKET,
+    COUNT_WRITEV,
+    COUNT_SENDFILE,
+    COUNT_SHUTDOWN,
+    COUNT_CLOSE,
+    COUNT_FCNTL,
+    COUNT_EPOLL_WAIT,
+    COUNT_EPOLL_CTL,
+    COUNT_IO_URING_ENTER,
+    COUNT_READ_OTHER,
+    COUNT_WRITE_OTHER,
+    NUM_COUNTS
+};
+
+static const char *count_names[NUM_COUNTS] = {
+        "accept4", "read_socket", "write_socket", "writev", "sendfile", "shutdown", "close", "fcntl",
+        "epoll_wait", "epoll_ctl", "io_uring_enter", "read_other", "write_other"
+};
+
+static unsigned long counts[NUM_COUNTS];
+
+#define COUNT(index) __atomic_add_fetch(&counts[index], 1, __ATOMIC_RELAXED)
+#define REAL_FN(name) static __typeof__(name) *real_fn; if (real_fn == NULL) *(void **) (&real_fn) = dlsym(RTLD_NEXT, #name)
+
+static int is_socket(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+static void write_counts(int signum) {
+    (void) signum;
+    const char *path = getenv("TWS_SYSCALL_COUNT_FILE");
+    FILE *fp = fopen(path ? path : "syscall_counts.txt", "w");
+    if (fp == NULL) {
+        return;
+    }
+    for (int i = 0; i < NUM_COUNTS; i++) {
+        fprintf(fp, "%s %lu\n", count_names[i], __atomic_load_n(&counts[i], __ATOMIC_RELAXED));
+    }
+    fclose(fp);
+}
+
+static void reset_counts(int signum) {
+    (void) signum;
+    for (int i = 0; i < NUM_COUNTS; i++) {
+        __atomic_store_n(&counts[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+__attribute__((constructor)) static void install_signal_handlers(void) {
+    signal(SIGUSR1, write_counts);
+    signal(SIGUSR2, reset_counts);
+}
+
+// glibc declares the address as a transparent union
+int accept4(int fd, __SOCKADDR_ARG addr, socklen_t *addrlen, int flags) {
+    REAL_FN(accept4);
+    COUNT(COUNT_ACCEPT4);
+    return real_fn(fd, addr, addrlen, flags);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    REAL_FN(read);
+    COUNT(is_socket(fd) ? COUNT_READ_SOCKET : COUNT_READ_OTHER);
+    return real_fn(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    REAL_FN(write);
+    COUNT(is_socket(fd) ? COUNT_WRITE_SOCKET : COUNT_WRITE_OTHER);
+    return real_fn(fd, buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    REAL_FN(writev);
+    COUNT(COUNT_WRITEV);
+    return real_fn(fd, iov, iovcnt);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    REAL_FN(sendfile);
+    COUNT(COUNT_SENDFILE);
+    return real_fn(out_fd, in_fd, offset, count);
+}
+
+int shutdown(int fd, int how) {
+    REAL_FN(shutdown);
+    COUNT(COUNT_SHUTDOWN);
+    return real_fn(fd, how);
+}
+
+int close(int fd) {
+    REAL_FN(close);
+    COUNT(COUNT_CLOSE);
+    return real_fn(fd);
+}
+
+int fcntl(int fd, int cmd, ...) {
+    REAL_FN(fcntl);
+    va_list ap;
+    va_start(ap, cmd);
+    long arg = va_arg(ap, long);
+    va_end(ap);
+    COUNT(COUNT_FCNTL);
+    return real_fn(fd, cmd, arg);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    REAL_FN(epoll_wait);
+    COUNT(COUNT_EPOLL_WAIT);
+    return real_fn(epfd, events, maxevents, timeout);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    REAL_FN(epoll_ctl);
+    COUNT(COUNT_EPOLL_CTL);
+    return real_fn(epfd, op, fd, event);
+}
+
+long syscall(long number, ...) {
+    REAL_FN(syscall);
+    va_list ap;
+    va_start(ap, number);
+    long args[6];
+    for (int i = 0; i < 6; i++) {
+        args[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+    if (number == __NR_io_uring_enter) {
+        COUNT(COUNT_IO_URING_ENTER);
+    }
+    return real_fn(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
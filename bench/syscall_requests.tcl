@@ -0,0 +1,96 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Counts the system calls per request of a plain HTTP server with one conn thread and the
+# given event loop, with bench/syscall_count.c preloaded into the server. A client sends
+# num_requests requests one after the other, first each on a new connection with
+# "Connection: close", then all on one keepalive connection.
+#
+# Usage: cmake --build build --target syscall_count
+#        tclsh syscall_requests.tcl ?event_loop? ?num_requests? ?syscall_count_library?
+
+package require twebserver
+
+set event_loop [expr { [llength $argv] > 0 ? [lindex $argv 0] : "epoll" }]
+set num_requests [expr { [llength $argv] > 1 ? [lindex $argv 1] : 5000 }]
+set syscall_count_library [expr { [llength $argv] > 2 ? [lindex $argv 2] : [file join [file dirname [info script]] .. build libsyscall_count.so] }]
+set port 10092
+
+if { [lindex $argv 3] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain "hello"]
+        }
+    }
+    set config_dict [dict create num_threads 1 event_loop $event_loop]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+proc read_response {sock} {
+    while { [gets $sock line] >= 0 && $line ne "\r" } {
+    }
+    read $sock 5
+}
+
+proc close_requests {} {
+    for {set i 0} {$i < $::num_requests} {incr i} {
+        set sock [socket localhost $::port]
+        fconfigure $sock -translation binary -buffering none
+        puts -nonewline $sock "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+        read $sock
+        close $sock
+    }
+}
+
+proc keepalive_requests {} {
+    set sock [socket localhost $::port]
+    fconfigure $sock -translation binary -buffering none
+    for {set i 0} {$i < $::num_requests} {incr i} {
+        puts -nonewline $sock "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+        read_response $sock
+    }
+    close $sock
+}
+
+# the counts of the requests that client_proc sends, the server counts until it gets SIGUSR1
+proc count_syscalls {client_proc} {
+    exec kill -USR2 $::server_pid
+    $client_proc
+    exec kill -USR1 $::server_pid
+    sleep 200
+    set fp [open $::env(TWS_SYSCALL_COUNT_FILE)]
+    set counts [read $fp]
+    close $fp
+    set result [list]
+    foreach {name count} $counts {
+        set per_request [format %.2f [expr { double($count) / $::num_requests }]]
+        if { $per_request > 0 } {
+            lappend result $name $per_request
+        }
+    }
+    return $result
+}
+
+set env(TWS_SYSCALL_COUNT_FILE) [file join /tmp syscall_counts.[pid]]
+set env(LD_PRELOAD) [file normalize $syscall_count_library]
+set server_pid [exec [info nameofexecutable] [info script] $event_loop $num_requests $syscall_count_library server &]
+unset env(LD_PRELOAD)
+sleep 1000
+
+puts "event_loop: $event_loop close requests: [count_syscalls close_requests]"
+puts "event_loop: $event_loop keepalive requests: [count_syscalls keepalive_requests]"
+
+exec kill $server_pid
+file delete $env(TWS_SYSCALL_COUNT_FILE)
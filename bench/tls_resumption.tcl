@@ -0,0 +1,90 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the cost of the TLS handshakes of clients that open a new connection for every
+# request, as clients without keepalive do. The server has a TLS listener with num_threads
+# conn threads that share the port with SO_REUSEPORT. "openssl s_client" connects num_conns
+# times, one after the other, and sends a request on each connection. With the mode "new" it
+# does a full handshake each time and with "reuse" it resumes the session of its first
+# connection, so that most of the connections land on another thread than the one that made
+# the session. The client runs a process per connection, so the server CPU per connection is
+# the number to compare. The server reports how many handshakes resumed.
+#
+# Usage: tclsh tls_resumption.tcl ?mode? ?num_conns? ?num_threads? ?tls_version?
+
+package require twebserver
+
+set mode [expr { [llength $argv] > 0 ? [lindex $argv 0] : "reuse" }]
+set num_conns [expr { [llength $argv] > 1 ? [lindex $argv 1] : 500 }]
+set num_threads [expr { [llength $argv] > 2 ? [lindex $argv 2] : 4 }]
+set tls_version [expr { [llength $argv] > 3 ? [lindex $argv 3] : "tls1_3" }]
+set port 10090
+
+if { [lindex $argv 4] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            if { [dict get $req path] eq "/info-tls" } {
+                set body [::twebserver::info_tls]
+            } else {
+                set body ok
+            }
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain $body]
+        }
+    }
+    set certs_dir [file join [file dirname [info script]] .. certs host1]
+    set config_dict [dict create num_threads $num_threads keepalive 0]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::add_context $server_handle localhost [file join $certs_dir key.pem] [file join $certs_dir cert.pem]
+    ::twebserver::listen_server -num_threads $num_threads $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $mode $num_conns $num_threads $tls_version server &]
+sleep 1000
+
+set session_file [file join [expr { [info exists ::env(TMPDIR)] ? $::env(TMPDIR) : "/tmp" }] twebserver_tls_session_[pid].pem]
+set cmd "openssl s_client -connect localhost:$port -servername localhost -quiet -$tls_version"
+set request "GET / HTTP/1.1\r\nConnection: close\r\n\r\n"
+exec -ignorestderr -- {*}$cmd -sess_out $session_file << $request 2> /dev/null
+set session_args [expr { $mode eq "reuse" ? [list -sess_in $session_file] : {} }]
+
+set ticks_before [cpu_ticks $server_pid]
+set start [clock milliseconds]
+for {set i 0} {$i < $num_conns} {incr i} {
+    exec -ignorestderr -- {*}$cmd {*}$session_args << $request 2> /dev/null
+}
+set elapsed [expr { [clock milliseconds] - $start }]
+set ticks_after [cpu_ticks $server_pid]
+file delete $session_file
+
+set request "GET /info-tls HTTP/1.1\r\nConnection: close\r\n\r\n"
+set response [exec -ignorestderr -- openssl s_client -connect localhost:$port -servername localhost -quiet << $request 2> /dev/null]
+set info [lindex [split $response \n] end]
+
+exec kill -9 $server_pid
+
+set handshakes [dict get $info handshakes]
+set resumed [dict get $info resumed_handshakes]
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "mode: %s tls: %s threads: %d conns/sec: %.1f server cpu: %.1f us/conn resumed: %d of %d handshakes" \
+    $mode $tls_version $num_threads [expr { 1000.0 * $num_conns / $elapsed }] \
+    [expr { 1000.0 * $cpu_millis / $num_conns }] $resumed $handshakes]
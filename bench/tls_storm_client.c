@@ -0,0 +1,71 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+// Opens TLS connections to a port one after the other until it is killed, each with a full
+// handshake and closed right after it, for the connection storm of handshake_storm.tcl.
+// A process of openssl s_client per connection would take most of the CPU itself.
+//
+// Usage: cmake --build build --target tls_storm_client && ./build/tls_storm_client port ?servername?
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+static int connect_to(const char *port) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("localhost", port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s port ?servername?\n", argv[0]);
+        return 1;
+    }
+    const char *port = argv[1];
+    const char *servername = argc > 2 ? argv[2] : "localhost";
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    // every connection does a full handshake
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    for (;;) {
+        int fd = connect_to(port);
+        if (fd < 0) {
+            usleep(10000);
+            continue;
+        }
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        SSL_set_tlsext_host_name(ssl, servername);
+        if (SSL_connect(ssl) == 1) {
+            SSL_shutdown(ssl);
+        }
+        SSL_free(ssl);
+        close(fd);
+    }
+}
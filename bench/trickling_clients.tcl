@@ -0,0 +1,115 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the CPU used by the server and the latency of regular requests
+# while many clients send their request headers one byte at a time.
+#
+# Usage: tclsh trickling_clients.tcl ?num_clients? ?num_requests? ?duration_millis?
+
+package require twebserver
+
+set num_clients [expr { [llength $argv] > 0 ? [lindex $argv 0] : 1000 }]
+set num_requests [expr { [llength $argv] > 1 ? [lindex $argv 1] : 1000 }]
+set duration_millis [expr { [llength $argv] > 2 ? [lindex $argv 2] : 10000 }]
+set port 10081
+
+if { [lindex $argv 3] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain "hello"]
+        }
+    }
+    set config_dict [dict create num_threads 1 read_timeout_millis 600000 conn_timeout_millis 600000]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+# send one more byte of the request every second, never completing it
+proc trickle {sock offset} {
+    set request "GET / HTTP/1.1\r\nHost: localhost\r\nX-Trickle: [string repeat x 1000]\r\n\r\n"
+    if { [catch {puts -nonewline $sock [string index $request $offset]; flush $sock}] } {
+        close $sock
+        return
+    }
+    after 1000 [list trickle $sock [expr { ($offset + 1) % ([string length $request] - 4) }]]
+}
+
+set server_pid [exec [info nameofexecutable] [info script] $num_clients $num_requests $duration_millis server &]
+sleep 1000
+
+for {set i 0} {$i < $num_clients} {incr i} {
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary -buffering none
+    trickle $sock 0
+}
+
+sleep 2000
+set ticks_before [cpu_ticks $server_pid]
+sleep $duration_millis
+set ticks_after [cpu_ticks $server_pid]
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "clients: %d server cpu: %d ms over %d ms (%.1f%%)" \
+    $num_clients $cpu_millis $duration_millis [expr { 100.0 * $cpu_millis / $duration_millis }]]
+
+proc on_response {sock} {
+    append ::response [read $sock]
+    if { [eof $sock] } {
+        set ::done 1
+    }
+}
+
+# requests that take longer than a second are counted as timeouts
+set latencies [list]
+set timeouts 0
+for {set i 0} {$i < $num_requests} {incr i} {
+    set start [clock microseconds]
+    set sock [socket localhost $port]
+    fconfigure $sock -blocking 0 -translation binary
+    puts -nonewline $sock "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+    flush $sock
+    set ::response ""
+    set ::done 0
+    fileevent $sock readable [list on_response $sock]
+    set timer [after 1000 [list set ::done 0]]
+    vwait ::done
+    after cancel $timer
+    close $sock
+    if { $::done } {
+        lappend latencies [expr { [clock microseconds] - $start }]
+    } else {
+        incr timeouts
+    }
+}
+set latencies [lsort -integer $latencies]
+set n [llength $latencies]
+
+exec kill -9 $server_pid
+
+if { $n } {
+    puts [format "requests: %d timeouts: %d p50: %.2f ms p99: %.2f ms" $num_requests $timeouts \
+        [expr { [lindex $latencies [expr { $n / 2 }]] / 1000.0 }] \
+        [expr { [lindex $latencies [expr { $n * 99 / 100 }]] / 1000.0 }]]
+} else {
+    puts [format "requests: %d timeouts: %d" $num_requests $timeouts]
+}
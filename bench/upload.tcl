@@ -0,0 +1,103 @@
+# Copyright Jerily LTD. All Rights Reserved.
+# SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+# SPDX-License-Identifier: MIT.
+#
+# Measures the memory and the CPU of receiving multipart/form-data uploads of a file of
+# body_size bytes, one after the other over a keepalive http conn. The handler parses
+# the form with get_form. With a body_file_min_length of 0 the bodies are read into
+# memory, otherwise the bodies of that length or more are written to a file as they
+# arrive. The handler takes the uploaded file out of the form, it decodes it where the
+# binary_body option is "base64" and gets it as is where it is "bytearray". The peak RSS
+# of the server is read from /proc at the end of the run.
+#
+# Usage: tclsh upload.tcl ?body_size? ?num_requests? ?body_file_min_length? ?event_loop? ?binary_body?
+
+package require twebserver
+
+set body_size [expr { [llength $argv] > 0 ? [lindex $argv 0] : 50000000 }]
+set num_requests [expr { [llength $argv] > 1 ? [lindex $argv 1] : 20 }]
+set body_file_min_length [expr { [llength $argv] > 2 ? [lindex $argv 2] : 0 }]
+set event_loop [expr { [llength $argv] > 3 ? [lindex $argv 3] : "epoll" }]
+set binary_body [expr { [llength $argv] > 4 ? [lindex $argv 4] : "base64" }]
+set port 10089
+
+if { [lindex $argv 5] eq "server" } {
+    set init_script {
+        package require twebserver
+        proc process_conn {ctx req} {
+            set form [::twebserver::get_form $req]
+            if { [dict exists $form fileRanges file.bin] } {
+                set length [lindex [dict get $form fileRanges file.bin] 1]
+            } elseif { [dict exists $req isBinary] } {
+                set length [string length [dict get $form files file.bin]]
+            } else {
+                set length [string length [binary decode base64 [dict get $form files file.bin]]]
+            }
+            set conn [dict get $ctx conn]
+            ::twebserver::return_response $conn [::twebserver::build_response 200 text/plain $length]
+        }
+    }
+    set config_dict [dict create num_threads 1 event_loop $event_loop max_request_read_bytes [expr { 100 * 1024 * 1024 }] \
+        body_file_min_length $body_file_min_length binary_body $binary_body]
+    set server_handle [::twebserver::create_server $config_dict process_conn $init_script]
+    ::twebserver::listen_server -http -num_threads 1 $server_handle $port
+    ::twebserver::wait_signal
+    ::twebserver::destroy_server $server_handle
+    exit 0
+}
+
+proc cpu_ticks {pid} {
+    set fp [open /proc/$pid/stat]
+    set stat [read $fp]
+    close $fp
+    set fields [split [string range $stat [expr { [string last ")" $stat] + 2 }] end]]
+    return [expr { [lindex $fields 11] + [lindex $fields 12] }]
+}
+
+proc peak_rss_kb {pid} {
+    set fp [open /proc/$pid/status]
+    set status [read $fp]
+    close $fp
+    regexp {VmHWM:\s+(\d+)} $status -> kb
+    return $kb
+}
+
+proc sleep {ms} {
+    after $ms [list set ::sleep 1]
+    vwait ::sleep
+}
+
+set file_data [string repeat [binary format c* {0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15}] [expr { $body_size / 16 }]]
+set body "--B\r\nContent-Disposition: form-data; name=\"text\"\r\n\r\nupload\r\n--B\r\nContent-Disposition: form-data; name=\"file\"; filename=\"file.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n$file_data\r\n--B--\r\n"
+set request "POST /upload HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nContent-Type: multipart/form-data; boundary=B\r\nContent-Length: [string length $body]\r\n\r\n$body"
+unset file_data body
+
+set server_pid [exec [info nameofexecutable] [info script] $body_size $num_requests $body_file_min_length $event_loop $binary_body server &]
+sleep 1000
+
+set sock [socket localhost $port]
+fconfigure $sock -translation binary -buffering full -buffersize 1048576
+
+set ticks_before [cpu_ticks $server_pid]
+set start [clock milliseconds]
+for {set i 0} {$i < $num_requests} {incr i} {
+    puts -nonewline $sock $request
+    flush $sock
+    set content_length 0
+    while { [set line [string trim [gets $sock]]] ne "" } {
+        regexp -nocase {^Content-Length: (\d+)} $line -> content_length
+    }
+    read $sock $content_length
+}
+set elapsed [expr { [clock milliseconds] - $start }]
+set ticks_after [cpu_ticks $server_pid]
+set rss [peak_rss_kb $server_pid]
+close $sock
+
+exec kill -9 $server_pid
+
+# clock ticks are 1/100 of a second on linux
+set cpu_millis [expr { ($ticks_after - $ticks_before) * 10 }]
+puts [format "body_file_min_length: %d binary_body: %s event_loop: %s body_size: %d requests/sec: %.1f server cpu: %.1f ms/request peak rss: %d kB" \
+    $body_file_min_length $binary_body $event_loop $body_size [expr { 1000.0 * $num_requests / $elapsed }] \
+    [expr { double($cpu_millis) / $num_requests }] $rss]
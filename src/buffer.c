@@ -0,0 +1,171 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include "buffer.h"
+
+// The read functions append to the input buffer of a conn by reading straight into
+// its spare capacity. A conn that has nothing buffered gives its storage back to a
+// per-thread pool, so that idle keepalive conns only hold the static space of the
+// Tcl_DString and the next conn that reads picks up an already allocated buffer.
+
+void tws_InitReadBufferPool(tws_thread_data_t *dataPtr, int pool_size) {
+    dataPtr->read_buffers = pool_size > 0 ? (tws_read_buffer_t *) ckalloc(pool_size * sizeof(tws_read_buffer_t)) : NULL;
+    dataPtr->read_buffer_pool_size = pool_size;
+    dataPtr->num_read_buffers = 0;
+}
+
+void tws_FreeReadBufferPool(tws_thread_data_t *dataPtr) {
+    for (int i = 0; i < dataPtr->num_read_buffers; i++) {
+        ckfree(dataPtr->read_buffers[i].buf);
+    }
+    if (dataPtr->read_buffers) {
+        ckfree((char *) dataPtr->read_buffers);
+    }
+    dataPtr->read_buffers = NULL;
+    dataPtr->read_buffer_pool_size = 0;
+    dataPtr->num_read_buffers = 0;
+}
+
+// a read into less spare capacity than this grows the buffer first
+#define TWS_MIN_READ_SPACE 4096
+
+// returns a pointer to the spare capacity at the end of ds_ptr and stores its size, up to size bytes,
+// in avail_ptr. The caller sets the length of ds_ptr to include the bytes it wrote there.
+char *tws_ReserveReadSpace(Tcl_DString *ds_ptr, Tcl_Size size, Tcl_Size *avail_ptr) {
+    Tcl_Size length = Tcl_DStringLength(ds_ptr);
+    // one byte is kept for the terminating null of the Tcl_DString
+    Tcl_Size spare = ds_ptr->spaceAvl - length - 1;
+    if (spare >= size || spare >= TWS_MIN_READ_SPACE) {
+        *avail_ptr = MIN(spare, size);
+        return ds_ptr->string + length;
+    }
+    *avail_ptr = size;
+
+    if (ds_ptr->string == ds_ptr->staticSpace) {
+        tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+        if (dataPtr->num_read_buffers > 0) {
+            tws_read_buffer_t *read_buffer = &dataPtr->read_buffers[dataPtr->num_read_buffers - 1];
+            if (length + size < read_buffer->size) {
+                dataPtr->num_read_buffers--;
+                memcpy(read_buffer->buf, ds_ptr->string, length + 1);
+                ds_ptr->string = read_buffer->buf;
+                ds_ptr->spaceAvl = read_buffer->size;
+                return ds_ptr->string + length;
+            }
+        }
+    }
+
+    // grow the buffer the same way as appending would, without changing its contents
+    Tcl_DStringSetLength(ds_ptr, length + size);
+    Tcl_DStringSetLength(ds_ptr, length);
+    return ds_ptr->string + length;
+}
+
+// empties ds_ptr and gives its storage to the pool of this thread,
+// buffers that grew beyond conn_pool_max_buffer_size are freed instead
+void tws_ReleaseReadBuffer(Tcl_DString *ds_ptr) {
+    if (ds_ptr->string == ds_ptr->staticSpace) {
+        Tcl_DStringSetLength(ds_ptr, 0);
+        return;
+    }
+
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+    if (dataPtr->num_read_buffers < dataPtr->read_buffer_pool_size
+        && ds_ptr->spaceAvl <= dataPtr->server->conn_pool_max_buffer_size) {
+        tws_read_buffer_t *read_buffer = &dataPtr->read_buffers[dataPtr->num_read_buffers++];
+        read_buffer->buf = ds_ptr->string;
+        read_buffer->size = ds_ptr->spaceAvl;
+        Tcl_DStringInit(ds_ptr);
+        return;
+    }
+
+    Tcl_DStringFree(ds_ptr);
+}
+
+// the file body of a conn is read this much at a time where it cannot be sent with sendfile
+#define TWS_FILE_CHUNK_SIZE 65536
+
+// replaces the contents of the output buffer of the conn with the next chunk of its file body
+int tws_ReadFileChunk(tws_conn_t *conn) {
+    Tcl_DStringSetLength(&conn->inout_ds, 0);
+    conn->write_offset = 0;
+
+    Tcl_Size avail;
+    char *buf = tws_ReserveReadSpace(&conn->inout_ds, (Tcl_Size) MIN(TWS_FILE_CHUNK_SIZE, conn->file_length - conn->file_offset), &avail);
+    ssize_t rc;
+    do {
+        rc = pread(conn->file_fd, buf, avail, conn->file_offset);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc <= 0) {
+        // the file was truncated after its length was sent
+        return TWS_ERROR;
+    }
+    conn->file_offset += rc;
+    Tcl_DStringSetLength(&conn->inout_ds, rc);
+    return TWS_DONE;
+}
+
+// Large request bodies are not kept in the input buffer of the conn. With the
+// body_file_min_length option, the body is moved to a temporary file as it arrives,
+// the input buffer only holds the request line and the headers, and the request dict
+// has the path of the file as "bodyFile" instead of the body.
+
+// creates the body file of the conn and moves to it the part of the body read so far
+int tws_OpenBodyFile(tws_conn_t *conn) {
+    const char *dir = conn->accept_ctx->server->body_file_dir;
+    size_t dir_length = strlen(dir);
+    char *path = ckalloc(dir_length + sizeof("/twebserver_body_XXXXXX"));
+    memcpy(path, dir, dir_length);
+    memcpy(path + dir_length, "/twebserver_body_XXXXXX", sizeof("/twebserver_body_XXXXXX"));
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        ckfree(path);
+        return TCL_ERROR;
+    }
+    conn->body_file_path = path;
+    conn->body_file_fd = fd;
+    conn->body_file_length = 0;
+    return tws_WriteBodyFile(conn);
+}
+
+// moves the part of the body in the input buffer of the conn to the end of its body file
+int tws_WriteBodyFile(tws_conn_t *conn) {
+    const char *buf = Tcl_DStringValue(&conn->inout_ds) + conn->top_part_offset;
+    Tcl_Size length = MIN(Tcl_DStringLength(&conn->inout_ds) - conn->top_part_offset,
+                          conn->content_length - conn->body_file_length);
+    while (length > 0) {
+        ssize_t rc = write(conn->body_file_fd, buf, length);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return TCL_ERROR;
+        }
+        buf += rc;
+        length -= rc;
+        conn->body_file_length += rc;
+    }
+    Tcl_DStringSetLength(&conn->inout_ds, conn->top_part_offset);
+    return TCL_OK;
+}
+
+void tws_CloseBodyFile(tws_conn_t *conn) {
+    if (conn->body_file_fd != -1) {
+        close(conn->body_file_fd);
+        conn->body_file_fd = -1;
+    }
+    if (conn->body_file_path) {
+        unlink(conn->body_file_path);
+        ckfree(conn->body_file_path);
+        conn->body_file_path = NULL;
+    }
+    conn->body_file_length = 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_BUFFER_H
+#define TWEBSERVER_BUFFER_H
+
+#include "common.h"
+
+void tws_InitReadBufferPool(tws_thread_data_t *dataPtr, int pool_size);
+void tws_FreeReadBufferPool(tws_thread_data_t *dataPtr);
+char *tws_ReserveReadSpace(Tcl_DString *ds_ptr, Tcl_Size size, Tcl_Size *avail_ptr);
+void tws_ReleaseReadBuffer(Tcl_DString *ds_ptr);
+int tws_ReadFileChunk(tws_conn_t *conn);
+int tws_OpenBodyFile(tws_conn_t *conn);
+int tws_WriteBodyFile(tws_conn_t *conn);
+void tws_CloseBodyFile(tws_conn_t *conn);
+
+#endif //TWEBSERVER_BUFFER_H
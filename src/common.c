@@ -32,9 +32,6 @@ static Tcl_Mutex tws_ServerNameToInternal_HT_Mutex;
 static Tcl_HashTable tws_ConnNameToInternal_HT;
 static Tcl_Mutex tws_ConnNameToInternal_HT_Mutex;
 
-static Tcl_HashTable tws_HostNameToInternal_HT;
-static Tcl_Mutex tws_HostNameToInternal_HT_Mutex;
-
 static Tcl_HashTable tws_RouterNameToInternal_HT;
 static Tcl_Mutex tws_RouterNameToInternal_HT_Mutex;
 
@@ -140,53 +137,6 @@ tws_conn_t *tws_GetInternalFromConnName(const char *name) {
     return internal;
 }
 
-int tws_RegisterHostName(const char *name, SSL_CTX *internal) {
-
-    Tcl_HashEntry *entryPtr;
-    int newEntry;
-    Tcl_MutexLock(&tws_HostNameToInternal_HT_Mutex);
-    entryPtr = Tcl_CreateHashEntry(&tws_HostNameToInternal_HT, (char *) name, &newEntry);
-    if (newEntry) {
-        Tcl_SetHashValue(entryPtr, (ClientData) internal);
-    }
-    Tcl_MutexUnlock(&tws_HostNameToInternal_HT_Mutex);
-
-    DBG2(printf("--> RegisterHostName: name=%s internal=%p %s\n", name, internal,
-                newEntry ? "entered into" : "already in"));
-
-    return newEntry;
-}
-
-int tws_UnregisterHostName(const char *name) {
-
-    Tcl_HashEntry *entryPtr;
-
-    Tcl_MutexLock(&tws_HostNameToInternal_HT_Mutex);
-    entryPtr = Tcl_FindHashEntry(&tws_HostNameToInternal_HT, (char *) name);
-    if (entryPtr != NULL) {
-        Tcl_DeleteHashEntry(entryPtr);
-    }
-    Tcl_MutexUnlock(&tws_HostNameToInternal_HT_Mutex);
-
-    DBG2(printf("--> UnregisterHostName: name=%s entryPtr=%p\n", name, entryPtr));
-
-    return entryPtr != NULL;
-}
-
-SSL_CTX *tws_GetInternalFromHostName(const char *name) {
-    SSL_CTX *internal = NULL;
-    Tcl_HashEntry *entryPtr;
-
-    Tcl_MutexLock(&tws_HostNameToInternal_HT_Mutex);
-    entryPtr = Tcl_FindHashEntry(&tws_HostNameToInternal_HT, (char *) name);
-    if (entryPtr != NULL) {
-        internal = (SSL_CTX *) Tcl_GetHashValue(entryPtr);
-    }
-    Tcl_MutexUnlock(&tws_HostNameToInternal_HT_Mutex);
-
-    return internal;
-}
-
 int tws_RegisterRouterName(const char *name, tws_router_t *internal) {
 
     Tcl_HashEntry *entryPtr;
@@ -246,12 +196,6 @@ void tws_InitConnNameHT() {
     Tcl_MutexUnlock(&tws_ConnNameToInternal_HT_Mutex);
 }
 
-void tws_InitHostNameHT() {
-    Tcl_MutexLock(&tws_HostNameToInternal_HT_Mutex);
-    Tcl_InitHashTable(&tws_HostNameToInternal_HT, TCL_STRING_KEYS);
-    Tcl_MutexUnlock(&tws_HostNameToInternal_HT_Mutex);
-}
-
 void tws_InitRouterNameHT() {
     Tcl_MutexLock(&tws_RouterNameToInternal_HT_Mutex);
     Tcl_InitHashTable(&tws_RouterNameToInternal_HT, TCL_STRING_KEYS);
@@ -270,12 +214,6 @@ void tws_DeleteConnNameHT() {
     Tcl_MutexUnlock(&tws_ConnNameToInternal_HT_Mutex);
 }
 
-void tws_DeleteHostNameHT() {
-    Tcl_MutexLock(&tws_HostNameToInternal_HT_Mutex);
-    Tcl_DeleteHashTable(&tws_HostNameToInternal_HT);
-    Tcl_MutexUnlock(&tws_HostNameToInternal_HT_Mutex);
-}
-
 void tws_DeleteRouterNameHT() {
     Tcl_MutexLock(&tws_RouterNameToInternal_HT_Mutex);
     Tcl_DeleteHashTable(&tws_RouterNameToInternal_HT);
@@ -339,6 +277,12 @@ long long current_time_in_millis() {
     return milliseconds;
 }
 
+long long current_time_in_micros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000000LL) + tv.tv_usec;
+}
+
 void tws_DecrRefCountUntilZero(Tcl_Obj *obj) {
     while (Tcl_IsShared(obj)) {
         Tcl_DecrRefCount(obj);
@@ -346,18 +290,6 @@ void tws_DecrRefCountUntilZero(Tcl_Obj *obj) {
     Tcl_DecrRefCount(obj);
 }
 
-void tws_FreeSslContexts() {
-    Tcl_MutexLock(&tws_HostNameToInternal_HT_Mutex);
-    Tcl_HashSearch search;
-    Tcl_HashEntry *entryPtr = Tcl_FirstHashEntry(&tws_HostNameToInternal_HT, &search);
-    while (entryPtr != NULL) {
-        SSL_CTX *ctx = (SSL_CTX *) Tcl_GetHashValue(entryPtr);
-        SSL_CTX_free(ctx);
-        entryPtr = Tcl_NextHashEntry(&search);
-    }
-    Tcl_MutexUnlock(&tws_HostNameToInternal_HT_Mutex);
-}
-
 void tws_PrintRefCountObjv(int objc, Tcl_Obj *const objv[]) {
     for (int i = 0; i < objc; i++) {
         fprintf(stderr, "i=%d: %ld\n", i, objv[i]->refCount);
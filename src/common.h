@@ -11,6 +11,7 @@
 #include <openssl/err.h>
 #include <ctype.h>
 #include <arpa/inet.h>
+#include <sys/types.h>
 
 #ifndef TCL_SIZE_MAX
 typedef int Tcl_Size;
@@ -57,6 +58,7 @@ typedef int Tcl_Size;
 
 #define CHARTYPE(what, c) (is ## what ((int)((unsigned char)(c))))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
 
 typedef struct tws_listener_t_ {
     int port;
@@ -70,6 +72,19 @@ typedef struct tws_listener_t_ {
     struct tws_listener_t_ *nextPtr;
 } tws_listener_t;
 
+typedef enum tws_EventLoop {
+    TWS_EVENT_LOOP_TCL,
+    TWS_EVENT_LOOP_EPOLL,
+    TWS_EVENT_LOOP_IO_URING
+} tws_event_loop_t;
+
+// the tls sessions and session ticket keys that all the conn threads of a server share, defined in session.c
+typedef struct tws_session_cache_s tws_session_cache_t;
+// the threads that run the tls handshakes of a server, defined in handshake.c
+typedef struct tws_handshake_pool_s tws_handshake_pool_t;
+// the ocsp responses that a server staples and the thread that reads them again, defined in ocsp.c
+typedef struct tws_ocsp_stapler_s tws_ocsp_stapler_t;
+
 typedef struct {
     int option_router;
     Tcl_DString cmd_ds;
@@ -89,16 +104,73 @@ typedef struct {
     int keepintvl;  // the time (in seconds) between individual keepalive probes
     int keepcnt;    // The maximum number of keepalive probes TCP should send before dropping the connection
     int num_threads; // number of threads to handle connections
+    tws_event_loop_t event_loop; // the event loop that the connection threads run
     Tcl_Size thread_stacksize; // the stack size for each thread in bytes
     int thread_max_concurrent_conns; // the maximum number of concurrent connections per thread
+    int conn_pool_size; // the maximum number of freed conns that each thread keeps for reuse
+    Tcl_Size conn_pool_max_buffer_size; // buffers of pooled conns that grew beyond this size are freed
+    int read_buffer_pool_size; // the maximum number of read buffers that each thread keeps for reuse
     int gzip; // whether gzip compression is on or off
     Tcl_Size gzip_min_length; // the minimum length of the response body to apply gzip compression
     Tcl_HashTable gzip_types_HT; // the list of mime types to apply gzip compression
+    int ktls; // whether the tls conns ask openssl to offload the record layer to the kernel
+    Tcl_Size body_file_min_length; // request bodies of this length or more are written to a file as they arrive, 0 for never
+    Tcl_Size max_body_file_length; // the maximum length of a request body that is written to a file
+    char *body_file_dir; // the directory of the files of the request bodies
+    int binary_body_bytearray; // whether binary request bodies are byte arrays instead of base64 encoded strings
+    Tcl_Size tls_session_cache_size; // the number of tls sessions that the shared session cache holds, 0 for no cache
+    int tls_session_timeout; // the time (in seconds) that a tls session can be resumed
+    int tls_session_tickets; // whether the clients get session tickets
+    int tls_ticket_key_rotation_interval; // the time (in seconds) after which a new session ticket key is made, 0 for never
+    tws_session_cache_t *session_cache;
+    int tls_handshake_threads; // the number of threads that run the tls handshakes instead of the conn threads, 0 for none
+    tws_handshake_pool_t *handshake_pool;
+    int tls_max_early_data; // the number of bytes of tls 1.3 early data that a resumed conn may send, 0 for none
+    int ocsp_refresh_interval; // the time (in seconds) after which the ocsp response files are checked for changes, 0 for never
+    tws_ocsp_stapler_t *ocsp_stapler;
+    // the tls counters of all the conn threads, updated with atomic builtins
+    Tcl_WideInt tls_handshakes;
+    Tcl_WideInt ktls_send_conns;
+    Tcl_WideInt ktls_recv_conns;
+    Tcl_WideInt ktls_sendfile_bytes;
+    Tcl_WideInt tls_resumed_handshakes;
+    Tcl_WideInt tls_session_cache_hits;
+    Tcl_WideInt tls_session_cache_misses;
+    Tcl_WideInt tls_ticket_hits;
+    Tcl_WideInt tls_ticket_misses;
+    Tcl_WideInt tls_ticket_key_rotations;
+    Tcl_WideInt tls_offloaded_handshakes;
+    Tcl_WideInt tls_handshake_queue_depth; // the conns that the handshake threads have at the moment
+    Tcl_WideInt tls_handshake_queue_wait_micros;
+    Tcl_WideInt tls_handshake_latency_micros; // from accept until the conn can read its request
+    Tcl_WideInt tls_handshake_latency_max_micros;
+    Tcl_WideInt tls_early_data_accepted; // the conns whose early data was accepted
+    Tcl_WideInt tls_early_data_replays; // the conns whose early data was turned down as a possible replay
+    Tcl_WideInt tls_early_data_requests; // the requests that were served before their handshake completed
+    Tcl_WideInt tls_too_early_responses;
+    Tcl_WideInt tls_ocsp_staples; // the handshakes that got an ocsp response
+    Tcl_WideInt tls_ocsp_refreshes; // the ocsp response files that were read
+    Tcl_WideInt tls_ocsp_load_failures; // the ocsp response files that were not a valid response for their certificate
     tws_listener_t *first_listener_ptr;
 } tws_server_t;
 
 // declare "tws_conn_t" here so that we can use it in the "tws_accept_ctx_t" struct
 typedef struct tws_conn_t_ tws_conn_t;
+// the io_uring instance of a thread, defined in uring.c
+typedef struct tws_uring_s tws_uring_t;
+
+#define TWS_TIMER_WHEEL_SLOTS 256
+#define TWS_TIMER_WHEEL_OUTER_SLOTS 64
+
+// expires the conns of a thread, see timer.c
+typedef struct {
+    int tick_millis; // garbage_collection_interval_millis
+    long long base_millis;
+    long long current_tick;
+    tws_conn_t *slots[TWS_TIMER_WHEEL_SLOTS];
+    tws_conn_t *outer_slots[TWS_TIMER_WHEEL_OUTER_SLOTS];
+    Tcl_TimerToken tick_token;
+} tws_timer_wheel_t;
 
 typedef struct {
     int option_http;
@@ -111,7 +183,13 @@ typedef struct {
     SSL_CTX *ssl_ctx;
     int (*read_fn)(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size);
     int (*write_fn)(tws_conn_t *conn, const char *buf, Tcl_Size len);
+    // writes the rest of inout_ds and then the body of the conn
+    int (*writev_fn)(tws_conn_t *conn);
+    // writes the rest of inout_ds and then the file body of the conn
+    int (*sendfile_fn)(tws_conn_t *conn);
     int (*handle_conn_fn)(tws_conn_t *conn);
+    int native_loop; // whether conns are dispatched directly instead of through the Tcl event queue
+    int wake_fd; // an eventfd that wakes up the native event loop when a handshake thread gives back a conn, -1 for none
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
     Tcl_ThreadId *conn_thread_ids;
 #endif
@@ -137,11 +215,13 @@ typedef struct tws_conn_t_ {
     tws_compression_method_t compression;
     int keepalive;
     int created_file_handler_p;
-    int todelete;
     int ready;
     int handshaked;
     int inprogress;
     int shutdown;
+    int write_pending; // whether the conn is waiting for the socket to become writable
+    int ktls_send; // whether the kernel encrypts what is written to the conn, see the ktls option
+    int ktls_recv; // whether the kernel decrypts what is read from the conn
     struct tws_conn_t_ *prevPtr;
     struct tws_conn_t_ *nextPtr;
     // On a 64-bit system, a pointer address can be up to 16 hexadecimal digits long
@@ -152,27 +232,81 @@ typedef struct tws_conn_t_ {
 
     Tcl_Encoding encoding;
     Tcl_DString inout_ds;
-    Tcl_DString parse_ds;
     Tcl_Obj *req_dict_ptr;
     Tcl_Size top_part_offset;
     Tcl_Size write_offset;
     Tcl_Size content_length;
     Tcl_Size blank_line_offset;
-    Tcl_DString *chunks_ds;
-    Tcl_Size n_chunks;
-    Tcl_Size chunk_offset;
+    // the state of a response streamed with stream_begin, one of TWS_STREAM_*
+    int stream;
+    // evaluated once the stream has written out what it buffered, see stream_on_drain
+    Tcl_Obj *stream_drain_ptr;
+    // the body of the response, written after inout_ds from where it is, NULL if none.
+    // body_obj_ptr or body_alloc_ptr keep it alive until the conn is closed
+    const char *body;
+    Tcl_Size body_length;
+    Tcl_Obj *body_obj_ptr;
+    char *body_alloc_ptr;
+    // the file body of a response built with build_response -return_file, -1 if none
+    int file_fd;
+    off_t file_offset;
+    off_t file_length;
+    // the file that the body of the request is written to as it arrives, see body_file_min_length.
+    // The file is removed when the conn is closed
+    char *body_file_path;
+    int body_file_fd;
+    Tcl_Size body_file_length;
     char content_type[MAX_CONTENT_TYPE_SIZE];
 
     int error;
     int (*handle_conn_fn)(tws_conn_t *conn);
+    int read_timer_p; // whether the read timeout applies, i.e. the conn waits for the rest of its request
+    // the conns that expire on the same tick of the timer wheel
+    struct tws_conn_t_ *timerPrevPtr;
+    struct tws_conn_t_ *timerNextPtr;
+    struct tws_conn_t_ **timerSlotPtr; // NULL when the conn is not scheduled
+    long long timer_expires_tick;
+    unsigned int uring_id; // identifies the conn in io_uring completions, 0 until it is first armed
+    // the provided io_uring buffer with received bytes that were not read yet, -1 for none
+    int uring_bid;
+    Tcl_Size uring_buf_offset;
+    Tcl_Size uring_buf_length;
+    long long handshake_start_micros;
+    // whether a handshake thread has the conn, the conn thread does not touch it until it is given back
+    int handshake_offloaded;
+    int handshake_result; // one of TWS_HANDSHAKE_*, set by the handshake thread
+    long long handshake_queued_micros;
+    struct tws_conn_t_ *handshakeNextPtr; // the conns that were queued to the same handshake thread
+    int early_data_state; // one of TWS_EARLY_DATA_*, whether the conn reads with SSL_read_early_data
+    int too_early; // the request came as early data with a method that is not safe to replay
 } tws_conn_t;
 
+enum {
+    TWS_HANDSHAKE_DONE,
+    TWS_HANDSHAKE_WANT_READ,
+    TWS_HANDSHAKE_WANT_WRITE,
+    TWS_HANDSHAKE_FAILED
+};
+
+enum {
+    TWS_EARLY_DATA_NONE,
+    // the handshake reads the early data that the client may send along with its ClientHello
+    TWS_EARLY_DATA_ACCEPTING,
+    // the conn serves the requests of its early data before the client finished the handshake
+    TWS_EARLY_DATA_READING
+};
+
 typedef struct {
     Tcl_EventProc *proc;    /* Function to call to service this event. */
     Tcl_Event *nextPtr;    /* Next in list of pending events, or NULL. */
     ClientData *clientData; // The pointer to the client data
 } tws_event_t;
 
+typedef struct {
+    char *buf;
+    Tcl_Size size;
+} tws_read_buffer_t;
+
 typedef struct {
     Tcl_Interp *interp;
     Tcl_Obj *cmd_ptr;
@@ -182,11 +316,18 @@ typedef struct {
     tws_conn_t *lastConnPtr;
     int thread_index;
     int num_conns;
-    int num_requests;
-    int thread_pivot;
+    tws_conn_t *freeConnPtr; // the conns that were freed and can be reused, linked with nextPtr
+    int num_free_conns;
+    Tcl_WideInt conn_pool_hits;
+    Tcl_WideInt conn_pool_misses;
+    tws_read_buffer_t *read_buffers; // the storage that conns gave back once they had nothing buffered
+    int read_buffer_pool_size;
+    int num_read_buffers;
     int terminate;
     int server_fd;
     int epoll_fd;
+    tws_uring_t *uring;
+    tws_timer_wheel_t timer_wheel;
 } tws_thread_data_t;
 
 typedef struct {
@@ -198,7 +339,13 @@ typedef struct {
     int option_http;
 } tws_thread_ctrl_t;
 
+enum {
+    ROUTE_TYPE_EXACT,
+    ROUTE_TYPE_REGEXP
+};
+
 typedef struct tws_route_s {
+    Tcl_Size index;
     int type;
     int fast_star;
     int fast_slash;
@@ -213,6 +360,12 @@ typedef struct tws_route_s {
     char proc_name[128];
     Tcl_Obj *keys;
     char *pattern;
+    // holds the regexp that is compiled from the pattern when the route is added
+    Tcl_Obj *pattern_ptr;
+    Tcl_RegExp regexp;
+    Tcl_WideInt regexp_exec_count;
+    // matches the path without the regexp, see path_regexp.h
+    struct tws_path_matcher_s *matcher;
     Tcl_Obj *guard_list_ptr;
     Tcl_Obj *name_ptr;
     struct tws_route_s *nextPtr;
@@ -228,6 +381,11 @@ typedef struct tws_middleware_s {
 typedef struct {
     tws_route_t *firstRoutePtr;
     tws_route_t *lastRoutePtr;
+    Tcl_Size num_routes;
+    // the routes by http method, see route_tree.h
+    struct tws_route_method_s *firstMethodPtr;
+    Tcl_Obj *http_method_key_ptr;
+    Tcl_Obj *path_key_ptr;
     tws_middleware_t *firstMiddlewarePtr;
     tws_middleware_t *lastMiddlewarePtr;
     char handle[40];
@@ -245,12 +403,16 @@ enum {
     TWS_AGAIN
 };
 
+enum {
+    TWS_STREAM_NONE,
+    TWS_STREAM_OPEN,
+    TWS_STREAM_ENDED
+};
+
 void tws_InitServerNameHT();
 void tws_DeleteServerNameHT();
 void tws_InitConnNameHT();
 void tws_DeleteConnNameHT();
-void tws_InitHostNameHT();
-void tws_DeleteHostNameHT();
 void tws_InitRouterNameHT();
 void tws_DeleteRouterNameHT();
 
@@ -260,17 +422,14 @@ tws_server_t * tws_GetInternalFromServerName(const char *name);
 int tws_RegisterConnName(const char *name, tws_conn_t *internal);
 int tws_UnregisterConnName(const char *name);
 tws_conn_t *tws_GetInternalFromConnName(const char *name);
-int tws_RegisterHostName(const char *name, SSL_CTX *internal);
-int tws_UnregisterHostName(const char *name);
-SSL_CTX *tws_GetInternalFromHostName(const char *name);
 int tws_RegisterRouterName(const char *name, tws_router_t *internal);
 int tws_UnregisterRouterName(const char *name);
 tws_router_t *tws_GetInternalFromRouterName(const char *name);
 char *tws_strndup(const char *s, size_t n);
 int tws_IsBinaryType(const char *content_type, size_t content_type_length);
 long long current_time_in_millis();
+long long current_time_in_micros();
 void tws_DecrRefCountUntilZero(Tcl_Obj *obj);
-void tws_FreeSslContexts();
 void tws_PrintRefCountObjv(int objc, Tcl_Obj *const objv[]);
 void tws_IncrRefCountObjv(int objc, Tcl_Obj *const objv[]);
 void tws_DecrRefCountObjv(int objc, Tcl_Obj *const objv[]);
@@ -4,6 +4,9 @@
  * SPDX-License-Identifier: MIT.
  */
 
+// for accept4
+#define _GNU_SOURCE
+
 #include <sys/socket.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -15,9 +18,16 @@
 #include <string.h>
 #include "conn.h"
 #include "request.h"
+#include "scan.h"
 #include "https.h"
 #include "router.h"
 #include "return.h"
+#include "uring.h"
+#include "timer.h"
+#include "buffer.h"
+#include "session.h"
+#include "sni.h"
+#include "handshake.h"
 #include <netdb.h>
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
@@ -27,6 +37,7 @@
 #else
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <signal.h>
 #include <assert.h>
@@ -38,6 +49,9 @@
 #define MAX_BUFFER_SIZE 1024
 #endif
 
+// how long the native event loop blocks in epoll_wait before running Tcl timers and events
+#define NATIVE_LOOP_TICK_MILLIS 10
+
 enum {
     TWS_MODE_BLOCKING,
     TWS_MODE_NONBLOCKING
@@ -46,6 +60,8 @@ enum {
 static int tws_HandleRecv(tws_conn_t *conn);
 static void tws_KeepaliveConnHandler(void *data, int mask);
 static int tws_AddConnToThreadList(tws_conn_t *conn);
+static void tws_QueueProcessEvent(tws_conn_t *conn);
+static void tws_MarkConnActivity(tws_conn_t *conn);
 
 static int tws_SetBlockingMode(
         int fd,
@@ -262,23 +278,79 @@ static int create_epoll_fd(Tcl_Interp *interp, int server_fd, int *epoll_sock) {
     return TCL_OK;
 }
 
+// returns a conn from the pool of this thread if there is one, its buffers are empty
+// but keep the memory they had, and allocates a new conn otherwise
+static tws_conn_t *tws_AllocConn(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    tws_conn_t *conn = dataPtr->freeConnPtr;
+    if (conn != NULL) {
+        dataPtr->freeConnPtr = conn->nextPtr;
+        dataPtr->num_free_conns--;
+        dataPtr->conn_pool_hits++;
+        return conn;
+    }
+
+    dataPtr->conn_pool_misses++;
+    conn = (tws_conn_t *) ckalloc(sizeof(tws_conn_t));
+    conn->encoding = Tcl_GetEncoding(accept_ctx->interp, "utf-8");
+    Tcl_DStringInit(&conn->inout_ds);
+    return conn;
+}
+
+// puts the conn in the pool of this thread unless the pool is full,
+// the caller has already released everything else that the conn holds
+void tws_ReleaseConn(tws_thread_data_t *dataPtr, tws_conn_t *conn) {
+    // the thread that accepts conns on BSD is not a conn thread and has no server
+    tws_server_t *server = dataPtr->server;
+    if (server == NULL || dataPtr->num_free_conns >= server->conn_pool_size) {
+        Tcl_DStringFree(&conn->inout_ds);
+        Tcl_FreeEncoding(conn->encoding);
+        ckfree((char *) conn);
+        return;
+    }
+
+    tws_ReleaseReadBuffer(&conn->inout_ds);
+    conn->handle[0] = '\0';
+    conn->nextPtr = dataPtr->freeConnPtr;
+    dataPtr->freeConnPtr = conn;
+    dataPtr->num_free_conns++;
+}
+
+static void tws_FreeConnPool(tws_thread_data_t *dataPtr) {
+    while (dataPtr->freeConnPtr != NULL) {
+        tws_conn_t *conn = dataPtr->freeConnPtr;
+        dataPtr->freeConnPtr = conn->nextPtr;
+        Tcl_DStringFree(&conn->inout_ds);
+        Tcl_FreeEncoding(conn->encoding);
+        ckfree((char *) conn);
+    }
+    dataPtr->num_free_conns = 0;
+}
+
 tws_conn_t *tws_NewConn(tws_accept_ctx_t *accept_ctx, int client, char client_ip[INET6_ADDRSTRLEN]) {
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
     tws_SetBlockingMode(client, TWS_MODE_NONBLOCKING);
+#endif
 
-    tws_conn_t *conn = (tws_conn_t *) ckalloc(sizeof(tws_conn_t));
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+    tws_conn_t *conn = tws_AllocConn(dataPtr, accept_ctx);
 
     if (accept_ctx->option_http) {
         conn->ssl = NULL;
     } else {
         SSL *ssl = SSL_new(accept_ctx->ssl_ctx);
         if (ssl == NULL) {
-            ckfree((char *) conn);
+            tws_ReleaseConn(dataPtr, conn);
             return NULL;
         }
         SSL_set_fd(ssl, client);
         SSL_set_accept_state(ssl);
+        // the session callbacks get to the server from the conn
+        SSL_set_app_data(ssl, conn);
         conn->ssl = ssl;
+        conn->handshake_start_micros = current_time_in_micros();
     }
+    conn->early_data_state = conn->ssl && SSL_get_max_early_data(conn->ssl) > 0 ? TWS_EARLY_DATA_ACCEPTING : TWS_EARLY_DATA_NONE;
+    conn->too_early = 0;
 
     conn->accept_ctx = accept_ctx;
     conn->handle_conn_fn = accept_ctx->handle_conn_fn;
@@ -289,23 +361,42 @@ tws_conn_t *tws_NewConn(tws_accept_ctx_t *accept_ctx, int client, char client_ip
     conn->ready = 0;
     conn->handshaked = 0;
     conn->inprogress = 0;
-    conn->todelete = 0;
     conn->shutdown = 0;
+    conn->write_pending = 0;
+    conn->ktls_send = 0;
+    conn->ktls_recv = 0;
     conn->prevPtr = NULL;
     conn->nextPtr = NULL;
     memcpy(conn->client_ip, client_ip, INET6_ADDRSTRLEN);
-    conn->encoding = Tcl_GetEncoding(accept_ctx->interp, "utf-8");
-    Tcl_DStringInit(&conn->inout_ds);
-    Tcl_DStringInit(&conn->parse_ds);
     conn->req_dict_ptr = NULL;
     conn->top_part_offset = 0;
     conn->write_offset = 0;
     conn->content_length = 0;
     conn->error = 0;
     conn->blank_line_offset = 0;
-    conn->n_chunks = 0;
-    conn->chunks_ds = NULL;
-    conn->chunk_offset = 0;
+    conn->stream = TWS_STREAM_NONE;
+    conn->stream_drain_ptr = NULL;
+    conn->body = NULL;
+    conn->body_length = 0;
+    conn->body_obj_ptr = NULL;
+    conn->body_alloc_ptr = NULL;
+    conn->file_fd = -1;
+    conn->file_offset = 0;
+    conn->file_length = 0;
+    conn->body_file_path = NULL;
+    conn->body_file_fd = -1;
+    conn->body_file_length = 0;
+    conn->read_timer_p = 0;
+    conn->timerPrevPtr = NULL;
+    conn->timerNextPtr = NULL;
+    conn->timerSlotPtr = NULL;
+    conn->timer_expires_tick = 0;
+    conn->uring_id = 0;
+    conn->uring_bid = -1;
+    conn->uring_buf_offset = 0;
+    conn->uring_buf_length = 0;
+    conn->handshake_offloaded = 0;
+    conn->handshakeNextPtr = NULL;
 
 //        fprintf(stderr, "tws_NewConn - num_threads: %d\n", accept_ctx->server->num_threads);
 //        fprintf(stderr, "tws_NewConn - client: %d\n", client);
@@ -331,6 +422,7 @@ static int tws_HandleProcessing(tws_conn_t *conn) {
 
     Tcl_Obj *dup_req_dict_ptr = conn->req_dict_ptr;
     conn->req_dict_ptr = NULL;
+    conn->stream = TWS_STREAM_NONE;
 
     if (accept_ctx->server->option_router) {
         Tcl_CmdInfo cmd_info;
@@ -393,38 +485,80 @@ static int tws_FoundBlankLine(tws_conn_t *conn) {
     }
 
     const char *s = Tcl_DStringValue(&conn->inout_ds);
-    const char *p = s + conn->blank_line_offset;
-    const char *end = s + Tcl_DStringLength(&conn->inout_ds);
-    while (p < end) {
-        if ((p < end - 3 && *p == '\r' && *(p + 1) == '\n' && *(p + 2) == '\r' && *(p + 3) == '\n') || (p < end - 1 && *p == '\n' && *(p + 1) == '\n')) {
-            DBG2(printf("FoundBlankLine\n"));
-            conn->blank_line_offset = -1;
-            return 1;
-        }
-        p++;
+    Tcl_Size length = Tcl_DStringLength(&conn->inout_ds);
+    if (tws_FindBlankLine(s + conn->blank_line_offset, s + length)) {
+        DBG2(printf("FoundBlankLine\n"));
+        conn->blank_line_offset = -1;
+        return 1;
     }
 
     DBG2(printf("NotFoundBlankLine\n"));
-    conn->blank_line_offset = p - s;
+    // the blank line may start in the last three bytes and end with the next read
+    if (length - 3 > conn->blank_line_offset) {
+        conn->blank_line_offset = length - 3;
+    }
     return 0;
 }
 
 static int tws_ShouldParseTopPart(tws_conn_t *conn) {
-    return Tcl_DStringLength(&conn->parse_ds) == 0 && Tcl_DStringLength(&conn->inout_ds) > 0 && tws_FoundBlankLine(conn);
+    return conn->req_dict_ptr == NULL && Tcl_DStringLength(&conn->inout_ds) > 0 && tws_FoundBlankLine(conn);
 }
 
 static int tws_ShouldParseBottomPart(tws_conn_t *conn) {
     return conn->content_length > 0;
 }
 
+// the part of the body that has been read, in the input buffer or in the body file
+static Tcl_Size tws_BodyBytesRead(tws_conn_t *conn) {
+    return Tcl_DStringLength(&conn->inout_ds) - conn->top_part_offset + conn->body_file_length;
+}
+
 static int tws_ShouldReadMore(tws_conn_t *conn) {
     if (conn->content_length > 0) {
-        int content_read_but_not_processed = Tcl_DStringLength(&conn->inout_ds) - conn->top_part_offset;
-        return conn->content_length - content_read_but_not_processed > 0;
+        return conn->content_length - tws_BodyBytesRead(conn) > 0;
     }
     return !tws_FoundBlankLine(conn);
 }
 
+// reads the rest of the body into the body file, at most max_read_buffer_size bytes
+// at a time, so that the input buffer does not grow with the body
+static int tws_ReadBodyFile(tws_conn_t *conn, Tcl_Size bytes_to_read) {
+    Tcl_Size chunk_size = conn->accept_ctx->server->max_read_buffer_size;
+    for (;;) {
+        Tcl_Size length_before = Tcl_DStringLength(&conn->inout_ds);
+        int ret = conn->accept_ctx->read_fn(conn, &conn->inout_ds, MIN(bytes_to_read, chunk_size));
+        Tcl_Size bytes_read = Tcl_DStringLength(&conn->inout_ds) - length_before;
+        if (TCL_OK != tws_WriteBodyFile(conn)) {
+            return TWS_ERROR;
+        }
+        bytes_to_read -= bytes_read;
+        if (TWS_DONE != ret || bytes_to_read <= 0) {
+            return ret;
+        }
+        if (bytes_read == 0) {
+            // the peer closed the conn before it sent the whole body
+            return TWS_ERROR;
+        }
+    }
+}
+
+
+// reads the headers a chunk at a time and stops once they are in, so that a body
+// that goes to a file is not read into the input buffer along with them
+static int tws_ReadTopPart(tws_conn_t *conn) {
+    Tcl_Size chunk_size = conn->accept_ctx->server->max_read_buffer_size;
+    for (;;) {
+        Tcl_Size length_before = Tcl_DStringLength(&conn->inout_ds);
+        int ret = conn->accept_ctx->read_fn(conn, &conn->inout_ds, chunk_size);
+        if (TWS_DONE != ret || Tcl_DStringLength(&conn->inout_ds) - length_before < chunk_size) {
+            return ret;
+        }
+        if (tws_ShouldParseTopPart(conn)) {
+            // there is more to read, HandleRecv parses the headers and goes on with the body
+            return TWS_AGAIN;
+        }
+    }
+}
 
 static int tws_HandleRecv(tws_conn_t *conn) {
     DBG2(printf("HandleRecv: %d %s\n", conn->client, conn->handle));
@@ -444,7 +578,6 @@ static int tws_HandleRecv(tws_conn_t *conn) {
                     tws_parse_error_messages[error_num], conn->handle);
 
             // ProcessEventInThread will return Bad Request and close the connection
-            Tcl_DStringSetLength(&conn->parse_ds, 0);
             conn->ready = 1;
             return 1;
         }
@@ -455,22 +588,35 @@ static int tws_HandleRecv(tws_conn_t *conn) {
     if (elapsed > conn->accept_ctx->server->read_timeout_millis) {
         DBG2(printf("exceeded read timeout: %lld\n", elapsed));
         // ProcessEventInThread will return Bad Request and close the connection
-        Tcl_DStringSetLength(&conn->parse_ds, 0);
+        if (conn->req_dict_ptr) {
+            Tcl_DecrRefCount(conn->req_dict_ptr);
+            conn->req_dict_ptr = NULL;
+        }
         conn->ready = 1;
         return 1;
     }
 
     int ret = TWS_DONE;
     if (tws_ShouldReadMore(conn)) {
-        Tcl_Size content_read_but_not_processed = Tcl_DStringLength(&conn->inout_ds) - conn->top_part_offset;
-        Tcl_Size bytes_to_read = conn->content_length == 0 ? 0 : conn->content_length - content_read_but_not_processed;
-        ret = conn->accept_ctx->read_fn(conn, &conn->inout_ds, bytes_to_read);
+        Tcl_Size bytes_to_read = conn->content_length == 0 ? 0 : conn->content_length - tws_BodyBytesRead(conn);
+        if (conn->body_file_fd != -1) {
+            ret = tws_ReadBodyFile(conn, bytes_to_read);
+        } else if (!conn->req_dict_ptr && conn->accept_ctx->server->body_file_min_length > 0) {
+            ret = tws_ReadTopPart(conn);
+        } else {
+            ret = conn->accept_ctx->read_fn(conn, &conn->inout_ds, bytes_to_read);
+        }
     }
 
     if (TWS_AGAIN == ret) {
-        if (tws_ShouldParseTopPart(conn) || tws_ShouldReadMore(conn)) {
-            DBG2(printf("retry dslen=%zd offset=%zd parsedslen=%zd\n", Tcl_DStringLength(&conn->inout_ds), conn->top_part_offset,
-                        Tcl_DStringLength(&conn->parse_ds)));
+        if (tws_ShouldParseTopPart(conn)) {
+            // the headers are complete, parse them and continue with the body, if any,
+            // instead of waiting for more data that might never arrive
+            return tws_HandleRecv(conn);
+        }
+        if (tws_ShouldReadMore(conn)) {
+            DBG2(printf("retry dslen=%zd offset=%zd reqdictptr=%p\n", Tcl_DStringLength(&conn->inout_ds), conn->top_part_offset,
+                        conn->req_dict_ptr));
             return 0;
         }
     } else if (TWS_ERROR == ret) {
@@ -495,7 +641,6 @@ static int tws_HandleRecv(tws_conn_t *conn) {
             fprintf(stderr, "ParseTopPart failed (after rubicon): %s\n",
                     tws_parse_error_messages[error_num]);
             // ProcessEventInThread will return Bad Request and close the connection
-            Tcl_DStringSetLength(&conn->parse_ds, 0);
             conn->ready = 1;
             return 1;
         }
@@ -509,10 +654,10 @@ static int tws_HandleRecv(tws_conn_t *conn) {
             return 1;
         }
     } else {
-        DBG2(printf("conn->parse_ds len: %ld\n", Tcl_DStringLength(&conn->parse_ds)));
+        DBG2(printf("conn->req_dict_ptr: %p\n", conn->req_dict_ptr));
 
-        if (!Tcl_DStringLength(&conn->parse_ds)) {
-            DBG2(printf("parse ds is empty, inout_ds: %s\n", Tcl_DStringValue(&conn->inout_ds)));
+        if (!conn->req_dict_ptr) {
+            DBG2(printf("req dict is empty, inout_ds: %s\n", Tcl_DStringValue(&conn->inout_ds)));
             conn->ready = 1;
             // ProcessEventInThread will return Bad Request and close the connection
             return 1;
@@ -525,40 +670,174 @@ static int tws_HandleRecv(tws_conn_t *conn) {
     return 1;
 }
 
-int tws_HandleSslHandshake(tws_conn_t *conn) {
-
-    assert(valid_conn_handle(conn));
+// Reads the early data that a resumed tls 1.3 client sent along with its ClientHello into
+// inout_ds. Once there is some, the handshake is done as far as the conn is concerned: it
+// serves the requests in it while the client finishes the handshake, and the reads and
+// writes of the conn go through SSL_read_early_data and SSL_write_early_data until the
+// client says that its early data has ended.
+static int tws_ReadEarlyData(tws_conn_t *conn) {
+    tws_server_t *server = conn->accept_ctx->server;
+    // the read buffer pool is of the conn thread, a handshake thread reads into a buffer of its own
+    char *chunk = conn->handshake_offloaded ? ckalloc(server->max_read_buffer_size) : NULL;
+    int result;
+    for (;;) {
+        Tcl_Size avail = server->max_read_buffer_size;
+        char *buf = chunk ? chunk : tws_ReserveReadSpace(&conn->inout_ds, server->max_read_buffer_size, &avail);
+        size_t bytes_read = 0;
+        int rc = SSL_read_early_data(conn->ssl, buf, avail, &bytes_read);
+        if (rc == SSL_READ_EARLY_DATA_SUCCESS) {
+            if (chunk) {
+                Tcl_DStringAppend(&conn->inout_ds, chunk, (Tcl_Size) bytes_read);
+            } else {
+                Tcl_DStringSetLength(&conn->inout_ds, Tcl_DStringLength(&conn->inout_ds) + (Tcl_Size) bytes_read);
+            }
+            continue;
+        }
+        if (rc == SSL_READ_EARLY_DATA_FINISH) {
+            // no early data or all of it was read, SSL_accept completes the handshake
+            conn->early_data_state = TWS_EARLY_DATA_NONE;
+            result = TWS_HANDSHAKE_WANT_READ;
+            break;
+        }
 
-    if (conn->handshaked) {
-        fprintf(stderr, "HandleSslHandshake: already handshaked\n");
-        return 1;
+        int err = SSL_get_error(conn->ssl, rc);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            if (Tcl_DStringLength(&conn->inout_ds) > 0) {
+                DBG2(printf("ReadEarlyData: %zd bytes\n", Tcl_DStringLength(&conn->inout_ds)));
+                conn->early_data_state = TWS_EARLY_DATA_READING;
+                result = TWS_HANDSHAKE_DONE;
+            } else {
+                result = err == SSL_ERROR_WANT_READ ? TWS_HANDSHAKE_WANT_READ : TWS_HANDSHAKE_WANT_WRITE;
+            }
+        } else if (err == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+            fprintf(stderr, "peer closed connection in SSL handshake\n");
+            result = TWS_HANDSHAKE_FAILED;
+        } else {
+            fprintf(stderr, "SSL_read_early_data failed client: %d err=%s\n", conn->client, tws_GetSslError(err));
+            ERR_print_errors_fp(stderr);
+            result = TWS_HANDSHAKE_FAILED;
+        }
+        break;
     }
+    if (chunk) {
+        ckfree(chunk);
+    }
+    return result;
+}
+
+// runs SSL_accept, also on the threads of the handshake pool, and returns one of TWS_HANDSHAKE_*
+int tws_AcceptSsl(tws_conn_t *conn) {
     ERR_clear_error();
+    if (conn->early_data_state == TWS_EARLY_DATA_ACCEPTING) {
+        int result = tws_ReadEarlyData(conn);
+        if (conn->early_data_state != TWS_EARLY_DATA_NONE) {
+            return result;
+        }
+    }
+
     int rc = SSL_accept(conn->ssl);
     if (rc == 1) {
         DBG2(printf("HandleHandshake: success\n"));
-        conn->handshaked = 1;
-        conn->handle_conn_fn = tws_HandleRecv;
-        return 1;
+        return TWS_HANDSHAKE_DONE;
     }
 
     int err = SSL_get_error(conn->ssl, rc);
     if (err == SSL_ERROR_WANT_READ) {
         DBG2(printf("HandleHandshake: SSL_ERROR_WANT_READ\n"));
-        return 0;
+        return TWS_HANDSHAKE_WANT_READ;
     } else if (err == SSL_ERROR_WANT_WRITE) {
         DBG2(printf("HandleHandshake: SSL_ERROR_WANT_WRITE\n"));
-        return 0;
+        return TWS_HANDSHAKE_WANT_WRITE;
     } else if (err == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
         fprintf(stderr, "peer closed connection in SSL handshake\n");
+        return TWS_HANDSHAKE_FAILED;
+    }
+    fprintf(stderr, "SSL_accept <= 0 client: %d err=%s\n", conn->client, tws_GetSslError(err));
+    ERR_print_errors_fp(stderr);
+    return TWS_HANDSHAKE_FAILED;
+}
+
+// counts the handshake and switches the conn to reading its request
+static void tws_FinishSslHandshake(tws_conn_t *conn) {
+    conn->handshaked = 1;
+    conn->handle_conn_fn = tws_HandleRecv;
+
+    // with the ktls option, openssl gave the keys to the kernel during the handshake
+    // if the kernel has the tls module and supports the cipher that was negotiated.
+    // A conn that serves its early data has not completed the handshake that SSL_sendfile needs
+    if (conn->early_data_state == TWS_EARLY_DATA_NONE) {
+        conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+        conn->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(conn->ssl));
+    }
+    tws_server_t *server = conn->accept_ctx->server;
+    __atomic_add_fetch(&server->tls_handshakes, 1, __ATOMIC_RELAXED);
+    if (SSL_session_reused(conn->ssl)) {
+        __atomic_add_fetch(&server->tls_resumed_handshakes, 1, __ATOMIC_RELAXED);
+    }
+    if (conn->ktls_send) {
+        __atomic_add_fetch(&server->ktls_send_conns, 1, __ATOMIC_RELAXED);
+    }
+    if (conn->ktls_recv) {
+        __atomic_add_fetch(&server->ktls_recv_conns, 1, __ATOMIC_RELAXED);
+    }
+
+    Tcl_WideInt latency_micros = current_time_in_micros() - conn->handshake_start_micros;
+    __atomic_add_fetch(&server->tls_handshake_latency_micros, latency_micros, __ATOMIC_RELAXED);
+    Tcl_WideInt max_micros = __atomic_load_n(&server->tls_handshake_latency_max_micros, __ATOMIC_RELAXED);
+    while (latency_micros > max_micros
+           && !__atomic_compare_exchange_n(&server->tls_handshake_latency_max_micros, &max_micros, latency_micros,
+                                           0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+int tws_HandleSslHandshake(tws_conn_t *conn) {
+
+    assert(valid_conn_handle(conn));
+
+    if (conn->handshaked) {
+        fprintf(stderr, "HandleSslHandshake: already handshaked\n");
+        return 1;
+    }
+
+    tws_handshake_pool_t *pool = conn->accept_ctx->server->handshake_pool;
+    if (pool) {
+        // the conn comes back in tws_HandleHandshakeEventInThread
+        tws_QueueHandshake(pool, conn);
+        return 1;
+    }
+
+    switch (tws_AcceptSsl(conn)) {
+        case TWS_HANDSHAKE_DONE:
+            tws_FinishSslHandshake(conn);
+            return 1;
+        case TWS_HANDSHAKE_WANT_READ:
+        case TWS_HANDSHAKE_WANT_WRITE:
+            return 0;
+        default:
+            conn->error = 1;
+            tws_CloseConn(conn, 1);
+            return 1;
+    }
+}
+
+// a handshake thread gives the conn back to the conn thread that owns it
+int tws_HandleHandshakeEventInThread(Tcl_Event *evPtr, int flags) {
+    UNUSED(flags);
+
+    tws_event_t *connEvPtr = (tws_event_t *) evPtr;
+    tws_conn_t *conn = (tws_conn_t *) connEvPtr->clientData;
+
+    DBG2(printf("HandleHandshakeEventInThread: %s result: %d\n", conn->handle, conn->handshake_result));
+    conn->handshake_offloaded = 0;
+    if (conn->handshake_result != TWS_HANDSHAKE_DONE) {
         conn->error = 1;
         tws_CloseConn(conn, 1);
         return 1;
     }
-    fprintf(stderr, "SSL_accept <= 0 client: %d err=%s\n", conn->client, tws_GetSslError(err));
-    conn->error = 1;
-    tws_CloseConn(conn, 1);
-    ERR_print_errors_fp(stderr);
+
+    tws_FinishSslHandshake(conn);
+    tws_MarkConnActivity(conn);
+    tws_QueueProcessEvent(conn);
     return 1;
 }
 
@@ -580,39 +859,98 @@ int tws_HandleTermEventInThread(Tcl_Event *evPtr, int flags) {
     return 1;
 }
 
-static int tws_SetDefaultBodyIfNeeded(Tcl_Interp *interp, tws_conn_t *conn) {
-    if (!conn->content_length) {
-        if (TCL_OK !=
-            Tcl_DictObjPut(interp, conn->req_dict_ptr, Tcl_NewStringObj("isBase64Encoded", -1),
-                           Tcl_NewBooleanObj(0))) {
-            fprintf(stderr, "failed to write to dict 1\n");
-            tws_CloseConn(conn, 1);
-            return TCL_ERROR;
+static void tws_HandleReadTimeout(tws_conn_t *conn) {
+    DBG2(printf("HandleReadTimeout: %s\n", conn->handle));
+    conn->read_timer_p = 0;
+
+    if (conn->ready || conn->shutdown) {
+        return;
+    }
+
+    if (!conn->accept_ctx->option_http && !conn->handshaked) {
+        tws_CloseConn(conn, 1);
+        return;
+    }
+
+    // HandleRecv will find that the read timeout was exceeded and return Bad Request
+    tws_QueueProcessEvent(conn);
+}
+
+// schedules the conn on the timer wheel of this thread for the earliest of its deadlines,
+// activity only moves the deadlines later so they are checked again when the conn comes due
+static void tws_ScheduleConnTimer(tws_conn_t *conn) {
+    tws_server_t *server = conn->accept_ctx->server;
+    long long expires_millis = conn->latest_millis + server->conn_timeout_millis;
+    if (conn->read_timer_p) {
+        long long read_expires_millis = conn->start_read_millis + server->read_timeout_millis;
+        if (read_expires_millis < expires_millis) {
+            expires_millis = read_expires_millis;
         }
-        if (TCL_OK !=
-            Tcl_DictObjPut(interp, conn->req_dict_ptr, Tcl_NewStringObj("body", -1), Tcl_NewStringObj("", -1))) {
-            fprintf(stderr, "failed to write to dict 2\n");
-            tws_CloseConn(conn, 1);
-            return TCL_ERROR;
+    }
+
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+    tws_AddConnTimer(&dataPtr->timer_wheel, conn, expires_millis + 1);
+}
+
+static void tws_HandleConnTimer(tws_conn_t *conn, long long now_millis) {
+    assert(valid_conn_handle(conn));
+
+    if (conn->shutdown) {
+        return;
+    }
+
+    // the handshake thread gives the conn back by the read timeout
+    if (conn->handshake_offloaded) {
+        tws_ScheduleConnTimer(conn);
+        return;
+    }
+
+    tws_server_t *server = conn->accept_ctx->server;
+    if (conn->read_timer_p && now_millis - conn->start_read_millis > server->read_timeout_millis) {
+        tws_HandleReadTimeout(conn);
+        if (conn->shutdown) {
+            return;
         }
     }
-    return TCL_OK;
+
+    if (now_millis - conn->latest_millis > server->conn_timeout_millis) {
+        DBG2(printf("HandleConnTimer - conn timeout: %s\n", conn->handle));
+        tws_CloseConn(conn, 1);
+        return;
+    }
+
+    tws_ScheduleConnTimer(conn);
 }
 
-static int tws_HandleProcessEventInThread(Tcl_Event *evPtr, int flags) {
-    UNUSED(flags);
+static void tws_HandleTimerWheelTick(ClientData clientData) {
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) clientData;
+    tws_timer_wheel_t *wheel = &dataPtr->timer_wheel;
+    tws_AdvanceTimerWheel(wheel, current_time_in_millis(), tws_HandleConnTimer);
+    // the host name tables that a reloaded context replaced
+    tws_ReleaseRetiredHostNames();
+    wheel->tick_token = Tcl_CreateTimerHandler(wheel->tick_millis, tws_HandleTimerWheelTick, dataPtr);
+}
 
-    tws_event_t *connEvPtr = (tws_event_t *) evPtr;
-    tws_conn_t *conn = (tws_conn_t *) connEvPtr->clientData;
+// a conn that waits for the rest of its request would otherwise
+// only notice that the read timeout was exceeded when more data arrives
+static void tws_CreateReadTimer(tws_conn_t *conn) {
+    if (conn->read_timer_p) {
+        return;
+    }
 
+    conn->read_timer_p = 1;
+    tws_ScheduleConnTimer(conn);
+}
+
+static int tws_ProcessConn(tws_conn_t *conn) {
     assert(valid_conn_handle(conn));
 
     if (conn->ready || conn->shutdown) {
-        DBG2(printf("HandleProcessEventInThread: ready: %d shutdown: %d\n", conn->ready, conn->shutdown));
+        DBG2(printf("ProcessConn: ready: %d shutdown: %d\n", conn->ready, conn->shutdown));
         return 1;
     }
 
-    DBG2(printf("HandleProcessEventInThread: %s (%p)\n", conn->handle, conn->handle_conn_fn));
+    DBG2(printf("ProcessConn: %s (%p)\n", conn->handle, conn->handle_conn_fn));
     int rc = conn->handle_conn_fn(conn);
 
     // when conn is in error (e.g. peer closed connection), HandleRecv closes the connection and
@@ -622,11 +960,19 @@ static int tws_HandleProcessEventInThread(Tcl_Event *evPtr, int flags) {
         return 1;
     }
 
+    // a handshake thread has the conn until it queues a handshake event
+    if (conn->handshake_offloaded) {
+        return 1;
+    }
+
     if (!rc) {
-        Tcl_ThreadAlert(conn->threadId);
-        return 0;
+        // resume from tws_KeepaliveConnHandler once more data arrives,
+        // parsing continues from blank_line_offset and top_part_offset
+        tws_WaitForReadable(conn);
+        tws_CreateReadTimer(conn);
+        return 1;
     }
-    DBG2(printf("HandleProcessEventInThread: ready=%d (%p)\n", conn->ready, conn->handle_conn_fn));
+    DBG2(printf("ProcessConn: ready=%d (%p)\n", conn->ready, conn->handle_conn_fn));
 
     int ready = conn->ready;
     if (ready) {
@@ -635,7 +981,7 @@ static int tws_HandleProcessEventInThread(Tcl_Event *evPtr, int flags) {
             tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
             Tcl_InterpState interp_state = Tcl_SaveInterpState(dataPtr->interp, TCL_OK);
 
-            if (!Tcl_DStringLength(&conn->parse_ds)) {
+            if (!conn->req_dict_ptr) {
                 if (TCL_OK != tws_ReturnError(dataPtr->interp, conn, 400, "Bad Request")) {
                     tws_CloseConn(conn, 1);
                 }
@@ -643,30 +989,61 @@ static int tws_HandleProcessEventInThread(Tcl_Event *evPtr, int flags) {
                 return 1;
             }
 
-#if TCL_MAJOR_VERSION > 8
-            conn->req_dict_ptr = Tcl_DStringToObj(&conn->parse_ds);
-#else
-            Tcl_DStringResult(dataPtr->interp, &conn->parse_ds);
-            conn->req_dict_ptr = Tcl_DuplicateObj(Tcl_GetObjResult(dataPtr->interp));
-            Tcl_ResetResult(dataPtr->interp);
-#endif
-            Tcl_IncrRefCount(conn->req_dict_ptr);
-            if (TCL_OK != tws_SetDefaultBodyIfNeeded(dataPtr->interp, conn)) {
+            if (conn->too_early) {
+                // the client sends the request again once its handshake is complete (RFC 8470),
+                // the conn is closed since the body of the request may still be unread
+                __atomic_add_fetch(&conn->accept_ctx->server->tls_too_early_responses, 1, __ATOMIC_RELAXED);
+                Tcl_DecrRefCount(conn->req_dict_ptr);
+                conn->req_dict_ptr = NULL;
+                conn->keepalive = 0;
+                if (TCL_OK != tws_ReturnError(dataPtr->interp, conn, 425, "Too Early")) {
+                    tws_CloseConn(conn, 1);
+                }
                 Tcl_RestoreInterpState(dataPtr->interp, interp_state);
                 return 1;
             }
+
             tws_HandleProcessing(conn);
             Tcl_RestoreInterpState(dataPtr->interp, interp_state);
         }
     }
-    Tcl_ThreadAlert(conn->threadId);
+    if (!conn->accept_ctx->native_loop) {
+        Tcl_ThreadAlert(conn->threadId);
+    }
     return ready;
 }
 
+static int tws_HandleProcessEventInThread(Tcl_Event *evPtr, int flags) {
+    UNUSED(flags);
+
+    tws_event_t *connEvPtr = (tws_event_t *) evPtr;
+    tws_conn_t *conn = (tws_conn_t *) connEvPtr->clientData;
+
+    DBG2(printf("HandleProcessEventInThread: %s\n", conn->handle));
+    return tws_ProcessConn(conn);
+}
+
+// the read timeout counts from the first byte of a request,
+// so that a client trickling in a request cannot keep extending it
+static void tws_MarkConnActivity(tws_conn_t *conn) {
+    conn->latest_millis = current_time_in_millis();
+    if (!Tcl_DStringLength(&conn->inout_ds)) {
+        conn->start_read_millis = conn->latest_millis;
+    }
+}
+
+
 static void tws_QueueProcessEvent(tws_conn_t *conn) {
 
     assert(valid_conn_handle(conn));
 
+    if (conn->accept_ctx->native_loop) {
+        // ProcessConn returns 0 right after the handshake completes, so that we read the request next
+        while (!tws_ProcessConn(conn)) {
+        }
+        return;
+    }
+
     DBG2(printf("ThreadQueueProcessEvent - threadId: %p\n", conn->threadId));
     tws_event_t *connEvPtr = (tws_event_t *) ckalloc(sizeof(tws_event_t));
     connEvPtr->proc = tws_HandleProcessEventInThread;
@@ -708,8 +1085,7 @@ static int tws_HandleKeepaliveEventInThread(Tcl_Event *evPtr, int flags) {
     tws_conn_t *conn = (tws_conn_t *) connEvPtr->clientData;
 
     DBG2(printf("current thread: %p conn->threadId: %p\n", Tcl_GetCurrentThread(), conn->threadId));
-    conn->start_read_millis = current_time_in_millis();
-    conn->latest_millis = conn->start_read_millis;
+    tws_MarkConnActivity(conn);
 
     tws_QueueProcessEvent(conn);
 
@@ -753,7 +1129,117 @@ int tws_InfoConnCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
         }
     }
 
-    if (TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("server", -1), Tcl_NewStringObj(conn->accept_ctx->server->handle, -1))) {
+    if (TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("server", -1), Tcl_NewStringObj(conn->accept_ctx->server->handle, -1))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ktls_send", -1), Tcl_NewBooleanObj(conn->ktls_send))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ktls_recv", -1), Tcl_NewBooleanObj(conn->ktls_recv))) {
+        fprintf(stderr, "error writing to dict\n");
+        Tcl_DecrRefCount(result_ptr);
+        return TCL_ERROR;
+    }
+
+    Tcl_SetObjResult(interp, result_ptr);
+    Tcl_DecrRefCount(result_ptr);
+    return TCL_OK;
+}
+
+int tws_InfoConnPoolCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("InfoConnPoolCmd\n"));
+    CheckArgs(1, 1, 1, "");
+
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+
+    Tcl_Obj *result_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(result_ptr);
+    if (TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("hits", -1), Tcl_NewWideIntObj(dataPtr->conn_pool_hits))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("misses", -1), Tcl_NewWideIntObj(dataPtr->conn_pool_misses))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("free", -1), Tcl_NewIntObj(dataPtr->num_free_conns))) {
+        fprintf(stderr, "error writing to dict\n");
+        Tcl_DecrRefCount(result_ptr);
+        return TCL_ERROR;
+    }
+
+    Tcl_SetObjResult(interp, result_ptr);
+    Tcl_DecrRefCount(result_ptr);
+    return TCL_OK;
+}
+
+int tws_InfoTlsCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("InfoTlsCmd\n"));
+    CheckArgs(1, 2, 1, "?server_handle?");
+
+    tws_server_t *server;
+    if (objc == 2) {
+        server = tws_GetInternalFromServerName(Tcl_GetString(objv[1]));
+        if (!server) {
+            SetResult("info_tls: server handle not found");
+            return TCL_ERROR;
+        }
+    } else {
+        tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+        server = dataPtr->server;
+        if (!server) {
+            SetResult("info_tls: not called from a conn thread, a server handle is required");
+            return TCL_ERROR;
+        }
+    }
+
+    Tcl_Obj *result_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(result_ptr);
+    if (TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ktls", -1), Tcl_NewBooleanObj(server->ktls))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("handshakes", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_handshakes, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ktls_send_conns", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->ktls_send_conns, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ktls_recv_conns", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->ktls_recv_conns, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ktls_sendfile_bytes", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->ktls_sendfile_bytes, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("resumed_handshakes", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_resumed_handshakes, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("session_cache_hits", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_session_cache_hits, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("session_cache_misses", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_session_cache_misses, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("session_cache_entries", -1),
+                                    Tcl_NewWideIntObj(tws_GetSessionCacheEntries(server->session_cache)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ticket_hits", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_ticket_hits, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ticket_misses", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_ticket_misses, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ticket_key_rotations", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_ticket_key_rotations, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("handshake_threads", -1),
+                                    Tcl_NewIntObj(server->handshake_pool ? server->tls_handshake_threads : 0))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("offloaded_handshakes", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_offloaded_handshakes, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("handshake_queue_depth", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_handshake_queue_depth, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("handshake_queue_wait_micros", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_handshake_queue_wait_micros, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("handshake_latency_micros", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_handshake_latency_micros, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("handshake_latency_max_micros", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_handshake_latency_max_micros, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("max_early_data", -1),
+                                    Tcl_NewIntObj(server->tls_max_early_data))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("early_data_accepted", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_early_data_accepted, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("early_data_replays", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_early_data_replays, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("early_data_requests", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_early_data_requests, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("too_early_responses", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_too_early_responses, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ocsp_staples", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_ocsp_staples, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ocsp_refreshes", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_ocsp_refreshes, __ATOMIC_RELAXED)))
+        || TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("ocsp_load_failures", -1),
+                                    Tcl_NewWideIntObj(__atomic_load_n(&server->tls_ocsp_load_failures, __ATOMIC_RELAXED)))) {
         fprintf(stderr, "error writing to dict\n");
         Tcl_DecrRefCount(result_ptr);
         return TCL_ERROR;
@@ -779,7 +1265,7 @@ static int tws_AddConnToThreadList(tws_conn_t *conn) {
         shutdown(conn->client, SHUT_RDWR);
         close(conn->client);
         SSL_free(conn->ssl);
-        ckfree((char *) conn);
+        tws_ReleaseConn(dataPtr, conn);
         Tcl_MutexUnlock(tws_GetThreadMutex());
         return 0;
     }
@@ -793,6 +1279,7 @@ static int tws_AddConnToThreadList(tws_conn_t *conn) {
         dataPtr->lastConnPtr = conn;
     }
     dataPtr->num_conns++;
+    tws_ScheduleConnTimer(conn);
 
     DBG2(printf("AddConnToThreatList - dataKey: %p thread: %p numConns: %d FD_SETSIZE: %d thread_limit: %d\n", tws_GetThreadDataKey(), Tcl_GetCurrentThread(), dataPtr->num_conns, FD_SETSIZE, thread_limit));
 
@@ -812,7 +1299,12 @@ void tws_AcceptConn(void *data, int mask) {
 
         struct sockaddr_in6 client_addr;
         unsigned int len = sizeof(client_addr);
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
         int client = accept(accept_ctx->server_fd, (struct sockaddr *) &client_addr, &len);
+#else
+        // accepted sockets are non-blocking from the start, so tws_NewConn does not need fcntl
+        int client = accept4(accept_ctx->server_fd, (struct sockaddr *) &client_addr, &len, SOCK_NONBLOCK);
+#endif
         DBG2(printf("client: %d\n", client));
         if (client < 0) {
             fprintf(stderr, "Unable to accept\n");
@@ -824,25 +1316,28 @@ void tws_AcceptConn(void *data, int mask) {
         inet_ntop(AF_INET6, &client_addr.sin6_addr, client_ip, sizeof(client_ip));
         DBG2(printf("Client connected from %s\n", client_ip));
 
-        tws_conn_t *conn = tws_NewConn(accept_ctx, client, client_ip);
-        if (conn == NULL) {
-            shutdown(client, SHUT_WR);
-            shutdown(client, SHUT_RD);
-            close(client);
-            DBG2(printf("Unable to create SSL connection"));
-            return;
-        }
+        tws_HandleAcceptedConn(accept_ctx, client, client_ip);
+}
+
+void tws_HandleAcceptedConn(tws_accept_ctx_t *accept_ctx, int client, char client_ip[INET6_ADDRSTRLEN]) {
+    tws_conn_t *conn = tws_NewConn(accept_ctx, client, client_ip);
+    if (conn == NULL) {
+        shutdown(client, SHUT_WR);
+        shutdown(client, SHUT_RD);
+        close(client);
+        DBG2(printf("Unable to create SSL connection"));
+        return;
+    }
 
-        CMD_CONN_NAME(conn->handle, conn);
-        tws_RegisterConnName(conn->handle, conn);
+    CMD_CONN_NAME(conn->handle, conn);
+    tws_RegisterConnName(conn->handle, conn);
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
-        tws_ThreadQueueConnEvent(conn);
+    tws_ThreadQueueConnEvent(conn);
 #else
-        if (tws_AddConnToThreadList(conn)) {
-            tws_QueueProcessEvent(conn);
-        }
+    if (tws_AddConnToThreadList(conn)) {
+        tws_QueueProcessEvent(conn);
+    }
 #endif
-
 }
 
 Tcl_Obj *tws_DStringToObj(Tcl_DString *ds_ptr) {
@@ -859,6 +1354,75 @@ Tcl_Obj *tws_DStringToDict(Tcl_DString *ds_ptr) {
     return dict_ptr;
 }
 
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#else
+void tws_HandleConnReady(tws_conn_t *conn) {
+    if (conn->write_pending) {
+        // EPOLLERR and EPOLLHUP are reported as well, the write will fail and close the conn
+        tws_HandleWriteReady(conn);
+        return;
+    }
+
+    DBG2(printf("HandleConnReady - keepalive client: %d %s\n", conn->client, conn->handle));
+    tws_MarkConnActivity(conn);
+
+    if (!conn->handle_conn_fn) {
+        conn->handle_conn_fn = tws_HandleRecv;
+    }
+
+    tws_QueueProcessEvent(conn);
+}
+
+static void tws_RunNativeEventLoop(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!dataPtr->terminate || dataPtr->num_conns) {
+        int nfds = epoll_wait(dataPtr->epoll_fd, events, MAX_EVENTS, NATIVE_LOOP_TICK_MILLIS);
+        if (nfds == -1) {
+            if (errno != EINTR) {
+                fprintf(stderr, "RunNativeEventLoop: epoll_wait failed\n");
+                break;
+            }
+            nfds = 0;
+        }
+
+        DBG2(printf("RunNativeEventLoop - nfds: %d\n", nfds));
+
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.ptr == NULL) {
+                tws_AcceptConn(accept_ctx, TCL_READABLE);
+            } else if (events[i].data.ptr == &accept_ctx->wake_fd) {
+                // a handshake thread queued a conn back, the Tcl events below pick it up
+                uint64_t value;
+                if (read(accept_ctx->wake_fd, &value, sizeof(value)) < 0) {
+                    DBG2(printf("RunNativeEventLoop: wake_fd read failed\n"));
+                }
+            } else {
+                tws_HandleConnReady((tws_conn_t *) events[i].data.ptr);
+            }
+        }
+
+        // run pending Tcl timers and the events that are still queued, e.g. freeing conns
+        while (Tcl_DoOneEvent(TCL_ALL_EVENTS | TCL_DONT_WAIT)) {
+        }
+    }
+}
+#endif
+
+static void tws_RunTclEventLoop(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    do {
+        Tcl_DoOneEvent(TCL_ALL_EVENTS);
+        if (dataPtr->terminate && dataPtr->num_conns) {
+            fprintf(stderr, "Draining connections - thread: %p num_conns: %d conn_timeout_millis: %d\n", Tcl_GetCurrentThread(), dataPtr->num_conns, accept_ctx->server->conn_timeout_millis);
+            Tcl_Time block_time = {0, 10000};
+            while (dataPtr->num_conns) {
+                Tcl_DoOneEvent(TCL_DONT_WAIT);
+                Tcl_WaitForEvent(&block_time);
+            }
+        }
+    } while (!dataPtr->terminate);
+}
+
 Tcl_ThreadCreateType tws_HandleConnThread(ClientData clientData) {
 
     tws_thread_ctrl_t *ctrl = (tws_thread_ctrl_t *) clientData;
@@ -875,11 +1439,16 @@ Tcl_ThreadCreateType tws_HandleConnThread(ClientData clientData) {
     dataPtr->server = ctrl->server;
     dataPtr->thread_index = ctrl->thread_index;
     dataPtr->terminate = 0;
-    dataPtr->num_requests = 0;
-    dataPtr->thread_pivot = dataPtr->thread_index * (ctrl->server->garbage_collection_cleanup_threshold / ctrl->server->num_threads);
     dataPtr->num_conns = 0;
+    dataPtr->freeConnPtr = NULL;
+    dataPtr->num_free_conns = 0;
+    dataPtr->conn_pool_hits = 0;
+    dataPtr->conn_pool_misses = 0;
+    tws_InitReadBufferPool(dataPtr, ctrl->server->read_buffer_pool_size);
     dataPtr->firstConnPtr = NULL;
     dataPtr->lastConnPtr = NULL;
+    dataPtr->uring = NULL;
+    tws_InitTimerWheel(&dataPtr->timer_wheel, ctrl->server->garbage_collection_interval_millis, current_time_in_millis());
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
     dataPtr->epoll_fd = kqueue();
 #else
@@ -917,19 +1486,23 @@ Tcl_ThreadCreateType tws_HandleConnThread(ClientData clientData) {
     if (ctrl->option_http) {
         accept_ctx->read_fn = tws_ReadHttpConnAsync;
         accept_ctx->write_fn = tws_WriteHttpConnAsync;
+        accept_ctx->writev_fn = tws_WritevHttpConnAsync;
+        accept_ctx->sendfile_fn = tws_SendFileHttpConnAsync;
         accept_ctx->handle_conn_fn = tws_HandleRecv;
         accept_ctx->ssl_ctx = NULL;
     } else {
 
         accept_ctx->read_fn = tws_ReadSslConnAsync;
         accept_ctx->write_fn = tws_WriteSslConnAsync;
+        accept_ctx->writev_fn = tws_WritevSslConnAsync;
+        accept_ctx->sendfile_fn = tws_SendFileSslConnAsync;
         accept_ctx->handle_conn_fn = tws_HandleSslHandshake;
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
         accept_ctx->ssl_ctx = NULL;
 #else
         // it is an https server, so we need to create an SSL_CTX
-        if (TCL_OK != tws_CreateSslContext(dataPtr->interp, &accept_ctx->ssl_ctx)) {
+        if (TCL_OK != tws_CreateSslContext(dataPtr->interp, ctrl->server, &accept_ctx->ssl_ctx)) {
             ckfree((char *) accept_ctx);
             goto error;
         }
@@ -943,16 +1516,66 @@ Tcl_ThreadCreateType tws_HandleConnThread(ClientData clientData) {
     accept_ctx->server = ctrl->server;
 // todo:    accept_ctx->num_threads = ctrl->option_num_threads;
 
+    accept_ctx->wake_fd = -1;
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    accept_ctx->native_loop = 0;
 #else
     accept_ctx->server_fd = server_fd;
     dataPtr->server_fd = server_fd;
-    Tcl_CreateFileHandler(server_fd, TCL_READABLE, tws_AcceptConn, accept_ctx);
+    accept_ctx->native_loop = ctrl->server->event_loop != TWS_EVENT_LOOP_TCL;
+
+    if (accept_ctx->native_loop && ctrl->server->handshake_pool) {
+        // Tcl_ThreadAlert does not wake up epoll_wait or io_uring_enter, without the eventfd
+        // a conn that a handshake thread gave back would wait for the next tick of the loop
+        accept_ctx->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (accept_ctx->wake_fd < 0) {
+            fprintf(stderr, "failed to create eventfd on thread\n");
+        }
+    }
 
+    if (ctrl->server->event_loop == TWS_EVENT_LOOP_IO_URING) {
+        if (TCL_OK == tws_UringCreate(dataPtr, accept_ctx)) {
+            if (accept_ctx->option_http) {
+                accept_ctx->read_fn = tws_ReadUringConnAsync;
+            }
+        } else {
+            fprintf(stderr, "io_uring is not available, falling back to epoll\n");
+        }
+    }
+
+    if (dataPtr->uring) {
+        // the io_uring event loop accepts conns with its own requests
+    } else if (accept_ctx->native_loop) {
+        // the native event loop waits on the listening socket together with the conns,
+        // a NULL data pointer tells them apart
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(dataPtr->epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+            fprintf(stderr, "failed to add server socket to epoll set on thread\n");
+            if (accept_ctx->wake_fd >= 0) {
+                close(accept_ctx->wake_fd);
+            }
+            ckfree((char *) accept_ctx);
+            goto error;
+        }
+        // the address of the wake_fd tells it apart from the conns
+        if (accept_ctx->wake_fd >= 0) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = &accept_ctx->wake_fd;
+            if (epoll_ctl(dataPtr->epoll_fd, EPOLL_CTL_ADD, accept_ctx->wake_fd, &ev) == -1) {
+                fprintf(stderr, "failed to add eventfd to epoll set on thread\n");
+            }
+        }
+    } else {
+        Tcl_CreateFileHandler(server_fd, TCL_READABLE, tws_AcceptConn, accept_ctx);
+    }
 #endif
 
-    // create a file handler for the epoll fd for this thread
-    Tcl_CreateFileHandler(dataPtr->epoll_fd, TCL_READABLE, tws_KeepaliveConnHandler, NULL);
+    if (!accept_ctx->native_loop) {
+        // create a file handler for the epoll fd for this thread
+        Tcl_CreateFileHandler(dataPtr->epoll_fd, TCL_READABLE, tws_KeepaliveConnHandler, NULL);
+    }
 
     Tcl_Obj *script_ptr = tws_DStringToObj(&ctrl->server->script_ds);
     Tcl_IncrRefCount(script_ptr);
@@ -980,31 +1603,44 @@ Tcl_ThreadCreateType tws_HandleConnThread(ClientData clientData) {
     }
     Tcl_DecrRefCount(script_ptr);
 
+    // the native event loops run the Tcl timers as well, so this drives the timer wheel for all of them
+    dataPtr->timer_wheel.tick_token = Tcl_CreateTimerHandler(dataPtr->timer_wheel.tick_millis, tws_HandleTimerWheelTick, dataPtr);
+
     // notify the main thread that we are done initializing
     Tcl_ConditionNotify(ctrl->cond_wait_ptr);
 
     DBG2(printf("HandleConnThread: in (%p)\n", Tcl_GetCurrentThread()));
-    do {
-        Tcl_DoOneEvent(TCL_ALL_EVENTS);
-        if (dataPtr->terminate && dataPtr->num_conns) {
-            fprintf(stderr, "Draining connections - thread: %p num_conns: %d conn_timeout_millis: %d\n", Tcl_GetCurrentThread(), dataPtr->num_conns, accept_ctx->server->conn_timeout_millis);
-            Tcl_Time block_time = {0, 10000};
-            while (dataPtr->num_conns) {
-                Tcl_DoOneEvent(TCL_DONT_WAIT);
-                Tcl_WaitForEvent(&block_time);
-                tws_CleanupConnections();
-            }
-        }
-    } while (!dataPtr->terminate);
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    tws_RunTclEventLoop(dataPtr, accept_ctx);
+#else
+    if (dataPtr->uring) {
+        tws_RunUringEventLoop(dataPtr, accept_ctx);
+    } else if (accept_ctx->native_loop) {
+        tws_RunNativeEventLoop(dataPtr, accept_ctx);
+    } else {
+        tws_RunTclEventLoop(dataPtr, accept_ctx);
+    }
+#endif
 
     DBG2(printf("exited event loop - thread: %p\n", Tcl_GetCurrentThread()));
 
     // we did not close this in HandleTermEventInThread
     // because we wanted to drain keepalive connections
     close(dataPtr->epoll_fd);
+    Tcl_DeleteTimerHandler(dataPtr->timer_wheel.tick_token);
+    tws_FreeConnPool(dataPtr);
+    tws_FreeReadBufferPool(dataPtr);
+    if (dataPtr->uring) {
+        tws_UringDelete(dataPtr);
+    }
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 #else
+    if (accept_ctx->wake_fd >= 0) {
+        // all the conns of the thread were given back, but a handshake thread may still be writing to the wake_fd
+        tws_SyncHandshakePool(accept_ctx->server->handshake_pool);
+        close(accept_ctx->wake_fd);
+    }
     if (accept_ctx->ssl_ctx) {
         SSL_CTX_free(accept_ctx->ssl_ctx);
     }
@@ -1027,6 +1663,7 @@ Tcl_ThreadCreateType tws_HandleConnThread(ClientData clientData) {
 
 }
 
+
 static void tws_KeepaliveConnHandler(void *data, int mask) {
     UNUSED(data);
     UNUSED(mask);
@@ -1062,22 +1699,18 @@ static void tws_KeepaliveConnHandler(void *data, int mask) {
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
         tws_conn_t *conn = (tws_conn_t *) events[i].udata;
 
-        if (!conn->handle_conn_fn) {
-            conn->handle_conn_fn = tws_HandleRecv;
+        if (events[i].filter == EVFILT_WRITE) {
+            tws_HandleWriteReady(conn);
+            continue;
         }
 
-        tws_ThreadQueueKeepaliveEvent(conn);
-#else
-        tws_conn_t *conn = (tws_conn_t *) events[i].data.ptr;
-        DBG2(printf("KeepaliveConnHandler - keepalive client: %d %s\n", conn->client, conn->handle));
-        conn->start_read_millis = current_time_in_millis();
-        conn->latest_millis = conn->start_read_millis;
-
         if (!conn->handle_conn_fn) {
             conn->handle_conn_fn = tws_HandleRecv;
         }
 
-        tws_QueueProcessEvent(conn);
+        tws_ThreadQueueKeepaliveEvent(conn);
+#else
+        tws_HandleConnReady((tws_conn_t *) events[i].data.ptr);
 #endif
     }
 
@@ -1122,13 +1755,17 @@ int tws_Listen(Tcl_Interp *interp, tws_server_t *server, int option_http, int op
     if (option_http) {
         accept_ctx->read_fn = tws_ReadHttpConnAsync;
         accept_ctx->write_fn = tws_WriteHttpConnAsync;
+        accept_ctx->writev_fn = tws_WritevHttpConnAsync;
+        accept_ctx->sendfile_fn = tws_SendFileHttpConnAsync;
         accept_ctx->handle_conn_fn = tws_HandleRecv;
     } else {
         accept_ctx->read_fn = tws_ReadSslConnAsync;
         accept_ctx->write_fn = tws_WriteSslConnAsync;
+        accept_ctx->writev_fn = tws_WritevSslConnAsync;
+        accept_ctx->sendfile_fn = tws_SendFileSslConnAsync;
         accept_ctx->handle_conn_fn = tws_HandleSslHandshake;
 
-        if (TCL_OK != tws_CreateSslContext(interp, &accept_ctx->ssl_ctx)) {
+        if (TCL_OK != tws_CreateSslContext(interp, server, &accept_ctx->ssl_ctx)) {
             ckfree((char *) accept_ctx);
             SetResult("Failed to create SSL context");
             return TCL_ERROR;
@@ -1142,6 +1779,7 @@ int tws_Listen(Tcl_Interp *interp, tws_server_t *server, int option_http, int op
     accept_ctx->interp = interp;
     accept_ctx->server = server;
     accept_ctx->num_threads = option_num_threads;
+    accept_ctx->native_loop = 0;
 
     accept_ctx->server_fd = server_fd;
     accept_ctx->epoll_fd = epoll_fd;
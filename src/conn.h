@@ -13,9 +13,19 @@
 #include "http.h"
 
 ObjCmdProc(tws_InfoConnCmd);
+ObjCmdProc(tws_InfoConnPoolCmd);
+ObjCmdProc(tws_InfoTlsCmd);
 
 int tws_Listen(Tcl_Interp *interp, tws_server_t *server, int option_http, int option_num_threads, const char *host, const char *port);
 tws_server_t *tws_GetCurrentServer();
 int tws_HandleTermEventInThread(Tcl_Event *evPtr, int flags);
+int tws_HandleHandshakeEventInThread(Tcl_Event *evPtr, int flags);
+int tws_AcceptSsl(tws_conn_t *conn);
+void tws_ReleaseConn(tws_thread_data_t *dataPtr, tws_conn_t *conn);
+void tws_HandleAcceptedConn(tws_accept_ctx_t *accept_ctx, int client, char client_ip[INET6_ADDRSTRLEN]);
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#else
+void tws_HandleConnReady(tws_conn_t *conn);
+#endif
 
 #endif //TWEBSERVER_CONN_H
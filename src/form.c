@@ -7,6 +7,10 @@
 #include "form.h"
 #include "base64.h"
 #include "request.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 
 static int
@@ -71,8 +75,9 @@ tws_AddMultipartFormField(Tcl_Interp *interp, Tcl_Obj *mp_form_fields_ptr, Tcl_O
     return TCL_OK;
 }
 
-static int tws_ParseMultipartEntry(Tcl_Interp *interp, const char *bs, const char *be, Tcl_Obj *mp_form_fields_ptr,
-                                   Tcl_Obj *mp_form_files_ptr, Tcl_Obj *mp_form_multivalue_fields_ptr) {
+static int tws_ParseMultipartEntry(Tcl_Interp *interp, const char *body_file, int binary_files_p, const char *bs,
+                                   const char *be, Tcl_Obj *mp_form_fields_ptr, Tcl_Obj *mp_form_files_ptr,
+                                   Tcl_Obj *mp_form_multivalue_fields_ptr) {
     // look for and parse the "field_name" from the "Content-Disposition" header for this part, e.g.:
     // "field1" from header ```Content-Disposition: form-data; name="field1"```
     // or:
@@ -185,7 +190,25 @@ static int tws_ParseMultipartEntry(Tcl_Interp *interp, const char *bs, const cha
     bs = headers_end;
 
     Tcl_Obj *field_value_ptr = NULL;
-    if (filename_length > 0) {
+    if (filename_length > 0 && body_file) {
+        // the file stays where it is in the body file, as its offset and length
+        Tcl_Obj *range_objv[2] = {Tcl_NewWideIntObj(bs - body_file), Tcl_NewWideIntObj(be - bs)};
+        if (TCL_OK != Tcl_DictObjPut(interp, mp_form_files_ptr, Tcl_NewStringObj(filename, filename_length),
+                                     Tcl_NewListObj(2, range_objv))) {
+            SetResult("tws_ParseMultipartForm: multipart/form-data dict write error");
+            return TCL_ERROR;
+        }
+        field_value_ptr = Tcl_NewStringObj(filename, filename_length);
+    } else if (filename_length > 0 && binary_files_p) {
+        if (be > bs) {
+            if (TCL_OK != Tcl_DictObjPut(interp, mp_form_files_ptr, Tcl_NewStringObj(filename, filename_length),
+                                         Tcl_NewByteArrayObj((const unsigned char *) bs, be - bs))) {
+                SetResult("tws_ParseMultipartForm: multipart/form-data dict write error");
+                return TCL_ERROR;
+            }
+        }
+        field_value_ptr = Tcl_NewStringObj(filename, filename_length);
+    } else if (filename_length > 0) {
         Tcl_Size block_length = be - bs;
         if (block_length > 0) {
             char *block_body = ckalloc(block_length * 2);
@@ -226,9 +249,13 @@ static int tws_ParseMultipartEntry(Tcl_Interp *interp, const char *bs, const cha
     return TCL_OK;
 }
 
+// Parses a multipart/form-data body into "fields", "multiValueFields" and "files". The files
+// are base64 encoded, or byte arrays with binary_files_p. Where the body is the mapped body
+// file of the request, the files are left in it and "fileRanges" has the offset and the
+// length of each one instead.
 static int
-tws_ParseMultipartForm(Tcl_Interp *interp, const char *body, int body_length, Tcl_Obj *multipart_boundary_ptr,
-                       Tcl_Obj *resultPtr) {
+tws_ParseMultipartForm(Tcl_Interp *interp, const char *body, Tcl_Size body_length, int body_file_p,
+                       int binary_files_p, Tcl_Obj *multipart_boundary_ptr, Tcl_Obj *resultPtr) {
 
     const char *end = body + body_length;
 
@@ -288,7 +315,8 @@ tws_ParseMultipartForm(Tcl_Interp *interp, const char *body, int body_length, Tc
             break;
         }
 
-        if (TCL_OK != tws_ParseMultipartEntry(interp, bs, be, mp_form_fields_ptr, mp_form_files_ptr,
+        if (TCL_OK != tws_ParseMultipartEntry(interp, body_file_p ? body : NULL, binary_files_p, bs, be,
+                                              mp_form_fields_ptr, mp_form_files_ptr,
                                               mp_form_multivalue_fields_ptr)) {
             Tcl_DecrRefCount(mp_form_multivalue_fields_ptr);
             Tcl_DecrRefCount(mp_form_fields_ptr);
@@ -300,6 +328,11 @@ tws_ParseMultipartForm(Tcl_Interp *interp, const char *body, int body_length, Tc
         bs = next_bs;
         bs += boundary_length + 2;
 
+        // the closing boundary is followed by "--"
+        if (bs + 1 < end && bs[0] == '-' && bs[1] == '-') {
+            break;
+        }
+
         // skip "\r\n" or "\n"
         if (bs + 1 < end && *bs == '\r' && *(bs + 1) == '\n') {
             bs += 2;
@@ -334,7 +367,17 @@ tws_ParseMultipartForm(Tcl_Interp *interp, const char *body, int body_length, Tc
     }
     Tcl_DecrRefCount(mp_form_multivalue_fields_key_ptr);
 
-    Tcl_Obj *mp_form_files_key_ptr = Tcl_NewStringObj("files", -1);
+    if (body_file_p) {
+        if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("files", -1), Tcl_NewDictObj())) {
+            Tcl_DecrRefCount(mp_form_multivalue_fields_ptr);
+            Tcl_DecrRefCount(mp_form_fields_ptr);
+            Tcl_DecrRefCount(mp_form_files_ptr);
+            SetResult("tws_ParseMultipartForm: multipart form dict write error (files)");
+            return TCL_ERROR;
+        }
+    }
+
+    Tcl_Obj *mp_form_files_key_ptr = Tcl_NewStringObj(body_file_p ? "fileRanges" : "files", -1);
     Tcl_IncrRefCount(mp_form_files_key_ptr);
     if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, mp_form_files_key_ptr, mp_form_files_ptr)) {
         Tcl_DecrRefCount(mp_form_multivalue_fields_ptr);
@@ -436,12 +479,9 @@ tws_AddUrlEncodedFormField(Tcl_Interp *interp, Tcl_Obj *fields_ptr, Tcl_Obj *mul
     return TCL_OK;
 }
 
-static int tws_ParseUrlEncodedForm(Tcl_Interp *interp, Tcl_Obj *body_ptr, Tcl_Obj *result_ptr) {
+static int tws_ParseUrlEncodedForm(Tcl_Interp *interp, const char *body, Tcl_Size body_length, Tcl_Obj *result_ptr) {
     DBG2(printf("ParseUrlEncodedForm\n"));
 
-    Tcl_Size body_length;
-    const char *body = Tcl_GetStringFromObj(body_ptr, &body_length);
-
     Tcl_Obj *fields_ptr = Tcl_NewDictObj();
     Tcl_IncrRefCount(fields_ptr);
     Tcl_Obj *multivalue_fields_ptr = Tcl_NewDictObj();
@@ -500,6 +540,40 @@ static int tws_ParseUrlEncodedForm(Tcl_Interp *interp, Tcl_Obj *body_ptr, Tcl_Ob
     return TCL_OK;
 }
 
+// maps the body file of a request, see body_file_min_length, so that the form is parsed in place
+static int tws_MapBodyFile(Tcl_Interp *interp, Tcl_Obj *body_file_ptr, const char **body_ptr, Tcl_Size *body_length_ptr) {
+    int fd = open(Tcl_GetString(body_file_ptr), O_RDONLY);
+    if (fd == -1) {
+        SetResult("get_form: error opening body file");
+        return TCL_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        SetResult("get_form: error reading body file");
+        return TCL_ERROR;
+    }
+    *body_ptr = "";
+    *body_length_ptr = st.st_size;
+    if (st.st_size > 0) {
+        void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            SetResult("get_form: error mapping body file");
+            return TCL_ERROR;
+        }
+        *body_ptr = addr;
+    }
+    close(fd);
+    return TCL_OK;
+}
+
+static void tws_UnmapBodyFile(const char *body, Tcl_Size body_length) {
+    if (body_length > 0) {
+        munmap((void *) body, body_length);
+    }
+}
+
 int tws_GetFormCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
     UNUSED(clientData);
 
@@ -533,30 +607,87 @@ int tws_GetFormCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
     }
     Tcl_DecrRefCount(multipart_boundary_key_ptr);
 
+    Tcl_Obj *body_file_ptr = NULL;
+    Tcl_Obj *body_file_key_ptr = Tcl_NewStringObj("bodyFile", -1);
+    Tcl_IncrRefCount(body_file_key_ptr);
+    if (TCL_OK != Tcl_DictObjGet(interp, objv[1], body_file_key_ptr, &body_file_ptr)) {
+        Tcl_DecrRefCount(body_file_key_ptr);
+        SetResult("get_form: error reading bodyFile from request dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(body_file_key_ptr);
+
+    int is_binary = 0;
+    Tcl_Obj *is_binary_ptr = NULL;
+    Tcl_Obj *is_binary_key_ptr = Tcl_NewStringObj("isBinary", -1);
+    Tcl_IncrRefCount(is_binary_key_ptr);
+    if (TCL_OK != Tcl_DictObjGet(interp, objv[1], is_binary_key_ptr, &is_binary_ptr)) {
+        Tcl_DecrRefCount(is_binary_key_ptr);
+        SetResult("get_form: error reading isBinary from request dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(is_binary_key_ptr);
+    if (is_binary_ptr && TCL_OK != Tcl_GetBooleanFromObj(interp, is_binary_ptr, &is_binary)) {
+        SetResult("get_form: isBinary must be a boolean");
+        return TCL_ERROR;
+    }
+
     Tcl_Obj *result_ptr = Tcl_NewDictObj();
     Tcl_IncrRefCount(result_ptr);
     if (multipart_boundary_ptr) {
         DBG2(printf("multipart form data with boundary=%s\n", Tcl_GetString(multipart_boundary_ptr)));
 
-        Tcl_Size body_b64_length;
-        const char *body_b64 = Tcl_GetStringFromObj(body_ptr, &body_b64_length);
+        // the body is base64 encoded, unless it is still the raw one that the request came with,
+        // a byte array or it was written to the body file
+        const char *raw_body;
+        Tcl_Size raw_body_length;
+        if (body_file_ptr) {
+            if (TCL_OK != tws_MapBodyFile(interp, body_file_ptr, &raw_body, &raw_body_length)) {
+                Tcl_DecrRefCount(result_ptr);
+                return TCL_ERROR;
+            }
+            if (TCL_OK != tws_ParseMultipartForm(interp, raw_body, raw_body_length, 1, 0, multipart_boundary_ptr, result_ptr)) {
+                tws_UnmapBodyFile(raw_body, raw_body_length);
+                Tcl_DecrRefCount(result_ptr);
+                SetResult("get_form: error parsing multipart form data");
+                return TCL_ERROR;
+            }
+            tws_UnmapBodyFile(raw_body, raw_body_length);
+        } else if (is_binary) {
+            // the files are byte arrays, too
+            raw_body = (const char *) Tcl_GetByteArrayFromObj(body_ptr, &raw_body_length);
+            if (TCL_OK != tws_ParseMultipartForm(interp, raw_body, raw_body_length, 0, 1, multipart_boundary_ptr, result_ptr)) {
+                Tcl_DecrRefCount(result_ptr);
+                SetResult("get_form: error parsing multipart form data");
+                return TCL_ERROR;
+            }
+        } else if (tws_GetRawRequestBody(body_ptr, &raw_body, &raw_body_length)) {
+            if (TCL_OK != tws_ParseMultipartForm(interp, raw_body, raw_body_length, 0, 0, multipart_boundary_ptr, result_ptr)) {
+                Tcl_DecrRefCount(result_ptr);
+                SetResult("get_form: error parsing multipart form data");
+                return TCL_ERROR;
+            }
+        } else {
+            Tcl_Size body_b64_length;
+            const char *body_b64 = Tcl_GetStringFromObj(body_ptr, &body_b64_length);
 
-        char *body = ckalloc(3 * body_b64_length / 4 + 2);
-        Tcl_Size body_length;
-        if (base64_decode(body_b64, body_b64_length, body, &body_length)) {
-            Tcl_DecrRefCount(result_ptr);
-            ckfree(body);
-            SetResult("base64_decode failed");
-            return TCL_ERROR;
-        }
+            char *body = ckalloc(3 * body_b64_length / 4 + 2);
+            Tcl_Size body_length;
+            if (base64_decode(body_b64, body_b64_length, body, &body_length)) {
+                Tcl_DecrRefCount(result_ptr);
+                ckfree(body);
+                SetResult("base64_decode failed");
+                return TCL_ERROR;
+            }
 
-        if (TCL_OK != tws_ParseMultipartForm(interp, body, body_length, multipart_boundary_ptr, result_ptr)) {
-            Tcl_DecrRefCount(result_ptr);
+            if (TCL_OK != tws_ParseMultipartForm(interp, body, body_length, 0, 0, multipart_boundary_ptr, result_ptr)) {
+                Tcl_DecrRefCount(result_ptr);
+                ckfree(body);
+                SetResult("get_form: error parsing multipart form data");
+                return TCL_ERROR;
+            }
             ckfree(body);
-            SetResult("get_form: error parsing multipart form data");
-            return TCL_ERROR;
         }
-        ckfree(body);
     } else {
         // check if "content-type" is "application/x-form-urlencoded"
 
@@ -592,7 +723,21 @@ int tws_GetFormCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
                 if (content_type_length >= 33 && strncmp(content_type, "application/x-www-form-urlencoded", 33) == 0) {
 
                     // parse urlencoded form data
-                    if (TCL_OK != tws_ParseUrlEncodedForm(interp, body_ptr, result_ptr)) {
+                    const char *body;
+                    Tcl_Size body_length;
+                    if (body_file_ptr) {
+                        if (TCL_OK != tws_MapBodyFile(interp, body_file_ptr, &body, &body_length)) {
+                            Tcl_DecrRefCount(result_ptr);
+                            return TCL_ERROR;
+                        }
+                    } else {
+                        body = Tcl_GetStringFromObj(body_ptr, &body_length);
+                    }
+                    int rc = tws_ParseUrlEncodedForm(interp, body, body_length, result_ptr);
+                    if (body_file_ptr) {
+                        tws_UnmapBodyFile(body, body_length);
+                    }
+                    if (TCL_OK != rc) {
                         fprintf(stderr, "get_form: error parsing urlencoded form data\n");
                         Tcl_DecrRefCount(result_ptr);
                         return TCL_ERROR;
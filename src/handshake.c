@@ -0,0 +1,287 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "handshake.h"
+#include "conn.h"
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+
+// The tls handshakes of a server with tls_handshake_threads run on threads of their own, so
+// that the public key operations of a burst of new conns do not hold up the requests of the
+// conns that the conn threads already serve. A conn thread queues a new conn to one of the
+// handshake threads in turn and does not touch it until the handshake thread gives it back
+// with a Tcl event, once the handshake is done, failed or ran out of the read timeout. The
+// epoll and io_uring event loops of the conn threads also wait on an eventfd for these events.
+// A handshake thread waits with poll on the sockets of its conns and on a pipe that wakes
+// it up when a conn is queued to it.
+
+#define TWS_HANDSHAKE_POLL_MAX_MILLIS 1000
+
+typedef struct {
+    tws_server_t *server;
+    Tcl_ThreadId thread_id;
+    Tcl_Mutex mutex;
+    // the conns that were queued to the thread, linked with handshakeNextPtr
+    tws_conn_t *firstQueuedPtr;
+    tws_conn_t *lastQueuedPtr;
+    int terminate;
+    int wake_fds[2];
+} tws_handshake_thread_t;
+
+struct tws_handshake_pool_s {
+    tws_server_t *server;
+    int num_threads;
+    unsigned int next_thread_index;
+    tws_handshake_thread_t *threads;
+};
+
+static void tws_WakeHandshakeThread(tws_handshake_thread_t *thread) {
+    // the pipe is non-blocking, when it is full the thread is awake anyway
+    char c = 0;
+    if (write(thread->wake_fds[1], &c, 1) < 0) {
+        DBG2(printf("WakeHandshakeThread: pipe full\n"));
+    }
+}
+
+// this is called from the conn thread that owns the conn
+void tws_QueueHandshake(tws_handshake_pool_t *pool, tws_conn_t *conn) {
+    unsigned int index = __atomic_fetch_add(&pool->next_thread_index, 1, __ATOMIC_RELAXED);
+    tws_handshake_thread_t *thread = &pool->threads[index % pool->num_threads];
+
+    conn->handshake_offloaded = 1;
+    conn->handshakeNextPtr = NULL;
+    conn->handshake_queued_micros = current_time_in_micros();
+    __atomic_add_fetch(&pool->server->tls_handshake_queue_depth, 1, __ATOMIC_RELAXED);
+
+    Tcl_MutexLock(&thread->mutex);
+    int wake_p = thread->firstQueuedPtr == NULL;
+    if (wake_p) {
+        thread->firstQueuedPtr = conn;
+    } else {
+        thread->lastQueuedPtr->handshakeNextPtr = conn;
+    }
+    thread->lastQueuedPtr = conn;
+    Tcl_MutexUnlock(&thread->mutex);
+
+    // the thread takes all the queued conns at once, so only the first one wakes it up
+    if (wake_p) {
+        tws_WakeHandshakeThread(thread);
+    }
+}
+
+static void tws_GiveBackConn(tws_handshake_thread_t *thread, tws_conn_t *conn, int result) {
+    DBG2(printf("GiveBackConn: %s result: %d\n", conn->handle, result));
+    tws_server_t *server = thread->server;
+    conn->handshake_result = result;
+    __atomic_sub_fetch(&server->tls_handshake_queue_depth, 1, __ATOMIC_RELAXED);
+    if (result == TWS_HANDSHAKE_DONE) {
+        __atomic_add_fetch(&server->tls_offloaded_handshakes, 1, __ATOMIC_RELAXED);
+    }
+
+    // the conn thread may free the conn as soon as the event is queued
+    Tcl_ThreadId thread_id = conn->threadId;
+    int wake_fd = conn->accept_ctx->wake_fd;
+
+    tws_event_t *connEvPtr = (tws_event_t *) ckalloc(sizeof(tws_event_t));
+    connEvPtr->proc = tws_HandleHandshakeEventInThread;
+    connEvPtr->nextPtr = NULL;
+    connEvPtr->clientData = (ClientData *) conn;
+
+    // the mutex keeps the wake_fd open until the write is done, see tws_SyncHandshakePool
+    Tcl_MutexLock(&thread->mutex);
+    Tcl_ThreadQueueEvent(thread_id, (Tcl_Event *) connEvPtr, TCL_QUEUE_TAIL);
+    // the alert wakes up the Tcl event loop, the native event loops wait on their wake_fd instead
+    Tcl_ThreadAlert(thread_id);
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            DBG2(printf("GiveBackConn: wake_fd write failed\n"));
+        }
+    }
+    Tcl_MutexUnlock(&thread->mutex);
+}
+
+static Tcl_ThreadCreateType tws_HandshakeThread(ClientData clientData) {
+    tws_handshake_thread_t *thread = (tws_handshake_thread_t *) clientData;
+    tws_server_t *server = thread->server;
+
+    // the conns that the thread has, the first pollfd is the wake up pipe
+    int num_conns = 0;
+    int max_conns = 16;
+    tws_conn_t **conns = (tws_conn_t **) ckalloc(max_conns * sizeof(tws_conn_t *));
+    struct pollfd *pollfds = (struct pollfd *) ckalloc((max_conns + 1) * sizeof(struct pollfd));
+    pollfds[0].fd = thread->wake_fds[0];
+    pollfds[0].events = POLLIN;
+
+    for (;;) {
+        Tcl_MutexLock(&thread->mutex);
+        tws_conn_t *conn = thread->firstQueuedPtr;
+        thread->firstQueuedPtr = NULL;
+        thread->lastQueuedPtr = NULL;
+        int terminate = thread->terminate;
+        Tcl_MutexUnlock(&thread->mutex);
+
+        // the conn threads have already given back their conns when the pool is stopped
+        if (terminate && conn == NULL && num_conns == 0) {
+            break;
+        }
+
+        long long now_micros = current_time_in_micros();
+        while (conn) {
+            tws_conn_t *next_conn = conn->handshakeNextPtr;
+            __atomic_add_fetch(&server->tls_handshake_queue_wait_micros, now_micros - conn->handshake_queued_micros, __ATOMIC_RELAXED);
+            if (num_conns == max_conns) {
+                max_conns *= 2;
+                conns = (tws_conn_t **) ckrealloc((char *) conns, max_conns * sizeof(tws_conn_t *));
+                pollfds = (struct pollfd *) ckrealloc((char *) pollfds, (max_conns + 1) * sizeof(struct pollfd));
+            }
+            conns[num_conns] = conn;
+            // a conn that was just queued has no socket to wait on yet, its handshake is run right away
+            pollfds[num_conns + 1].fd = -1;
+            pollfds[num_conns + 1].revents = 0;
+            num_conns++;
+            conn = next_conn;
+        }
+
+        long long now_millis = now_micros / 1000;
+        int timeout_millis = -1;
+        for (int i = 0; i < num_conns;) {
+            struct pollfd *pollfd = &pollfds[i + 1];
+            conn = conns[i];
+            long long remaining_millis = conn->start_read_millis + server->read_timeout_millis - now_millis;
+
+            int result;
+            if (pollfd->fd < 0 || pollfd->revents) {
+                result = tws_AcceptSsl(conn);
+            } else if (remaining_millis < 0) {
+                DBG2(printf("HandshakeThread: read timeout: %s\n", conn->handle));
+                result = TWS_HANDSHAKE_FAILED;
+            } else {
+                result = pollfd->events == POLLOUT ? TWS_HANDSHAKE_WANT_WRITE : TWS_HANDSHAKE_WANT_READ;
+            }
+
+            if (result == TWS_HANDSHAKE_DONE || result == TWS_HANDSHAKE_FAILED) {
+                tws_GiveBackConn(thread, conn, result);
+                num_conns--;
+                conns[i] = conns[num_conns];
+                pollfds[i + 1] = pollfds[num_conns + 1];
+                continue;
+            }
+
+            pollfd->fd = conn->client;
+            pollfd->events = result == TWS_HANDSHAKE_WANT_WRITE ? POLLOUT : POLLIN;
+            pollfd->revents = 0;
+            if (remaining_millis < 0) {
+                remaining_millis = 0;
+            }
+            if (timeout_millis < 0 || remaining_millis < timeout_millis) {
+                timeout_millis = (int) MIN(remaining_millis + 1, TWS_HANDSHAKE_POLL_MAX_MILLIS);
+            }
+            i++;
+        }
+
+        pollfds[0].revents = 0;
+        if (poll(pollfds, num_conns + 1, timeout_millis) < 0 && errno != EINTR) {
+            fprintf(stderr, "HandshakeThread: poll failed\n");
+        }
+
+        if (pollfds[0].revents) {
+            char buf[64];
+            while (read(thread->wake_fds[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+    }
+
+    ckfree((char *) conns);
+    ckfree((char *) pollfds);
+
+    Tcl_ExitThread(TCL_OK);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+// a conn thread that has no conns left calls this before it closes its wake_fd,
+// once it has every mutex in turn no handshake thread is still waking it up
+void tws_SyncHandshakePool(tws_handshake_pool_t *pool) {
+    for (int i = 0; i < pool->num_threads; i++) {
+        Tcl_MutexLock(&pool->threads[i].mutex);
+        Tcl_MutexUnlock(&pool->threads[i].mutex);
+    }
+}
+
+static void tws_StopHandshakeThreads(tws_handshake_pool_t *pool, int num_threads) {
+    for (int i = 0; i < num_threads; i++) {
+        tws_handshake_thread_t *thread = &pool->threads[i];
+        Tcl_MutexLock(&thread->mutex);
+        thread->terminate = 1;
+        Tcl_MutexUnlock(&thread->mutex);
+        tws_WakeHandshakeThread(thread);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        tws_handshake_thread_t *thread = &pool->threads[i];
+        if (TCL_OK != Tcl_JoinThread(thread->thread_id, NULL)) {
+            fprintf(stderr, "Error joining handshake thread %p\n", (void *) thread->thread_id);
+        }
+    }
+}
+
+static void tws_FreeHandshakeThreads(tws_handshake_pool_t *pool) {
+    for (int i = 0; i < pool->num_threads; i++) {
+        tws_handshake_thread_t *thread = &pool->threads[i];
+        if (thread->wake_fds[0] >= 0) {
+            close(thread->wake_fds[0]);
+            close(thread->wake_fds[1]);
+        }
+        Tcl_MutexFinalize(&thread->mutex);
+    }
+    ckfree((char *) pool->threads);
+    ckfree((char *) pool);
+}
+
+tws_handshake_pool_t *tws_NewHandshakePool(tws_server_t *server) {
+    tws_handshake_pool_t *pool = (tws_handshake_pool_t *) ckalloc(sizeof(tws_handshake_pool_t));
+    pool->server = server;
+    pool->num_threads = server->tls_handshake_threads;
+    pool->next_thread_index = 0;
+    pool->threads = (tws_handshake_thread_t *) ckalloc(pool->num_threads * sizeof(tws_handshake_thread_t));
+    memset(pool->threads, 0, pool->num_threads * sizeof(tws_handshake_thread_t));
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        pool->threads[i].server = server;
+        pool->threads[i].wake_fds[0] = -1;
+    }
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        tws_handshake_thread_t *thread = &pool->threads[i];
+        if (pipe(thread->wake_fds) < 0) {
+            fprintf(stderr, "NewHandshakePool: unable to create pipe\n");
+            thread->wake_fds[0] = -1;
+            tws_FreeHandshakeThreads(pool);
+            return NULL;
+        }
+        fcntl(thread->wake_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(thread->wake_fds[1], F_SETFL, O_NONBLOCK);
+    }
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        tws_handshake_thread_t *thread = &pool->threads[i];
+        if (TCL_OK != Tcl_CreateThread(&thread->thread_id, tws_HandshakeThread, thread, server->thread_stacksize, TCL_THREAD_JOINABLE)) {
+            fprintf(stderr, "NewHandshakePool: unable to create thread\n");
+            tws_StopHandshakeThreads(pool, i);
+            tws_FreeHandshakeThreads(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+// this is called once the conn threads of the server have exited
+void tws_FreeHandshakePool(tws_handshake_pool_t *pool) {
+    tws_StopHandshakeThreads(pool, pool->num_threads);
+    tws_FreeHandshakeThreads(pool);
+}
@@ -0,0 +1,17 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_HANDSHAKE_H
+#define TWEBSERVER_HANDSHAKE_H
+
+#include "common.h"
+
+tws_handshake_pool_t *tws_NewHandshakePool(tws_server_t *server);
+void tws_FreeHandshakePool(tws_handshake_pool_t *pool);
+void tws_QueueHandshake(tws_handshake_pool_t *pool, tws_conn_t *conn);
+void tws_SyncHandshakePool(tws_handshake_pool_t *pool);
+
+#endif //TWEBSERVER_HANDSHAKE_H
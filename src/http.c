@@ -5,47 +5,55 @@
  */
 
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "http.h"
+#include "buffer.h"
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+// the head of a response with a file body is held back until the file body follows
+#define TWS_SEND_MORE_FLAG MSG_MORE
+#else
+#define TWS_SEND_MORE_FLAG 0
+#endif
 
 int tws_ReadHttpConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
     long max_request_read_bytes = conn->accept_ctx->server->max_request_read_bytes - Tcl_DStringLength(&conn->inout_ds);
     Tcl_Size max_buffer_size =
             size == 0 ? conn->accept_ctx->server->max_read_buffer_size : MIN(size, conn->accept_ctx->server->max_read_buffer_size);
 
-    char *buf = (char *) ckalloc(max_buffer_size);
     Tcl_Size total_read = 0;
     Tcl_Size bytes_read = 0;
 
     ssize_t rc;
     for (;;) {
-        rc = read(conn->client, buf, max_buffer_size);
+        Tcl_Size avail;
+        // never read past the bytes asked for, they belong to the next request
+        char *buf = tws_ReserveReadSpace(dsPtr, size == 0 ? max_buffer_size : MIN(max_buffer_size, size - total_read), &avail);
+        rc = read(conn->client, buf, avail);
 
         if (rc > 0) {
             bytes_read = rc;
             total_read += bytes_read;
+            Tcl_DStringSetLength(dsPtr, Tcl_DStringLength(dsPtr) + bytes_read);
             if (total_read > max_request_read_bytes) {
-                ckfree(buf);
                 return TWS_ERROR;
             }
-            Tcl_DStringAppend(dsPtr, buf, bytes_read);
             if (total_read == size) {
-                ckfree(buf);
                 return TWS_DONE;
             }
 
         } else {
             if (rc == 0) {
                 DBG2(printf("peer closed connection %d\n", conn->client));
-                ckfree(buf);
 //                conn->shutdown = 1;
                 return TWS_DONE;
             } else {
                 if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    ckfree(buf);
                     return TWS_AGAIN;
                 } else {
                     DBG2(printf("read error: %d\n", conn->client));
-                    ckfree(buf);
                     return TWS_ERROR;
                 }
             }
@@ -74,4 +82,81 @@ int tws_WriteHttpConnAsync(tws_conn_t *conn, const char *buf, Tcl_Size len) {
             }
         }
     }
-}
\ No newline at end of file
+}
+// Writes the rest of inout_ds and the body of the conn together with writev, write_offset
+// counts the bytes of both.
+int tws_WritevHttpConnAsync(tws_conn_t *conn) {
+    Tcl_Size head_length = Tcl_DStringLength(&conn->inout_ds);
+    for (;;) {
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (conn->write_offset < head_length) {
+            iov[iovcnt].iov_base = Tcl_DStringValue(&conn->inout_ds) + conn->write_offset;
+            iov[iovcnt].iov_len = head_length - conn->write_offset;
+            iovcnt++;
+        }
+        Tcl_Size body_offset = conn->write_offset < head_length ? 0 : conn->write_offset - head_length;
+        if (body_offset < conn->body_length) {
+            iov[iovcnt].iov_base = (char *) conn->body + body_offset;
+            iov[iovcnt].iov_len = conn->body_length - body_offset;
+            iovcnt++;
+        }
+        if (iovcnt == 0) {
+            return TWS_DONE;
+        }
+
+        ssize_t rc = writev(conn->client, iov, iovcnt);
+        if (rc > 0) {
+            conn->write_offset += rc;
+        } else if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return TWS_AGAIN;
+        } else if (rc == -1 && errno != EINTR) {
+            return TWS_ERROR;
+        }
+    }
+}
+
+// Writes the head of the response with MSG_MORE, so that it leaves in the same segment
+// as the start of the file body, and then sends the file body with sendfile(2) without
+// copying it through user space. Where sendfile is not available, the file body goes
+// through inout_ds in chunks.
+int tws_SendFileHttpConnAsync(tws_conn_t *conn) {
+    for (;;) {
+        Tcl_Size length = Tcl_DStringLength(&conn->inout_ds);
+        int flags = conn->file_offset < conn->file_length ? TWS_SEND_MORE_FLAG : 0;
+        while (conn->write_offset < length) {
+            ssize_t rc = send(conn->client, Tcl_DStringValue(&conn->inout_ds) + conn->write_offset,
+                              length - conn->write_offset, flags);
+            if (rc > 0) {
+                conn->write_offset += rc;
+            } else if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return TWS_AGAIN;
+            } else if (rc == -1 && errno != EINTR) {
+                return TWS_ERROR;
+            }
+        }
+
+        if (conn->file_offset == conn->file_length) {
+            return TWS_DONE;
+        }
+
+#ifdef __linux__
+        ssize_t rc = sendfile(conn->client, conn->file_fd, &conn->file_offset,
+                              conn->file_length - conn->file_offset);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return TWS_AGAIN;
+            } else if (errno != EINTR) {
+                return TWS_ERROR;
+            }
+        } else if (rc == 0) {
+            // the file was truncated after its length was sent
+            return TWS_ERROR;
+        }
+#else
+        if (TWS_DONE != tws_ReadFileChunk(conn)) {
+            return TWS_ERROR;
+        }
+#endif
+    }
+}
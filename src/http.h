@@ -12,5 +12,7 @@
 
 int tws_ReadHttpConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size);
 int tws_WriteHttpConnAsync(tws_conn_t *conn, const char *buf, Tcl_Size len);
+int tws_WritevHttpConnAsync(tws_conn_t *conn);
+int tws_SendFileHttpConnAsync(tws_conn_t *conn);
 
 #endif //TWEBSERVER_HTTP_H
@@ -5,6 +5,9 @@
  */
 
 #include "https.h"
+#include "buffer.h"
+#include "session.h"
+#include "sni.h"
 
 // ClientHello callback
 int tws_ClientHelloCallback(SSL *ssl, int *al, void *arg) {
@@ -41,21 +44,21 @@ int tws_ClientHelloCallback(SSL *ssl, int *al, void *arg) {
         DBG2(printf("extension_data is null in clienthello callback\n"));
         goto abort;
     }
-    extension_len = len;
-    int servername_len = len;
-    const char *servername = (const char *) p;
-    // "extension_data" is not null-terminated, so we need to copy it to a new buffer
     DBG2(printf("servername=%.*s\n", (int) len, p));
 
-    SSL_CTX *ctx = tws_GetInternalFromHostName(servername);
-    if (!ctx) {
+    // the lookup takes no lock, see sni.c
+    SSL_CTX *ctx;
+    int verify_mode;
+    if (!tws_GetHostName((const char *) p, (Tcl_Size) len, &ctx, &verify_mode)) {
         DBG2(printf("servername not found in clienthello callback\n"));
         goto abort;
     }
 
-    SSL_set_verify(ssl, SSL_CTX_get_verify_mode(ctx), NULL);
-    SSL_set_client_CA_list(ssl, SSL_dup_CA_list(SSL_CTX_get_client_CA_list(ctx)));
+    // the client CA list was set on the context when it was added, the conn gets it from the context
+    SSL_set_verify(ssl, verify_mode, NULL);
+    // the conn takes a reference of its own to the context
     SSL_set_SSL_CTX(ssl, ctx);
+    SSL_CTX_free(ctx);
 
     return SSL_CLIENT_HELLO_SUCCESS;
 
@@ -65,7 +68,7 @@ int tws_ClientHelloCallback(SSL *ssl, int *al, void *arg) {
 }
 
 
-int tws_CreateSslContext(Tcl_Interp *interp, SSL_CTX **sslCtx) {
+int tws_CreateSslContext(Tcl_Interp *interp, tws_server_t *server, SSL_CTX **sslCtx) {
     SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
     if (!ctx) {
         SetResult("Unable to create SSL context");
@@ -77,11 +80,32 @@ int tws_CreateSslContext(Tcl_Interp *interp, SSL_CTX **sslCtx) {
     op |= SSL_OP_NO_SSLv3;
     op |= SSL_OP_NO_TLSv1;
     op |= SSL_OP_NO_TLSv1_1;
+    // SSL_write of a tls 1.2 conn that renegotiates wants to read, while the conn only waits
+    // for the socket to become writable, see tws_WriteSslConnAsync
+    op |= SSL_OP_NO_RENEGOTIATION;
+    if (server->ktls) {
+        // openssl hands the keys to the kernel after the handshake if both support the cipher,
+        // see tws_HandleSslHandshake for whether they did
+        op |= SSL_OP_ENABLE_KTLS;
+    }
     SSL_CTX_set_options(ctx, op);
 
     SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
     SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION);
     SSL_CTX_set_read_ahead(ctx, 1);
+    // a streamed response appends to inout_ds, which may move it, while a write waits to be retried
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (server->tls_max_early_data > 0) {
+        // openssl would make the tickets single use in its internal session cache for
+        // anti-replay, which the server does not use, tws_AllowEarlyDataCallback keeps
+        // a window of the ClientHellos with early data instead
+        SSL_CTX_set_max_early_data(ctx, server->tls_max_early_data);
+        SSL_CTX_set_recv_max_early_data(ctx, server->tls_max_early_data);
+        SSL_CTX_set_options(ctx, SSL_OP_NO_ANTI_REPLAY);
+        SSL_CTX_set_allow_early_data_cb(ctx, tws_AllowEarlyDataCallback, NULL);
+    }
+    // the sessions and the ticket keys are shared by all the conn threads of the server
+    tws_InstallSessionCache(server, ctx);
 
     *sslCtx = ctx;
     return TCL_OK;
@@ -109,7 +133,6 @@ int tws_ReadSslConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
     int max_buffer_size = MIN(INT_MAX,
             size == 0 ? conn->accept_ctx->server->max_read_buffer_size : MIN(size, conn->accept_ctx->server->max_read_buffer_size));
 
-    char *buf = (char *) ckalloc(max_buffer_size);
     long total_read = 0;
     int rc;
     int bytes_read;
@@ -124,14 +147,29 @@ int tws_ReadSslConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
     DBG2(printf("max_buffer_size = %ld\n", max_buffer_size));
 
     for (;;) {
-        rc = SSL_read(conn->ssl, buf, max_buffer_size);
+        Tcl_Size avail;
+        // never read past the bytes asked for, they belong to the next request
+        char *buf = tws_ReserveReadSpace(dsPtr, size == 0 ? max_buffer_size : MIN(max_buffer_size, size - total_read), &avail);
+        if (conn->early_data_state == TWS_EARLY_DATA_READING) {
+            // the client has not finished the handshake yet, see tws_ReadEarlyData
+            size_t early_bytes_read = 0;
+            rc = SSL_read_early_data(conn->ssl, buf, avail, &early_bytes_read);
+            if (rc == SSL_READ_EARLY_DATA_FINISH) {
+                // SSL_read completes the handshake before it returns what comes after the early data
+                conn->early_data_state = TWS_EARLY_DATA_NONE;
+                continue;
+            }
+            rc = rc == SSL_READ_EARLY_DATA_SUCCESS ? (int) early_bytes_read : -1;
+        } else {
+            rc = SSL_read(conn->ssl, buf, (int) avail);
+        }
         if (rc > 0) {
             bytes_read = rc;
             total_read += bytes_read;
+            Tcl_DStringSetLength(dsPtr, Tcl_DStringLength(dsPtr) + bytes_read);
             if (total_read > max_request_read_bytes) {
                 goto failed_due_to_request_too_large;
             }
-            Tcl_DStringAppend(dsPtr, buf, bytes_read);
             if (total_read < size) {
                 continue;
             }
@@ -142,7 +180,6 @@ int tws_ReadSslConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
             int err = SSL_get_error(conn->ssl, rc);
             if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
                 DBG2(printf("AGAIN %s\n", tws_GetSslError(err)));
-                ckfree(buf);
                 return TWS_AGAIN;
 
             } else if (err == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
@@ -154,22 +191,18 @@ int tws_ReadSslConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
             fprintf(stderr, "SSL_read error: %s err=%d rc=%d total_read=%zd\n",
                     tws_GetSslError(err), err, rc, total_read);
 
-            ckfree(buf);
             return TWS_ERROR;
         }
         break;
     }
 
-    ckfree(buf);
     return TWS_AGAIN;
 
     failed_due_to_request_too_large:
-    ckfree(buf);
     fprintf(stderr, "request too large");
     return TWS_ERROR;
 
     done:
-    ckfree(buf);
     return TWS_DONE;
 
 }
@@ -179,7 +212,13 @@ int tws_WriteSslConnAsync(tws_conn_t *conn, const char *buf, Tcl_Size len) {
     int rc;
     for (;;) {
         int towrite = MIN(INT_MAX, len - total_written);
-        rc = SSL_write(conn->ssl, buf + total_written, towrite);
+        if (conn->early_data_state == TWS_EARLY_DATA_READING) {
+            // the response to a request of the early data goes out before the client finished the handshake
+            size_t early_written = 0;
+            rc = SSL_write_early_data(conn->ssl, buf + total_written, towrite, &early_written) ? (int) early_written : -1;
+        } else {
+            rc = SSL_write(conn->ssl, buf + total_written, towrite);
+        }
         if (rc > 0) {
             // The write operation was successful, the return value is the number
             // of bytes actually written to the TLS/SSL connection.
@@ -189,9 +228,15 @@ int tws_WriteSslConnAsync(tws_conn_t *conn, const char *buf, Tcl_Size len) {
             }
         } else {
             int err = SSL_get_error(conn->ssl, rc);
-            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            if (err == SSL_ERROR_WANT_WRITE) {
+                // tws_HandleWrite waits for the socket to become writable
                 conn->write_offset += total_written;
                 return TWS_AGAIN;
+            } else if (err == SSL_ERROR_WANT_READ) {
+                // only a renegotiation makes SSL_write read, which SSL_OP_NO_RENEGOTIATION rejects,
+                // waiting for a writable socket would return here right away until the peer sends
+                fprintf(stderr, "SSL_write wants to read, conn: %s\n", conn->handle);
+                return TWS_ERROR;
             } else if (err == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
                 // peer closed connection
                 return TWS_DONE;
@@ -200,4 +245,66 @@ int tws_WriteSslConnAsync(tws_conn_t *conn, const char *buf, Tcl_Size len) {
             return TWS_ERROR;
         }
     }
-}
\ No newline at end of file
+}
+// Writes the rest of inout_ds and then the body of the conn, write_offset counts the bytes
+// of both. tws_ReturnConn has moved the start of the body into inout_ds to fill the first
+// record, the rest of the body is written with SSL_write from where it is.
+int tws_WritevSslConnAsync(tws_conn_t *conn) {
+    Tcl_Size head_length = Tcl_DStringLength(&conn->inout_ds);
+    if (conn->write_offset < head_length) {
+        int rc = tws_WriteSslConnAsync(conn, Tcl_DStringValue(&conn->inout_ds) + conn->write_offset,
+                                       head_length - conn->write_offset);
+        if (rc != TWS_DONE) {
+            return rc;
+        }
+        conn->write_offset = head_length;
+    }
+
+    Tcl_Size body_offset = conn->write_offset - head_length;
+    if (body_offset < conn->body_length) {
+        return tws_WriteSslConnAsync(conn, conn->body + body_offset, conn->body_length - body_offset);
+    }
+    return TWS_DONE;
+}
+
+// Where the kernel encrypts what is written to the conn (ktls_send), the file body is sent
+// with SSL_sendfile once the rest of inout_ds has been written. Otherwise it goes through
+// inout_ds in chunks, and each chunk is written with SSL_write.
+int tws_SendFileSslConnAsync(tws_conn_t *conn) {
+    for (;;) {
+        Tcl_Size length = Tcl_DStringLength(&conn->inout_ds);
+        if (conn->write_offset < length) {
+            int rc = tws_WriteSslConnAsync(conn, Tcl_DStringValue(&conn->inout_ds) + conn->write_offset,
+                                           length - conn->write_offset);
+            if (rc != TWS_DONE) {
+                return rc;
+            }
+        }
+
+        if (conn->file_offset == conn->file_length) {
+            return TWS_DONE;
+        }
+
+        if (conn->ktls_send) {
+            // inout_ds is not written again, all of it has gone out
+            conn->write_offset = length;
+            ossl_ssize_t rc = SSL_sendfile(conn->ssl, conn->file_fd, conn->file_offset,
+                                           conn->file_length - conn->file_offset, 0);
+            if (rc > 0) {
+                conn->file_offset += rc;
+                __atomic_add_fetch(&conn->accept_ctx->server->ktls_sendfile_bytes, rc, __ATOMIC_RELAXED);
+                continue;
+            }
+            int err = SSL_get_error(conn->ssl, (int) rc);
+            if (err == SSL_ERROR_WANT_WRITE) {
+                return TWS_AGAIN;
+            }
+            // as in tws_WriteSslConnAsync, a conn that waits to write does not wait for reads
+            return TWS_ERROR;
+        }
+
+        if (TWS_DONE != tws_ReadFileChunk(conn)) {
+            return TWS_ERROR;
+        }
+    }
+}
@@ -13,6 +13,11 @@
 #include "crypto.h"
 #include "form.h"
 #include "return.h"
+#include "scan.h"
+#include "session.h"
+#include "sni.h"
+#include "handshake.h"
+#include "ocsp.h"
 
 #include <sys/socket.h> // for SOMAXCONN
 #include <stdio.h>
@@ -20,6 +25,7 @@
 #include <ctype.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <unistd.h> // for R_OK
 #include <stdlib.h>
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
@@ -96,10 +102,17 @@ int tws_Destroy(Tcl_Interp *interp, const char *handle) {
     Tcl_DStringFree(&server->cmd_ds);
     Tcl_DStringFree(&server->script_ds);
     Tcl_DStringFree(&server->config_dict_ds);
+    ckfree(server->body_file_dir);
 
     DBG2(printf("dstrings freed\n"));
     tws_FreeSslContexts();
     DBG2(printf("ssl contexts freed\n"));
+    // the conn threads have exited, so the handshake threads have given back all their conns
+    if (server->handshake_pool) {
+        tws_FreeHandshakePool(server->handshake_pool);
+    }
+    tws_FreeSessionCache(server->session_cache);
+    tws_FreeOcspStapler(server->ocsp_stapler);
 
     Tcl_DeleteCommand(interp, handle);
     ckfree((char *) server);
@@ -348,6 +361,23 @@ static int tws_InitServerFromConfigDict(Tcl_Interp *interp, tws_server_t *server
         }
     }
 
+    // read "ktls" boolean option
+    Tcl_Obj *ktlsPtr;
+    Tcl_Obj *ktlsKeyPtr = Tcl_NewStringObj("ktls", -1);
+    Tcl_IncrRefCount(ktlsKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, ktlsKeyPtr, &ktlsPtr)) {
+        Tcl_DecrRefCount(ktlsKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(ktlsKeyPtr);
+    if (ktlsPtr) {
+        if (TCL_OK != Tcl_GetBooleanFromObj(interp, ktlsPtr, &server_ctx->ktls)) {
+            SetResult("ktls must be a boolean");
+            return TCL_ERROR;
+        }
+    }
+
     // read "gzip_min_length" int option
     Tcl_Obj *gzipMinLengthPtr;
     Tcl_Obj *gzipMinLengthKeyPtr = Tcl_NewStringObj("gzip_min_length", -1);
@@ -420,6 +450,29 @@ static int tws_InitServerFromConfigDict(Tcl_Interp *interp, tws_server_t *server
         return TCL_ERROR;
     }
 
+    Tcl_Obj *eventLoopPtr;
+    Tcl_Obj *eventLoopKeyPtr = Tcl_NewStringObj("event_loop", -1);
+    Tcl_IncrRefCount(eventLoopKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, eventLoopKeyPtr, &eventLoopPtr)) {
+        Tcl_DecrRefCount(eventLoopKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(eventLoopKeyPtr);
+    if (eventLoopPtr) {
+        const char *event_loop = Tcl_GetString(eventLoopPtr);
+        if (strcmp(event_loop, "tcl") == 0) {
+            server_ctx->event_loop = TWS_EVENT_LOOP_TCL;
+        } else if (strcmp(event_loop, "epoll") == 0) {
+            server_ctx->event_loop = TWS_EVENT_LOOP_EPOLL;
+        } else if (strcmp(event_loop, "io_uring") == 0) {
+            server_ctx->event_loop = TWS_EVENT_LOOP_IO_URING;
+        } else {
+            SetResult("event_loop must be one of: tcl, epoll, io_uring");
+            return TCL_ERROR;
+        }
+    }
+
 
     Tcl_Obj *threadStacksizePtr;
     Tcl_Obj *threadStacksizeKeyPtr = Tcl_NewStringObj("thread_stacksize", -1);
@@ -462,6 +515,290 @@ static int tws_InitServerFromConfigDict(Tcl_Interp *interp, tws_server_t *server
         return TCL_ERROR;
     }
 
+    Tcl_Obj *connPoolSizePtr;
+    Tcl_Obj *connPoolSizeKeyPtr = Tcl_NewStringObj("conn_pool_size", -1);
+    Tcl_IncrRefCount(connPoolSizeKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, connPoolSizeKeyPtr, &connPoolSizePtr)) {
+        Tcl_DecrRefCount(connPoolSizeKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(connPoolSizeKeyPtr);
+    if (connPoolSizePtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, connPoolSizePtr, &server_ctx->conn_pool_size)) {
+            SetResult("conn_pool_size must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->conn_pool_size < 0) {
+        SetResult("conn_pool_size must be >= 0");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *connPoolMaxBufferSizePtr;
+    Tcl_Obj *connPoolMaxBufferSizeKeyPtr = Tcl_NewStringObj("conn_pool_max_buffer_size", -1);
+    Tcl_IncrRefCount(connPoolMaxBufferSizeKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, connPoolMaxBufferSizeKeyPtr, &connPoolMaxBufferSizePtr)) {
+        Tcl_DecrRefCount(connPoolMaxBufferSizeKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(connPoolMaxBufferSizeKeyPtr);
+    if (connPoolMaxBufferSizePtr) {
+        if (TCL_OK != Tcl_GetSizeIntFromObj(interp, connPoolMaxBufferSizePtr, &server_ctx->conn_pool_max_buffer_size)) {
+            SetResult("conn_pool_max_buffer_size must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->conn_pool_max_buffer_size < 0) {
+        SetResult("conn_pool_max_buffer_size must be >= 0");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *readBufferPoolSizePtr;
+    Tcl_Obj *readBufferPoolSizeKeyPtr = Tcl_NewStringObj("read_buffer_pool_size", -1);
+    Tcl_IncrRefCount(readBufferPoolSizeKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, readBufferPoolSizeKeyPtr, &readBufferPoolSizePtr)) {
+        Tcl_DecrRefCount(readBufferPoolSizeKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(readBufferPoolSizeKeyPtr);
+    if (readBufferPoolSizePtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, readBufferPoolSizePtr, &server_ctx->read_buffer_pool_size)) {
+            SetResult("read_buffer_pool_size must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->read_buffer_pool_size < 0) {
+        SetResult("read_buffer_pool_size must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "tls_session_cache_size" int option
+    Tcl_Obj *tlsSessionCacheSizePtr;
+    Tcl_Obj *tlsSessionCacheSizeKeyPtr = Tcl_NewStringObj("tls_session_cache_size", -1);
+    Tcl_IncrRefCount(tlsSessionCacheSizeKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, tlsSessionCacheSizeKeyPtr, &tlsSessionCacheSizePtr)) {
+        Tcl_DecrRefCount(tlsSessionCacheSizeKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(tlsSessionCacheSizeKeyPtr);
+    if (tlsSessionCacheSizePtr) {
+        if (TCL_OK != Tcl_GetSizeIntFromObj(interp, tlsSessionCacheSizePtr, &server_ctx->tls_session_cache_size)) {
+            SetResult("tls_session_cache_size must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->tls_session_cache_size < 0) {
+        SetResult("tls_session_cache_size must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "tls_session_timeout" int option
+    Tcl_Obj *tlsSessionTimeoutPtr;
+    Tcl_Obj *tlsSessionTimeoutKeyPtr = Tcl_NewStringObj("tls_session_timeout", -1);
+    Tcl_IncrRefCount(tlsSessionTimeoutKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, tlsSessionTimeoutKeyPtr, &tlsSessionTimeoutPtr)) {
+        Tcl_DecrRefCount(tlsSessionTimeoutKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(tlsSessionTimeoutKeyPtr);
+    if (tlsSessionTimeoutPtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, tlsSessionTimeoutPtr, &server_ctx->tls_session_timeout)) {
+            SetResult("tls_session_timeout must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->tls_session_timeout <= 0) {
+        SetResult("tls_session_timeout must be > 0");
+        return TCL_ERROR;
+    }
+
+    // read "tls_session_tickets" boolean option
+    Tcl_Obj *tlsSessionTicketsPtr;
+    Tcl_Obj *tlsSessionTicketsKeyPtr = Tcl_NewStringObj("tls_session_tickets", -1);
+    Tcl_IncrRefCount(tlsSessionTicketsKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, tlsSessionTicketsKeyPtr, &tlsSessionTicketsPtr)) {
+        Tcl_DecrRefCount(tlsSessionTicketsKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(tlsSessionTicketsKeyPtr);
+    if (tlsSessionTicketsPtr) {
+        if (TCL_OK != Tcl_GetBooleanFromObj(interp, tlsSessionTicketsPtr, &server_ctx->tls_session_tickets)) {
+            SetResult("tls_session_tickets must be a boolean");
+            return TCL_ERROR;
+        }
+    }
+
+    // read "tls_ticket_key_rotation_interval" int option
+    Tcl_Obj *tlsTicketKeyRotationIntervalPtr;
+    Tcl_Obj *tlsTicketKeyRotationIntervalKeyPtr = Tcl_NewStringObj("tls_ticket_key_rotation_interval", -1);
+    Tcl_IncrRefCount(tlsTicketKeyRotationIntervalKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, tlsTicketKeyRotationIntervalKeyPtr, &tlsTicketKeyRotationIntervalPtr)) {
+        Tcl_DecrRefCount(tlsTicketKeyRotationIntervalKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(tlsTicketKeyRotationIntervalKeyPtr);
+    if (tlsTicketKeyRotationIntervalPtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, tlsTicketKeyRotationIntervalPtr, &server_ctx->tls_ticket_key_rotation_interval)) {
+            SetResult("tls_ticket_key_rotation_interval must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->tls_ticket_key_rotation_interval < 0) {
+        SetResult("tls_ticket_key_rotation_interval must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "tls_handshake_threads" int option
+    Tcl_Obj *tlsHandshakeThreadsPtr;
+    Tcl_Obj *tlsHandshakeThreadsKeyPtr = Tcl_NewStringObj("tls_handshake_threads", -1);
+    Tcl_IncrRefCount(tlsHandshakeThreadsKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, tlsHandshakeThreadsKeyPtr, &tlsHandshakeThreadsPtr)) {
+        Tcl_DecrRefCount(tlsHandshakeThreadsKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(tlsHandshakeThreadsKeyPtr);
+    if (tlsHandshakeThreadsPtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, tlsHandshakeThreadsPtr, &server_ctx->tls_handshake_threads)) {
+            SetResult("tls_handshake_threads must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->tls_handshake_threads < 0) {
+        SetResult("tls_handshake_threads must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "tls_max_early_data" int option
+    Tcl_Obj *tlsMaxEarlyDataPtr;
+    Tcl_Obj *tlsMaxEarlyDataKeyPtr = Tcl_NewStringObj("tls_max_early_data", -1);
+    Tcl_IncrRefCount(tlsMaxEarlyDataKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, tlsMaxEarlyDataKeyPtr, &tlsMaxEarlyDataPtr)) {
+        Tcl_DecrRefCount(tlsMaxEarlyDataKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(tlsMaxEarlyDataKeyPtr);
+    if (tlsMaxEarlyDataPtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, tlsMaxEarlyDataPtr, &server_ctx->tls_max_early_data)) {
+            SetResult("tls_max_early_data must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->tls_max_early_data < 0) {
+        SetResult("tls_max_early_data must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "ocsp_refresh_interval" int option
+    Tcl_Obj *ocspRefreshIntervalPtr;
+    Tcl_Obj *ocspRefreshIntervalKeyPtr = Tcl_NewStringObj("ocsp_refresh_interval", -1);
+    Tcl_IncrRefCount(ocspRefreshIntervalKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, ocspRefreshIntervalKeyPtr, &ocspRefreshIntervalPtr)) {
+        Tcl_DecrRefCount(ocspRefreshIntervalKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(ocspRefreshIntervalKeyPtr);
+    if (ocspRefreshIntervalPtr) {
+        if (TCL_OK != Tcl_GetIntFromObj(interp, ocspRefreshIntervalPtr, &server_ctx->ocsp_refresh_interval)) {
+            SetResult("ocsp_refresh_interval must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->ocsp_refresh_interval < 0) {
+        SetResult("ocsp_refresh_interval must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "binary_body" option
+    Tcl_Obj *binaryBodyPtr;
+    Tcl_Obj *binaryBodyKeyPtr = Tcl_NewStringObj("binary_body", -1);
+    Tcl_IncrRefCount(binaryBodyKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, binaryBodyKeyPtr, &binaryBodyPtr)) {
+        Tcl_DecrRefCount(binaryBodyKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(binaryBodyKeyPtr);
+    if (binaryBodyPtr) {
+        const char *binary_body = Tcl_GetString(binaryBodyPtr);
+        if (strcmp(binary_body, "base64") == 0) {
+            server_ctx->binary_body_bytearray = 0;
+        } else if (strcmp(binary_body, "bytearray") == 0) {
+            server_ctx->binary_body_bytearray = 1;
+        } else {
+            SetResult("binary_body must be one of: base64, bytearray");
+            return TCL_ERROR;
+        }
+    }
+
+    // read "body_file_min_length" int option
+    Tcl_Obj *bodyFileMinLengthPtr;
+    Tcl_Obj *bodyFileMinLengthKeyPtr = Tcl_NewStringObj("body_file_min_length", -1);
+    Tcl_IncrRefCount(bodyFileMinLengthKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, bodyFileMinLengthKeyPtr, &bodyFileMinLengthPtr)) {
+        Tcl_DecrRefCount(bodyFileMinLengthKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(bodyFileMinLengthKeyPtr);
+    if (bodyFileMinLengthPtr) {
+        if (TCL_OK != Tcl_GetSizeIntFromObj(interp, bodyFileMinLengthPtr, &server_ctx->body_file_min_length)) {
+            SetResult("body_file_min_length must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->body_file_min_length < 0) {
+        SetResult("body_file_min_length must be >= 0");
+        return TCL_ERROR;
+    }
+
+    // read "max_body_file_length" int option
+    Tcl_Obj *maxBodyFileLengthPtr;
+    Tcl_Obj *maxBodyFileLengthKeyPtr = Tcl_NewStringObj("max_body_file_length", -1);
+    Tcl_IncrRefCount(maxBodyFileLengthKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, maxBodyFileLengthKeyPtr, &maxBodyFileLengthPtr)) {
+        Tcl_DecrRefCount(maxBodyFileLengthKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(maxBodyFileLengthKeyPtr);
+    if (maxBodyFileLengthPtr) {
+        if (TCL_OK != Tcl_GetSizeIntFromObj(interp, maxBodyFileLengthPtr, &server_ctx->max_body_file_length)) {
+            SetResult("max_body_file_length must be an integer");
+            return TCL_ERROR;
+        }
+    }
+    if (server_ctx->max_body_file_length < 1) {
+        SetResult("max_body_file_length must be a positive integer");
+        return TCL_ERROR;
+    }
+
+    // read "body_file_dir" string option, the default is $TMPDIR or /tmp
+    Tcl_Obj *bodyFileDirPtr;
+    Tcl_Obj *bodyFileDirKeyPtr = Tcl_NewStringObj("body_file_dir", -1);
+    Tcl_IncrRefCount(bodyFileDirKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, configDictPtr, bodyFileDirKeyPtr, &bodyFileDirPtr)) {
+        Tcl_DecrRefCount(bodyFileDirKeyPtr);
+        SetResult("error reading dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(bodyFileDirKeyPtr);
+    const char *body_file_dir = bodyFileDirPtr ? Tcl_GetString(bodyFileDirPtr) : getenv("TMPDIR");
+    if (body_file_dir == NULL || body_file_dir[0] == '\0') {
+        body_file_dir = "/tmp";
+    }
+    server_ctx->body_file_dir = ckalloc(strlen(body_file_dir) + 1);
+    strcpy(server_ctx->body_file_dir, body_file_dir);
+
     return TCL_OK;
 }
 
@@ -512,14 +849,51 @@ static int tws_CreateServerCmd(ClientData clientData, Tcl_Interp *interp, int in
     server_ptr->backlog = SOMAXCONN;
     server_ptr->conn_timeout_millis = 2 * 60 * 1000;  // 2 minutes
     server_ptr->read_timeout_millis = 30 * 1000;  // 30 seconds
-    server_ptr->garbage_collection_cleanup_threshold = 10 * 1000;  // attempt cleanup every 10000 requests
-    server_ptr->garbage_collection_interval_millis = 10 * 1000;  // 10 seconds
+    server_ptr->garbage_collection_cleanup_threshold = 10 * 1000;  // no longer used, conns expire from the timer wheel
+    server_ptr->garbage_collection_interval_millis = 1000;  // the timer wheels advance once a second
     server_ptr->keepalive = 1;
     server_ptr->keepidle = 10;
     server_ptr->keepintvl = 5;
     server_ptr->keepcnt = 3;
     server_ptr->gzip = 1;
     server_ptr->gzip_min_length = 8192;
+    server_ptr->ktls = 0;
+    server_ptr->tls_handshakes = 0;
+    server_ptr->ktls_send_conns = 0;
+    server_ptr->ktls_recv_conns = 0;
+    server_ptr->ktls_sendfile_bytes = 0;
+    server_ptr->body_file_min_length = 0;
+    server_ptr->max_body_file_length = 1024 * 1024 * 1024;
+    server_ptr->body_file_dir = NULL;
+    server_ptr->binary_body_bytearray = 0;
+    server_ptr->tls_session_cache_size = 20480;
+    server_ptr->tls_session_timeout = 300;  // 5 minutes
+    server_ptr->tls_session_tickets = 1;
+    server_ptr->tls_ticket_key_rotation_interval = 3600;  // 1 hour
+    server_ptr->session_cache = NULL;
+    server_ptr->tls_resumed_handshakes = 0;
+    server_ptr->tls_session_cache_hits = 0;
+    server_ptr->tls_session_cache_misses = 0;
+    server_ptr->tls_ticket_hits = 0;
+    server_ptr->tls_ticket_misses = 0;
+    server_ptr->tls_ticket_key_rotations = 0;
+    server_ptr->tls_handshake_threads = 0;
+    server_ptr->handshake_pool = NULL;
+    server_ptr->tls_offloaded_handshakes = 0;
+    server_ptr->tls_handshake_queue_depth = 0;
+    server_ptr->tls_handshake_queue_wait_micros = 0;
+    server_ptr->tls_handshake_latency_micros = 0;
+    server_ptr->tls_handshake_latency_max_micros = 0;
+    server_ptr->tls_max_early_data = 0;
+    server_ptr->tls_early_data_accepted = 0;
+    server_ptr->tls_early_data_replays = 0;
+    server_ptr->tls_early_data_requests = 0;
+    server_ptr->tls_too_early_responses = 0;
+    server_ptr->ocsp_refresh_interval = 60;
+    server_ptr->ocsp_stapler = NULL;
+    server_ptr->tls_ocsp_staples = 0;
+    server_ptr->tls_ocsp_refreshes = 0;
+    server_ptr->tls_ocsp_load_failures = 0;
     Tcl_InitHashTable(&server_ptr->gzip_types_HT, TCL_STRING_KEYS);
 
     Tcl_HashEntry *entryPtr;
@@ -530,14 +904,37 @@ static int tws_CreateServerCmd(ClientData clientData, Tcl_Interp *interp, int in
     }
 
     server_ptr->num_threads = 10;
+    server_ptr->event_loop = TWS_EVENT_LOOP_TCL;
     server_ptr->thread_stacksize = TCL_THREAD_STACK_DEFAULT;
     server_ptr->thread_max_concurrent_conns = 0;
+    server_ptr->conn_pool_size = 1000;
+    server_ptr->conn_pool_max_buffer_size = 64 * 1024;
+    server_ptr->read_buffer_pool_size = 64;
 
     if (TCL_OK != tws_InitServerFromConfigDict(interp, server_ptr, remObjv[1])) {
         ckfree((char *) server_ptr);
         return TCL_ERROR;
     }
 
+    server_ptr->session_cache = tws_NewSessionCache(server_ptr);
+    if (!server_ptr->session_cache) {
+        ckfree((char *) server_ptr);
+        SetResult("Unable to create tls session cache");
+        return TCL_ERROR;
+    }
+
+    if (server_ptr->tls_handshake_threads > 0) {
+        server_ptr->handshake_pool = tws_NewHandshakePool(server_ptr);
+        if (!server_ptr->handshake_pool) {
+            tws_FreeSessionCache(server_ptr->session_cache);
+            ckfree((char *) server_ptr);
+            SetResult("Unable to create tls handshake threads");
+            return TCL_ERROR;
+        }
+    }
+
+    server_ptr->ocsp_stapler = tws_NewOcspStapler(server_ptr);
+
     CMD_SERVER_NAME(server_ptr->handle, server_ptr);
     tws_RegisterServerName(server_ptr->handle, server_ptr);
 
@@ -611,18 +1008,18 @@ static int tws_ListenCmd(ClientData clientData, Tcl_Interp *interp, int incoming
 
 }
 
-static int tws_AddContextCmd(ClientData clientData, Tcl_Interp *interp, int incoming_objc, Tcl_Obj *const objv[]) {
-    UNUSED(clientData);
-
-    DBG2(printf("AddContextCmd\n"));
-
+// builds the context of add_context and reload_context, the listeners keep serving
+// with the contexts that are registered until it is swapped into the host name table
+static int tws_AddOrReloadContext(Tcl_Interp *interp, int incoming_objc, Tcl_Obj *const objv[], int reload_p) {
     int option_verify_client = 0;
     char *cafile = NULL;
     char *cadir = NULL;
+    char *ocsp_file = NULL;
     Tcl_ArgvInfo ArgTable[] = {
             {TCL_ARGV_CONSTANT, "-verify_client", INT2PTR(1), &option_verify_client, "enables client verification",          NULL},
             {TCL_ARGV_STRING,   "-cafile",        NULL,       &cafile,               "CA file for client verification",      NULL},
             {TCL_ARGV_STRING,   "-cadir",         NULL,       &cadir,                "CA directory for client verification", NULL},
+            {TCL_ARGV_STRING,   "-ocsp_file",     NULL,       &ocsp_file,            "OCSP response file or directory",      NULL},
             {TCL_ARGV_END, NULL,                  NULL, NULL, NULL,                                                          NULL}
     };
 
@@ -679,8 +1076,14 @@ static int tws_AddContextCmd(ClientData clientData, Tcl_Interp *interp, int inco
     }
 
     SSL_CTX *ctx;
-    if (TCL_OK != tws_CreateSslContext(interp, &ctx)) {
+    if (TCL_OK != tws_CreateSslContext(interp, server, &ctx)) {
+        ckfree(remObjv);
+        return TCL_ERROR;
+    }
+    if (!tws_SetSessionIdContext(ctx, hostname)) {
+        SSL_CTX_free(ctx);
         ckfree(remObjv);
+        SetResult("Unable to set session id context");
         return TCL_ERROR;
     }
     if (TCL_OK != tws_ConfigureSslContext(interp, ctx, keyfile, certfile)) {
@@ -704,14 +1107,53 @@ static int tws_AddContextCmd(ClientData clientData, Tcl_Interp *interp, int inco
             return TCL_ERROR;
         }
 
+        // the CertificateRequest names the CAs, the list is built once for all the handshakes of the context
+        STACK_OF(X509_NAME) *ca_list = SSL_load_client_CA_file(cafile);
+        if (ca_list) {
+            SSL_CTX_set_client_CA_list(ctx, ca_list);
+        }
+    }
+
+    if (ocsp_file) {
+        if (!tws_AddOcspResponse(server->ocsp_stapler, ctx, hostname, ocsp_file)) {
+            SSL_CTX_free(ctx);
+            ckfree(remObjv);
+            SetResult("Unable to set up ocsp stapling");
+            return TCL_ERROR;
+        }
     }
 
-    tws_RegisterHostName(hostname, ctx);
+    if (reload_p) {
+        // the conns that switched to the old context keep it until they are closed
+        if (!tws_ReplaceHostName(hostname, ctx)) {
+            SSL_CTX_free(ctx);
+            ckfree(remObjv);
+            SetResult("hostname not found");
+            return TCL_ERROR;
+        }
+    } else if (!tws_RegisterHostName(hostname, ctx)) {
+        // the context that was added first for the host name stays
+        SSL_CTX_free(ctx);
+    }
 
     ckfree(remObjv);
     return TCL_OK;
 }
 
+static int tws_AddContextCmd(ClientData clientData, Tcl_Interp *interp, int incoming_objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("AddContextCmd\n"));
+    return tws_AddOrReloadContext(interp, incoming_objc, objv, 0);
+}
+
+static int tws_ReloadContextCmd(ClientData clientData, Tcl_Interp *interp, int incoming_objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("ReloadContextCmd\n"));
+    return tws_AddOrReloadContext(interp, incoming_objc, objv, 1);
+}
+
 static int tws_EncodeURIComponentCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
     UNUSED(clientData);
 
@@ -1115,19 +1557,19 @@ static int tws_ParseQueryCmd(ClientData clientData, Tcl_Interp *interp, int objc
         encoding_name = Tcl_GetString(objv[2]);
     }
 
-    Tcl_DString parse_ds;
-    Tcl_DStringInit(&parse_ds);
+    Tcl_Obj *result_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(result_ptr);
 
     int error_num = 0;
     if (TCL_OK != tws_ParseQueryStringParameters(Tcl_GetEncoding(interp, encoding_name), query_string, query_string_len,
-                                                 &parse_ds, &error_num)) {
-        Tcl_DStringFree(&parse_ds);
+                                                 result_ptr, &error_num)) {
+        Tcl_DecrRefCount(result_ptr);
         SetResult(tws_parse_error_messages[error_num]);
         return TCL_ERROR;
     }
 
-    Tcl_DStringResult(interp, &parse_ds);
-    Tcl_DStringFree(&parse_ds);
+    Tcl_SetObjResult(interp, result_ptr);
+    Tcl_DecrRefCount(result_ptr);
     return TCL_OK;
 
 }
@@ -1349,8 +1791,29 @@ static int tws_BuildResponseCmd(ClientData clientData, Tcl_Interp *interp, int i
     int is_binary_type = tws_IsBinaryType(mimetype, mimetype_length);
 
     Tcl_Obj *input_ptr;
-    if (option_file) {
-        // read the file denoted by the last parameter
+    int file_body_p = 0;
+    const char *native_path = option_file ? Tcl_FSGetNativePath(remObjv[3]) : NULL;
+    if (native_path != NULL) {
+        // the file is sent from where it is, it is not read here
+        struct stat statbuf;
+        if (Tcl_FSStat(remObjv[3], &statbuf) != 0) {
+            Tcl_DecrRefCount(response_dict_ptr);
+            ckfree(remObjv);
+            SetResult("build_response: error stating file");
+            return TCL_ERROR;
+        }
+        if (Tcl_FSAccess(remObjv[3], R_OK) != 0) {
+            Tcl_DecrRefCount(response_dict_ptr);
+            ckfree(remObjv);
+            SetResult("build_response: error opening file");
+            return TCL_ERROR;
+        }
+
+        input_ptr = tws_NewFileBodyObj(native_path, is_binary_type);
+        Tcl_IncrRefCount(input_ptr);
+        file_body_p = 1;
+    } else if (option_file) {
+        // read the file denoted by the last parameter, it is not on the native filesystem
 
         Tcl_Size filename_length;
         const char *filename = Tcl_GetStringFromObj(remObjv[3], &filename_length);
@@ -1413,7 +1876,9 @@ static int tws_BuildResponseCmd(ClientData clientData, Tcl_Interp *interp, int i
             return TCL_ERROR;
         }
         Tcl_DecrRefCount(is_base64_encoded_key_ptr);
+    }
 
+    if (is_binary_type && !file_body_p) {
         // base64 encode the body
         Tcl_Size input_length;
         const char *input = Tcl_GetByteArrayFromObj(input_ptr, &input_length);
@@ -1557,8 +2022,8 @@ static int tws_GetQueryParam(Tcl_Interp *interp, Tcl_Obj *req_dict_ptr, Tcl_Obj
     Tcl_Obj *multi_value_query_string_parameters_key_ptr = Tcl_NewStringObj("multiValueQueryStringParameters", -1);
     Tcl_IncrRefCount(multi_value_query_string_parameters_key_ptr);
     Tcl_Obj *multi_value_query_string_parameters_ptr;
-    if (TCL_OK != Tcl_DictObjGet(interp, req_dict_ptr, multi_value_query_string_parameters_key_ptr,
-                                 &multi_value_query_string_parameters_ptr)) {
+    if (TCL_OK != tws_GetRequestDictValue(interp, req_dict_ptr, multi_value_query_string_parameters_key_ptr,
+                                          &multi_value_query_string_parameters_ptr)) {
         Tcl_DecrRefCount(multi_value_query_string_parameters_key_ptr);
         SetResult("get_query_param: error reading multiValueQueryStringParameters from request_dict");
         return TCL_ERROR;
@@ -1584,7 +2049,7 @@ static int tws_GetQueryParam(Tcl_Interp *interp, Tcl_Obj *req_dict_ptr, Tcl_Obj
     Tcl_Obj *query_string_parameters_key_ptr = Tcl_NewStringObj("queryStringParameters", -1);
     Tcl_IncrRefCount(query_string_parameters_key_ptr);
     Tcl_Obj *query_string_parameters_ptr;
-    if (TCL_OK != Tcl_DictObjGet(interp, req_dict_ptr, query_string_parameters_key_ptr, &query_string_parameters_ptr)) {
+    if (TCL_OK != tws_GetRequestDictValue(interp, req_dict_ptr, query_string_parameters_key_ptr, &query_string_parameters_ptr)) {
         Tcl_DecrRefCount(query_string_parameters_key_ptr);
         SetResult("get_query_param: error reading queryStringParameters from request_dict");
         return TCL_ERROR;
@@ -1642,7 +2107,7 @@ int tws_GetQueryParamCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tc
         Tcl_SetObjResult(interp, result_ptr);
     }
 
-    if (option_multi) {
+    if (option_multi && result_ptr != NULL) {
         Tcl_DecrRefCount(result_ptr);
     }
 
@@ -1714,7 +2179,7 @@ int tws_GetPathParamCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl
         Tcl_SetObjResult(interp, result_ptr);
     }
 
-    if (option_multi) {
+    if (option_multi && result_ptr != NULL) {
         Tcl_DecrRefCount(result_ptr);
     }
 
@@ -1817,7 +2282,7 @@ int tws_GetHeaderCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
         Tcl_SetObjResult(interp, result_ptr);
     }
 
-    if (option_multi) {
+    if (option_multi && result_ptr != NULL) {
         Tcl_DecrRefCount(result_ptr);
     }
 
@@ -2047,7 +2512,7 @@ static void tws_ExitHandler(ClientData clientData) {
     DBG2(printf("Exit Handler: start\n"));
     tws_DeleteServerNameHT();
     tws_DeleteConnNameHT();
-    tws_DeleteHostNameHT();
+    tws_FreeSslContexts();
     tws_DeleteRouterNameHT();
 
     DBG2(printf("Exit Handler: done\n"));
@@ -2064,8 +2529,8 @@ void tws_InitModule() {
 
         tws_InitServerNameHT();
         tws_InitConnNameHT();
-        tws_InitHostNameHT();
         tws_InitRouterNameHT();
+        tws_InitScan();
 
         Tcl_CreateThreadExitHandler(tws_ExitHandler, NULL);
         tws_ModuleInitialized = 1;
@@ -2092,11 +2557,14 @@ int Twebserver_Init(Tcl_Interp *interp) {
     Tcl_CreateObjCommand(interp, "::twebserver::destroy_server", tws_DestroyServerCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::twebserver::listen_server", tws_ListenCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::twebserver::add_context", tws_AddContextCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::reload_context", tws_ReloadContextCmd, NULL, NULL);
 
     Tcl_CreateObjCommand(interp, "::twebserver::wait_signal", tws_WaitSignalCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::twebserver::get_rootdir", tws_GetRootdirCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::twebserver::get_config_dict", tws_GetConfigDictCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::twebserver::info_conn", tws_InfoConnCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::info_conn_pool", tws_InfoConnPoolCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::info_tls", tws_InfoTlsCmd, NULL, NULL);
 
     Tcl_CreateObjCommand(interp, "::twebserver::encode_uri_component", tws_EncodeURIComponentCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::twebserver::decode_uri_component", tws_DecodeURIComponentCmd, NULL, NULL);
@@ -2132,6 +2600,10 @@ int Twebserver_Init(Tcl_Interp *interp) {
     Tcl_CreateObjCommand(interp, "::twebserver::ipv6_to_ipv4", tws_IpV6ToIpV4Cmd, NULL, NULL);
 
     Tcl_CreateObjCommand(interp, "::twebserver::return_response", tws_ReturnResponseCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::stream_begin", tws_StreamBeginCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::stream_write", tws_StreamWriteCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::stream_on_drain", tws_StreamOnDrainCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::twebserver::stream_end", tws_StreamEndCmd, NULL, NULL);
 
     return Tcl_PkgProvide(interp, "twebserver", XSTR(VERSION));
 }
@@ -0,0 +1,351 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "ocsp.h"
+#include <openssl/ocsp.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <time.h>
+
+// The OCSP responses that a server staples to the handshakes of its contexts, so that the
+// clients that check the revocation of the certificate do not ask the responder of the CA
+// themselves. The response of a context is a DER file that something else fetches from the
+// responder, e.g. "openssl ocsp -respout" from cron. The file is read when the context is
+// added and then by a thread of the server every ocsp_refresh_interval seconds, if it
+// changed. The status callback of a handshake only copies the response that was read last.
+
+// a response file that is larger than this is not an OCSP response of a single certificate
+#define TWS_OCSP_MAX_RESPONSE_LENGTH (64 * 1024)
+
+typedef struct tws_ocsp_response_s {
+    char *path;
+    ASN1_INTEGER *serial; // of the certificate of the context
+    // the stapler and the context hold a reference each, updated with atomic builtins
+    int refs;
+    // the file as it was when it was read last, so that it is not read again until it changes
+    time_t mtime;
+    off_t size;
+    Tcl_Mutex mutex;
+    // guarded by the mutex, NULL until a valid response was read
+    unsigned char *der;
+    int der_len;
+    time_t next_update; // 0 if the response does not say
+    struct tws_ocsp_response_s *nextPtr;
+} tws_ocsp_response_t;
+
+struct tws_ocsp_stapler_s {
+    tws_server_t *server;
+    Tcl_Mutex mutex;
+    Tcl_Condition cond;
+    // guarded by the mutex
+    tws_ocsp_response_t *firstResponsePtr;
+    int thread_started;
+    int terminate;
+    Tcl_ThreadId thread_id;
+};
+
+static int tws_ocsp_ex_index = -1;
+static Tcl_Mutex tws_OcspExIndexMutex;
+
+static void tws_ReleaseOcspResponse(tws_ocsp_response_t *response) {
+    if (__atomic_sub_fetch(&response->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    ckfree(response->path);
+    ASN1_INTEGER_free(response->serial);
+    if (response->der) {
+        ckfree((char *) response->der);
+    }
+    Tcl_MutexFinalize(&response->mutex);
+    ckfree((char *) response);
+}
+
+// the context is freed once it was replaced by reload_context and its last conn is closed
+static void tws_FreeOcspExData(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp) {
+    UNUSED(parent);
+    UNUSED(ad);
+    UNUSED(idx);
+    UNUSED(argl);
+    UNUSED(argp);
+
+    if (ptr) {
+        tws_ReleaseOcspResponse((tws_ocsp_response_t *) ptr);
+    }
+}
+
+static int tws_GetOcspExIndex() {
+    Tcl_MutexLock(&tws_OcspExIndexMutex);
+    if (tws_ocsp_ex_index < 0) {
+        tws_ocsp_ex_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, tws_FreeOcspExData);
+    }
+    Tcl_MutexUnlock(&tws_OcspExIndexMutex);
+    return tws_ocsp_ex_index;
+}
+
+// returns 1 and the time of the next update if der is a successful response for the certificate
+static int tws_CheckOcspResponse(const unsigned char *der, long der_len, const ASN1_INTEGER *serial, time_t *next_update, const char **reason) {
+    const unsigned char *p = der;
+    OCSP_RESPONSE *resp = d2i_OCSP_RESPONSE(NULL, &p, der_len);
+    if (!resp) {
+        *reason = "not an OCSP response";
+        return 0;
+    }
+    if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+        OCSP_RESPONSE_free(resp);
+        *reason = "response status is not successful";
+        return 0;
+    }
+    OCSP_BASICRESP *basic = OCSP_response_get1_basic(resp);
+    OCSP_RESPONSE_free(resp);
+    if (!basic) {
+        *reason = "not a basic response";
+        return 0;
+    }
+
+    // the client checks the signature, the server only makes sure that it staples the right response
+    int found = 0;
+    *reason = "no status for the certificate";
+    for (int i = 0; i < OCSP_resp_count(basic); i++) {
+        OCSP_SINGLERESP *single = OCSP_resp_get0(basic, i);
+        ASN1_INTEGER *single_serial = NULL;
+        if (!OCSP_id_get0_info(NULL, NULL, NULL, &single_serial, (OCSP_CERTID *) OCSP_SINGLERESP_get0_id(single))
+            || ASN1_INTEGER_cmp(single_serial, serial) != 0) {
+            continue;
+        }
+
+        ASN1_GENERALIZEDTIME *next = NULL;
+        OCSP_single_get0_status(single, NULL, NULL, NULL, &next);
+        *next_update = 0;
+        if (next) {
+            int days, seconds;
+            if (!ASN1_TIME_diff(&days, &seconds, NULL, next)) {
+                *reason = "invalid next update";
+                break;
+            }
+            if (days < 0 || seconds < 0 || (days == 0 && seconds == 0)) {
+                *reason = "response expired";
+                break;
+            }
+            *next_update = time(NULL) + (time_t) days * 86400 + seconds;
+        }
+        found = 1;
+        break;
+    }
+    OCSP_BASICRESP_free(basic);
+    return found;
+}
+
+// reads the file of the response if it changed since it was read last
+static void tws_LoadOcspResponse(tws_server_t *server, tws_ocsp_response_t *response) {
+    struct stat st;
+    if (stat(response->path, &st) != 0) {
+        // no file yet or any more, a response that was read before is stapled until it expires
+        return;
+    }
+    if (st.st_mtime == response->mtime && st.st_size == response->size) {
+        return;
+    }
+    response->mtime = st.st_mtime;
+    response->size = st.st_size;
+
+    if (st.st_size == 0 || st.st_size > TWS_OCSP_MAX_RESPONSE_LENGTH) {
+        fprintf(stderr, "LoadOcspResponse: %s: invalid length %ld\n", response->path, (long) st.st_size);
+        __atomic_add_fetch(&server->tls_ocsp_load_failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    FILE *fp = fopen(response->path, "rb");
+    if (!fp) {
+        fprintf(stderr, "LoadOcspResponse: %s: unable to open file\n", response->path);
+        __atomic_add_fetch(&server->tls_ocsp_load_failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    unsigned char *der = (unsigned char *) ckalloc(st.st_size);
+    size_t der_len = fread(der, 1, st.st_size, fp);
+    fclose(fp);
+
+    time_t next_update;
+    const char *reason = "short read";
+    if (der_len != (size_t) st.st_size
+        || !tws_CheckOcspResponse(der, (long) der_len, response->serial, &next_update, &reason)) {
+        fprintf(stderr, "LoadOcspResponse: %s: %s\n", response->path, reason);
+        __atomic_add_fetch(&server->tls_ocsp_load_failures, 1, __ATOMIC_RELAXED);
+        ckfree((char *) der);
+        return;
+    }
+
+    Tcl_MutexLock(&response->mutex);
+    unsigned char *old_der = response->der;
+    response->der = der;
+    response->der_len = (int) der_len;
+    response->next_update = next_update;
+    Tcl_MutexUnlock(&response->mutex);
+
+    if (old_der) {
+        ckfree((char *) old_der);
+    }
+    __atomic_add_fetch(&server->tls_ocsp_refreshes, 1, __ATOMIC_RELAXED);
+    DBG2(printf("LoadOcspResponse: %s: %d bytes\n", response->path, response->der_len));
+}
+
+// the status callback of the context that the ClientHello callback switched the conn to
+static int tws_OcspStatusCallback(SSL *ssl, void *arg) {
+    UNUSED(arg);
+
+    tws_ocsp_response_t *response = (tws_ocsp_response_t *) SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), tws_ocsp_ex_index);
+    if (!response) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    // openssl frees the copy along with the conn
+    unsigned char *der = NULL;
+    int der_len = 0;
+    Tcl_MutexLock(&response->mutex);
+    if (response->der && (response->next_update == 0 || response->next_update > time(NULL))) {
+        der = OPENSSL_malloc(response->der_len);
+        if (der) {
+            memcpy(der, response->der, response->der_len);
+            der_len = response->der_len;
+        }
+    }
+    Tcl_MutexUnlock(&response->mutex);
+
+    if (!der) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    if (!SSL_set_tlsext_status_ocsp_resp(ssl, der, der_len)) {
+        OPENSSL_free(der);
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    tws_conn_t *conn = (tws_conn_t *) SSL_get_app_data(ssl);
+    __atomic_add_fetch(&conn->accept_ctx->server->tls_ocsp_staples, 1, __ATOMIC_RELAXED);
+    return SSL_TLSEXT_ERR_OK;
+}
+
+// frees the responses whose context is gone, this is called with the mutex of the stapler held
+static void tws_PruneOcspResponses(tws_ocsp_stapler_t *stapler) {
+    tws_ocsp_response_t **responsePtrPtr = &stapler->firstResponsePtr;
+    while (*responsePtrPtr) {
+        tws_ocsp_response_t *response = *responsePtrPtr;
+        if (__atomic_load_n(&response->refs, __ATOMIC_ACQUIRE) == 1) {
+            *responsePtrPtr = response->nextPtr;
+            tws_ReleaseOcspResponse(response);
+        } else {
+            responsePtrPtr = &response->nextPtr;
+        }
+    }
+}
+
+static Tcl_ThreadCreateType tws_OcspThread(ClientData clientData) {
+    tws_ocsp_stapler_t *stapler = (tws_ocsp_stapler_t *) clientData;
+    tws_server_t *server = stapler->server;
+
+    Tcl_MutexLock(&stapler->mutex);
+    while (!stapler->terminate) {
+        Tcl_Time timeout = {server->ocsp_refresh_interval, 0};
+        Tcl_ConditionWait(&stapler->cond, &stapler->mutex, &timeout);
+        if (stapler->terminate) {
+            break;
+        }
+
+        tws_PruneOcspResponses(stapler);
+        for (tws_ocsp_response_t *response = stapler->firstResponsePtr; response; response = response->nextPtr) {
+            tws_LoadOcspResponse(server, response);
+        }
+    }
+    Tcl_MutexUnlock(&stapler->mutex);
+
+    Tcl_ExitThread(TCL_OK);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+tws_ocsp_stapler_t *tws_NewOcspStapler(tws_server_t *server) {
+    tws_ocsp_stapler_t *stapler = (tws_ocsp_stapler_t *) ckalloc(sizeof(tws_ocsp_stapler_t));
+    memset(stapler, 0, sizeof(tws_ocsp_stapler_t));
+    stapler->server = server;
+    return stapler;
+}
+
+void tws_FreeOcspStapler(tws_ocsp_stapler_t *stapler) {
+    Tcl_MutexLock(&stapler->mutex);
+    stapler->terminate = 1;
+    Tcl_ConditionNotify(&stapler->cond);
+    int thread_started = stapler->thread_started;
+    Tcl_MutexUnlock(&stapler->mutex);
+
+    if (thread_started && TCL_OK != Tcl_JoinThread(stapler->thread_id, NULL)) {
+        fprintf(stderr, "Error joining ocsp thread %p\n", (void *) stapler->thread_id);
+    }
+
+    // the contexts that are still around release their responses when they are freed
+    while (stapler->firstResponsePtr) {
+        tws_ocsp_response_t *response = stapler->firstResponsePtr;
+        stapler->firstResponsePtr = response->nextPtr;
+        tws_ReleaseOcspResponse(response);
+    }
+    Tcl_ConditionFinalize(&stapler->cond);
+    Tcl_MutexFinalize(&stapler->mutex);
+    ckfree((char *) stapler);
+}
+
+// staples the response in path to the handshakes of ctx, or the response in "<path>/<hostname>.der"
+// if path is a directory. The file does not have to exist yet, it is read once it does.
+int tws_AddOcspResponse(tws_ocsp_stapler_t *stapler, SSL_CTX *ctx, const char *hostname, const char *path) {
+    X509 *cert = SSL_CTX_get0_certificate(ctx);
+    int ex_index = tws_GetOcspExIndex();
+    if (!cert || ex_index < 0) {
+        return 0;
+    }
+
+    tws_ocsp_response_t *response = (tws_ocsp_response_t *) ckalloc(sizeof(tws_ocsp_response_t));
+    memset(response, 0, sizeof(tws_ocsp_response_t));
+    response->serial = ASN1_INTEGER_dup(X509_get0_serialNumber(cert));
+    response->mtime = -1;
+    response->size = -1;
+
+    Tcl_DString path_ds;
+    Tcl_DStringInit(&path_ds);
+    Tcl_DStringAppend(&path_ds, path, -1);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        Tcl_DStringAppend(&path_ds, "/", 1);
+        Tcl_DStringAppend(&path_ds, hostname, -1);
+        Tcl_DStringAppend(&path_ds, ".der", 4);
+    }
+    response->path = ckalloc(Tcl_DStringLength(&path_ds) + 1);
+    memcpy(response->path, Tcl_DStringValue(&path_ds), Tcl_DStringLength(&path_ds) + 1);
+    Tcl_DStringFree(&path_ds);
+
+    // the stapler and the context hold a reference each
+    response->refs = 2;
+    if (!response->serial || !SSL_CTX_set_ex_data(ctx, ex_index, response)) {
+        response->refs = 1;
+        tws_ReleaseOcspResponse(response);
+        return 0;
+    }
+    SSL_CTX_set_tlsext_status_cb(ctx, tws_OcspStatusCallback);
+
+    tws_server_t *server = stapler->server;
+    Tcl_MutexLock(&stapler->mutex);
+    // the first handshakes of the context already get the response
+    tws_LoadOcspResponse(server, response);
+    tws_PruneOcspResponses(stapler);
+    response->nextPtr = stapler->firstResponsePtr;
+    stapler->firstResponsePtr = response;
+
+    int ok = 1;
+    if (!stapler->thread_started && server->ocsp_refresh_interval > 0) {
+        if (TCL_OK == Tcl_CreateThread(&stapler->thread_id, tws_OcspThread, stapler, server->thread_stacksize, TCL_THREAD_JOINABLE)) {
+            stapler->thread_started = 1;
+        } else {
+            fprintf(stderr, "AddOcspResponse: unable to create thread\n");
+            ok = 0;
+        }
+    }
+    Tcl_MutexUnlock(&stapler->mutex);
+    return ok;
+}
@@ -0,0 +1,16 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_OCSP_H
+#define TWEBSERVER_OCSP_H
+
+#include "common.h"
+
+tws_ocsp_stapler_t *tws_NewOcspStapler(tws_server_t *server);
+void tws_FreeOcspStapler(tws_ocsp_stapler_t *stapler);
+int tws_AddOcspResponse(tws_ocsp_stapler_t *stapler, SSL_CTX *ctx, const char *hostname, const char *path);
+
+#endif //TWEBSERVER_OCSP_H
@@ -9,6 +9,8 @@
 
 
 #include "path_regexp.h"
+#include <string.h>
+#include <strings.h>
 
 enum lex_token_type_enum {
     MODIFIER,
@@ -104,8 +106,9 @@ int tws_PathExprLexer(Tcl_Interp *interp, const char *path_expr, int path_expr_l
                 return TCL_ERROR;
             }
 
+            // the pattern without the parentheses, tws_TokensToRegExp puts it in a group of its own
             Tcl_ListObjAppendElement(interp, lexTokensListPtr, Tcl_NewIntObj(PATTERN));
-            Tcl_ListObjAppendElement(interp, lexTokensListPtr, Tcl_NewStringObj(p, q - p));
+            Tcl_ListObjAppendElement(interp, lexTokensListPtr, Tcl_NewStringObj(p + 1, q - p - 2));
             p = q;
             continue;
         }
@@ -513,3 +516,123 @@ int tws_PathToRegExp(Tcl_Interp *interp, const char *path, Tcl_Size path_len, in
     Tcl_DStringFree(&ds);
     return TCL_OK;
 }
+
+// Returns 0 for the paths that need the regexp, i.e. those with modifiers, custom patterns,
+// groups, or parameters that are not a whole segment. The literal parts of the matcher point
+// into "path", which must outlive it.
+int tws_PathToMatcher(const char *path, Tcl_Size path_len, int flags, tws_path_matcher_t **matcher_ptr) {
+    *matcher_ptr = NULL;
+    if (path_len == 0 || path[0] == ':') {
+        return 0;
+    }
+
+    int num_elements = 0;
+    int num_params = 0;
+    for (const char *p = path; p < path + path_len; p++) {
+        if (*p == '*' || *p == '+' || *p == '?' || *p == '\\' || *p == '{' || *p == '}' || *p == '(' || *p == ')') {
+            return 0;
+        }
+        if ((flags & NOCASE_MATCH) && (unsigned char) *p >= 0x80) {
+            return 0;
+        }
+        if (*p == ':') {
+            if (p[-1] != '/') {
+                return 0;
+            }
+            const char *q = p + 1;
+            while (q < path + path_len && (CHARTYPE(alpha, *q) || CHARTYPE(digit, *q) || *q == '_')) {
+                q++;
+            }
+            if (q == p + 1 || (q < path + path_len && *q != '/')) {
+                return 0;
+            }
+            num_params++;
+            // the literal before the parameter and the parameter
+            num_elements += 2;
+            p = q - 1;
+        }
+    }
+    if (num_params == 0 || num_params > TWS_MAX_PATH_PARAMS) {
+        return 0;
+    }
+    num_elements++;
+
+    tws_path_matcher_t *matcher = (tws_path_matcher_t *) ckalloc(
+            sizeof(tws_path_matcher_t) + num_elements * sizeof(tws_path_element_t));
+    matcher->flags = flags;
+    matcher->num_params = num_params;
+    matcher->num_elements = 0;
+
+    const char *literal = path;
+    const char *p = path;
+    const char *end = path + path_len;
+    while (p < end) {
+        if (*p == '/' && p + 1 < end && p[1] == ':') {
+            tws_path_element_t *element_ptr = &matcher->elements[matcher->num_elements++];
+            element_ptr->literal = literal;
+            element_ptr->literal_len = p - literal;
+            element_ptr = &matcher->elements[matcher->num_elements++];
+            element_ptr->literal = NULL;
+            element_ptr->literal_len = 0;
+            p += 2;
+            while (p < end && *p != '/') {
+                p++;
+            }
+            literal = p;
+            continue;
+        }
+        p++;
+    }
+    tws_path_element_t *element_ptr = &matcher->elements[matcher->num_elements++];
+    element_ptr->literal = literal;
+    element_ptr->literal_len = end - literal;
+
+    // as in tws_TokensToRegExp, a path that ends with a parameter is not delimited
+    matcher->is_end_delimited = element_ptr->literal_len > 0 && literal[element_ptr->literal_len - 1] == '/';
+
+    *matcher_ptr = matcher;
+    return 1;
+}
+
+// Returns whether the path matches. On a match, "ranges" has the start and the end offsets
+// of the value of each parameter.
+int tws_MatchPath(const tws_path_matcher_t *matcher_ptr, const char *path, Tcl_Size path_len, Tcl_Size *ranges) {
+    int nocase = matcher_ptr->flags & NOCASE_MATCH;
+    const char *p = path;
+    const char *end = path + path_len;
+    for (int i = 0; i < matcher_ptr->num_elements; i++) {
+        const tws_path_element_t *element_ptr = &matcher_ptr->elements[i];
+        if (element_ptr->literal != NULL) {
+            if (end - p < element_ptr->literal_len) {
+                return 0;
+            }
+            if (nocase ? strncasecmp(p, element_ptr->literal, element_ptr->literal_len) != 0
+                       : memcmp(p, element_ptr->literal, element_ptr->literal_len) != 0) {
+                return 0;
+            }
+            p += element_ptr->literal_len;
+        } else {
+            if (p >= end || *p != '/') {
+                return 0;
+            }
+            p++;
+            const char *value = p;
+            while (p < end && *p != '/') {
+                p++;
+            }
+            if (p == value) {
+                return 0;
+            }
+            *ranges++ = value - path;
+            *ranges++ = p - path;
+        }
+    }
+
+    int strict = matcher_ptr->flags & STRICT_MATCH;
+    if (matcher_ptr->flags & END_MATCH) {
+        // "$", or "\/?$" if not strict
+        return p == end || (!strict && end - p == 1 && *p == '/');
+    }
+    // "(?=\/)" unless the path ends with "/", after an optional "\/" if not strict
+    return matcher_ptr->is_end_delimited || (p < end && *p == '/');
+}
@@ -17,6 +17,28 @@ enum {
     NOCASE_MATCH = 8,
 };
 
+#define TWS_MAX_PATH_PARAMS 16
+
+// A literal part of a path, or a parameter when literal is NULL. A parameter matches
+// a "/" followed by a non-empty segment, i.e. "/:name".
+typedef struct {
+    const char *literal;
+    Tcl_Size literal_len;
+} tws_path_element_t;
+
+// Matches the paths that are literal parts and "/:name" parameters only, the same
+// way as the regexp that tws_PathToRegExp makes for them.
+typedef struct tws_path_matcher_s {
+    int flags;
+    int is_end_delimited;
+    int num_params;
+    int num_elements;
+    tws_path_element_t elements[];
+} tws_path_matcher_t;
+
 int tws_PathToRegExp(Tcl_Interp *interp, const char *path, Tcl_Size path_len, int flags, Tcl_Obj **keysPtr, char **pattern);
 
+int tws_PathToMatcher(const char *path, Tcl_Size path_len, int flags, tws_path_matcher_t **matcher_ptr);
+int tws_MatchPath(const tws_path_matcher_t *matcher_ptr, const char *path, Tcl_Size path_len, Tcl_Size *ranges);
+
 #endif //TWEBSERVER_PATH_REGEXP_H
@@ -7,6 +7,9 @@
 #include "request.h"
 #include "uri.h"
 #include "base64.h"
+#include "scan.h"
+#include "buffer.h"
+#include <unistd.h>
 
 static char hex_digits[] = "0123456789ABCDEF"; // A lookup table for hexadecimal digits
 
@@ -127,82 +130,208 @@ int tws_UrlEncode(int enc_flags, const char *value, Tcl_Size value_length, Tcl_O
     return TCL_OK;
 }
 
-static int tws_AddQueryStringParameter(Tcl_Encoding encoding, Tcl_HashTable *query_string_parameters_HT_ptr,
-                                       Tcl_HashTable *multivalue_query_string_parameters_HT_ptr, const char *key, const char *value,
-                                       Tcl_Size value_length, int *error_num) {
+// The keys of the request dict are the same objects for every request of a thread,
+// and so are the names of the headers that were seen before, up to a limit, so that
+// parsing a request does not allocate a new key object for each of them.
+#define TWS_MAX_SHARED_HEADER_KEYS 256
+
+typedef struct {
+    int initialized;
+    Tcl_Obj *http_method_key_ptr;
+    Tcl_Obj *url_key_ptr;
+    Tcl_Obj *path_key_ptr;
+    Tcl_Obj *query_string_key_ptr;
+    Tcl_Obj *query_string_parameters_key_ptr;
+    Tcl_Obj *multi_value_query_string_parameters_key_ptr;
+    Tcl_Obj *version_key_ptr;
+    Tcl_Obj *headers_key_ptr;
+    Tcl_Obj *multi_value_headers_key_ptr;
+    Tcl_Obj *multipart_boundary_key_ptr;
+    Tcl_Obj *is_base64_encoded_key_ptr;
+    Tcl_Obj *body_key_ptr;
+    Tcl_Obj *body_file_key_ptr;
+    Tcl_Obj *is_binary_key_ptr;
+    Tcl_Obj *early_data_key_ptr;
+    Tcl_Obj *content_length_key_ptr;
+    Tcl_Obj *content_type_key_ptr;
+    Tcl_Obj *connection_key_ptr;
+    Tcl_Obj *accept_encoding_key_ptr;
+    Tcl_HashTable header_keys_HT;
+} tws_request_keys_t;
+
+static Tcl_ThreadDataKey requestKeysKey;
+
+static Tcl_Obj *tws_NewSharedKey(const char *key) {
+    Tcl_Obj *key_ptr = Tcl_NewStringObj(key, -1);
+    Tcl_IncrRefCount(key_ptr);
+    return key_ptr;
+}
 
-    Tcl_DString value_ds;
-    Tcl_DStringInit(&value_ds);
-    if (TCL_OK != tws_UrlDecode(encoding, value, value_length, &value_ds, error_num)) {
-        Tcl_DStringFree(&value_ds);
-        return TCL_ERROR;
+static Tcl_Obj *tws_NewSharedHeaderKey(tws_request_keys_t *keys, const char *key) {
+    int newEntry = 0;
+    Tcl_HashEntry *entry_ptr = Tcl_CreateHashEntry(&keys->header_keys_HT, key, &newEntry);
+    Tcl_Obj *key_ptr = tws_NewSharedKey(key);
+    Tcl_SetHashValue(entry_ptr, key_ptr);
+    return key_ptr;
+}
+
+static void tws_FreeRequestKeys(ClientData clientData) {
+    tws_request_keys_t *keys = (tws_request_keys_t *) clientData;
+    Tcl_DecrRefCount(keys->http_method_key_ptr);
+    Tcl_DecrRefCount(keys->url_key_ptr);
+    Tcl_DecrRefCount(keys->path_key_ptr);
+    Tcl_DecrRefCount(keys->query_string_key_ptr);
+    Tcl_DecrRefCount(keys->query_string_parameters_key_ptr);
+    Tcl_DecrRefCount(keys->multi_value_query_string_parameters_key_ptr);
+    Tcl_DecrRefCount(keys->version_key_ptr);
+    Tcl_DecrRefCount(keys->headers_key_ptr);
+    Tcl_DecrRefCount(keys->multi_value_headers_key_ptr);
+    Tcl_DecrRefCount(keys->multipart_boundary_key_ptr);
+    Tcl_DecrRefCount(keys->is_base64_encoded_key_ptr);
+    Tcl_DecrRefCount(keys->body_key_ptr);
+    Tcl_DecrRefCount(keys->body_file_key_ptr);
+    Tcl_DecrRefCount(keys->is_binary_key_ptr);
+    Tcl_DecrRefCount(keys->early_data_key_ptr);
+
+    // the keys of the headers that we look up are in the table, too
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry;
+    for (entry = Tcl_FirstHashEntry(&keys->header_keys_HT, &search); entry != NULL; entry = Tcl_NextHashEntry(&search)) {
+        Tcl_Obj *key_ptr = Tcl_GetHashValue(entry);
+        Tcl_DecrRefCount(key_ptr);
     }
+    Tcl_DeleteHashTable(&keys->header_keys_HT);
+    keys->initialized = 0;
+}
 
-    // check if "key" already exists in "queryStringParameters"
-    char *key_ptr = tws_strndup(key, value - key - 1);
-    Tcl_HashEntry *existing_entry_ptr = Tcl_FindHashEntry(query_string_parameters_HT_ptr, key_ptr);
+static tws_request_keys_t *tws_GetRequestKeys() {
+    tws_request_keys_t *keys = (tws_request_keys_t *) Tcl_GetThreadData(&requestKeysKey, sizeof(tws_request_keys_t));
+    if (keys->initialized) {
+        return keys;
+    }
 
-    if (existing_entry_ptr != NULL) {
-        // check if "key" already exists in "multivalueQueryStringParameters"
-        Tcl_HashEntry *existing_mv_entry_ptr = Tcl_FindHashEntry(query_string_parameters_HT_ptr, key_ptr);
+    keys->http_method_key_ptr = tws_NewSharedKey("httpMethod");
+    keys->url_key_ptr = tws_NewSharedKey("url");
+    keys->path_key_ptr = tws_NewSharedKey("path");
+    keys->query_string_key_ptr = tws_NewSharedKey("queryString");
+    keys->query_string_parameters_key_ptr = tws_NewSharedKey("queryStringParameters");
+    keys->multi_value_query_string_parameters_key_ptr = tws_NewSharedKey("multiValueQueryStringParameters");
+    keys->version_key_ptr = tws_NewSharedKey("version");
+    keys->headers_key_ptr = tws_NewSharedKey("headers");
+    keys->multi_value_headers_key_ptr = tws_NewSharedKey("multiValueHeaders");
+    keys->multipart_boundary_key_ptr = tws_NewSharedKey("multipartBoundary");
+    keys->is_base64_encoded_key_ptr = tws_NewSharedKey("isBase64Encoded");
+    keys->body_key_ptr = tws_NewSharedKey("body");
+    keys->body_file_key_ptr = tws_NewSharedKey("bodyFile");
+    keys->is_binary_key_ptr = tws_NewSharedKey("isBinary");
+    keys->early_data_key_ptr = tws_NewSharedKey("earlyData");
+
+    Tcl_InitHashTable(&keys->header_keys_HT, TCL_STRING_KEYS);
+    keys->content_length_key_ptr = tws_NewSharedHeaderKey(keys, "content-length");
+    keys->content_type_key_ptr = tws_NewSharedHeaderKey(keys, "content-type");
+    keys->connection_key_ptr = tws_NewSharedHeaderKey(keys, "connection");
+    keys->accept_encoding_key_ptr = tws_NewSharedHeaderKey(keys, "accept-encoding");
+
+    keys->initialized = 1;
+    Tcl_CreateThreadExitHandler(tws_FreeRequestKeys, keys);
+    return keys;
+}
 
-        if (existing_mv_entry_ptr == NULL) {
-            // it does not exist, create a new list and add the existing value from queryStringParameters
-            Tcl_DString *existing_value_ds_ptr = Tcl_GetHashValue(existing_entry_ptr);
-            Tcl_DString *multi_value_ds_ptr = (Tcl_DString *) ckalloc(sizeof(Tcl_DString));
-            Tcl_DStringInit(multi_value_ds_ptr);
-            Tcl_DStringAppendElement(multi_value_ds_ptr, Tcl_DStringValue(existing_value_ds_ptr));
-            // append the new value to the list
-            Tcl_DStringAppendElement(multi_value_ds_ptr, Tcl_DStringValue(&value_ds));
-            int newEntry = 0;
-            Tcl_SetHashValue(Tcl_CreateHashEntry(multivalue_query_string_parameters_HT_ptr, key_ptr, &newEntry), multi_value_ds_ptr);
+// returns the key object for the given lowercase header name, it has a zero ref count
+// if it is not one of the shared keys
+static Tcl_Obj *tws_GetHeaderKey(tws_request_keys_t *keys, const char *key, Tcl_Size key_length) {
+    Tcl_HashEntry *entry_ptr = Tcl_FindHashEntry(&keys->header_keys_HT, key);
+    if (entry_ptr != NULL) {
+        return Tcl_GetHashValue(entry_ptr);
+    }
+    if (keys->header_keys_HT.numEntries < TWS_MAX_SHARED_HEADER_KEYS) {
+        return tws_NewSharedHeaderKey(keys, key);
+    }
+    return Tcl_NewStringObj(key, key_length);
+}
 
-        } else {
-            Tcl_DString *multi_value_ds_ptr = Tcl_GetHashValue(existing_mv_entry_ptr);
-            // append the new value to the list
-            Tcl_DStringAppendElement(multi_value_ds_ptr, Tcl_DStringValue(&value_ds));
-        }
-    } else {
-        Tcl_DString *value_ds_ptr = (Tcl_DString *) ckalloc(sizeof(Tcl_DString));
-        Tcl_DStringInit(value_ds_ptr);
-        Tcl_DStringAppend(value_ds_ptr, Tcl_DStringValue(&value_ds), Tcl_DStringLength(&value_ds));
-        int newEntry = 0;
-        Tcl_SetHashValue(Tcl_CreateHashEntry(query_string_parameters_HT_ptr, key_ptr, &newEntry), value_ds_ptr);
+// puts the value in "single_value_dict_ptr" if this is the first value for the key, the first
+// value is the one that is kept there, and appends it to the list of all the values for the key
+// in "multi_value_dict_ptr" otherwise
+static int tws_AddMultiValue(Tcl_Obj *single_value_dict_ptr, Tcl_Obj *multi_value_dict_ptr, Tcl_Obj *key_ptr,
+                             Tcl_Obj *value_ptr) {
 
+    Tcl_Obj *existing_value_ptr;
+    if (TCL_OK != Tcl_DictObjGet(NULL, single_value_dict_ptr, key_ptr, &existing_value_ptr)) {
+        return TCL_ERROR;
     }
 
-    Tcl_DStringFree(&value_ds);
-    ckfree(key_ptr);
-    return TCL_OK;
-}
+    if (!existing_value_ptr) {
+        return Tcl_DictObjPut(NULL, single_value_dict_ptr, key_ptr, value_ptr);
+    }
 
-static void tws_FreeParseHashTable(Tcl_HashTable *ht_ptr) {
-    Tcl_HashSearch search;
-    Tcl_HashEntry *entry;
-    for (entry = Tcl_FirstHashEntry(ht_ptr, &search); entry != NULL; entry = Tcl_NextHashEntry(&search)) {
-        Tcl_DString *value_ds_ptr = Tcl_GetHashValue(entry);
-        Tcl_DStringFree(value_ds_ptr);
-        ckfree((char *) value_ds_ptr);
+    Tcl_Obj *multi_value_ptr;
+    if (TCL_OK != Tcl_DictObjGet(NULL, multi_value_dict_ptr, key_ptr, &multi_value_ptr)) {
+        return TCL_ERROR;
+    }
+
+    if (!multi_value_ptr) {
+        // it does not exist, create a new list with the existing value and the new one
+        Tcl_Obj *objv[2] = {existing_value_ptr, value_ptr};
+        return Tcl_DictObjPut(NULL, multi_value_dict_ptr, key_ptr, Tcl_NewListObj(2, objv));
     }
-    Tcl_DeleteHashTable(ht_ptr);
+
+    // the list is only referenced by the dict, append the new value to it in place
+    if (TCL_OK != Tcl_ListObjAppendElement(NULL, multi_value_ptr, value_ptr)) {
+        return TCL_ERROR;
+    }
+    Tcl_InvalidateStringRep(multi_value_dict_ptr);
+    return TCL_OK;
 }
 
-int
-tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_string, Tcl_Size query_string_length, Tcl_DString *parse_ds_ptr, int *error_num) {
-    // parse "query_string" into "queryStringParameters" given that it is of the form "key1=value1&key2=value2&..."
-//    Tcl_Obj *queryStringParametersPtr = Tcl_NewDictObj();
-//    Tcl_IncrRefCount(queryStringParametersPtr);
-//    Tcl_Obj *multiValueQueryStringParametersPtr = Tcl_NewDictObj();
-//    Tcl_IncrRefCount(multiValueQueryStringParametersPtr);
+static int tws_AddQueryStringParameter(Tcl_Encoding encoding, Tcl_Obj *query_string_parameters_ptr,
+                                       Tcl_Obj *multi_value_query_string_parameters_ptr, const char *key,
+                                       const char *value, Tcl_Size value_length, int *error_num) {
 
-    Tcl_HashTable query_string_parameters_HT;
-    Tcl_InitHashTable(&query_string_parameters_HT, TCL_STRING_KEYS);
+    Tcl_DString value_ds;
+    Tcl_DStringInit(&value_ds);
+    if (TCL_OK != tws_UrlDecode(encoding, value, value_length, &value_ds, error_num)) {
+        Tcl_DStringFree(&value_ds);
+        return TCL_ERROR;
+    }
 
-    Tcl_HashTable multi_value_query_string_parameters_HT;
-    Tcl_InitHashTable(&multi_value_query_string_parameters_HT, TCL_STRING_KEYS);
+    Tcl_Obj *key_ptr = Tcl_NewStringObj(key, value - key - 1);
+    Tcl_IncrRefCount(key_ptr);
+    Tcl_Obj *value_ptr = Tcl_NewStringObj(Tcl_DStringValue(&value_ds), Tcl_DStringLength(&value_ds));
+    Tcl_IncrRefCount(value_ptr);
+    Tcl_DStringFree(&value_ds);
+
+    int rc = tws_AddMultiValue(query_string_parameters_ptr, multi_value_query_string_parameters_ptr, key_ptr, value_ptr);
+    Tcl_DecrRefCount(value_ptr);
+    Tcl_DecrRefCount(key_ptr);
+    return rc;
+}
 
-//    Tcl_Size query_string_length;
-//    const char *query_string = Tcl_GetStringFromObj(queryStringPtr, &query_string_length);
+// The sections of the request that are built on demand, see tws_lazyRequestSectionType
+enum {
+    TWS_SECTION_QUERY_STRING_PARAMETERS,
+    TWS_SECTION_MULTI_VALUE_QUERY_STRING_PARAMETERS,
+    TWS_SECTION_BODY,
+    TWS_NUM_SECTIONS
+};
+
+// a copy of the raw query string or body that the lazy sections of the request dict are built from
+typedef struct {
+    Tcl_Size refCount;
+    Tcl_Encoding encoding;
+    char *buf;
+    Tcl_Size length;
+    Tcl_Obj *section_ptrs[TWS_NUM_SECTIONS];
+} tws_lazy_request_t;
+
+static tws_lazy_request_t *tws_NewLazyRequest(const char *buf, Tcl_Size length);
+static void tws_ReleaseLazyRequest(tws_lazy_request_t *lazy);
+static Tcl_Obj *tws_NewLazySectionObj(tws_lazy_request_t *lazy, int section);
+
+static int tws_ParseQueryStringParameterDicts(Tcl_Encoding encoding, const char *query_string,
+                                              Tcl_Size query_string_length, Tcl_Obj *query_string_parameters_ptr,
+                                              Tcl_Obj *multi_value_query_string_parameters_ptr, int *error_num) {
+    // parse "query_string" into "queryStringParameters" given that it is of the form "key1=value1&key2=value2&..."
     const char *p = query_string;
     const char *end = query_string + query_string_length;
     while (p < end) {
@@ -212,12 +341,6 @@ tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_string,
             p++;
         }
         if (p == end) {
-//            Tcl_DecrRefCount(multiValueQueryStringParametersPtr);
-//            Tcl_DecrRefCount(queryStringParametersPtr);
-            tws_FreeParseHashTable(&query_string_parameters_HT);
-            tws_FreeParseHashTable(&multi_value_query_string_parameters_HT);
-
-//            SetResult("query string parse error");
             *error_num = ERROR_NO_HEADER_KEY;
             return TCL_ERROR;
         }
@@ -225,91 +348,78 @@ tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_string,
         while (p < end && *p != '&') {
             p++;
         }
+        if (TCL_OK != tws_AddQueryStringParameter(encoding, query_string_parameters_ptr,
+                                                  multi_value_query_string_parameters_ptr, key, value, p - value,
+                                                  error_num)) {
+            return TCL_ERROR;
+        }
         if (p == end) {
-            if (TCL_OK !=
-                tws_AddQueryStringParameter(encoding, &query_string_parameters_HT,
-                                            &multi_value_query_string_parameters_HT, key,
-                                            value, p - value, error_num)) {
-
-//                Tcl_DecrRefCount(multiValueQueryStringParametersPtr);
-//                Tcl_DecrRefCount(queryStringParametersPtr);
-                // todo: free hash table entries
-                Tcl_DeleteHashTable(&query_string_parameters_HT);
-                Tcl_DeleteHashTable(&multi_value_query_string_parameters_HT);
-
-//                SetResult("query string parse error");
-                return TCL_ERROR;
-            }
             break;
         }
-        if (TCL_OK !=
-            tws_AddQueryStringParameter(encoding, &query_string_parameters_HT, &multi_value_query_string_parameters_HT,
-                                        key,
-                                        value, p - value, error_num)) {
-//            Tcl_DecrRefCount(multiValueQueryStringParametersPtr);
-//            Tcl_DecrRefCount(queryStringParametersPtr);
+        p++;
+    }
+    return TCL_OK;
+}
+
+int tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_string, Tcl_Size query_string_length,
+                                   Tcl_Obj *result_ptr, int *error_num) {
+    tws_request_keys_t *keys = tws_GetRequestKeys();
+
+    Tcl_Obj *query_string_parameters_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(query_string_parameters_ptr);
+    Tcl_Obj *multi_value_query_string_parameters_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(multi_value_query_string_parameters_ptr);
+
+    if (TCL_OK != tws_ParseQueryStringParameterDicts(encoding, query_string, query_string_length,
+                                                     query_string_parameters_ptr,
+                                                     multi_value_query_string_parameters_ptr, error_num)) {
+        Tcl_DecrRefCount(multi_value_query_string_parameters_ptr);
+        Tcl_DecrRefCount(query_string_parameters_ptr);
+        return TCL_ERROR;
+    }
 
-            Tcl_DeleteHashTable(&query_string_parameters_HT);
-            Tcl_DeleteHashTable(&multi_value_query_string_parameters_HT);
+    Tcl_DictObjPut(NULL, result_ptr, keys->query_string_parameters_key_ptr, query_string_parameters_ptr);
+    Tcl_DictObjPut(NULL, result_ptr, keys->multi_value_query_string_parameters_key_ptr,
+                   multi_value_query_string_parameters_ptr);
+    Tcl_DecrRefCount(multi_value_query_string_parameters_ptr);
+    Tcl_DecrRefCount(query_string_parameters_ptr);
+    return TCL_OK;
+}
 
-//            SetResult("query string parse error");
+// checks the query string for the errors that tws_ParseQueryStringParameterDicts would find,
+// without decoding it
+static int tws_CheckQueryString(const char *query_string, Tcl_Size query_string_length, int *error_num) {
+    const char *p = query_string;
+    const char *end = query_string + query_string_length;
+    while (p < end) {
+        while (p < end && *p != '=') {
+            p++;
+        }
+        if (p == end) {
+            *error_num = ERROR_NO_HEADER_KEY;
             return TCL_ERROR;
         }
         p++;
+        while (p < end && *p != '&') {
+            if (*p == '%') {
+                if (p + 3 > end || !tws_IsCharOfType(p[1], CHAR_HEX) || !tws_IsCharOfType(p[2], CHAR_HEX)) {
+                    *error_num = ERROR_URLDECODE_INVALID_SEQUENCE;
+                    return TCL_ERROR;
+                }
+                p += 2;
+            }
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        p++;
     }
-
-    Tcl_DStringAppend(parse_ds_ptr, " queryStringParameters ", -1);
-    Tcl_DStringStartSublist(parse_ds_ptr);
-    Tcl_HashSearch search;
-    Tcl_HashEntry *entry;
-    for (entry = Tcl_FirstHashEntry(&query_string_parameters_HT, &search); entry != NULL;
-         entry = Tcl_NextHashEntry(&search)) {
-        const char *key = Tcl_GetHashKey(&query_string_parameters_HT, entry);
-        Tcl_DString *value_ds_ptr = Tcl_GetHashValue(entry);
-        Tcl_DStringAppend(parse_ds_ptr, key, -1);
-        Tcl_DStringAppend(parse_ds_ptr, " ", -1);
-        Tcl_DStringAppend(parse_ds_ptr, Tcl_DStringValue(value_ds_ptr), Tcl_DStringLength(value_ds_ptr));
-    }
-    Tcl_DStringEndSublist(parse_ds_ptr);
-
-//    if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("queryStringParameters", -1), queryStringParametersPtr)) {
-//        Tcl_DecrRefCount(multiValueQueryStringParametersPtr);
-//        Tcl_DecrRefCount(queryStringParametersPtr);
-//        SetResult("query string parameters put error");
-//        return TCL_ERROR;
-//    }
-
-    Tcl_DStringAppend(parse_ds_ptr, " multiValueQueryStringParameters ", -1);
-    Tcl_DStringStartSublist(parse_ds_ptr);
-    for (entry = Tcl_FirstHashEntry(&multi_value_query_string_parameters_HT, &search); entry != NULL;
-         entry = Tcl_NextHashEntry(&search)) {
-        const char *key = Tcl_GetHashKey(&multi_value_query_string_parameters_HT, entry);
-        Tcl_DString *value = Tcl_GetHashValue(entry);
-        Tcl_DStringAppendElement(parse_ds_ptr, key);
-//        Tcl_DStringStartSublist(parse_ds_ptr);
-        Tcl_DStringAppendElement(parse_ds_ptr, Tcl_DStringValue(value));
-//        Tcl_DStringEndSublist(parse_ds_ptr);
-    }
-    Tcl_DStringEndSublist(parse_ds_ptr);
-
-//    if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("multiValueQueryStringParameters", -1),
-//                   multiValueQueryStringParametersPtr)) {
-//        Tcl_DecrRefCount(multiValueQueryStringParametersPtr);
-//        Tcl_DecrRefCount(queryStringParametersPtr);
-//        SetResult("multi value query string parameters put error");
-//        return TCL_ERROR;
-//    }
-//    Tcl_DecrRefCount(multiValueQueryStringParametersPtr);
-//    Tcl_DecrRefCount(queryStringParametersPtr);
-
-    // todo: free hash table entries
-    Tcl_DeleteHashTable(&query_string_parameters_HT);
-    Tcl_DeleteHashTable(&multi_value_query_string_parameters_HT);
     return TCL_OK;
 }
 
-static int tws_ParsePathAndQueryString(Tcl_Encoding encoding, const char *url, Tcl_Size url_length,
-                                       Tcl_DString *parse_ds_ptr, int *error_num) {
+static int tws_ParsePathAndQueryString(Tcl_Encoding encoding, tws_request_keys_t *keys, Tcl_Obj *url_ptr,
+                                       const char *url, Tcl_Size url_length, Tcl_Obj *result_ptr, int *error_num) {
     // parse "path" and "queryStringParameters" from "url"
     const char *p2 = url;
     const char *end = url + url_length;
@@ -324,57 +434,32 @@ static int tws_ParsePathAndQueryString(Tcl_Encoding encoding, const char *url, T
                 return TCL_ERROR;
             }
 
-            Tcl_DStringAppend(parse_ds_ptr, " path ", -1);
-            Tcl_DStringStartSublist(parse_ds_ptr);
-            Tcl_DStringAppend(parse_ds_ptr, Tcl_DStringValue(&path_ds), Tcl_DStringLength(&path_ds));
-            Tcl_DStringEndSublist(parse_ds_ptr);
+            Tcl_DictObjPut(NULL, result_ptr, keys->path_key_ptr,
+                           Tcl_NewStringObj(Tcl_DStringValue(&path_ds), Tcl_DStringLength(&path_ds)));
             Tcl_DStringFree(&path_ds);
 
-//            if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("path", -1), pathPtr)) {
-//                Tcl_DecrRefCount(pathPtr);
-//                SetResult("path dict put error");
-//                return TCL_ERROR;
-//            }
-//            Tcl_DecrRefCount(pathPtr);
-
             Tcl_Size query_string_length = url + url_length - p2 - 1;
-//            Tcl_Obj *queryStringPtr = Tcl_NewStringObj(p2 + 1, query_string_length);
-
-            Tcl_DStringAppend(parse_ds_ptr, " queryString ", -1);
-            Tcl_DStringStartSublist(parse_ds_ptr);
-            Tcl_DStringAppend(parse_ds_ptr, p2 + 1, query_string_length);
-            Tcl_DStringEndSublist(parse_ds_ptr);
-
-//            Tcl_IncrRefCount(queryStringPtr);
-//            if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("queryString", -1), queryStringPtr)) {
-//                Tcl_DecrRefCount(queryStringPtr);
-//                SetResult("queryString dict put error");
-//                return TCL_ERROR;
-//            }
-            if (TCL_OK != tws_ParseQueryStringParameters(encoding, p2 + 1, query_string_length, parse_ds_ptr, error_num)) {
+            Tcl_DictObjPut(NULL, result_ptr, keys->query_string_key_ptr, Tcl_NewStringObj(p2 + 1, query_string_length));
+
+            // the query string parameters are decoded when they are asked for
+            if (TCL_OK != tws_CheckQueryString(p2 + 1, query_string_length, error_num)) {
                 return TCL_ERROR;
             }
-//            Tcl_DecrRefCount(queryStringPtr);
+            tws_lazy_request_t *lazy = tws_NewLazyRequest(p2 + 1, query_string_length);
+            lazy->encoding = Tcl_GetEncoding(NULL, Tcl_GetEncodingName(encoding));
+            Tcl_DictObjPut(NULL, result_ptr, keys->query_string_parameters_key_ptr,
+                           tws_NewLazySectionObj(lazy, TWS_SECTION_QUERY_STRING_PARAMETERS));
+            Tcl_DictObjPut(NULL, result_ptr, keys->multi_value_query_string_parameters_key_ptr,
+                           tws_NewLazySectionObj(lazy, TWS_SECTION_MULTI_VALUE_QUERY_STRING_PARAMETERS));
+            tws_ReleaseLazyRequest(lazy);
             break;
         }
         p2++;
     }
     if (p2 == end) {
-        Tcl_DStringAppend(parse_ds_ptr, " path ", -1);
-        Tcl_DStringStartSublist(parse_ds_ptr);
-        Tcl_DStringAppend(parse_ds_ptr, url, url_length);
-        Tcl_DStringEndSublist(parse_ds_ptr);
-        Tcl_DStringAppend(parse_ds_ptr, " queryString ", -1);
-        Tcl_DStringAppend(parse_ds_ptr, "{}", -1);
-
-//        if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("path", -1), Tcl_NewStringObj(url, url_length))) {
-//            SetResult("path dict put error");
-//            return TCL_ERROR;
-//        }
-//        if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("queryString", -1), Tcl_NewStringObj("", -1))) {
-//            SetResult("queryString dict put error");
-//            return TCL_ERROR;
-//        }
+        // the path is the url itself
+        Tcl_DictObjPut(NULL, result_ptr, keys->path_key_ptr, url_ptr);
+        Tcl_DictObjPut(NULL, result_ptr, keys->query_string_key_ptr, Tcl_NewObj());
     }
     return TCL_OK;
 }
@@ -395,6 +480,13 @@ static inline int tws_IsHttpMethod(const char *p, size_t len) {
             ));
 }
 
+// the methods that are served from tls early data, which may be a replay (RFC 8470)
+static inline int tws_IsSafeHttpMethod(const char *p, Tcl_Size len) {
+    return (len == 3 && memcmp(p, "GET", 3) == 0)
+           || (len == 4 && memcmp(p, "HEAD", 4) == 0)
+           || (len == 7 && memcmp(p, "OPTIONS", 7) == 0);
+}
+
 static inline int tws_IsHttpVersion(const char *p, size_t len) {
     return (len >= 6 && *p == 'H' && *(p + 1) == 'T' && *(p + 2) == 'T' && *(p + 3) == 'P' && *(p + 4) == '/' &&
             CHARTYPE(digit, *(p + 5)))
@@ -402,8 +494,8 @@ static inline int tws_IsHttpVersion(const char *p, size_t len) {
            && (len < 8 || CHARTYPE(digit, *(p + 7)));
 }
 
-static int tws_ParseRequestLine(Tcl_Encoding encoding, const char **currPtr, const char *end,
-                                Tcl_DString *parse_ds_ptr, int *error_num) {
+static int tws_ParseRequestLine(Tcl_Encoding encoding, tws_request_keys_t *keys, const char **currPtr,
+                                const char *end, Tcl_Obj *result_ptr, int *error_num) {
     const char *curr = *currPtr;
     // skip spaces
     while (curr < end && CHARTYPE(space, *curr) != 0) {
@@ -435,10 +527,7 @@ static int tws_ParseRequestLine(Tcl_Encoding encoding, const char **currPtr, con
         return TCL_ERROR;
     }
 
-    Tcl_DStringAppend(parse_ds_ptr, "httpMethod ", -1);
-    Tcl_DStringStartSublist(parse_ds_ptr);
-    Tcl_DStringAppend(parse_ds_ptr, p, http_method_length);
-    Tcl_DStringEndSublist(parse_ds_ptr);
+    Tcl_DictObjPut(NULL, result_ptr, keys->http_method_key_ptr, Tcl_NewStringObj(p, http_method_length));
 
 //    if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("httpMethod", -1), Tcl_NewStringObj(p, http_method_length))) {
 //        SetResult("request line parse error: dict put error");
@@ -467,17 +556,15 @@ static int tws_ParseRequestLine(Tcl_Encoding encoding, const char **currPtr, con
 //    url[curr - p - 1] = '\0';
     Tcl_Size url_length = curr - p - 1;
 
-    Tcl_DStringAppend(parse_ds_ptr, " url ", -1);
-    Tcl_DStringStartSublist(parse_ds_ptr);
-    Tcl_DStringAppend(parse_ds_ptr, p, url_length);
-    Tcl_DStringEndSublist(parse_ds_ptr);
+    Tcl_Obj *url_ptr = Tcl_NewStringObj(p, url_length);
+    Tcl_DictObjPut(NULL, result_ptr, keys->url_key_ptr, url_ptr);
 
 //    if (TCL_OK != Tcl_DictObjPut(interp, resultPtr, Tcl_NewStringObj("url", -1), Tcl_NewStringObj(p, url_length))) {
 //        SetResult("request line parse error: dict put error");
 //        return TCL_ERROR;
 //    }
 
-    if (TCL_OK != tws_ParsePathAndQueryString(encoding, p, url_length, parse_ds_ptr, error_num)) {
+    if (TCL_OK != tws_ParsePathAndQueryString(encoding, keys, url_ptr, p, url_length, result_ptr, error_num)) {
         return TCL_ERROR;
     }
 
@@ -512,10 +599,7 @@ static int tws_ParseRequestLine(Tcl_Encoding encoding, const char **currPtr, con
             return TCL_ERROR;
         }
 
-        Tcl_DStringAppend(parse_ds_ptr, " version ", -1);
-        Tcl_DStringStartSublist(parse_ds_ptr);
-        Tcl_DStringAppend(parse_ds_ptr, p, curr - p);
-        Tcl_DStringEndSublist(parse_ds_ptr);
+        Tcl_DictObjPut(NULL, result_ptr, keys->version_key_ptr, Tcl_NewStringObj(p, curr - p));
 
         // mark the end of the token and remember as "version"
         curr++;
@@ -531,59 +615,31 @@ static int tws_ParseRequestLine(Tcl_Encoding encoding, const char **currPtr, con
 
 }
 
-static int tws_AddHeader(Tcl_HashTable *headers_HT_ptr, Tcl_HashTable *multi_value_headers_HT_ptr, const char *key,
-                         const char *value) {
-
-    // check if "key" already exists in "headers"
-    Tcl_HashEntry *existing_entry_ptr = Tcl_FindHashEntry(headers_HT_ptr, key);
-    if (existing_entry_ptr != NULL) {
-        // check if "key" already exists in "multiValueHeaders"
-        Tcl_HashEntry *existing_mv_entry_ptr = Tcl_FindHashEntry(multi_value_headers_HT_ptr, key);
-
-        if (existing_mv_entry_ptr == NULL) {
-            // it does not exist, create a new list and add the existing value from headers
-
-            Tcl_DString *existing_value_ds_ptr = Tcl_GetHashValue(existing_entry_ptr);
-            Tcl_DString *multi_value_ds_ptr = (Tcl_DString *) ckalloc(sizeof(Tcl_DString));
-            Tcl_DStringInit(multi_value_ds_ptr);
-            Tcl_DStringAppendElement(multi_value_ds_ptr, Tcl_DStringValue(existing_value_ds_ptr));
-            // append the new value to the list
-            Tcl_DStringAppendElement(multi_value_ds_ptr, value);
-            int newEntry = 0;
-            Tcl_SetHashValue(Tcl_CreateHashEntry(multi_value_headers_HT_ptr, key, &newEntry), multi_value_ds_ptr);
-        } else {
-
-            Tcl_DString *multi_value_ds_ptr = Tcl_GetHashValue(existing_mv_entry_ptr);
-            // append the new value to the list
-            Tcl_DStringAppendElement(multi_value_ds_ptr, value);
-        }
-    } else {
-        Tcl_DString *value_ds_ptr = (Tcl_DString *) ckalloc(sizeof(Tcl_DString));
-        Tcl_DStringInit(value_ds_ptr);
-        Tcl_DStringAppend(value_ds_ptr, value, strlen(value));
+static int tws_AddHeader(tws_request_keys_t *keys, Tcl_Obj *headers_ptr, Tcl_Obj *multi_value_headers_ptr,
+                         Tcl_DString *key_ds_ptr, Tcl_Obj *value_ptr) {
 
-        int newEntry = 0;
-        Tcl_SetHashValue(Tcl_CreateHashEntry(headers_HT_ptr, key, &newEntry), value_ds_ptr);
-    }
-
-    return TCL_OK;
+    Tcl_Obj *key_ptr = tws_GetHeaderKey(keys, Tcl_DStringValue(key_ds_ptr), Tcl_DStringLength(key_ds_ptr));
+    Tcl_IncrRefCount(key_ptr);
+    int rc = tws_AddMultiValue(headers_ptr, multi_value_headers_ptr, key_ptr, value_ptr);
+    Tcl_DecrRefCount(key_ptr);
+    return rc;
 }
 
-static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable *headers_HT_ptr,
-                            Tcl_HashTable *multi_value_headers_HT_ptr, int *error_num) {
+static int tws_ParseHeaders(tws_request_keys_t *keys, const char **currPtr, const char *end, Tcl_Obj *headers_ptr,
+                            Tcl_Obj *multi_value_headers_ptr, int *error_num) {
 
     // parse the headers, each header is a line of the form "key: value"
     // stop when we reach an empty line denoted by "\r\n" or "\n"
     const char *curr = *currPtr;
+    Tcl_DString key_ds;
+    Tcl_DStringInit(&key_ds);
     while (curr < end) {
         const char *p = curr;
 
         // collect non-space chars as header key
-        while (curr < end && CHARTYPE(space, *curr) == 0 && *curr != ':') {
-            curr++;
-        }
+        curr = tws_FindHeaderKeyEnd(curr, end);
         if (curr == end) {
-//            SetResult("ParseHeaders: no header key");
+            Tcl_DStringFree(&key_ds);
             *error_num = ERROR_NO_HEADER_KEY;
             return TCL_ERROR;
         }
@@ -591,10 +647,11 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
         // mark the end of the token and remember as "key"
         curr++;
         Tcl_Size keylen = curr - p - 1;
-        char *key = tws_strndup(p, keylen);
         // lowercase "key"
+        Tcl_DStringSetLength(&key_ds, keylen);
+        char *key = Tcl_DStringValue(&key_ds);
         for (int i = 0; i < keylen; i++) {
-            key[i] = tolower(key[i]);
+            key[i] = tolower(p[i]);
         }
 
         // skip spaces
@@ -604,20 +661,14 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
         p = curr;
 
         // collect all chars to the end of line as header value
-        while (curr < end && *curr != '\r' && *curr != '\n') {
-            curr++;
-        }
+        curr = tws_FindLineEnd(curr, end);
 
         // mark the end of the token and remember as "value"
-//        curr++;
-
         Tcl_Size valuelen = curr - p;
-//        char *value = tws_strndup(p, valuelen);
-        Tcl_DString value_ds;
-        Tcl_DStringInit(&value_ds);
-        Tcl_DStringAppend(&value_ds, p, valuelen);
+        Tcl_Obj *value_ptr = Tcl_NewStringObj(p, valuelen);
+        Tcl_IncrRefCount(value_ptr);
 
-        DBG2(printf("key=%s value=%s\n", key, Tcl_DStringValue(&value_ds)));
+        DBG2(printf("key=%s value=%s\n", key, Tcl_GetString(value_ptr)));
 
         // skip spaces until end of line denoted by "\r\n" or "\n"
         while (curr < end && CHARTYPE(space, *curr) != 0 && *curr != '\r' && *curr != '\n') {
@@ -626,19 +677,15 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
 
         // check if we reached the end
         if (curr == end) {
-            if (TCL_OK != tws_AddHeader(headers_HT_ptr, multi_value_headers_HT_ptr, key, Tcl_DStringValue(&value_ds))) {
-                ckfree(key);
-                Tcl_DStringFree(&value_ds);
+            int rc = tws_AddHeader(keys, headers_ptr, multi_value_headers_ptr, &key_ds, value_ptr);
+            Tcl_DecrRefCount(value_ptr);
+            Tcl_DStringFree(&key_ds);
+            if (TCL_OK != rc) {
                 return TCL_ERROR;
             }
-            ckfree(key);
-            Tcl_DStringFree(&value_ds);
             break;
         }
 
-        // print 3 chars from curr
-//        fprintf(stderr, "here1: curr[0]=%c curr[1]=%c curr[2]=%c\n", curr[0], curr[1], curr[2]);
-
         // skip "\r\n" or "\n" at most once
         if (curr + 1 < end && *curr == '\r' && *(curr + 1) == '\n') {
             curr += 2;
@@ -650,18 +697,12 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
 
         // check if we reached the end
         if (curr == end) {
-            if (TCL_OK != tws_AddHeader(headers_HT_ptr, multi_value_headers_HT_ptr, key, Tcl_DStringValue(&value_ds))) {
-//                Tcl_DecrRefCount(keyPtr);
-//                Tcl_DecrRefCount(valuePtr);
-//                SetResult("ParseHeaders: failed adding header (2)");
-                ckfree(key);
-                Tcl_DStringFree(&value_ds);
+            int rc = tws_AddHeader(keys, headers_ptr, multi_value_headers_ptr, &key_ds, value_ptr);
+            Tcl_DecrRefCount(value_ptr);
+            Tcl_DStringFree(&key_ds);
+            if (TCL_OK != rc) {
                 return TCL_ERROR;
             }
-//            Tcl_DecrRefCount(keyPtr);
-//            Tcl_DecrRefCount(valuePtr);
-            ckfree(key);
-            Tcl_DStringFree(&value_ds);
             break;
         }
 
@@ -675,17 +716,11 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
             p = curr;
 
             // read the new line to the end by advancing "curr"
-            while (curr < end && *curr != '\r' && *curr != '\n') {
-                curr++;
-            }
+            curr = tws_FindLineEnd(curr, end);
 
-            // mark the end of the string and remember as "continuation_value"
+            // mark the end of the string and append the continuation value to the previous value
             curr++;
-            Tcl_Size continuation_valuelen = curr - p - 1;
-            char *continuation_value = tws_strndup(p, continuation_valuelen);
-            // append the continuation value to the previous value
-            Tcl_DStringAppend(&value_ds, continuation_value, continuation_valuelen);
-            ckfree(continuation_value);
+            Tcl_AppendToObj(value_ptr, p, curr - p - 1);
 
             // skip "\r\n" or "\n" at most once
             if (curr + 1 < end && *curr == '\r' && *(curr + 1) == '\n') {
@@ -698,16 +733,12 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
 
         }
 
-        if (TCL_OK != tws_AddHeader(headers_HT_ptr, multi_value_headers_HT_ptr, key, Tcl_DStringValue(&value_ds))) {
-            ckfree(key);
-            Tcl_DStringFree(&value_ds);
+        int rc = tws_AddHeader(keys, headers_ptr, multi_value_headers_ptr, &key_ds, value_ptr);
+        Tcl_DecrRefCount(value_ptr);
+        if (TCL_OK != rc) {
+            Tcl_DStringFree(&key_ds);
             return TCL_ERROR;
         }
-        ckfree(key);
-        Tcl_DStringFree(&value_ds);
-
-        // print 3 chars from curr
-//        fprintf(stderr, "here2: curr[0]=%c curr[1]=%c curr[2]=%c\n", curr[0], curr[1], curr[2]);
 
         // check if we reached a blank line
         if (curr + 1 < end && *curr == '\r' && *(curr + 1) == '\n') {
@@ -721,13 +752,162 @@ static int tws_ParseHeaders(const char **currPtr, const char *end, Tcl_HashTable
             break;
         }
     }
+    Tcl_DStringFree(&key_ds);
     *currPtr = curr;
     return TCL_OK;
 
 }
 
+// The query string parameters and a binary body are kept as values of this type in the
+// request dict. They are decoded from a copy of the raw request only when they are asked
+// for, so that a handler that does not look at them does not pay for them. get_query_param,
+// get_param and get_form use the decoded values directly, any other access turns the value
+// into a plain dict or string.
+static void tws_FreeLazySectionInternalRep(Tcl_Obj *objPtr);
+static void tws_DupLazySectionInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+static void tws_UpdateLazySectionString(Tcl_Obj *objPtr);
+
+static const Tcl_ObjType tws_lazyRequestSectionType = {
+        "twebserver.requestSection",
+        tws_FreeLazySectionInternalRep,
+        tws_DupLazySectionInternalRep,
+        tws_UpdateLazySectionString,
+        NULL,
+#ifdef TCL_OBJTYPE_V0
+        TCL_OBJTYPE_V0
+#endif
+};
+
+// the lazy request is freed once the last of the section objects that refer to it is freed,
+// tws_ReleaseLazyRequest drops the reference that the caller of tws_NewLazyRequest holds
+static tws_lazy_request_t *tws_NewLazyRequest(const char *buf, Tcl_Size length) {
+    tws_lazy_request_t *lazy = (tws_lazy_request_t *) ckalloc(sizeof(tws_lazy_request_t));
+    memset(lazy, 0, sizeof(tws_lazy_request_t));
+    lazy->refCount = 1;
+    lazy->buf = ckalloc(length + 1);
+    memcpy(lazy->buf, buf, length);
+    lazy->buf[length] = '\0';
+    lazy->length = length;
+    return lazy;
+}
+
+static void tws_ReleaseLazyRequest(tws_lazy_request_t *lazy) {
+    if (--lazy->refCount > 0) {
+        return;
+    }
+    for (int i = 0; i < TWS_NUM_SECTIONS; i++) {
+        if (lazy->section_ptrs[i]) {
+            Tcl_DecrRefCount(lazy->section_ptrs[i]);
+        }
+    }
+    if (lazy->encoding) {
+        Tcl_FreeEncoding(lazy->encoding);
+    }
+    ckfree(lazy->buf);
+    ckfree((char *) lazy);
+}
+
+static Tcl_Obj *tws_NewLazySectionObj(tws_lazy_request_t *lazy, int section) {
+    Tcl_Obj *objPtr = Tcl_NewObj();
+    Tcl_InvalidateStringRep(objPtr);
+    objPtr->internalRep.ptrAndLongRep.ptr = lazy;
+    objPtr->internalRep.ptrAndLongRep.value = (unsigned long) section;
+    objPtr->typePtr = &tws_lazyRequestSectionType;
+    lazy->refCount++;
+    return objPtr;
+}
+
+static void tws_FreeLazySectionInternalRep(Tcl_Obj *objPtr) {
+    tws_ReleaseLazyRequest((tws_lazy_request_t *) objPtr->internalRep.ptrAndLongRep.ptr);
+    objPtr->typePtr = NULL;
+}
+
+static void tws_DupLazySectionInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr) {
+    tws_lazy_request_t *lazy = (tws_lazy_request_t *) srcPtr->internalRep.ptrAndLongRep.ptr;
+    dupPtr->internalRep.ptrAndLongRep.ptr = lazy;
+    dupPtr->internalRep.ptrAndLongRep.value = srcPtr->internalRep.ptrAndLongRep.value;
+    dupPtr->typePtr = &tws_lazyRequestSectionType;
+    lazy->refCount++;
+}
+
+// builds both the single and the multi value dict of the query string parameters
+static void tws_BuildLazySection(tws_lazy_request_t *lazy) {
+    Tcl_Obj *single_value_ptr = Tcl_NewDictObj();
+    Tcl_Obj *multi_value_ptr = Tcl_NewDictObj();
+    int error_num = 0;
+
+    // the query string was checked already when the request was parsed
+    tws_ParseQueryStringParameterDicts(lazy->encoding, lazy->buf, lazy->length, single_value_ptr, multi_value_ptr,
+                                       &error_num);
+
+    Tcl_IncrRefCount(single_value_ptr);
+    Tcl_IncrRefCount(multi_value_ptr);
+    lazy->section_ptrs[TWS_SECTION_QUERY_STRING_PARAMETERS] = single_value_ptr;
+    lazy->section_ptrs[TWS_SECTION_MULTI_VALUE_QUERY_STRING_PARAMETERS] = multi_value_ptr;
+}
+
+static Tcl_Obj *tws_GetLazySection(tws_lazy_request_t *lazy, int section) {
+    if (!lazy->section_ptrs[section]) {
+        tws_BuildLazySection(lazy);
+    }
+    return lazy->section_ptrs[section];
+}
+
+static void tws_UpdateLazySectionString(Tcl_Obj *objPtr) {
+    tws_lazy_request_t *lazy = (tws_lazy_request_t *) objPtr->internalRep.ptrAndLongRep.ptr;
+    int section = (int) objPtr->internalRep.ptrAndLongRep.value;
+
+    if (section == TWS_SECTION_BODY) {
+        // a binary body is base64 encoded
+        objPtr->bytes = ckalloc(2 * lazy->length + 4);
+        Tcl_Size length = 0;
+        if (base64_encode(lazy->buf, lazy->length, objPtr->bytes, &length)) {
+            length = 0;
+        }
+        objPtr->bytes[length] = '\0';
+        objPtr->length = length;
+        return;
+    }
+
+    Tcl_Size length;
+    const char *bytes = Tcl_GetStringFromObj(tws_GetLazySection(lazy, section), &length);
+    objPtr->bytes = ckalloc(length + 1);
+    memcpy(objPtr->bytes, bytes, length + 1);
+    objPtr->length = length;
+}
+
+int tws_GetRequestDictValue(Tcl_Interp *interp, Tcl_Obj *req_dict_ptr, Tcl_Obj *key_ptr, Tcl_Obj **value_ptr) {
+    if (TCL_OK != Tcl_DictObjGet(interp, req_dict_ptr, key_ptr, value_ptr)) {
+        return TCL_ERROR;
+    }
+    Tcl_Obj *objPtr = *value_ptr;
+    if (objPtr && objPtr->typePtr == &tws_lazyRequestSectionType) {
+        int section = (int) objPtr->internalRep.ptrAndLongRep.value;
+        if (section != TWS_SECTION_BODY) {
+            *value_ptr = tws_GetLazySection((tws_lazy_request_t *) objPtr->internalRep.ptrAndLongRep.ptr, section);
+        }
+    }
+    return TCL_OK;
+}
+
+int tws_GetRawRequestBody(Tcl_Obj *body_ptr, const char **body_ptr_ptr, Tcl_Size *body_length_ptr) {
+    if (body_ptr->typePtr != &tws_lazyRequestSectionType) {
+        return 0;
+    }
+    if ((int) body_ptr->internalRep.ptrAndLongRep.value != TWS_SECTION_BODY) {
+        return 0;
+    }
+    tws_lazy_request_t *lazy = (tws_lazy_request_t *) body_ptr->internalRep.ptrAndLongRep.ptr;
+    *body_ptr_ptr = lazy->buf;
+    *body_length_ptr = lazy->length;
+    return 1;
+}
+
 int tws_ParseBody(tws_conn_t *conn, const char *curr, const char *end, int *error_num) {
+    UNUSED(error_num);
 
+    tws_request_keys_t *keys = tws_GetRequestKeys();
+    Tcl_Obj *req_dict_ptr = conn->req_dict_ptr;
     Tcl_Size content_length = end - curr;
 
     const char *content_type = conn->content_type;
@@ -767,8 +947,8 @@ int tws_ParseBody(tws_conn_t *conn, const char *curr, const char *end, int *erro
 //                        SetResult("dict put error");
 //                        return TCL_ERROR;
 //                    }
-                    Tcl_DStringAppend(&conn->parse_ds, " multipartBoundary ", -1);
-                    Tcl_DStringAppend(&conn->parse_ds, p, content_type_end - p);
+                    Tcl_DictObjPut(NULL, req_dict_ptr, keys->multipart_boundary_key_ptr,
+                                   Tcl_NewStringObj(p, content_type_end - p));
                 }
             }
         }
@@ -779,41 +959,42 @@ int tws_ParseBody(tws_conn_t *conn, const char *curr, const char *end, int *erro
 //        return TCL_ERROR;
 //    }
 
-    Tcl_DStringAppend(&conn->parse_ds, " isBase64Encoded ", -1);
-    Tcl_DStringAppend(&conn->parse_ds, base64_encode_it ? "1" : "0", 1);
+    if (conn->body_file_path) {
+        // the body is in the file, get_form parses it from there
+        close(conn->body_file_fd);
+        conn->body_file_fd = -1;
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_base64_encoded_key_ptr, Tcl_NewBooleanObj(0));
+        if (conn->accept_ctx->server->binary_body_bytearray) {
+            Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_binary_key_ptr, Tcl_NewBooleanObj(0));
+        }
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_key_ptr, Tcl_NewObj());
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_file_key_ptr, Tcl_NewStringObj(conn->body_file_path, -1));
+        return TCL_OK;
+    }
 
-    if (base64_encode_it) {
-        // base64 encode the body and remember as "body"
-        char *body = ckalloc(content_length * 2);
-        Tcl_Size body_length;
-        if (base64_encode(curr, content_length, body, &body_length)) {
-            ckfree(body);
-//            SetResult("base64_encode failed");
-            *error_num = ERROR_BASE64_ENCODE_BODY;
-            return TCL_ERROR;
+    if (conn->accept_ctx->server->binary_body_bytearray) {
+        // a binary body is a byte array, as it came with the request
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_base64_encoded_key_ptr, Tcl_NewBooleanObj(0));
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_binary_key_ptr, Tcl_NewBooleanObj(base64_encode_it));
+        if (base64_encode_it) {
+            Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_key_ptr,
+                           Tcl_NewByteArrayObj((const unsigned char *) curr, content_length));
+        } else {
+            Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_key_ptr, Tcl_NewStringObj(curr, content_length));
         }
-//        if (TCL_OK != Tcl_DictObjPut(interp, result_ptr, Tcl_NewStringObj("body", -1), Tcl_NewStringObj(body, body_length))) {
-//            ckfree(body);
-//            SetResult("dict put error");
-//            return TCL_ERROR;
-//        }
-
-        Tcl_DStringAppend(&conn->parse_ds, " body ", -1);
-        Tcl_DStringStartSublist(&conn->parse_ds);
-        Tcl_DStringAppend(&conn->parse_ds, body, body_length);
-        Tcl_DStringEndSublist(&conn->parse_ds);
-
-        ckfree(body);
-    } else {
-        // mark the end of the token and remember as "body"
-        char *body = tws_strndup(curr, content_length);
+        return TCL_OK;
+    }
 
-        Tcl_DStringAppend(&conn->parse_ds, " body ", -1);
-        Tcl_DStringStartSublist(&conn->parse_ds);
-        Tcl_DStringAppend(&conn->parse_ds, body, content_length);
-        Tcl_DStringEndSublist(&conn->parse_ds);
+    Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_base64_encoded_key_ptr, Tcl_NewBooleanObj(base64_encode_it));
 
-        ckfree(body);
+    if (base64_encode_it) {
+        // the body is base64 encoded when a script asks for it as "body"
+        tws_lazy_request_t *lazy = tws_NewLazyRequest(curr, content_length);
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_key_ptr, tws_NewLazySectionObj(lazy, TWS_SECTION_BODY));
+        tws_ReleaseLazyRequest(lazy);
+    } else {
+        // remember the rest of the request as "body"
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_key_ptr, Tcl_NewStringObj(curr, content_length));
     }
 
     return TCL_OK;
@@ -823,8 +1004,8 @@ int tws_ParseRequest(tws_conn_t *conn, int *error_num) {
 
     Tcl_Encoding encoding = conn->encoding;
     Tcl_DString *dsPtr = &conn->inout_ds;
-    Tcl_DString *parse_ds_ptr = &conn->parse_ds;
     Tcl_Size *offset = &conn->top_part_offset;
+    tws_request_keys_t *keys = tws_GetRequestKeys();
 
 //    String version;
 //    String path;
@@ -843,89 +1024,91 @@ int tws_ParseRequest(tws_conn_t *conn, int *error_num) {
     const char *curr = request;
     const char *end = request + length;
 
+    Tcl_Obj *req_dict_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(req_dict_ptr);
+
     // parse the first line of the request
-    if (TCL_OK != tws_ParseRequestLine(encoding, &curr, end, parse_ds_ptr, error_num)) {
+    if (TCL_OK != tws_ParseRequestLine(encoding, keys, &curr, end, req_dict_ptr, error_num)) {
+        Tcl_DecrRefCount(req_dict_ptr);
         return TCL_ERROR;
     }
-    DBG2(printf("parse dstring after parse request line: %s\n", Tcl_DStringValue(parse_ds_ptr)));
-
-    Tcl_HashTable headers_HT;
-    Tcl_InitHashTable(&headers_HT, TCL_STRING_KEYS);
-    Tcl_HashTable multi_value_headers_HT;
-    Tcl_InitHashTable(&multi_value_headers_HT, TCL_STRING_KEYS);
 
-//    Tcl_Obj *headersPtr = Tcl_NewDictObj();
-//    Tcl_IncrRefCount(headersPtr);
-//    Tcl_Obj *multiValueHeadersPtr = Tcl_NewDictObj();
-//    Tcl_IncrRefCount(multiValueHeadersPtr);
+    Tcl_Obj *headers_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(headers_ptr);
+    Tcl_Obj *multi_value_headers_ptr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(multi_value_headers_ptr);
 
-    if (TCL_OK != tws_ParseHeaders(&curr, end, &headers_HT, &multi_value_headers_HT, error_num)) {
-//        Tcl_DecrRefCount(multiValueHeadersPtr);
-//        Tcl_DecrRefCount(headersPtr);
-        tws_FreeParseHashTable(&headers_HT);
-        tws_FreeParseHashTable(&multi_value_headers_HT);
+    if (TCL_OK != tws_ParseHeaders(keys, &curr, end, headers_ptr, multi_value_headers_ptr, error_num)) {
+        Tcl_DecrRefCount(multi_value_headers_ptr);
+        Tcl_DecrRefCount(headers_ptr);
+        Tcl_DecrRefCount(req_dict_ptr);
         return TCL_ERROR;
     }
 
-    // headers
-    Tcl_DStringAppend(parse_ds_ptr, " headers ", -1);
-    Tcl_DStringStartSublist(parse_ds_ptr);
-    Tcl_HashSearch search;
-    Tcl_HashEntry *entry;
-    for (entry = Tcl_FirstHashEntry(&headers_HT, &search); entry != NULL; entry = Tcl_NextHashEntry(&search)) {
-        const char *key = Tcl_GetHashKey(&headers_HT, entry);
-        Tcl_DString *value_ds_ptr = Tcl_GetHashValue(entry);
-        Tcl_DStringAppendElement(parse_ds_ptr, key);
-        Tcl_DStringAppendElement(parse_ds_ptr, Tcl_DStringValue(value_ds_ptr));
+    // a request that is parsed before the client finished the handshake came as early data
+    if (conn->ssl && !SSL_is_init_finished(conn->ssl)) {
+        Tcl_Obj *http_method_ptr;
+        Tcl_DictObjGet(NULL, req_dict_ptr, keys->http_method_key_ptr, &http_method_ptr);
+        Tcl_Size http_method_length;
+        const char *http_method = Tcl_GetStringFromObj(http_method_ptr, &http_method_length);
+        if (tws_IsSafeHttpMethod(http_method, http_method_length)) {
+            Tcl_DictObjPut(NULL, req_dict_ptr, keys->early_data_key_ptr, Tcl_NewBooleanObj(1));
+            __atomic_add_fetch(&conn->accept_ctx->server->tls_early_data_requests, 1, __ATOMIC_RELAXED);
+        } else {
+            // answered with Too Early, see tws_ProcessConn
+            conn->too_early = 1;
+        }
     }
-    Tcl_DStringEndSublist(parse_ds_ptr);
 
-    // multiValueHeaders
-    Tcl_DStringAppend(parse_ds_ptr, " multiValueHeaders ", -1);
-    Tcl_DStringStartSublist(parse_ds_ptr);
-    for (entry = Tcl_FirstHashEntry(&multi_value_headers_HT, &search); entry != NULL; entry = Tcl_NextHashEntry(&search)) {
-        const char *key = Tcl_GetHashKey(&multi_value_headers_HT, entry);
-        Tcl_DString *value = Tcl_GetHashValue(entry);
-        Tcl_DStringAppendElement(parse_ds_ptr, key);
-        Tcl_DStringAppendElement(parse_ds_ptr, Tcl_DStringValue(value));
-    }
-    Tcl_DStringEndSublist(parse_ds_ptr);
+    Tcl_DictObjPut(NULL, req_dict_ptr, keys->headers_key_ptr, headers_ptr);
+    Tcl_DictObjPut(NULL, req_dict_ptr, keys->multi_value_headers_key_ptr, multi_value_headers_ptr);
+    Tcl_DecrRefCount(multi_value_headers_ptr);
+    Tcl_DecrRefCount(headers_ptr);
 
     // content-length
-    Tcl_HashEntry *content_length_entry_ptr = Tcl_FindHashEntry(&headers_HT, "content-length");
-    if (content_length_entry_ptr) {
-        Tcl_DString *content_length_ds_ptr = Tcl_GetHashValue(content_length_entry_ptr);
-        conn->content_length = strtol(Tcl_DStringValue(content_length_ds_ptr), NULL, 10);
+    Tcl_Obj *content_length_ptr;
+    Tcl_DictObjGet(NULL, headers_ptr, keys->content_length_key_ptr, &content_length_ptr);
+    if (content_length_ptr) {
+        conn->content_length = strtol(Tcl_GetString(content_length_ptr), NULL, 10);
     }
 
     // keepalive
     if (conn->accept_ctx->server->keepalive) {
-        if (TCL_OK != tws_ParseConnectionKeepalive(&headers_HT, &conn->keepalive)) {
+        if (TCL_OK != tws_ParseConnectionKeepalive(headers_ptr, &conn->keepalive)) {
+            Tcl_DecrRefCount(req_dict_ptr);
             return TCL_ERROR;
         }
     }
 
     // compression
     if (conn->accept_ctx->server->gzip) {
-        if (TCL_OK != tws_ParseAcceptEncoding(&headers_HT, &conn->compression)) {
+        if (TCL_OK != tws_ParseAcceptEncoding(headers_ptr, &conn->compression)) {
+            Tcl_DecrRefCount(req_dict_ptr);
             return TCL_ERROR;
         }
     }
 
     // content-type
-    Tcl_HashEntry *content_type_entry_ptr = Tcl_FindHashEntry(&headers_HT, "content-type");
-    if (content_type_entry_ptr) {
-        Tcl_DString *content_type_ds_ptr = Tcl_GetHashValue(content_type_entry_ptr);
-        Tcl_Size content_type_length = Tcl_DStringLength(content_type_ds_ptr);
-        const char *content_type = Tcl_DStringValue(content_type_ds_ptr);
+    Tcl_Obj *content_type_ptr;
+    Tcl_DictObjGet(NULL, headers_ptr, keys->content_type_key_ptr, &content_type_ptr);
+    if (content_type_ptr) {
+        Tcl_Size content_type_length;
+        const char *content_type = Tcl_GetStringFromObj(content_type_ptr, &content_type_length);
         size_t n = MIN(MAX_CONTENT_TYPE_SIZE - 1, content_type_length);
         memcpy(conn->content_type, content_type, n);
         conn->content_type[n] = '\0';
     }
 
-    tws_FreeParseHashTable(&headers_HT);
-    tws_FreeParseHashTable(&multi_value_headers_HT);
+    // the body and whether it is base64 encoded are added by ParseBody, if there is one
+    if (conn->content_length <= 0) {
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_base64_encoded_key_ptr, Tcl_NewBooleanObj(0));
+        if (conn->accept_ctx->server->binary_body_bytearray) {
+            Tcl_DictObjPut(NULL, req_dict_ptr, keys->is_binary_key_ptr, Tcl_NewBooleanObj(0));
+        }
+        Tcl_DictObjPut(NULL, req_dict_ptr, keys->body_key_ptr, Tcl_NewObj());
+    }
 
+    conn->req_dict_ptr = req_dict_ptr;
     *offset = curr - request;
     return TCL_OK;
 }
@@ -983,7 +1166,7 @@ static int tws_GzipAcceptEncoding(const char *accept_encoding, Tcl_Size accept_e
     return qvalue >= 0.001 && qvalue <= 1.0;
 }
 
-int tws_ParseConnectionKeepalive(Tcl_HashTable *headers_HT_ptr, int *keepalive) {
+int tws_ParseConnectionKeepalive(Tcl_Obj *headers_ptr, int *keepalive) {
 //    Tcl_Obj *connectionPtr;
 //    Tcl_Obj *connectionKeyPtr = Tcl_NewStringObj("connection", -1);
 //    Tcl_IncrRefCount(connectionKeyPtr);
@@ -997,14 +1180,16 @@ int tws_ParseConnectionKeepalive(Tcl_HashTable *headers_HT_ptr, int *keepalive)
 //        return TCL_OK;
 //    }
 
-    Tcl_HashEntry *connection_entry_ptr = Tcl_FindHashEntry(headers_HT_ptr, "connection");
-    if (!connection_entry_ptr) {
+    Tcl_Obj *connection_ptr;
+    if (TCL_OK != Tcl_DictObjGet(NULL, headers_ptr, tws_GetRequestKeys()->connection_key_ptr, &connection_ptr)) {
+        return TCL_ERROR;
+    }
+    if (!connection_ptr) {
         return TCL_OK;
     }
 
-    Tcl_DString *connection_ds_ptr = Tcl_GetHashValue(connection_entry_ptr);
-    Tcl_Size connection_length = Tcl_DStringLength(connection_ds_ptr);
-    const char *connection = Tcl_DStringValue(connection_ds_ptr);
+    Tcl_Size connection_length;
+    const char *connection = Tcl_GetStringFromObj(connection_ptr, &connection_length);
 
 //    Tcl_Size connection_length;
 //    const char *connection = Tcl_GetStringFromObj(connectionPtr, &connection_length);
@@ -1014,7 +1199,7 @@ int tws_ParseConnectionKeepalive(Tcl_HashTable *headers_HT_ptr, int *keepalive)
     return TCL_OK;
 }
 
-int tws_ParseAcceptEncoding(Tcl_HashTable *headers_HT_ptr, tws_compression_method_t *compression) {
+int tws_ParseAcceptEncoding(Tcl_Obj *headers_ptr, tws_compression_method_t *compression) {
     // parse "Accept-Encoding" header and set "compression" accordingly
 
 //    Tcl_Obj *acceptEncodingPtr;
@@ -1031,15 +1216,17 @@ int tws_ParseAcceptEncoding(Tcl_HashTable *headers_HT_ptr, tws_compression_metho
 //        return TCL_OK;
 //    }
 
-    Tcl_HashEntry *accept_encoding_entry_ptr = Tcl_FindHashEntry(headers_HT_ptr, "accept-encoding");
-    if (!accept_encoding_entry_ptr) {
+    Tcl_Obj *accept_encoding_ptr;
+    if (TCL_OK != Tcl_DictObjGet(NULL, headers_ptr, tws_GetRequestKeys()->accept_encoding_key_ptr, &accept_encoding_ptr)) {
+        return TCL_ERROR;
+    }
+    if (!accept_encoding_ptr) {
         *compression = NO_COMPRESSION;
         return TCL_OK;
     }
 
-    Tcl_DString *acceptEncoding_ds_ptr = Tcl_GetHashValue(accept_encoding_entry_ptr);
-    Tcl_Size accept_encoding_length = Tcl_DStringLength(acceptEncoding_ds_ptr);
-    const char *accept_encoding = Tcl_DStringValue(acceptEncoding_ds_ptr);
+    Tcl_Size accept_encoding_length;
+    const char *accept_encoding = Tcl_GetStringFromObj(accept_encoding_ptr, &accept_encoding_length);
 
 //    Tcl_Size accept_encoding_length;
 //    const char *accept_encoding = Tcl_GetStringFromObj(acceptEncodingPtr, &accept_encoding_length);
@@ -1074,6 +1261,22 @@ int tws_ParseTopPart(tws_conn_t *conn, int *error_num) {
         return TCL_ERROR;
     }
 
+    // a large body goes to a file as it arrives, instead of the input buffer
+    tws_server_t *server = conn->accept_ctx->server;
+    if (server->body_file_min_length > 0 && conn->content_length >= server->body_file_min_length) {
+        if (conn->content_length > server->max_body_file_length) {
+            *error_num = ERROR_BODY_FILE_TOO_LARGE;
+        } else if (TCL_OK != tws_OpenBodyFile(conn)) {
+            *error_num = ERROR_BODY_FILE;
+        }
+        if (*error_num) {
+            // the request is answered with Bad Request
+            Tcl_DecrRefCount(conn->req_dict_ptr);
+            conn->req_dict_ptr = NULL;
+            return TCL_ERROR;
+        }
+    }
+
     return TCL_OK;
 }
 
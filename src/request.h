@@ -12,12 +12,14 @@
 int tws_UrlEncode(int enc_flags, const char *value, Tcl_Size value_length, Tcl_Obj **valuePtrPtr);
 int tws_UrlDecode(Tcl_Encoding encoding, const char *value, Tcl_Size value_length, Tcl_DString *value_ds_ptr, int *error_num);
 int tws_ParseRequest(tws_conn_t *conn, int *error_num);
-int tws_ParseConnectionKeepalive(Tcl_HashTable *headers_HT_ptr, int *keepalive);
-int tws_ParseAcceptEncoding(Tcl_HashTable *headers_HT_ptr, tws_compression_method_t *compression);
+int tws_ParseConnectionKeepalive(Tcl_Obj *headers_ptr, int *keepalive);
+int tws_ParseAcceptEncoding(Tcl_Obj *headers_ptr, tws_compression_method_t *compression);
 int tws_ParseBody(tws_conn_t *conn, const char *curr, const char *end, int *error_num);
 int tws_ParseTopPart(tws_conn_t *conn, int *error_num);
 int tws_ParseBottomPart(tws_conn_t *conn, int *error_num);
-int tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_string, Tcl_Size query_string_length, Tcl_DString *parse_ds_ptr, int *error_num);
+int tws_GetRequestDictValue(Tcl_Interp *interp, Tcl_Obj *req_dict_ptr, Tcl_Obj *key_ptr, Tcl_Obj **value_ptr);
+int tws_GetRawRequestBody(Tcl_Obj *body_ptr, const char **body_ptr_ptr, Tcl_Size *body_length_ptr);
+int tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_string, Tcl_Size query_string_length, Tcl_Obj *result_ptr, int *error_num);
 
 #define ERROR_PATH_URL_DECODE 1
 #define ERROR_NO_HTTP_METHOD 2
@@ -28,6 +30,8 @@ int tws_ParseQueryStringParameters(Tcl_Encoding encoding, const char *query_stri
 #define ERROR_NO_HEADER_KEY 7
 #define ERROR_URLDECODE_INVALID_SEQUENCE 8
 #define ERROR_BASE64_ENCODE_BODY 9
+#define ERROR_BODY_FILE 10
+#define ERROR_BODY_FILE_TOO_LARGE 11
 
 static const char *tws_parse_error_messages[] = {
         "OK",
@@ -39,7 +43,9 @@ static const char *tws_parse_error_messages[] = {
         "Invalid HTTP version",
         "No header key found",
         "URL decode invalid sequence",
-        "Base64 encode request body"
+        "Base64 encode request body",
+        "Could not create body file",
+        "Request body larger than max_body_file_length"
 };
 
 #endif //TWEBSERVER_REQUEST_H
@@ -5,8 +5,15 @@
  */
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include "return.h"
+#include "conn.h"
 #include "base64.h"
+#include "uring.h"
+#include "timer.h"
+#include "buffer.h"
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 #include <sys/event.h>
@@ -26,18 +33,118 @@
 #define MAX_BUFFER_SIZE 1024
 #endif
 
-#define MAX_CHUNK_SIZE 10485760
+// stream_write asks for a drain once this much is waiting to be written
+#define TWS_STREAM_HIGH_WATER_MARK 65536
+// the maximum size of the plaintext of a tls record
+#define TWS_TLS_RECORD_SIZE 16384
 
 void tws_QueueCreateFileHandlerEvent(tws_conn_t *conn);
-void tws_QueueCleanupEvent();
 static int tws_HandleCreateFileHandlerEventInThread(Tcl_Event *evPtr, int flags);
 static void tws_CreateFileHandler(int fd, ClientData clientData);
 static void tws_ShutdownConn(tws_conn_t *conn);
-static int tws_HandleCleanupEventInThread(Tcl_Event *evPtr, int flags);
+
+// The body of a response built with build_response -return_file is kept as a value of
+// this type in the response dict. It refers to the file by its native path and the file is
+// only read into memory when the body is asked for as a string, base64 encoded if the
+// mimetype is binary. Otherwise tws_ReturnConn leaves the file to the sendfile_fn of the conn.
+static void tws_FreeFileBodyInternalRep(Tcl_Obj *objPtr);
+static void tws_DupFileBodyInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+static void tws_UpdateFileBodyString(Tcl_Obj *objPtr);
+
+static const Tcl_ObjType tws_fileBodyType = {
+        "twebserver.fileBody",
+        tws_FreeFileBodyInternalRep,
+        tws_DupFileBodyInternalRep,
+        tws_UpdateFileBodyString,
+        NULL,
+#ifdef TCL_OBJTYPE_V0
+        TCL_OBJTYPE_V0
+#endif
+};
+
+Tcl_Obj *tws_NewFileBodyObj(const char *native_path, int base64_encode_p) {
+    Tcl_Obj *objPtr = Tcl_NewObj();
+    Tcl_InvalidateStringRep(objPtr);
+    objPtr->internalRep.ptrAndLongRep.ptr = tws_strndup(native_path, strlen(native_path));
+    objPtr->internalRep.ptrAndLongRep.value = (unsigned long) base64_encode_p;
+    objPtr->typePtr = &tws_fileBodyType;
+    return objPtr;
+}
+
+static void tws_FreeFileBodyInternalRep(Tcl_Obj *objPtr) {
+    ckfree((char *) objPtr->internalRep.ptrAndLongRep.ptr);
+    objPtr->typePtr = NULL;
+}
+
+static void tws_DupFileBodyInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr) {
+    const char *native_path = (const char *) srcPtr->internalRep.ptrAndLongRep.ptr;
+    dupPtr->internalRep.ptrAndLongRep.ptr = tws_strndup(native_path, strlen(native_path));
+    dupPtr->internalRep.ptrAndLongRep.value = srcPtr->internalRep.ptrAndLongRep.value;
+    dupPtr->typePtr = &tws_fileBodyType;
+}
+
+// reads the first length bytes of the file into buf
+static int tws_ReadFileBody(int fd, char *buf, off_t length) {
+    off_t offset = 0;
+    while (offset < length) {
+        ssize_t rc = pread(fd, buf + offset, length - offset, offset);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            return TCL_ERROR;
+        }
+        offset += rc;
+    }
+    return TCL_OK;
+}
+
+static void tws_UpdateFileBodyString(Tcl_Obj *objPtr) {
+    const char *native_path = (const char *) objPtr->internalRep.ptrAndLongRep.ptr;
+    int base64_encode_p = (int) objPtr->internalRep.ptrAndLongRep.value;
+
+    // a file that cannot be read gives an empty body, as there is no way to report the error here
+    char *data = NULL;
+    Tcl_Size data_length = 0;
+    int fd = open(native_path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        struct stat statbuf;
+        if (fstat(fd, &statbuf) == 0) {
+            data = ckalloc(statbuf.st_size + 1);
+            if (TCL_OK == tws_ReadFileBody(fd, data, statbuf.st_size)) {
+                data_length = statbuf.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    if (base64_encode_p) {
+        objPtr->bytes = ckalloc(2 * data_length + 4);
+        Tcl_Size length = 0;
+        if (base64_encode(data, data_length, objPtr->bytes, &length)) {
+            length = 0;
+        }
+        objPtr->bytes[length] = '\0';
+        objPtr->length = length;
+        if (data) {
+            ckfree(data);
+        }
+        return;
+    }
+
+    if (!data) {
+        data = ckalloc(1);
+    }
+    data[data_length] = '\0';
+    objPtr->bytes = data;
+    objPtr->length = data_length;
+}
 
 static void tws_FreeConnWithThreadData(tws_conn_t *conn, tws_thread_data_t *dataPtr) {
     assert(valid_conn_handle(conn));
 
+    tws_RemoveConnTimer(conn);
+
     DBG2(printf("FreeConnWithThreadData - dataKey: %p thread: %p - client: %d - num_conns: %d\n", tws_GetThreadDataKey(), Tcl_GetCurrentThread(), conn->client, dataPtr->num_conns));
 
     if (conn->prevPtr == NULL) {
@@ -63,9 +170,7 @@ static void tws_FreeConnWithThreadData(tws_conn_t *conn, tws_thread_data_t *data
     if (!conn->accept_ctx->option_http) {
         SSL_free(conn->ssl);
     }
-    Tcl_DStringFree(&conn->inout_ds);
-    Tcl_DStringFree(&conn->parse_ds);
-    ckfree((char *) conn);
+    tws_ReleaseConn(dataPtr, conn);
 
     dataPtr->num_conns--;
 }
@@ -77,58 +182,6 @@ static void tws_FreeConn(tws_conn_t *conn) {
     Tcl_MutexUnlock(tws_GetThreadMutex());
 }
 
-int tws_CleanupConnections() {
-    Tcl_ThreadId currentThreadId = Tcl_GetCurrentThread();
-    DBG2(printf("CleanupConnections currentThreadId=%p\n", currentThreadId));
-
-    long long milliseconds = current_time_in_millis();
-
-    int count = 0;
-    int count_mark_for_deletion = 0;
-
-    Tcl_MutexLock(tws_GetThreadMutex());
-    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
-    tws_conn_t *curr_conn = dataPtr->firstConnPtr;
-    tws_conn_t *next_conn = NULL;
-    while (curr_conn != NULL) {
-
-        next_conn = curr_conn->nextPtr;
-
-        if (curr_conn->todelete) {
-            DBG2(printf("CleanupConnections - deleting conn - client: %d\n", curr_conn->client));
-
-            tws_FreeConnWithThreadData(curr_conn, dataPtr);
-
-            DBG2(printf("CleanupConnections - deleted conn\n"));
-        } else {
-            long long elapsed = milliseconds - curr_conn->latest_millis;
-            if (elapsed > curr_conn->accept_ctx->server->conn_timeout_millis) {
-                if (tws_UnregisterConnName(curr_conn->handle)) {
-                    DBG2(printf("CleanupConnections - mark connection for deletion\n"));
-                    tws_ShutdownConn(curr_conn);
-                    curr_conn->todelete = 1;
-                    count_mark_for_deletion++;
-                }
-            }
-        }
-        count++;
-
-        curr_conn = next_conn;
-    }
-    Tcl_MutexUnlock(tws_GetThreadMutex());
-
-    DBG2(printf("reviewed count: %d marked_for_deletion: %d\n", count, count_mark_for_deletion));
-
-    return 1;
-}
-
-static int tws_HandleCleanupEventInThread(Tcl_Event *evPtr, int flags) {
-    UNUSED(evPtr);
-    UNUSED(flags);
-
-    return tws_CleanupConnections();
-}
-
 static void tws_CreateFileHandler(int fd, ClientData clientData) {
     tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
 
@@ -140,6 +193,11 @@ static void tws_CreateFileHandler(int fd, ClientData clientData) {
         fprintf(stderr, "CreateFileHandler: kevent failed, fd: %d\n", fd);
     }
 #else
+    if (dataPtr->uring) {
+        tws_UringArmRead(dataPtr->uring, (tws_conn_t *) clientData);
+        return;
+    }
+
     // Add the server socket to the epoll set
     struct epoll_event ev;
     ev.events = EPOLLIN;
@@ -163,14 +221,14 @@ static int tws_HandleCreateFileHandlerEventInThread(Tcl_Event *evPtr, int flags)
     return 1;
 }
 
-void tws_QueueCleanupEvent() {
-    Tcl_ThreadId currentThreadId = Tcl_GetCurrentThread();
-    DBG2(printf("QueueCleanupEvent: %p\n", currentThreadId));
-    Tcl_Event *evPtr = (Tcl_Event *) ckalloc(sizeof(Tcl_Event));
-    evPtr->proc = tws_HandleCleanupEventInThread;
-    evPtr->nextPtr = NULL;
-    Tcl_QueueEvent((Tcl_Event *) evPtr, TCL_QUEUE_TAIL);
-    Tcl_ThreadAlert(currentThreadId);
+void tws_WaitForReadable(tws_conn_t *conn) {
+    if (conn->created_file_handler_p) {
+        return;
+    }
+
+    DBG2(printf("WaitForReadable client: %d\n", conn->client));
+    conn->created_file_handler_p = 1;
+    tws_CreateFileHandler(conn->client, conn);
 }
 
 static int tws_HandleFreeConnEventInThread(Tcl_Event *evPtr, int flags) {
@@ -225,16 +283,88 @@ static void tws_DeleteFileHandler(int fd) {
 #endif
 }
 
-static void tws_ShutdownConn(tws_conn_t *conn) {
-    if (conn->todelete) {
-        DBG2(printf("ShutdownConn - already marked for deletion\n"));
+// arms write readiness notifications for the conn on the epoll fd of this thread,
+// while waiting for the socket to become writable we are not interested in reading
+static void tws_ArmWriteHandler(tws_conn_t *conn) {
+    DBG2(printf("ArmWriteHandler client: %d\n", conn->client));
+
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    struct kevent ev[2];
+    int n = 0;
+    EV_SET(&ev[n++], conn->client, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, conn);
+    if (conn->created_file_handler_p) {
+        EV_SET(&ev[n++], conn->client, EVFILT_READ, EV_DISABLE, 0, 0, conn);
+    }
+    if (kevent(dataPtr->epoll_fd, ev, n, NULL, 0, NULL) == -1) {
+        fprintf(stderr, "ArmWriteHandler: kevent failed, fd: %d\n", conn->client);
+    }
+#else
+    if (dataPtr->uring) {
+        tws_UringArmWrite(dataPtr->uring, conn);
+        conn->write_pending = 1;
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = conn;
+    int op = conn->created_file_handler_p ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(dataPtr->epoll_fd, op, conn->client, &ev) == -1) {
+        fprintf(stderr, "ArmWriteHandler: epoll_ctl failed, fd: %d\n", conn->client);
+    }
+#endif
+
+    conn->write_pending = 1;
+}
+
+// restores the conn on the epoll fd of this thread to the state it had before ArmWriteHandler
+static void tws_DisarmWriteHandler(tws_conn_t *conn) {
+    DBG2(printf("DisarmWriteHandler client: %d\n", conn->client));
+
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    struct kevent ev[2];
+    int n = 0;
+    EV_SET(&ev[n++], conn->client, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    if (conn->created_file_handler_p) {
+        EV_SET(&ev[n++], conn->client, EVFILT_READ, EV_ENABLE, 0, 0, conn);
+    }
+    if (kevent(dataPtr->epoll_fd, ev, n, NULL, 0, NULL) == -1) {
+        fprintf(stderr, "DisarmWriteHandler: kevent failed, fd: %d\n", conn->client);
+    }
+#else
+    if (dataPtr->uring) {
+        // the poll request is one-shot and has completed already
+        conn->write_pending = 0;
         return;
     }
 
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    int op = conn->created_file_handler_p ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    if (epoll_ctl(dataPtr->epoll_fd, op, conn->client, &ev) == -1) {
+        fprintf(stderr, "DisarmWriteHandler: epoll_ctl failed, fd: %d\n", conn->client);
+    }
+#endif
+
+    conn->write_pending = 0;
+}
 
-    if (conn->created_file_handler_p == 1) {
+static void tws_ShutdownConn(tws_conn_t *conn) {
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+    if (dataPtr->uring) {
+        // the pending requests complete once the socket is shut down and are dropped as stale
+        tws_UringRemoveConn(dataPtr->uring, conn);
+        conn->created_file_handler_p = 0;
+        conn->write_pending = 0;
+    } else if (conn->created_file_handler_p == 1 || conn->write_pending) {
         tws_DeleteFileHandler(conn->client);
         conn->created_file_handler_p = 0;
+        conn->write_pending = 0;
     }
 
     conn->shutdown = 1;
@@ -278,8 +408,8 @@ int tws_CloseConn(tws_conn_t *conn, int force) {
     DBG2(printf("CloseConn - client: %d force: %d keepalive: %d handler: %d\n", conn->client, force,
                 conn->keepalive, conn->created_file_handler_p));
 
-    Tcl_DStringSetLength(&conn->inout_ds, 0);
-    Tcl_DStringSetLength(&conn->parse_ds, 0);
+    // an idle keepalive conn should not hold on to its read buffer
+    tws_ReleaseReadBuffer(&conn->inout_ds);
     conn->top_part_offset = 0;
     conn->write_offset = 0;
     conn->blank_line_offset = 0;
@@ -288,18 +418,33 @@ int tws_CloseConn(tws_conn_t *conn, int force) {
         Tcl_DecrRefCount(conn->req_dict_ptr);
     }
     conn->req_dict_ptr = NULL;
+    conn->read_timer_p = 0;
 //    conn->handle_conn_fn = NULL;
     conn->shutdown = 0;
     conn->ready = 0;
     conn->inprogress = 0;
 //    conn->handshaked = 0;
-    for (Tcl_Size i = 0; i < conn->n_chunks; i++) {
-        Tcl_DStringFree(&conn->chunks_ds[i]);
+    if (conn->stream_drain_ptr) {
+        Tcl_DecrRefCount(conn->stream_drain_ptr);
+        conn->stream_drain_ptr = NULL;
     }
-    ckfree(conn->chunks_ds);
-    conn->n_chunks = 0;
-    conn->chunk_offset = 0;
-
+    if (conn->body_obj_ptr) {
+        Tcl_DecrRefCount(conn->body_obj_ptr);
+        conn->body_obj_ptr = NULL;
+    }
+    if (conn->body_alloc_ptr) {
+        ckfree(conn->body_alloc_ptr);
+        conn->body_alloc_ptr = NULL;
+    }
+    conn->body = NULL;
+    conn->body_length = 0;
+    if (conn->file_fd != -1) {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+    }
+    conn->file_offset = 0;
+    conn->file_length = 0;
+    tws_CloseBodyFile(conn);
 
     if (force) {
         if (tws_UnregisterConnName(conn->handle)) {
@@ -315,40 +460,45 @@ int tws_CloseConn(tws_conn_t *conn, int force) {
         } else {
             if (!conn->created_file_handler_p) {
                 conn->created_file_handler_p = 1;
-                // notify the event loop to keep the connection alive
-                tws_QueueCreateFileHandlerEvent(conn);
+                if (conn->accept_ctx->native_loop) {
+                    tws_CreateFileHandler(conn->client, conn);
+                } else {
+                    // notify the event loop to keep the connection alive
+                    tws_QueueCreateFileHandlerEvent(conn);
+                }
             }
         }
     }
 
-    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
-    dataPtr->num_requests = (dataPtr->num_requests + 1) % INT_MAX;
-    tws_server_t *server = conn->accept_ctx->server;
-    // make sure that garbage collection does not start the same time on all threads
-    if (dataPtr->num_requests % server->garbage_collection_cleanup_threshold == dataPtr->thread_pivot) {
-        tws_QueueCleanupEvent();
-    }
-
     return TCL_OK;
 }
+static void tws_HandleStreamDrained(tws_conn_t *conn);
+
 static int tws_HandleWrite(tws_conn_t *conn) {
     assert(valid_conn_handle(conn));
 
-    Tcl_DString *ds_ptr = &conn->inout_ds;
-    if (conn->chunk_offset > 0) {
-        ds_ptr = &conn->chunks_ds[conn->chunk_offset - 1];
-    }
-
-    DBG2(printf("chunk_offset: %ld n_chunks: %ld write_offset: %ld\n", conn->chunk_offset, conn->n_chunks, conn->write_offset));
+    Tcl_Size reply_length = Tcl_DStringLength(&conn->inout_ds);
+    const char *reply = Tcl_DStringValue(&conn->inout_ds);
 
-    Tcl_Size reply_length = Tcl_DStringLength(ds_ptr);
-    const char *reply = Tcl_DStringValue(ds_ptr);
+    DBG2(printf("write_offset: %ld reply_length: %ld\n", conn->write_offset, reply_length));
 
-    int rc = conn->accept_ctx->write_fn(conn, reply + conn->write_offset, reply_length - conn->write_offset);
+    int rc;
+    if (conn->file_fd != -1) {
+        rc = conn->accept_ctx->sendfile_fn(conn);
+    } else if (conn->body != NULL) {
+        rc = conn->accept_ctx->writev_fn(conn);
+    } else {
+        rc = conn->accept_ctx->write_fn(conn, reply + conn->write_offset, reply_length - conn->write_offset);
+    }
 
     if (rc == TWS_AGAIN) {
-        DBG2(printf("TWS_AGAIN write_offset: %ld reply_length: %ld n_chunks: %ld\n", conn->write_offset, reply_length, conn->n_chunks));
-        return 0;
+        DBG2(printf("TWS_AGAIN write_offset: %ld reply_length: %ld\n", conn->write_offset, reply_length));
+        // resume from tws_HandleWriteReady once the socket becomes writable, the write functions
+        // return TWS_AGAIN only when the socket is full and not when they have to read first
+        if (!conn->write_pending) {
+            tws_ArmWriteHandler(conn);
+        }
+        return 1;
     } else if (rc == TWS_ERROR) {
         DBG2(printf("TWS_ERROR\n"));
         conn->error = 1;
@@ -356,14 +506,16 @@ static int tws_HandleWrite(tws_conn_t *conn) {
         return 1;
     }
 
-    DBG2(printf("TWS_DONE write_offset: %ld reply_length: %ld n_chunks: %ld\n", conn->write_offset, reply_length, conn->n_chunks));
+    DBG2(printf("TWS_DONE write_offset: %ld reply_length: %ld\n", conn->write_offset, reply_length));
 
-    if (conn->n_chunks > 0) {
-        conn->write_offset = 0;
-        conn->chunk_offset++;
-        if (conn->chunk_offset <= conn->n_chunks) {
-            return 0;
-        }
+    if (conn->write_pending) {
+        tws_DisarmWriteHandler(conn);
+    }
+
+    if (conn->stream == TWS_STREAM_OPEN) {
+        // the stream goes on, the conn stays open until stream_end
+        tws_HandleStreamDrained(conn);
+        return 1;
     }
 
     // TWS_DONE
@@ -373,6 +525,19 @@ static int tws_HandleWrite(tws_conn_t *conn) {
     return 1;
 }
 
+void tws_HandleWriteReady(tws_conn_t *conn) {
+    assert(valid_conn_handle(conn));
+
+    DBG2(printf("HandleWriteReady: %s\n", conn->handle));
+
+    if (!conn->write_pending || conn->shutdown) {
+        return;
+    }
+
+    conn->latest_millis = current_time_in_millis();
+    tws_HandleWrite(conn);
+}
+
 static int tws_HandleWriteEventInThread(Tcl_Event *evPtr, int flags) {
     UNUSED(flags);
 
@@ -393,6 +558,12 @@ static void tws_QueueWriteEvent(tws_conn_t *conn) {
 
     DBG2(printf("QueueWriteEvent - threadId: %p conn: %s\n", conn->threadId, conn->handle));
     conn->write_offset = 0;
+
+    if (conn->accept_ctx->native_loop) {
+        tws_HandleWrite(conn);
+        return;
+    }
+
     tws_event_t *connEvPtr = (tws_event_t *) ckalloc(sizeof(tws_event_t));
     connEvPtr->proc = tws_HandleWriteEventInThread;
     connEvPtr->nextPtr = NULL;
@@ -403,19 +574,10 @@ static void tws_QueueWriteEvent(tws_conn_t *conn) {
 
 }
 
-int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const responseDictPtr) {
-    assert(valid_conn_handle(conn));
-
-    if (!conn->accept_ctx) {
-        SetResult("ReturnConn called on deleted conn");
-        return TCL_ERROR;
-    }
-
-    if (conn->error) {
-        SetResult("ReturnConn called on conn with error");
-        return TCL_ERROR;
-    }
-
+// Replaces inout_ds with the status line and the headers of the response dict, without
+// the blank line that ends them. The headers of the dict are returned for the gzip check.
+static int tws_AppendResponseHead(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const responseDictPtr,
+                                  Tcl_Obj **headersPtrPtr) {
     Tcl_Obj *statusCodePtr;
     Tcl_Obj *statusCodeKeyPtr = Tcl_NewStringObj("statusCode", -1);
     Tcl_IncrRefCount(statusCodeKeyPtr);
@@ -450,31 +612,6 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
     }
     Tcl_DecrRefCount(multiValueHeadersKeyPtr);
 
-    Tcl_Obj *bodyPtr;
-    Tcl_Obj *bodyKeyPtr = Tcl_NewStringObj("body", -1);
-    Tcl_IncrRefCount(bodyKeyPtr);
-    if (TCL_OK != Tcl_DictObjGet(interp, responseDictPtr, bodyKeyPtr, &bodyPtr)) {
-        Tcl_DecrRefCount(bodyKeyPtr);
-        SetResult("error reading from dict");
-        return TCL_ERROR;
-    }
-    Tcl_DecrRefCount(bodyKeyPtr);
-
-    if (!bodyPtr) {
-        SetResult("body not found");
-        return TCL_ERROR;
-    }
-
-    Tcl_Obj *isBase64EncodedPtr;
-    Tcl_Obj *isBase64EncodedKeyPtr = Tcl_NewStringObj("isBase64Encoded", -1);
-    Tcl_IncrRefCount(isBase64EncodedKeyPtr);
-    if (TCL_OK != Tcl_DictObjGet(interp, responseDictPtr, isBase64EncodedKeyPtr, &isBase64EncodedPtr)) {
-        Tcl_DecrRefCount(isBase64EncodedKeyPtr);
-        SetResult("error reading from dict");
-        return TCL_ERROR;
-    }
-    Tcl_DecrRefCount(isBase64EncodedKeyPtr);
-
     Tcl_DStringSetLength(&conn->inout_ds, 0);
     Tcl_DStringAppend(&conn->inout_ds, "HTTP/1.1 ", 9);
 
@@ -545,6 +682,53 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
         Tcl_DictObjDone(&mvHeadersSearch);
     }
 
+    *headersPtrPtr = headersPtr;
+    return TCL_OK;
+}
+
+int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const responseDictPtr) {
+    assert(valid_conn_handle(conn));
+
+    if (!conn->accept_ctx) {
+        SetResult("ReturnConn called on deleted conn");
+        return TCL_ERROR;
+    }
+
+    if (conn->error) {
+        SetResult("ReturnConn called on conn with error");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *bodyPtr;
+    Tcl_Obj *bodyKeyPtr = Tcl_NewStringObj("body", -1);
+    Tcl_IncrRefCount(bodyKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, responseDictPtr, bodyKeyPtr, &bodyPtr)) {
+        Tcl_DecrRefCount(bodyKeyPtr);
+        SetResult("error reading from dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(bodyKeyPtr);
+
+    if (!bodyPtr) {
+        SetResult("body not found");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *isBase64EncodedPtr;
+    Tcl_Obj *isBase64EncodedKeyPtr = Tcl_NewStringObj("isBase64Encoded", -1);
+    Tcl_IncrRefCount(isBase64EncodedKeyPtr);
+    if (TCL_OK != Tcl_DictObjGet(interp, responseDictPtr, isBase64EncodedKeyPtr, &isBase64EncodedPtr)) {
+        Tcl_DecrRefCount(isBase64EncodedKeyPtr);
+        SetResult("error reading from dict");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(isBase64EncodedKeyPtr);
+
+    Tcl_Obj *headersPtr;
+    if (TCL_OK != tws_AppendResponseHead(interp, conn, responseDictPtr, &headersPtr)) {
+        return TCL_ERROR;
+    }
+
     // write the body to the ssl connection
     int isBase64Encoded = 0;
     if (isBase64EncodedPtr) {
@@ -554,7 +738,21 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
     Tcl_Size body_length = 0;
     char *body = NULL;
     int body_alloc = 0;
-    if (isBase64Encoded) {
+    int file_fd = -1;
+    off_t file_length = 0;
+    if (bodyPtr->typePtr == &tws_fileBodyType) {
+        // the file is sent as it is, the base64 encoding only applies to its string representation
+        file_fd = open((const char *) bodyPtr->internalRep.ptrAndLongRep.ptr, O_RDONLY | O_CLOEXEC);
+        struct stat statbuf;
+        if (file_fd == -1 || fstat(file_fd, &statbuf) != 0) {
+            if (file_fd != -1) {
+                close(file_fd);
+            }
+            SetResult("error opening file");
+            return TCL_ERROR;
+        }
+        file_length = statbuf.st_size;
+    } else if (isBase64Encoded) {
 
         Tcl_Size b64_body_length;
         const char *b64_body = Tcl_GetStringFromObj(bodyPtr, &b64_body_length);
@@ -573,8 +771,8 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
 
     int gzip_p = conn->accept_ctx->server->gzip
                  && conn->compression == GZIP_COMPRESSION
-                 && body_length > 0
-                 && body_length >= conn->accept_ctx->server->gzip_min_length;
+                 && (file_fd != -1 ? file_length : body_length) > 0
+                 && (file_fd != -1 ? file_length : body_length) >= conn->accept_ctx->server->gzip_min_length;
 
     if (gzip_p && headersPtr) {
         // get Content-Type header
@@ -586,6 +784,9 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
             if (body_alloc) {
                 ckfree(body);
             }
+            if (file_fd != -1) {
+                close(file_fd);
+            }
             SetResult("error reading from dict");
             return TCL_ERROR;
         }
@@ -620,6 +821,21 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
         Tcl_DStringAppend(&conn->inout_ds, "Content-Encoding: gzip", 22);
     }
 
+    if (gzip_p && file_fd != -1) {
+        // a file body is compressed in memory like any other body
+        body = ckalloc(file_length + 1);
+        body_alloc = 1;
+        body_length = file_length;
+        int rc = tws_ReadFileBody(file_fd, body, file_length);
+        close(file_fd);
+        file_fd = -1;
+        if (TCL_OK != rc) {
+            ckfree(body);
+            SetResult("error reading file");
+            return TCL_ERROR;
+        }
+    }
+
     Tcl_Obj *compressed = NULL;
     if (gzip_p) {
 
@@ -644,7 +860,7 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
         Tcl_ResetResult(interp);
     }
 
-    Tcl_Obj *contentLengthPtr = Tcl_NewIntObj(body_length);
+    Tcl_Obj *contentLengthPtr = file_fd != -1 ? Tcl_NewWideIntObj(file_length) : Tcl_NewIntObj(body_length);
     Tcl_IncrRefCount(contentLengthPtr);
     Tcl_Size content_length_str_len;
     const char *content_length_str = Tcl_GetStringFromObj(contentLengthPtr, &content_length_str_len);
@@ -652,43 +868,40 @@ int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *const response
     Tcl_DStringAppend(&conn->inout_ds, "Content-Length: ", 16);
     Tcl_DStringAppend(&conn->inout_ds, content_length_str, content_length_str_len);
 
-    if (body_length < MAX_CHUNK_SIZE) {
+    if (file_fd != -1) {
+        // the sendfile_fn of the conn sends the file after the head of the response
         Tcl_DStringAppend(&conn->inout_ds, "\r\n\r\n", 4);
-        if (body_length > 0) {
-            Tcl_DStringAppend(&conn->inout_ds, body, body_length);
-        }
+        conn->file_fd = file_fd;
+        conn->file_offset = 0;
+        conn->file_length = file_length;
     } else {
-        Tcl_DStringAppend(&conn->inout_ds, "\r\n", 2);
-        Tcl_DStringAppend(&conn->inout_ds, "Transfer-Encoding: chunked", 26);
         Tcl_DStringAppend(&conn->inout_ds, "\r\n\r\n", 4);
-
-        // chunk the body
-        // it should be:
-        // 1. chunk size in hex
-        // 2. \r\n
-        // 3. chunk data
-        // 4. \r\n
-        // 5. repeat 1-4 until all data is sent
-        // 6. 0
-        // 7. \r\n
-        // 8. \r\n
-
-        conn->n_chunks = (body_length / MAX_CHUNK_SIZE) + 1;
-        DBG2(printf("n_chunks: %ld\n", conn->n_chunks));
-        conn->chunks_ds = (Tcl_DString *) ckalloc(sizeof(Tcl_DString) * conn->n_chunks);
-        Tcl_Size chunk_index = 0;
-        for (Tcl_Size i = 0; i < body_length; i += MAX_CHUNK_SIZE) {
-            Tcl_DStringInit(&conn->chunks_ds[chunk_index]);
-            Tcl_Size chunk_size = MIN(body_length - i, MAX_CHUNK_SIZE);
-            char chunk_size_str[16];
-            snprintf(chunk_size_str, 16, "%lx", chunk_size);
-            Tcl_DStringAppend(&conn->chunks_ds[chunk_index], chunk_size_str, strlen(chunk_size_str));
-            Tcl_DStringAppend(&conn->chunks_ds[chunk_index], "\r\n", 2);
-            Tcl_DStringAppend(&conn->chunks_ds[chunk_index], body + i, chunk_size);
-            Tcl_DStringAppend(&conn->chunks_ds[chunk_index], "\r\n", 2);
-            chunk_index++;
+        if (body_length > 0) {
+            // the body is written after the head from where it is, the conn holds on to it until then
+            if (compressed != NULL) {
+                conn->body_obj_ptr = compressed;
+                compressed = NULL;
+            } else if (body_alloc) {
+                conn->body_alloc_ptr = body;
+            } else {
+                conn->body_obj_ptr = bodyPtr;
+                Tcl_IncrRefCount(bodyPtr);
+            }
+            body_alloc = 0;
+            conn->body = body;
+            conn->body_length = body_length;
+
+            if (!conn->accept_ctx->option_http) {
+                // the head goes out in the same tls record as the start of the body
+                Tcl_Size head_length = Tcl_DStringLength(&conn->inout_ds);
+                if (head_length < TWS_TLS_RECORD_SIZE) {
+                    Tcl_Size length = MIN(body_length, TWS_TLS_RECORD_SIZE - head_length);
+                    Tcl_DStringAppend(&conn->inout_ds, body, length);
+                    conn->body += length;
+                    conn->body_length -= length;
+                }
+            }
         }
-        Tcl_DStringAppend(&conn->chunks_ds[conn->n_chunks - 1], "0\r\n\r\n", -1);
     }
     Tcl_DecrRefCount(contentLengthPtr);
 
@@ -738,3 +951,191 @@ tws_ReturnError(Tcl_Interp *interp, tws_conn_t *conn, int status_code, const cha
     Tcl_DecrRefCount(responseDictPtr);
     return TCL_OK;
 }
+
+// Drops what has been written from inout_ds before more of the stream is appended to it,
+// so that a stream that keeps up with its conn does not grow the buffer.
+static void tws_CompactStreamBuffer(tws_conn_t *conn) {
+    if (conn->write_offset == 0) {
+        return;
+    }
+    Tcl_Size length = Tcl_DStringLength(&conn->inout_ds) - conn->write_offset;
+    memmove(Tcl_DStringValue(&conn->inout_ds), Tcl_DStringValue(&conn->inout_ds) + conn->write_offset, length);
+    Tcl_DStringSetLength(&conn->inout_ds, length);
+    conn->write_offset = 0;
+}
+
+// Called from tws_HandleWrite once everything that the stream buffered has been written,
+// evaluates the script of stream_on_drain if there is one.
+static void tws_HandleStreamDrained(tws_conn_t *conn) {
+    Tcl_DStringSetLength(&conn->inout_ds, 0);
+    conn->write_offset = 0;
+
+    Tcl_Obj *drain_ptr = conn->stream_drain_ptr;
+    if (!drain_ptr) {
+        return;
+    }
+    conn->stream_drain_ptr = NULL;
+
+    Tcl_Interp *interp = conn->accept_ctx->interp;
+    if (TCL_OK != Tcl_EvalObjEx(interp, drain_ptr, TCL_EVAL_GLOBAL)) {
+        fprintf(stderr, "stream_on_drain: errorinfo=%s\n", Tcl_GetVar(interp, "errorInfo", TCL_GLOBAL_ONLY));
+        if (conn->stream == TWS_STREAM_OPEN) {
+            tws_CloseConn(conn, 1);
+        }
+    }
+    Tcl_ResetResult(interp);
+    Tcl_DecrRefCount(drain_ptr);
+}
+
+static tws_conn_t *tws_GetStreamConn(Tcl_Interp *interp, const char *cmd_name, Tcl_Obj *conn_handle_ptr,
+                                     int stream) {
+    tws_conn_t *conn = tws_GetInternalFromConnName(Tcl_GetString(conn_handle_ptr));
+    if (!conn) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("%s: conn handle not found", cmd_name));
+        return NULL;
+    }
+    if (!conn->accept_ctx || conn->error) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("%s: conn is closed", cmd_name));
+        return NULL;
+    }
+    if (conn->stream != stream) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(stream == TWS_STREAM_NONE ? "%s: stream already begun"
+                                                                         : "%s: stream not begun", cmd_name));
+        return NULL;
+    }
+    return conn;
+}
+
+int tws_StreamBeginCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("StreamBeginCmd\n"));
+    CheckArgs(3, 3, 1, "conn_handle response_dict");
+
+    tws_conn_t *conn = tws_GetStreamConn(interp, "stream_begin", objv[1], TWS_STREAM_NONE);
+    if (!conn) {
+        return TCL_ERROR;
+    }
+
+    // the body of the response dict, if any, is ignored
+    Tcl_Obj *headersPtr;
+    if (TCL_OK != tws_AppendResponseHead(interp, conn, objv[2], &headersPtr)) {
+        return TCL_ERROR;
+    }
+    Tcl_DStringAppend(&conn->inout_ds, "\r\nTransfer-Encoding: chunked\r\n\r\n", -1);
+    conn->stream = TWS_STREAM_OPEN;
+    conn->write_offset = 0;
+    conn->latest_millis = current_time_in_millis();
+    tws_HandleWrite(conn);
+
+    return TCL_OK;
+}
+
+// looked up on the first stream_write, every thread finds the same type
+static const Tcl_ObjType *tws_ByteArrayType = NULL;
+
+int tws_StreamWriteCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("StreamWriteCmd\n"));
+
+    // not parsed with Tcl_ParseArgsObjv, since the data may start with a dash
+    int option_binary = objc == 4 && strcmp(Tcl_GetString(objv[1]), "-binary") == 0;
+    if (objc != 3 && !option_binary) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-binary? conn_handle data");
+        return TCL_ERROR;
+    }
+    Tcl_Obj *const *remObjv = objv + option_binary;
+
+    tws_conn_t *conn = tws_GetStreamConn(interp, "stream_write", remObjv[1], TWS_STREAM_OPEN);
+    if (!conn) {
+        return TCL_ERROR;
+    }
+
+    // the string of a byte array is utf-8, \xff would go out as two bytes and a NUL as C0 80
+    if (tws_ByteArrayType == NULL) {
+        tws_ByteArrayType = Tcl_GetObjType("bytearray");
+    }
+    Tcl_Size data_length;
+    const char *data;
+    if (option_binary || (tws_ByteArrayType != NULL && remObjv[2]->typePtr == tws_ByteArrayType)) {
+        data = (const char *) Tcl_GetByteArrayFromObj(remObjv[2], &data_length);
+    } else {
+        data = Tcl_GetStringFromObj(remObjv[2], &data_length);
+    }
+
+    // an empty chunk would end the stream
+    if (data_length > 0) {
+        tws_CompactStreamBuffer(conn);
+        char chunk_size_str[20];
+        int chunk_size_str_len = snprintf(chunk_size_str, sizeof(chunk_size_str), "%lx\r\n", (unsigned long) data_length);
+        Tcl_DStringAppend(&conn->inout_ds, chunk_size_str, chunk_size_str_len);
+        Tcl_DStringAppend(&conn->inout_ds, data, data_length);
+        Tcl_DStringAppend(&conn->inout_ds, "\r\n", 2);
+
+        conn->latest_millis = current_time_in_millis();
+        if (!conn->write_pending) {
+            tws_HandleWrite(conn);
+            if (conn->error) {
+                SetResult("stream_write: error writing to conn");
+                return TCL_ERROR;
+            }
+        }
+    }
+
+    // whether the caller may go on writing, otherwise it should wait for stream_on_drain
+    Tcl_Size buffered = Tcl_DStringLength(&conn->inout_ds) - conn->write_offset;
+    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(buffered < TWS_STREAM_HIGH_WATER_MARK));
+    return TCL_OK;
+}
+
+int tws_StreamOnDrainCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("StreamOnDrainCmd\n"));
+    CheckArgs(3, 3, 1, "conn_handle script");
+
+    tws_conn_t *conn = tws_GetStreamConn(interp, "stream_on_drain", objv[1], TWS_STREAM_OPEN);
+    if (!conn) {
+        return TCL_ERROR;
+    }
+
+    if (!conn->write_pending) {
+        // nothing is waiting to be written
+        return Tcl_EvalObjEx(interp, objv[2], TCL_EVAL_GLOBAL);
+    }
+
+    if (conn->stream_drain_ptr) {
+        Tcl_DecrRefCount(conn->stream_drain_ptr);
+    }
+    conn->stream_drain_ptr = objv[2];
+    Tcl_IncrRefCount(conn->stream_drain_ptr);
+    return TCL_OK;
+}
+
+int tws_StreamEndCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    UNUSED(clientData);
+
+    DBG2(printf("StreamEndCmd\n"));
+    CheckArgs(2, 2, 1, "conn_handle");
+
+    tws_conn_t *conn = tws_GetStreamConn(interp, "stream_end", objv[1], TWS_STREAM_OPEN);
+    if (!conn) {
+        return TCL_ERROR;
+    }
+
+    tws_CompactStreamBuffer(conn);
+    Tcl_DStringAppend(&conn->inout_ds, "0\r\n\r\n", 5);
+    conn->stream = TWS_STREAM_ENDED;
+    if (conn->stream_drain_ptr) {
+        Tcl_DecrRefCount(conn->stream_drain_ptr);
+        conn->stream_drain_ptr = NULL;
+    }
+
+    // the conn is closed, or kept alive, once the last chunk has been written
+    conn->latest_millis = current_time_in_millis();
+    if (!conn->write_pending) {
+        tws_HandleWrite(conn);
+    }
+    return TCL_OK;
+}
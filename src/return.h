@@ -10,7 +10,14 @@
 
 int tws_ReturnConn(Tcl_Interp *interp, tws_conn_t *conn, Tcl_Obj *responseDictPtr);
 int tws_CloseConn(tws_conn_t *conn, int force);
-int tws_CleanupConnections();
+void tws_HandleWriteReady(tws_conn_t *conn);
+void tws_WaitForReadable(tws_conn_t *conn);
+Tcl_Obj *tws_NewFileBodyObj(const char *native_path, int base64_encode_p);
 int tws_ReturnError(Tcl_Interp *interp, tws_conn_t *conn, int status_code, const char *error_text);
 
+ObjCmdProc(tws_StreamBeginCmd);
+ObjCmdProc(tws_StreamWriteCmd);
+ObjCmdProc(tws_StreamOnDrainCmd);
+ObjCmdProc(tws_StreamEndCmd);
+
 #endif //TWEBSERVER_RETURN_H
\ No newline at end of file
@@ -0,0 +1,303 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "route_tree.h"
+#include <string.h>
+
+enum {
+    ROUTE_NODE_EXACT,
+    ROUTE_NODE_PREFIX,
+    ROUTE_NODE_REGEXP
+};
+
+static tws_route_node_t *tws_NewRouteNode(const char *label, Tcl_Size label_len) {
+    tws_route_node_t *node_ptr = (tws_route_node_t *) ckalloc(sizeof(tws_route_node_t));
+    node_ptr->label = ckalloc(label_len + 1);
+    memcpy(node_ptr->label, label, label_len);
+    node_ptr->label[label_len] = '\0';
+    node_ptr->label_len = label_len;
+    node_ptr->children = NULL;
+    node_ptr->num_children = 0;
+    node_ptr->exact_route_ptr = NULL;
+    node_ptr->prefix_route_ptr = NULL;
+    node_ptr->regexp_routes = NULL;
+    node_ptr->num_regexp_routes = 0;
+    return node_ptr;
+}
+
+static void tws_FreeRouteNode(tws_route_node_t *node_ptr) {
+    if (node_ptr == NULL) {
+        return;
+    }
+    for (int i = 0; i < node_ptr->num_children; i++) {
+        tws_FreeRouteNode(node_ptr->children[i]);
+    }
+    if (node_ptr->children != NULL) {
+        ckfree((char *) node_ptr->children);
+    }
+    if (node_ptr->regexp_routes != NULL) {
+        ckfree((char *) node_ptr->regexp_routes);
+    }
+    ckfree(node_ptr->label);
+    ckfree((char *) node_ptr);
+}
+
+static void tws_AppendRouteNodeChild(tws_route_node_t *node_ptr, tws_route_node_t *child_ptr) {
+    node_ptr->children = (tws_route_node_t **) ckrealloc((char *) node_ptr->children,
+                                                         (node_ptr->num_children + 1) * sizeof(tws_route_node_t *));
+    node_ptr->children[node_ptr->num_children++] = child_ptr;
+}
+
+// the labels of the children of a node start with different bytes
+static tws_route_node_t *tws_FindRouteNodeChild(tws_route_node_t *node_ptr, char c) {
+    for (int i = 0; i < node_ptr->num_children; i++) {
+        if (node_ptr->children[i]->label[0] == c) {
+            return node_ptr->children[i];
+        }
+    }
+    return NULL;
+}
+
+// Moves the part of the label of the node after "len" bytes into a new child,
+// along with the routes and the children of the node.
+static void tws_SplitRouteNode(tws_route_node_t *node_ptr, Tcl_Size len) {
+    tws_route_node_t *child_ptr = tws_NewRouteNode(node_ptr->label + len, node_ptr->label_len - len);
+    child_ptr->children = node_ptr->children;
+    child_ptr->num_children = node_ptr->num_children;
+    child_ptr->exact_route_ptr = node_ptr->exact_route_ptr;
+    child_ptr->prefix_route_ptr = node_ptr->prefix_route_ptr;
+    child_ptr->regexp_routes = node_ptr->regexp_routes;
+    child_ptr->num_regexp_routes = node_ptr->num_regexp_routes;
+
+    node_ptr->label_len = len;
+    node_ptr->label[len] = '\0';
+    node_ptr->children = NULL;
+    node_ptr->num_children = 0;
+    node_ptr->exact_route_ptr = NULL;
+    node_ptr->prefix_route_ptr = NULL;
+    node_ptr->regexp_routes = NULL;
+    node_ptr->num_regexp_routes = 0;
+    tws_AppendRouteNodeChild(node_ptr, child_ptr);
+}
+
+static void tws_InsertRouteNode(tws_route_node_t *node_ptr, const char *key, Tcl_Size key_len, int kind,
+                                tws_route_t *route_ptr) {
+    // the label of the root is empty
+    while (key_len > 0) {
+        tws_route_node_t *child_ptr = tws_FindRouteNodeChild(node_ptr, key[0]);
+        if (child_ptr == NULL) {
+            child_ptr = tws_NewRouteNode(key, key_len);
+            tws_AppendRouteNodeChild(node_ptr, child_ptr);
+            node_ptr = child_ptr;
+            break;
+        }
+
+        Tcl_Size common_len = 1;
+        while (common_len < child_ptr->label_len && common_len < key_len && child_ptr->label[common_len] == key[common_len]) {
+            common_len++;
+        }
+        if (common_len < child_ptr->label_len) {
+            tws_SplitRouteNode(child_ptr, common_len);
+        }
+        node_ptr = child_ptr;
+        key += common_len;
+        key_len -= common_len;
+    }
+
+    // a route that comes after another one of the same kind on the same node can never be the first match
+    switch (kind) {
+        case ROUTE_NODE_EXACT:
+            if (node_ptr->exact_route_ptr == NULL) {
+                node_ptr->exact_route_ptr = route_ptr;
+            }
+            break;
+        case ROUTE_NODE_PREFIX:
+            if (node_ptr->prefix_route_ptr == NULL) {
+                node_ptr->prefix_route_ptr = route_ptr;
+            }
+            break;
+        default:
+            node_ptr->regexp_routes = (tws_route_t **) ckrealloc((char *) node_ptr->regexp_routes,
+                                                                 (node_ptr->num_regexp_routes + 1) *
+                                                                 sizeof(tws_route_t *));
+            node_ptr->regexp_routes[node_ptr->num_regexp_routes++] = route_ptr;
+            break;
+    }
+}
+
+// The part of the path of a regexp route before the first special char. The "/" before
+// a parameter is optional when the parameter is, e.g. "/users/:id?" matches "/users",
+// so the literal prefix does not include a "/" that comes right before a special char.
+static Tcl_Size tws_RouteLiteralPrefixLength(tws_route_t *route_ptr) {
+    Tcl_Size len = (Tcl_Size) strcspn(route_ptr->path, ".+*?=^!:${}()[]|\\");
+    if (len > 0 && len < route_ptr->path_len && route_ptr->path[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
+
+tws_route_method_t *tws_FindRouteMethod(tws_route_method_t *method_ptr, const char *http_method,
+                                        Tcl_Size http_method_len) {
+    while (method_ptr != NULL) {
+        if (method_ptr->http_method_len == http_method_len
+            && memcmp(method_ptr->http_method, http_method, http_method_len) == 0) {
+            return method_ptr;
+        }
+        method_ptr = method_ptr->nextPtr;
+    }
+    return NULL;
+}
+
+int tws_AddRouteToMethods(Tcl_Interp *interp, tws_route_method_t **first_method_ptr_ptr, tws_route_t *route_ptr) {
+    tws_route_method_t *method_ptr = tws_FindRouteMethod(*first_method_ptr_ptr, route_ptr->http_method,
+                                                         route_ptr->http_method_len);
+    if (method_ptr == NULL) {
+        method_ptr = (tws_route_method_t *) ckalloc(sizeof(tws_route_method_t));
+        if (!method_ptr) {
+            SetResult("add_route: memory alloc failed");
+            return TCL_ERROR;
+        }
+        memcpy(method_ptr->http_method, route_ptr->http_method, route_ptr->http_method_len + 1);
+        method_ptr->http_method_len = route_ptr->http_method_len;
+        method_ptr->any_route_ptr = NULL;
+        method_ptr->root = NULL;
+        method_ptr->nocase_root = NULL;
+        method_ptr->nextPtr = *first_method_ptr_ptr;
+        *first_method_ptr_ptr = method_ptr;
+    }
+
+    if (route_ptr->fast_star || route_ptr->fast_slash) {
+        if (method_ptr->any_route_ptr == NULL) {
+            method_ptr->any_route_ptr = route_ptr;
+        }
+        return TCL_OK;
+    }
+
+    tws_route_node_t **root_ptr_ptr = route_ptr->option_nocase ? &method_ptr->nocase_root : &method_ptr->root;
+    if (*root_ptr_ptr == NULL) {
+        *root_ptr_ptr = tws_NewRouteNode("", 0);
+    }
+
+    if (route_ptr->type == ROUTE_TYPE_EXACT) {
+        // the path of a -nocase exact route is already lower-cased
+        tws_InsertRouteNode(*root_ptr_ptr, route_ptr->path, route_ptr->path_len,
+                            route_ptr->option_prefix ? ROUTE_NODE_PREFIX : ROUTE_NODE_EXACT, route_ptr);
+    } else {
+        Tcl_Size literal_len = tws_RouteLiteralPrefixLength(route_ptr);
+        char *literal = ckalloc(literal_len + 1);
+        memcpy(literal, route_ptr->path, literal_len);
+        literal[literal_len] = '\0';
+        if (route_ptr->option_nocase) {
+            literal_len = Tcl_UtfToLower(literal);
+        }
+        tws_InsertRouteNode(*root_ptr_ptr, literal, literal_len, ROUTE_NODE_REGEXP, route_ptr);
+        ckfree(literal);
+    }
+    return TCL_OK;
+}
+
+void tws_FreeRouteMethods(tws_route_method_t *method_ptr) {
+    while (method_ptr != NULL) {
+        tws_route_method_t *next = method_ptr->nextPtr;
+        tws_FreeRouteNode(method_ptr->root);
+        tws_FreeRouteNode(method_ptr->nocase_root);
+        ckfree((char *) method_ptr);
+        method_ptr = next;
+    }
+}
+
+static int tws_IsEarlierRoute(tws_route_t *route_ptr, tws_route_t *other_route_ptr) {
+    return other_route_ptr == NULL || route_ptr->index < other_route_ptr->index;
+}
+
+static void tws_AppendLookupRegExpRoute(tws_route_lookup_t *lookup_ptr, tws_route_t *route_ptr) {
+    if (lookup_ptr->num_regexp_routes == lookup_ptr->regexp_routes_capacity) {
+        int capacity = 2 * lookup_ptr->regexp_routes_capacity;
+        if (lookup_ptr->regexp_routes == lookup_ptr->static_regexp_routes) {
+            lookup_ptr->regexp_routes = (tws_route_t **) ckalloc(capacity * sizeof(tws_route_t *));
+            memcpy(lookup_ptr->regexp_routes, lookup_ptr->static_regexp_routes,
+                   lookup_ptr->num_regexp_routes * sizeof(tws_route_t *));
+        } else {
+            lookup_ptr->regexp_routes = (tws_route_t **) ckrealloc((char *) lookup_ptr->regexp_routes,
+                                                                   capacity * sizeof(tws_route_t *));
+        }
+        lookup_ptr->regexp_routes_capacity = capacity;
+    }
+    lookup_ptr->regexp_routes[lookup_ptr->num_regexp_routes++] = route_ptr;
+}
+
+// Walks down the nodes whose path is a prefix of the given path.
+static void tws_LookupRouteNode(tws_route_node_t *node_ptr, const char *path, Tcl_Size path_len,
+                                tws_route_lookup_t *lookup_ptr) {
+    while (node_ptr != NULL) {
+        if (node_ptr->prefix_route_ptr != NULL && tws_IsEarlierRoute(node_ptr->prefix_route_ptr, lookup_ptr->best_route_ptr)) {
+            lookup_ptr->best_route_ptr = node_ptr->prefix_route_ptr;
+        }
+        for (int i = 0; i < node_ptr->num_regexp_routes; i++) {
+            tws_route_t *route_ptr = node_ptr->regexp_routes[i];
+            if (!tws_IsEarlierRoute(route_ptr, lookup_ptr->best_route_ptr)) {
+                break;
+            }
+            tws_AppendLookupRegExpRoute(lookup_ptr, route_ptr);
+        }
+        if (path_len == 0) {
+            if (node_ptr->exact_route_ptr != NULL && tws_IsEarlierRoute(node_ptr->exact_route_ptr, lookup_ptr->best_route_ptr)) {
+                lookup_ptr->best_route_ptr = node_ptr->exact_route_ptr;
+            }
+            return;
+        }
+
+        tws_route_node_t *child_ptr = tws_FindRouteNodeChild(node_ptr, path[0]);
+        if (child_ptr == NULL || child_ptr->label_len > path_len
+            || memcmp(child_ptr->label, path, child_ptr->label_len) != 0) {
+            return;
+        }
+        path += child_ptr->label_len;
+        path_len -= child_ptr->label_len;
+        node_ptr = child_ptr;
+    }
+}
+
+void tws_LookupRoutes(tws_route_method_t *method_ptr, const char *path, Tcl_Size path_len,
+                      tws_route_lookup_t *lookup_ptr) {
+    lookup_ptr->best_route_ptr = method_ptr->any_route_ptr;
+    lookup_ptr->regexp_routes = lookup_ptr->static_regexp_routes;
+    lookup_ptr->num_regexp_routes = 0;
+    lookup_ptr->regexp_routes_capacity = sizeof(lookup_ptr->static_regexp_routes) / sizeof(tws_route_t *);
+
+    tws_LookupRouteNode(method_ptr->root, path, path_len, lookup_ptr);
+
+    if (method_ptr->nocase_root != NULL) {
+        Tcl_DString ds;
+        Tcl_DStringInit(&ds);
+        Tcl_DStringAppend(&ds, path, path_len);
+        Tcl_Size lower_path_len = Tcl_UtfToLower(Tcl_DStringValue(&ds));
+        tws_LookupRouteNode(method_ptr->nocase_root, Tcl_DStringValue(&ds), lower_path_len, lookup_ptr);
+        Tcl_DStringFree(&ds);
+    }
+
+    // keep the regexp routes that come before the best route, in the order they were added
+    int n = 0;
+    for (int i = 0; i < lookup_ptr->num_regexp_routes; i++) {
+        tws_route_t *route_ptr = lookup_ptr->regexp_routes[i];
+        if (!tws_IsEarlierRoute(route_ptr, lookup_ptr->best_route_ptr)) {
+            continue;
+        }
+        int j = n++;
+        while (j > 0 && lookup_ptr->regexp_routes[j - 1]->index > route_ptr->index) {
+            lookup_ptr->regexp_routes[j] = lookup_ptr->regexp_routes[j - 1];
+            j--;
+        }
+        lookup_ptr->regexp_routes[j] = route_ptr;
+    }
+    lookup_ptr->num_regexp_routes = n;
+}
+
+void tws_FreeRouteLookup(tws_route_lookup_t *lookup_ptr) {
+    if (lookup_ptr->regexp_routes != lookup_ptr->static_regexp_routes) {
+        ckfree((char *) lookup_ptr->regexp_routes);
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_ROUTE_TREE_H
+#define TWEBSERVER_ROUTE_TREE_H
+
+#include "common.h"
+
+// A node of a radix tree over route paths. The path of a node is the concatenation
+// of the labels from the root to the node.
+typedef struct tws_route_node_s {
+    char *label;
+    Tcl_Size label_len;
+    struct tws_route_node_s **children;
+    int num_children;
+    // the earliest route whose path is the path of the node
+    tws_route_t *exact_route_ptr;
+    // the earliest -prefix route whose path is the path of the node
+    tws_route_t *prefix_route_ptr;
+    // the regexp routes whose literal prefix is the path of the node, in the order they were added
+    tws_route_t **regexp_routes;
+    int num_regexp_routes;
+} tws_route_node_t;
+
+// The routes of a router for one http method.
+typedef struct tws_route_method_s {
+    Tcl_Size http_method_len;
+    char http_method[10];
+    // the earliest "*" or "-prefix /" route, these match any path
+    tws_route_t *any_route_ptr;
+    tws_route_node_t *root;
+    // -nocase routes, by their lower-cased path
+    tws_route_node_t *nocase_root;
+    struct tws_route_method_s *nextPtr;
+} tws_route_method_t;
+
+typedef struct {
+    // the earliest route that matched without a regexp
+    tws_route_t *best_route_ptr;
+    // the regexp routes that were added before best_route_ptr and may match
+    tws_route_t **regexp_routes;
+    int num_regexp_routes;
+    int regexp_routes_capacity;
+    tws_route_t *static_regexp_routes[16];
+} tws_route_lookup_t;
+
+int tws_AddRouteToMethods(Tcl_Interp *interp, tws_route_method_t **first_method_ptr_ptr, tws_route_t *route_ptr);
+void tws_FreeRouteMethods(tws_route_method_t *method_ptr);
+tws_route_method_t *tws_FindRouteMethod(tws_route_method_t *method_ptr, const char *http_method,
+                                        Tcl_Size http_method_len);
+void tws_LookupRoutes(tws_route_method_t *method_ptr, const char *path, Tcl_Size path_len,
+                      tws_route_lookup_t *lookup_ptr);
+void tws_FreeRouteLookup(tws_route_lookup_t *lookup_ptr);
+
+#endif //TWEBSERVER_ROUTE_TREE_H
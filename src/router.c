@@ -6,30 +6,65 @@
 #include "common.h"
 #include "router.h"
 #include "path_regexp/path_regexp.h"
+#include "route_tree.h"
 #include "return.h"
 #include <string.h>
 #include <assert.h>
 
-enum {
-    ROUTE_TYPE_EXACT,
-    ROUTE_TYPE_REGEXP
-};
+static int tws_PutPathParameters(Tcl_Interp *interp, Tcl_Obj *requestDictPtr, Tcl_Obj *pathParametersDictPtr) {
+    Tcl_Obj *pathParametersKeyPtr = Tcl_NewStringObj("pathParameters", -1);
+    Tcl_IncrRefCount(pathParametersKeyPtr);
+    if (TCL_OK != Tcl_DictObjPut(interp, requestDictPtr, pathParametersKeyPtr, pathParametersDictPtr)) {
+        Tcl_DecrRefCount(pathParametersKeyPtr);
+        SetResult("MatchRoute: dict put failed");
+        return TCL_ERROR;
+    }
+    Tcl_DecrRefCount(pathParametersKeyPtr);
+    return TCL_OK;
+}
 
-static int tws_MatchRegExpRoute(Tcl_Interp *interp, tws_route_t *route_ptr, Tcl_Obj *path_ptr, Tcl_Obj *requestDictPtr,
-                                int *matched) {
+// matches the routes with literal parts and "/:name" parameters only, without the regexp
+static int tws_MatchPathRoute(Tcl_Interp *interp, tws_route_t *route_ptr, Tcl_Obj *path_ptr, Tcl_Obj *requestDictPtr,
+                              int *matched) {
+    Tcl_Size path_len;
+    const char *path = Tcl_GetStringFromObj(path_ptr, &path_len);
+    Tcl_Size ranges[2 * TWS_MAX_PATH_PARAMS];
+    if (!tws_MatchPath(route_ptr->matcher, path, path_len, ranges)) {
+        *matched = 0;
+        return TCL_OK;
+    }
+    *matched = 1;
+
+    DBG2(printf("matched path: %s\n", route_ptr->path));
 
-    int cflags = TCL_REG_ADVANCED;
-    if (route_ptr->option_nocase) {
-        cflags |= TCL_REG_NOCASE;
+    Tcl_Size keys_objc;
+    Tcl_Obj **keys_objv;
+    Tcl_ListObjGetElements(interp, route_ptr->keys, &keys_objc, &keys_objv);
+    Tcl_Obj *pathParametersDictPtr = Tcl_NewDictObj();
+    Tcl_IncrRefCount(pathParametersDictPtr);
+    for (int i = 0; i < keys_objc; i++) {
+        Tcl_Obj *value_ptr = Tcl_NewStringObj(path + ranges[2 * i], ranges[2 * i + 1] - ranges[2 * i]);
+        if (TCL_OK != Tcl_DictObjPut(interp, pathParametersDictPtr, keys_objv[i], value_ptr)) {
+            Tcl_DecrRefCount(value_ptr);
+            Tcl_DecrRefCount(pathParametersDictPtr);
+            SetResult("MatchRoute: dict put failed");
+            return TCL_ERROR;
+        }
     }
-    Tcl_Obj *patObj = Tcl_NewStringObj(route_ptr->pattern, -1);
-    Tcl_IncrRefCount(patObj);
-    Tcl_RegExp regexp = Tcl_GetRegExpFromObj(interp, patObj, cflags);
-    Tcl_DecrRefCount(patObj);
-    if (regexp == NULL) {
-        SetResult("MatchRoute: regexp compile failed");
+
+    if (TCL_OK != tws_PutPathParameters(interp, requestDictPtr, pathParametersDictPtr)) {
+        Tcl_DecrRefCount(pathParametersDictPtr);
         return TCL_ERROR;
     }
+    Tcl_DecrRefCount(pathParametersDictPtr);
+    return TCL_OK;
+}
+
+static int tws_MatchRegExpRoute(Tcl_Interp *interp, tws_route_t *route_ptr, Tcl_Obj *path_ptr, Tcl_Obj *requestDictPtr,
+                                int *matched) {
+
+    Tcl_RegExp regexp = route_ptr->regexp;
+    route_ptr->regexp_exec_count++;
 
     // nmatches: The number of matching subexpressions that should be remembered for later use.
     // If this value is 0, then no subexpression match information will be computed.
@@ -65,15 +100,10 @@ static int tws_MatchRegExpRoute(Tcl_Interp *interp, tws_route_t *route_ptr, Tcl_
             Tcl_DecrRefCount(value_ptr);
         }
 
-        Tcl_Obj *pathParametersKeyPtr = Tcl_NewStringObj("pathParameters", -1);
-        Tcl_IncrRefCount(pathParametersKeyPtr);
-        if (TCL_OK != Tcl_DictObjPut(interp, requestDictPtr, pathParametersKeyPtr, pathParametersDictPtr)) {
-            Tcl_DecrRefCount(pathParametersKeyPtr);
+        if (TCL_OK != tws_PutPathParameters(interp, requestDictPtr, pathParametersDictPtr)) {
             Tcl_DecrRefCount(pathParametersDictPtr);
-            SetResult("MatchRoute: dict put failed");
             return TCL_ERROR;
         }
-        Tcl_DecrRefCount(pathParametersKeyPtr);
         Tcl_DecrRefCount(pathParametersDictPtr);
     } else {
         *matched = 0;
@@ -81,82 +111,65 @@ static int tws_MatchRegExpRoute(Tcl_Interp *interp, tws_route_t *route_ptr, Tcl_
     return TCL_OK;
 }
 
-static int tws_MatchExactRoute(tws_route_t *route_ptr, Tcl_Obj *path_ptr, int *matched) {
-    Tcl_Size path_len;
-    char *path = Tcl_GetStringFromObj(path_ptr, &path_len);
+// Finds the first route, in the order the routes were added, that matches the request.
+// The route tree of the http method gives the earliest route that matches without a
+// regexp along with the regexp routes before it that may match, which are tried in order.
+static int tws_FindRoute(Tcl_Interp *interp, tws_router_t *router_ptr, Tcl_Obj *dup_req_dict_ptr,
+                         tws_route_t **route_ptr_ptr) {
+    *route_ptr_ptr = NULL;
 
-    if (route_ptr->option_nocase) {
-        path_len = Tcl_UtfToLower(path);
-    }
-
-    if (route_ptr->option_prefix) {
-        *matched = (path_len >= route_ptr->path_len
-                    && strncmp(path, route_ptr->path, route_ptr->path_len) == 0);
-    } else {
-        *matched = (path_len == route_ptr->path_len
-                    && strncmp(path, route_ptr->path, path_len) == 0);
-    }
-    return TCL_OK;
-}
-
-static int tws_MatchRoute(Tcl_Interp *interp, tws_route_t *route_ptr, Tcl_Obj *dup_req_dict_ptr, int *matched) {
-    Tcl_Obj *http_method_key_ptr = Tcl_NewStringObj("httpMethod", -1);
-    Tcl_IncrRefCount(http_method_key_ptr);
     Tcl_Obj *http_method_ptr;
-    if (TCL_OK != Tcl_DictObjGet(interp, dup_req_dict_ptr, http_method_key_ptr, &http_method_ptr)) {
-        Tcl_DecrRefCount(http_method_key_ptr);
-        SetResult("MatchRoute: dict get failed");
+    if (TCL_OK != Tcl_DictObjGet(interp, dup_req_dict_ptr, router_ptr->http_method_key_ptr, &http_method_ptr)) {
+        SetResult("FindRoute: dict get failed");
         return TCL_ERROR;
     }
-    Tcl_DecrRefCount(http_method_key_ptr);
 
     if (!http_method_ptr) {
-        *matched = 0;
         return TCL_OK;
     }
 
-    Tcl_Size http_method_len;
-    const char *http_method = Tcl_GetStringFromObj(http_method_ptr, &http_method_len);
-
-    Tcl_Obj *path_key_ptr = Tcl_NewStringObj("path", -1);
-    Tcl_IncrRefCount(path_key_ptr);
     Tcl_Obj *path_ptr;
-    if (TCL_OK != Tcl_DictObjGet(interp, dup_req_dict_ptr, path_key_ptr, &path_ptr)) {
-        Tcl_DecrRefCount(path_key_ptr);
-        SetResult("MatchRoute: dict get failed");
+    if (TCL_OK != Tcl_DictObjGet(interp, dup_req_dict_ptr, router_ptr->path_key_ptr, &path_ptr)) {
+        SetResult("FindRoute: dict get failed");
         return TCL_ERROR;
     }
-    Tcl_DecrRefCount(path_key_ptr);
 
     if (!path_ptr) {
-        *matched = 0;
         return TCL_OK;
     }
 
-    if (http_method_len == route_ptr->http_method_len
-        && strncmp(http_method, route_ptr->http_method, route_ptr->http_method_len) == 0) {
+    Tcl_Size http_method_len;
+    const char *http_method = Tcl_GetStringFromObj(http_method_ptr, &http_method_len);
+    tws_route_method_t *method_ptr = tws_FindRouteMethod(router_ptr->firstMethodPtr, http_method, http_method_len);
+    if (!method_ptr) {
+        return TCL_OK;
+    }
 
-        if (route_ptr->fast_slash || route_ptr->fast_star) {
-            *matched = 1;
-            return TCL_OK;
-        }
+    Tcl_Size path_len;
+    const char *path = Tcl_GetStringFromObj(path_ptr, &path_len);
+    tws_route_lookup_t lookup;
+    tws_LookupRoutes(method_ptr, path, path_len, &lookup);
 
-        if (route_ptr->type == ROUTE_TYPE_EXACT) {
-            if (TCL_OK != tws_MatchExactRoute(route_ptr, path_ptr, matched)) {
-                SetResult("MatchRoute: match_exact_route failed");
-                return TCL_ERROR;
-            }
-        } else {
-            if (TCL_OK != tws_MatchRegExpRoute(interp, route_ptr, path_ptr, dup_req_dict_ptr, matched)) {
-                SetResult("MatchRoute: match_regexp_route failed");
-                return TCL_ERROR;
-            }
+    for (int i = 0; i < lookup.num_regexp_routes; i++) {
+        tws_route_t *route_ptr = lookup.regexp_routes[i];
+        int matched = 0;
+        int rc = route_ptr->matcher != NULL
+                 ? tws_MatchPathRoute(interp, route_ptr, path_ptr, dup_req_dict_ptr, &matched)
+                 : tws_MatchRegExpRoute(interp, route_ptr, path_ptr, dup_req_dict_ptr, &matched);
+        if (TCL_OK != rc) {
+            tws_FreeRouteLookup(&lookup);
+            SetResult("FindRoute: match_regexp_route failed");
+            return TCL_ERROR;
+        }
+        if (matched) {
+            *route_ptr_ptr = route_ptr;
+            tws_FreeRouteLookup(&lookup);
+            return TCL_OK;
         }
-
-    } else {
-        *matched = 0;
     }
 
+    *route_ptr_ptr = lookup.best_route_ptr;
+    tws_FreeRouteLookup(&lookup);
     return TCL_OK;
 }
 
@@ -448,6 +461,13 @@ static int tws_ProcessRoute(Tcl_Interp *interp, tws_conn_t *conn, tws_router_t *
         return TCL_OK;
     }
 
+    if (conn->stream != TWS_STREAM_NONE) {
+        // the route proc has streamed the response with stream_begin
+        Tcl_DecrRefCount(req_dict_ptr);
+        Tcl_ResetResult(interp);
+        return TCL_OK;
+    }
+
     Tcl_Obj *res_dict_ptr = Tcl_GetObjResult(interp);
     Tcl_IncrRefCount(res_dict_ptr);
     Tcl_ResetResult(interp);
@@ -520,36 +540,31 @@ static int tws_DoRouting(Tcl_Interp *interp, tws_router_t *router_ptr, tws_conn_
         return TCL_ERROR;
     }
 
-    tws_route_t *route_ptr = router_ptr->firstRoutePtr;
-    while (route_ptr != NULL) {
-        int matched = 0;
-        if (TCL_OK != tws_MatchRoute(interp, route_ptr, dup_req_dict_ptr, &matched)) {
-            Tcl_DecrRefCount(ctx_dict_ptr);
-            Tcl_DecrRefCount(dup_req_dict_ptr);
-            SetResult("DoRouting: match_route failed");
-            return TCL_ERROR;
-        }
-
-        if (matched) {
+    tws_route_t *route_ptr;
+    if (TCL_OK != tws_FindRoute(interp, router_ptr, dup_req_dict_ptr, &route_ptr)) {
+        Tcl_DecrRefCount(ctx_dict_ptr);
+        Tcl_DecrRefCount(dup_req_dict_ptr);
+        SetResult("DoRouting: match_route failed");
+        return TCL_ERROR;
+    }
 
-            if (route_ptr->name_ptr) {
-                if (TCL_OK !=
-                    Tcl_DictObjPut(interp, ctx_dict_ptr, Tcl_NewStringObj("route_name", -1), route_ptr->name_ptr)) {
-                    Tcl_DecrRefCount(ctx_dict_ptr);
-                    Tcl_DecrRefCount(dup_req_dict_ptr);
-                    SetResult("DoRouting: dict put failed");
-                    return TCL_ERROR;
-                }
-            }
+    if (route_ptr != NULL) {
 
-            // tws_ProcessRoute decrements ref count for dup_req_dict_ptr in any case
-            if (TCL_OK != tws_ProcessRoute(interp, conn, router_ptr, route_ptr, ctx_dict_ptr, dup_req_dict_ptr)) {
+        if (route_ptr->name_ptr) {
+            if (TCL_OK !=
+                Tcl_DictObjPut(interp, ctx_dict_ptr, Tcl_NewStringObj("route_name", -1), route_ptr->name_ptr)) {
                 Tcl_DecrRefCount(ctx_dict_ptr);
+                Tcl_DecrRefCount(dup_req_dict_ptr);
+                SetResult("DoRouting: dict put failed");
                 return TCL_ERROR;
             }
-            break;
         }
-        route_ptr = route_ptr->nextPtr;
+
+        // tws_ProcessRoute decrements ref count for dup_req_dict_ptr in any case
+        if (TCL_OK != tws_ProcessRoute(interp, conn, router_ptr, route_ptr, ctx_dict_ptr, dup_req_dict_ptr)) {
+            Tcl_DecrRefCount(ctx_dict_ptr);
+            return TCL_ERROR;
+        }
     }
 
     Tcl_DecrRefCount(ctx_dict_ptr);
@@ -590,6 +605,12 @@ int tws_HandleRouteEventInThread(tws_router_t *router, tws_conn_t *conn, Tcl_Obj
         fprintf(stderr, "DoRouting: errorinfo: %s\n", Tcl_GetString(errorinfo_ptr));
         Tcl_DecrRefCount(return_options_dict_ptr);
 
+        if (conn->stream != TWS_STREAM_NONE) {
+            // the head of a streamed response has been sent already
+            tws_CloseConn(conn, 1);
+            return 1;
+        }
+
         if (TCL_OK != tws_ReturnError(dataPtr->interp, conn, 500, "Internal Server Error")) {
             tws_CloseConn(conn, 1);
             return 1;
@@ -656,6 +677,10 @@ static int tws_DestroyRouter(Tcl_Interp *interp, const char *handle) {
 
     Tcl_DeleteCommand(interp, router_ptr->handle);
 
+    tws_FreeRouteMethods(router_ptr->firstMethodPtr);
+    Tcl_DecrRefCount(router_ptr->http_method_key_ptr);
+    Tcl_DecrRefCount(router_ptr->path_key_ptr);
+
     tws_route_t *route = router_ptr->firstRoutePtr;
     while (route) {
         tws_route_t *next = route->nextPtr;
@@ -667,6 +692,12 @@ static int tws_DestroyRouter(Tcl_Interp *interp, const char *handle) {
         }
         Tcl_DecrRefCount(route->keys);
         ckfree(route->pattern);
+        if (route->matcher != NULL) {
+            ckfree((char *) route->matcher);
+        }
+        if (route->pattern_ptr != NULL) {
+            Tcl_DecrRefCount(route->pattern_ptr);
+        }
         ckfree((char *) route);
         route = next;
     }
@@ -751,6 +782,12 @@ int tws_CreateRouterCmd(ClientData clientData, Tcl_Interp *interp, int incoming_
     }
     router_ptr->firstRoutePtr = NULL;
     router_ptr->lastRoutePtr = NULL;
+    router_ptr->num_routes = 0;
+    router_ptr->firstMethodPtr = NULL;
+    router_ptr->http_method_key_ptr = Tcl_NewStringObj("httpMethod", -1);
+    Tcl_IncrRefCount(router_ptr->http_method_key_ptr);
+    router_ptr->path_key_ptr = Tcl_NewStringObj("path", -1);
+    Tcl_IncrRefCount(router_ptr->path_key_ptr);
     router_ptr->firstMiddlewarePtr = NULL;
     router_ptr->lastMiddlewarePtr = NULL;
 
@@ -846,6 +883,10 @@ int tws_AddRouteCmd(ClientData clientData, Tcl_Interp *interp, int incoming_objc
     route_ptr->nextPtr = NULL;
     route_ptr->keys = NULL;
     route_ptr->pattern = NULL;
+    route_ptr->matcher = NULL;
+    route_ptr->pattern_ptr = NULL;
+    route_ptr->regexp = NULL;
+    route_ptr->regexp_exec_count = 0;
     route_ptr->guard_list_ptr = NULL;
     route_ptr->name_ptr = NULL;
 
@@ -889,6 +930,31 @@ int tws_AddRouteCmd(ClientData clientData, Tcl_Interp *interp, int incoming_objc
 //                SetResult("add_route: path_to_regexp failed");
                 return TCL_ERROR;
             }
+            // the pattern is still made for info_routes and to validate the path
+            if (!tws_PathToMatcher(route_ptr->path, route_ptr->path_len, flags, &route_ptr->matcher)) {
+                // the regexp is compiled once, the internal rep of pattern_ptr keeps it
+                int cflags = TCL_REG_ADVANCED;
+                if (option_nocase) {
+                    cflags |= TCL_REG_NOCASE;
+                }
+                route_ptr->pattern_ptr = Tcl_NewStringObj(route_ptr->pattern, -1);
+                Tcl_IncrRefCount(route_ptr->pattern_ptr);
+                route_ptr->regexp = Tcl_GetRegExpFromObj(interp, route_ptr->pattern_ptr, cflags);
+                if (route_ptr->regexp == NULL) {
+                    Tcl_DecrRefCount(route_ptr->pattern_ptr);
+                    Tcl_DecrRefCount(route_ptr->keys);
+                    ckfree(route_ptr->pattern);
+                    if (route_ptr->guard_list_ptr != NULL) {
+                        Tcl_DecrRefCount(route_ptr->guard_list_ptr);
+                    }
+                    if (route_ptr->name_ptr != NULL) {
+                        Tcl_DecrRefCount(route_ptr->name_ptr);
+                    }
+                    ckfree((char *) route_ptr);
+                    ckfree(remObjv);
+                    return TCL_ERROR;
+                }
+            }
         } else {
             route_ptr->type = ROUTE_TYPE_EXACT;
             if (option_nocase) {
@@ -903,6 +969,13 @@ int tws_AddRouteCmd(ClientData clientData, Tcl_Interp *interp, int incoming_objc
         }
     }
 
+    route_ptr->index = router_ptr->num_routes;
+    if (TCL_OK != tws_AddRouteToMethods(interp, &router_ptr->firstMethodPtr, route_ptr)) {
+        ckfree(remObjv);
+        return TCL_ERROR;
+    }
+    router_ptr->num_routes++;
+
     if (router_ptr->firstRoutePtr == NULL) {
         router_ptr->firstRoutePtr = route_ptr;
         router_ptr->lastRoutePtr = route_ptr;
@@ -940,6 +1013,7 @@ int tws_InfoRoutesCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
         Tcl_Obj *fast_star_ptr = Tcl_NewBooleanObj(route_ptr->fast_star);
         Tcl_Obj *fast_slash_ptr = Tcl_NewBooleanObj(route_ptr->fast_slash);
         Tcl_Obj *pattern_ptr = Tcl_NewStringObj(route_ptr->pattern ? route_ptr->pattern : "", -1);
+        Tcl_Obj *regexp_exec_count_ptr = Tcl_NewWideIntObj(route_ptr->regexp_exec_count);
 
         Tcl_Obj *values[] = {
                 http_method_ptr,
@@ -952,6 +1026,7 @@ int tws_InfoRoutesCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
                 fast_star_ptr,
                 fast_slash_ptr,
                 pattern_ptr,
+                regexp_exec_count_ptr,
                 NULL
         };
         Tcl_Obj *keys[] = {
@@ -965,6 +1040,7 @@ int tws_InfoRoutesCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
                 Tcl_NewStringObj("fast_star", -1),
                 Tcl_NewStringObj("fast_slash", -1),
                 Tcl_NewStringObj("pattern", -1),
+                Tcl_NewStringObj("regexp_exec_count", -1),
                 NULL
         };
         for (int i = 0; keys[i] != NULL; i++) {
@@ -0,0 +1,214 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include <tcl.h>
+#include <string.h>
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define TWS_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// a space char is one of " \t\n\v\f\r", as for isspace in the "C" locale
+static inline int tws_IsHeaderKeyEnd(char c) {
+    return c == ':' || c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+// checks whether the '\n' at "lf" ends a blank line that starts at or after "start"
+static inline int tws_EndsBlankLine(const char *start, const char *lf) {
+    return (lf - 1 >= start && lf[-1] == '\n')
+           || (lf - 3 >= start && lf[-1] == '\r' && lf[-2] == '\n' && lf[-3] == '\r');
+}
+
+static const char *tws_FindBlankLineScalar(const char *p, const char *end) {
+    const char *start = p;
+    while (p < end) {
+        p = memchr(p, '\n', end - p);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (tws_EndsBlankLine(start, p)) {
+            return p + 1;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static const char *tws_FindHeaderKeyEndScalar(const char *p, const char *end) {
+    while (p < end && !tws_IsHeaderKeyEnd(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *tws_FindLineEndScalar(const char *p, const char *end) {
+    while (p < end && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+#ifdef TWS_HAVE_X86_SIMD
+
+// The vector scanners compare 16 or 32 bytes at a time and leave the tail
+// that is shorter than a vector to the scalar ones.
+
+static const char *tws_FindBlankLineSse2(const char *p, const char *end) {
+    const char *start = p;
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        while (mask) {
+            const char *q = p + __builtin_ctz(mask);
+            if (tws_EndsBlankLine(start, q)) {
+                return q + 1;
+            }
+            mask &= mask - 1;
+        }
+        p += 16;
+    }
+    while (p < end) {
+        if (*p == '\n' && tws_EndsBlankLine(start, p)) {
+            return p + 1;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static const char *tws_FindHeaderKeyEndSse2(const char *p, const char *end) {
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        // "\t" to "\r" are the bytes that are at most 4 after "\t" when compared unsigned
+        __m128i t = _mm_sub_epi8(v, tab);
+        __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(t, range), t);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, space)), ctrl);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return tws_FindHeaderKeyEndScalar(p, end);
+}
+
+static const char *tws_FindLineEndSse2(const char *p, const char *end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return tws_FindLineEndScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *tws_FindBlankLineAvx2(const char *p, const char *end) {
+    const char *start = p;
+    const __m256i lf = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        while (mask) {
+            const char *q = p + __builtin_ctz(mask);
+            if (tws_EndsBlankLine(start, q)) {
+                return q + 1;
+            }
+            mask &= mask - 1;
+        }
+        p += 32;
+    }
+    while (p < end) {
+        if (*p == '\n' && tws_EndsBlankLine(start, p)) {
+            return p + 1;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *tws_FindHeaderKeyEndAvx2(const char *p, const char *end) {
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i range = _mm256_set1_epi8('\r' - '\t');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i t = _mm256_sub_epi8(v, tab);
+        __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, range), t);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, space)),
+                                      ctrl);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return tws_FindHeaderKeyEndSse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *tws_FindLineEndAvx2(const char *p, const char *end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return tws_FindLineEndSse2(p, end);
+}
+
+#endif
+
+static const tws_scan_impl_t tws_scan_impls[] = {
+        {"scalar", tws_FindBlankLineScalar, tws_FindHeaderKeyEndScalar, tws_FindLineEndScalar},
+#ifdef TWS_HAVE_X86_SIMD
+        {"sse2",   tws_FindBlankLineSse2,   tws_FindHeaderKeyEndSse2,   tws_FindLineEndSse2},
+        {"avx2",   tws_FindBlankLineAvx2,   tws_FindHeaderKeyEndAvx2,   tws_FindLineEndAvx2},
+#endif
+};
+
+const tws_scan_impl_t *tws_scan = &tws_scan_impls[0];
+
+// picks the widest scanners that the cpu supports, "sse2" is part of x86_64
+void tws_InitScan() {
+#ifdef TWS_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        tws_SetScanImpl("avx2");
+    } else if (__builtin_cpu_supports("sse2")) {
+        tws_SetScanImpl("sse2");
+    }
+#endif
+}
+
+int tws_SetScanImpl(const char *name) {
+    for (size_t i = 0; i < sizeof(tws_scan_impls) / sizeof(tws_scan_impls[0]); i++) {
+        if (strcmp(tws_scan_impls[i].name, name) == 0) {
+            tws_scan = &tws_scan_impls[i];
+            return TCL_OK;
+        }
+    }
+    return TCL_ERROR;
+}
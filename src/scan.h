@@ -0,0 +1,39 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_SCAN_H
+#define TWEBSERVER_SCAN_H
+
+// Scanners for the bytes that delimit the parts of a request. Each returns a pointer into
+// [p, end), or "end" (NULL for tws_FindBlankLine) if there is no match.
+typedef struct {
+    const char *name;
+    // the end of the first blank line, i.e. of the first "\r\n\r\n" or "\n\n"
+    const char *(*find_blank_line)(const char *p, const char *end);
+    // the first ':' or space char, where a header key ends
+    const char *(*find_header_key_end)(const char *p, const char *end);
+    // the first '\r' or '\n'
+    const char *(*find_line_end)(const char *p, const char *end);
+} tws_scan_impl_t;
+
+extern const tws_scan_impl_t *tws_scan;
+
+void tws_InitScan();
+int tws_SetScanImpl(const char *name);
+
+static inline const char *tws_FindBlankLine(const char *p, const char *end) {
+    return tws_scan->find_blank_line(p, end);
+}
+
+static inline const char *tws_FindHeaderKeyEnd(const char *p, const char *end) {
+    return tws_scan->find_header_key_end(p, end);
+}
+
+static inline const char *tws_FindLineEnd(const char *p, const char *end) {
+    return tws_scan->find_line_end(p, end);
+}
+
+#endif //TWEBSERVER_SCAN_H
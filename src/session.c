@@ -0,0 +1,468 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "session.h"
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+#include <time.h>
+
+// The tls sessions and the session ticket keys of a server. Every conn thread has its own
+// SSL_CTX, so openssl would keep the sessions and the ticket keys per thread and a client
+// that reconnects to another thread of the SO_REUSEPORT group would do a full handshake.
+// The cache is split into shards with a mutex each, so that the threads rarely wait on
+// each other, and a session goes to the shard of the first byte of its random id.
+
+#define TWS_SESSION_CACHE_SHARDS 16
+
+// A ClientHello with early data is remembered for this long, so that the same ClientHello
+// replayed to the server is turned down. openssl turns down the early data of a ticket whose
+// age is off by more than 10 seconds from what the client says, which a later replay is.
+#define TWS_EARLY_DATA_REPLAY_WINDOW_SECONDS 15
+
+// the key of the hash tables, an array of ints so that the session ids need no copy as strings
+typedef struct {
+    unsigned int id_len;
+    unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+} tws_session_key_t;
+
+typedef struct tws_session_entry_s {
+    unsigned char *der;
+    int der_len;
+    time_t expires;
+    Tcl_HashEntry *entryPtr;
+    struct tws_session_entry_s *prevPtr;
+    struct tws_session_entry_s *nextPtr;
+} tws_session_entry_t;
+
+// the client random of a ClientHello with early data, see TWS_EARLY_DATA_REPLAY_WINDOW_SECONDS
+typedef struct {
+    unsigned char random[SSL3_RANDOM_SIZE];
+} tws_replay_key_t;
+
+typedef struct tws_replay_entry_s {
+    time_t expires;
+    Tcl_HashEntry *entryPtr;
+    struct tws_replay_entry_s *nextPtr;
+} tws_replay_entry_t;
+
+typedef struct {
+    Tcl_Mutex mutex;
+    Tcl_HashTable sessions_HT;
+    // the oldest session first, all of them have the same timeout so it is also the first to expire
+    tws_session_entry_t *firstPtr;
+    tws_session_entry_t *lastPtr;
+    Tcl_Size num_entries;
+    // the ClientHellos with early data of the replay window, the oldest first
+    Tcl_HashTable replays_HT;
+    tws_replay_entry_t *firstReplayPtr;
+    tws_replay_entry_t *lastReplayPtr;
+    Tcl_Size num_replays;
+} tws_session_shard_t;
+
+typedef struct {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    time_t created;
+} tws_ticket_key_t;
+
+struct tws_session_cache_s {
+    tws_server_t *server;
+    Tcl_Size max_entries_per_shard;
+    tws_session_shard_t shards[TWS_SESSION_CACHE_SHARDS];
+    // the current key encrypts the new tickets, the previous key still decrypts the tickets
+    // that were issued before the last rotation
+    Tcl_Mutex ticket_keys_mutex;
+    tws_ticket_key_t current_key;
+    tws_ticket_key_t previous_key;
+    int has_previous_key;
+};
+
+static int tws_NewTicketKey(tws_ticket_key_t *key, time_t now) {
+    if (RAND_bytes(key->name, sizeof(key->name)) <= 0
+        || RAND_bytes(key->aes_key, sizeof(key->aes_key)) <= 0
+        || RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) <= 0) {
+        return 0;
+    }
+    key->created = now;
+    return 1;
+}
+
+// rotates the keys lazily, from the callbacks of the handshakes, with ticket_keys_mutex held
+static void tws_RotateTicketKeys(tws_session_cache_t *cache, time_t now) {
+    int interval = cache->server->tls_ticket_key_rotation_interval;
+    if (interval <= 0 || now - cache->current_key.created < interval) {
+        return;
+    }
+
+    tws_ticket_key_t key;
+    if (!tws_NewTicketKey(&key, now)) {
+        // keep the keys that we have, we try again on the next handshake
+        return;
+    }
+
+    // a key decrypts tickets for one interval after it was rotated out and not after
+    // a server that was idle for longer than that
+    if (now - cache->current_key.created < 2 * (time_t) interval) {
+        cache->previous_key = cache->current_key;
+        cache->has_previous_key = 1;
+    } else {
+        OPENSSL_cleanse(&cache->previous_key, sizeof(tws_ticket_key_t));
+        cache->has_previous_key = 0;
+    }
+    cache->current_key = key;
+    OPENSSL_cleanse(&key, sizeof(tws_ticket_key_t));
+    __atomic_add_fetch(&cache->server->tls_ticket_key_rotations, 1, __ATOMIC_RELAXED);
+}
+
+static int tws_TicketKeyCallback(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+                                 EVP_MAC_CTX *mac_ctx, int enc) {
+    tws_conn_t *conn = (tws_conn_t *) SSL_get_app_data(ssl);
+    tws_server_t *server = conn->accept_ctx->server;
+    tws_session_cache_t *cache = server->session_cache;
+
+    tws_ticket_key_t key;
+    int renew = 0;
+    Tcl_MutexLock(&cache->ticket_keys_mutex);
+    tws_RotateTicketKeys(cache, time(NULL));
+    if (enc || memcmp(key_name, cache->current_key.name, sizeof(key.name)) == 0) {
+        key = cache->current_key;
+    } else if (cache->has_previous_key && memcmp(key_name, cache->previous_key.name, sizeof(key.name)) == 0) {
+        key = cache->previous_key;
+        // the client gets a ticket with the current key for the next time
+        renew = 1;
+    } else {
+        Tcl_MutexUnlock(&cache->ticket_keys_mutex);
+        DBG2(printf("TicketKeyCallback: unknown key name\n"));
+        __atomic_add_fetch(&server->tls_ticket_misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    Tcl_MutexUnlock(&cache->ticket_keys_mutex);
+
+    int rc = -1;
+    OSSL_PARAM params[3];
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *) "sha256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+
+    if (enc) {
+        memcpy(key_name, key.name, sizeof(key.name));
+        if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) > 0
+            && EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv)
+            && EVP_MAC_CTX_set_params(mac_ctx, params)) {
+            rc = 1;
+        }
+    } else {
+        if (EVP_MAC_CTX_set_params(mac_ctx, params)
+            && EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv)) {
+            __atomic_add_fetch(&server->tls_ticket_hits, 1, __ATOMIC_RELAXED);
+            rc = renew ? 2 : 1;
+        }
+    }
+    OPENSSL_cleanse(&key, sizeof(tws_ticket_key_t));
+    return rc;
+}
+
+static tws_session_shard_t *tws_GetSessionShard(tws_session_cache_t *cache, tws_session_key_t *key) {
+    return &cache->shards[key->id[0] % TWS_SESSION_CACHE_SHARDS];
+}
+
+static int tws_MakeSessionKey(tws_session_key_t *key, const unsigned char *id, unsigned int id_len) {
+    if (id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) {
+        return 0;
+    }
+    memset(key, 0, sizeof(tws_session_key_t));
+    key->id_len = id_len;
+    memcpy(key->id, id, id_len);
+    return 1;
+}
+
+static void tws_RemoveSessionEntry(tws_session_shard_t *shard, tws_session_entry_t *entry) {
+    if (entry->prevPtr) {
+        entry->prevPtr->nextPtr = entry->nextPtr;
+    } else {
+        shard->firstPtr = entry->nextPtr;
+    }
+    if (entry->nextPtr) {
+        entry->nextPtr->prevPtr = entry->prevPtr;
+    } else {
+        shard->lastPtr = entry->prevPtr;
+    }
+    Tcl_DeleteHashEntry(entry->entryPtr);
+    ckfree((char *) entry->der);
+    ckfree((char *) entry);
+    shard->num_entries--;
+}
+
+static int tws_NewSessionCallback(SSL *ssl, SSL_SESSION *sess) {
+    tws_conn_t *conn = (tws_conn_t *) SSL_get_app_data(ssl);
+    tws_session_cache_t *cache = conn->accept_ctx->server->session_cache;
+
+    // tls 1.3 resumes from the stateless tickets, openssl only looks up its sessions in
+    // the cache when the tickets are off, the tickets stay stateless with early data
+    // since its anti-replay is off, see tws_AllowEarlyDataCallback
+    if (SSL_version(ssl) == TLS1_3_VERSION && !(SSL_get_options(ssl) & SSL_OP_NO_TICKET)) {
+        return 0;
+    }
+
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    tws_session_key_t key;
+    if (!tws_MakeSessionKey(&key, id, id_len)) {
+        return 0;
+    }
+
+    int der_len = i2d_SSL_SESSION(sess, NULL);
+    if (der_len <= 0) {
+        return 0;
+    }
+    unsigned char *der = (unsigned char *) ckalloc(der_len);
+    unsigned char *p = der;
+    i2d_SSL_SESSION(sess, &p);
+
+    time_t now = time(NULL);
+    tws_session_shard_t *shard = tws_GetSessionShard(cache, &key);
+    Tcl_MutexLock(&shard->mutex);
+
+    while (shard->firstPtr && (shard->firstPtr->expires <= now || shard->num_entries >= cache->max_entries_per_shard)) {
+        tws_RemoveSessionEntry(shard, shard->firstPtr);
+    }
+
+    int newEntry;
+    Tcl_HashEntry *entryPtr = Tcl_CreateHashEntry(&shard->sessions_HT, (const char *) &key, &newEntry);
+    if (!newEntry) {
+        // openssl does not reuse session ids, but keep the cache consistent if it did
+        tws_RemoveSessionEntry(shard, (tws_session_entry_t *) Tcl_GetHashValue(entryPtr));
+        entryPtr = Tcl_CreateHashEntry(&shard->sessions_HT, (const char *) &key, &newEntry);
+    }
+
+    tws_session_entry_t *entry = (tws_session_entry_t *) ckalloc(sizeof(tws_session_entry_t));
+    entry->der = der;
+    entry->der_len = der_len;
+    entry->expires = now + (time_t) SSL_SESSION_get_timeout(sess);
+    entry->entryPtr = entryPtr;
+    entry->prevPtr = shard->lastPtr;
+    entry->nextPtr = NULL;
+    if (shard->lastPtr) {
+        shard->lastPtr->nextPtr = entry;
+    } else {
+        shard->firstPtr = entry;
+    }
+    shard->lastPtr = entry;
+    shard->num_entries++;
+    Tcl_SetHashValue(entryPtr, (ClientData) entry);
+
+    Tcl_MutexUnlock(&shard->mutex);
+
+    // we did not keep a reference to the session
+    return 0;
+}
+
+static SSL_SESSION *tws_GetSessionCallback(SSL *ssl, const unsigned char *id, int id_len, int *copy) {
+    tws_conn_t *conn = (tws_conn_t *) SSL_get_app_data(ssl);
+    tws_server_t *server = conn->accept_ctx->server;
+    tws_session_cache_t *cache = server->session_cache;
+
+    // the session is decoded for this conn, openssl owns the only reference
+    *copy = 0;
+
+    tws_session_key_t key;
+    if (id_len <= 0 || !tws_MakeSessionKey(&key, id, (unsigned int) id_len)) {
+        __atomic_add_fetch(&server->tls_session_cache_misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    SSL_SESSION *sess = NULL;
+    tws_session_shard_t *shard = tws_GetSessionShard(cache, &key);
+    Tcl_MutexLock(&shard->mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&shard->sessions_HT, (const char *) &key);
+    if (entryPtr) {
+        tws_session_entry_t *entry = (tws_session_entry_t *) Tcl_GetHashValue(entryPtr);
+        if (entry->expires <= time(NULL)) {
+            tws_RemoveSessionEntry(shard, entry);
+        } else {
+            const unsigned char *p = entry->der;
+            sess = d2i_SSL_SESSION(NULL, &p, entry->der_len);
+        }
+    }
+    Tcl_MutexUnlock(&shard->mutex);
+
+    if (sess) {
+        __atomic_add_fetch(&server->tls_session_cache_hits, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&server->tls_session_cache_misses, 1, __ATOMIC_RELAXED);
+    }
+    return sess;
+}
+
+// openssl removes the sessions of failed handshakes and the single use ones
+static void tws_RemoveSessionCallback(SSL_CTX *ctx, SSL_SESSION *sess) {
+    tws_server_t *server = (tws_server_t *) SSL_CTX_get_app_data(ctx);
+    if (!server || !server->session_cache) {
+        return;
+    }
+
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    tws_session_key_t key;
+    if (!tws_MakeSessionKey(&key, id, id_len)) {
+        return;
+    }
+
+    tws_session_shard_t *shard = tws_GetSessionShard(server->session_cache, &key);
+    Tcl_MutexLock(&shard->mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&shard->sessions_HT, (const char *) &key);
+    if (entryPtr) {
+        tws_RemoveSessionEntry(shard, (tws_session_entry_t *) Tcl_GetHashValue(entryPtr));
+    }
+    Tcl_MutexUnlock(&shard->mutex);
+}
+
+static void tws_RemoveFirstReplayEntry(tws_session_shard_t *shard) {
+    tws_replay_entry_t *entry = shard->firstReplayPtr;
+    shard->firstReplayPtr = entry->nextPtr;
+    if (!shard->firstReplayPtr) {
+        shard->lastReplayPtr = NULL;
+    }
+    Tcl_DeleteHashEntry(entry->entryPtr);
+    ckfree((char *) entry);
+    shard->num_replays--;
+}
+
+// openssl calls this once it would accept the early data of a resumed conn. The early data
+// is turned down when the same ClientHello came within the replay window, and when the
+// window is full, so that a replay cannot get through by flooding it. The client then
+// sends its requests again after the handshake. The window is of this server only, a
+// ClientHello that is replayed to another server with the same ticket keys gets through.
+int tws_AllowEarlyDataCallback(SSL *ssl, void *arg) {
+    UNUSED(arg);
+    tws_conn_t *conn = (tws_conn_t *) SSL_get_app_data(ssl);
+    tws_server_t *server = conn->accept_ctx->server;
+    tws_session_cache_t *cache = server->session_cache;
+
+    tws_replay_key_t key;
+    memset(&key, 0, sizeof(tws_replay_key_t));
+    if (SSL_get_client_random(ssl, key.random, sizeof(key.random)) != sizeof(key.random)) {
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    tws_session_shard_t *shard = &cache->shards[key.random[0] % TWS_SESSION_CACHE_SHARDS];
+    Tcl_MutexLock(&shard->mutex);
+
+    while (shard->firstReplayPtr && shard->firstReplayPtr->expires <= now) {
+        tws_RemoveFirstReplayEntry(shard);
+    }
+
+    int newEntry = 0;
+    if (shard->num_replays < cache->max_entries_per_shard) {
+        Tcl_HashEntry *entryPtr = Tcl_CreateHashEntry(&shard->replays_HT, (const char *) &key, &newEntry);
+        if (newEntry) {
+            tws_replay_entry_t *entry = (tws_replay_entry_t *) ckalloc(sizeof(tws_replay_entry_t));
+            entry->expires = now + TWS_EARLY_DATA_REPLAY_WINDOW_SECONDS;
+            entry->entryPtr = entryPtr;
+            entry->nextPtr = NULL;
+            if (shard->lastReplayPtr) {
+                shard->lastReplayPtr->nextPtr = entry;
+            } else {
+                shard->firstReplayPtr = entry;
+            }
+            shard->lastReplayPtr = entry;
+            shard->num_replays++;
+            Tcl_SetHashValue(entryPtr, (ClientData) entry);
+        }
+    }
+
+    Tcl_MutexUnlock(&shard->mutex);
+
+    if (!newEntry) {
+        DBG2(printf("AllowEarlyDataCallback: replay or full window\n"));
+        __atomic_add_fetch(&server->tls_early_data_replays, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_add_fetch(&server->tls_early_data_accepted, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+tws_session_cache_t *tws_NewSessionCache(tws_server_t *server) {
+    tws_session_cache_t *cache = (tws_session_cache_t *) ckalloc(sizeof(tws_session_cache_t));
+    memset(cache, 0, sizeof(tws_session_cache_t));
+    cache->server = server;
+    cache->max_entries_per_shard = MAX(1, (server->tls_session_cache_size + TWS_SESSION_CACHE_SHARDS - 1) / TWS_SESSION_CACHE_SHARDS);
+    if (!tws_NewTicketKey(&cache->current_key, time(NULL))) {
+        ckfree((char *) cache);
+        return NULL;
+    }
+    for (int i = 0; i < TWS_SESSION_CACHE_SHARDS; i++) {
+        Tcl_InitHashTable(&cache->shards[i].sessions_HT, sizeof(tws_session_key_t) / sizeof(int));
+        Tcl_InitHashTable(&cache->shards[i].replays_HT, sizeof(tws_replay_key_t) / sizeof(int));
+    }
+    return cache;
+}
+
+void tws_FreeSessionCache(tws_session_cache_t *cache) {
+    for (int i = 0; i < TWS_SESSION_CACHE_SHARDS; i++) {
+        tws_session_shard_t *shard = &cache->shards[i];
+        while (shard->firstPtr) {
+            tws_RemoveSessionEntry(shard, shard->firstPtr);
+        }
+        Tcl_DeleteHashTable(&shard->sessions_HT);
+        while (shard->firstReplayPtr) {
+            tws_RemoveFirstReplayEntry(shard);
+        }
+        Tcl_DeleteHashTable(&shard->replays_HT);
+        Tcl_MutexFinalize(&shard->mutex);
+    }
+    Tcl_MutexFinalize(&cache->ticket_keys_mutex);
+    OPENSSL_cleanse(cache, sizeof(tws_session_cache_t));
+    ckfree((char *) cache);
+}
+
+// openssl keeps the sessions in the SSL_CTX of the listener that accepted the conn, also
+// when the ClientHello callback switched the conn to the SSL_CTX of its host name, so the
+// callbacks find the cache from the conn, but every SSL_CTX gets them
+void tws_InstallSessionCache(tws_server_t *server, SSL_CTX *ctx) {
+    SSL_CTX_set_app_data(ctx, server);
+    SSL_CTX_set_timeout(ctx, server->tls_session_timeout);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "twebserver", 10);
+
+    if (server->tls_session_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+        SSL_CTX_sess_set_new_cb(ctx, tws_NewSessionCallback);
+        SSL_CTX_sess_set_get_cb(ctx, tws_GetSessionCallback);
+        SSL_CTX_sess_set_remove_cb(ctx, tws_RemoveSessionCallback);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (server->tls_session_tickets) {
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tws_TicketKeyCallback);
+    } else {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+}
+
+// a session resumes only with the same session id context, so that a session of one host
+// name cannot skip the client certificate verification of another one
+int tws_SetSessionIdContext(SSL_CTX *ctx, const char *hostname) {
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_len;
+    if (!EVP_Digest(hostname, strlen(hostname), md, &md_len, EVP_sha256(), NULL)) {
+        return 0;
+    }
+    return SSL_CTX_set_session_id_context(ctx, md, MIN(md_len, SSL_MAX_SID_CTX_LENGTH));
+}
+
+Tcl_Size tws_GetSessionCacheEntries(tws_session_cache_t *cache) {
+    Tcl_Size num_entries = 0;
+    for (int i = 0; i < TWS_SESSION_CACHE_SHARDS; i++) {
+        Tcl_MutexLock(&cache->shards[i].mutex);
+        num_entries += cache->shards[i].num_entries;
+        Tcl_MutexUnlock(&cache->shards[i].mutex);
+    }
+    return num_entries;
+}
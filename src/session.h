@@ -0,0 +1,19 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_SESSION_H
+#define TWEBSERVER_SESSION_H
+
+#include "common.h"
+
+tws_session_cache_t *tws_NewSessionCache(tws_server_t *server);
+void tws_FreeSessionCache(tws_session_cache_t *cache);
+void tws_InstallSessionCache(tws_server_t *server, SSL_CTX *ctx);
+int tws_SetSessionIdContext(SSL_CTX *ctx, const char *hostname);
+Tcl_Size tws_GetSessionCacheEntries(tws_session_cache_t *cache);
+int tws_AllowEarlyDataCallback(SSL *ssl, void *arg);
+
+#endif //TWEBSERVER_SESSION_H
@@ -0,0 +1,407 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "sni.h"
+#include <limits.h>
+
+// Every TLS handshake looks up the host name of its ClientHello, while the host names only
+// change when a context is added or reloaded. A table is never changed once it is published:
+// a writer builds a new table under tws_HostNames_Mutex and swaps the pointer, and the
+// handshakes load the pointer without a lock. A handshake may still read a table that was
+// replaced, so a replaced table is retired with the epoch that it was replaced in and freed,
+// with its references to the contexts, once no thread is in a lookup that started in that
+// epoch or before. Every thread that looks up host names has a reader with the epoch of the
+// lookup that it is in, a thread that is stalled in a lookup holds the tables back however
+// long it takes. The lookup takes a reference to the context for its caller, so a reloaded
+// context is freed when the last conn that uses it is done.
+
+// The host name of a table with the SSL_CTX that the table holds a reference to.
+typedef struct {
+    char *name; // in lower case, without the "*." of a wildcard
+    Tcl_Size name_len;
+    SSL_CTX *ctx;
+    int verify_mode;
+} tws_host_name_t;
+
+typedef struct tws_host_name_table_s {
+    // sorted by name
+    tws_host_name_t *exact;
+    int num_exact;
+    tws_host_name_t *wildcard;
+    int num_wildcard;
+    unsigned long long retired_epoch;
+    struct tws_host_name_table_s *retiredNextPtr;
+} tws_host_name_table_t;
+
+typedef struct tws_host_names_reader_s {
+    // the epoch that the lookup of the thread started in, 0 when the thread is in no lookup
+    unsigned long long epoch;
+    struct tws_host_names_reader_s *nextPtr;
+} tws_host_names_reader_t;
+
+typedef struct {
+    tws_host_names_reader_t *reader;
+} tws_host_names_thread_data_t;
+
+static tws_host_name_table_t *tws_HostNames = NULL;
+static tws_host_name_table_t *tws_RetiredHostNames = NULL;
+// guarded by tws_HostNames_Mutex
+static tws_host_names_reader_t *tws_HostNamesReaders = NULL;
+// the epochs start at 1, a reader with 0 is in no lookup
+static unsigned long long tws_HostNamesEpoch = 1;
+static Tcl_Mutex tws_HostNames_Mutex;
+static Tcl_ThreadDataKey tws_HostNamesReaderKey;
+
+static int tws_CompareHostName(const char *a, Tcl_Size a_len, const char *b, Tcl_Size b_len) {
+    int rc = memcmp(a, b, MIN(a_len, b_len));
+    if (rc != 0) {
+        return rc;
+    }
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+// returns the index of the name or, if it is not there, the index where it would go as -index - 1
+static int tws_SearchHostName(const tws_host_name_t *entries, int num_entries, const char *name, Tcl_Size name_len) {
+    int low = 0;
+    int high = num_entries - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        int rc = tws_CompareHostName(entries[mid].name, entries[mid].name_len, name, name_len);
+        if (rc == 0) {
+            return mid;
+        } else if (rc < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -low - 1;
+}
+
+static int tws_LowerHostName(const char *name, Tcl_Size name_len, char *buf) {
+    if (name_len == 0 || name_len > TLSEXT_MAXLEN_host_name) {
+        return 0;
+    }
+    for (Tcl_Size i = 0; i < name_len; i++) {
+        buf[i] = (char) tolower((unsigned char) name[i]);
+    }
+    return 1;
+}
+
+// copies the entries of a table with room for one more entry at insert_index or
+// without the entry at remove_index, the copy takes a reference to each context
+static tws_host_name_t *tws_CopyHostNames(const tws_host_name_t *entries, int num_entries, int insert_index,
+                                          int remove_index, int *num_copied) {
+    int num = num_entries + (insert_index >= 0 ? 1 : 0) - (remove_index >= 0 ? 1 : 0);
+    *num_copied = num;
+    if (num == 0) {
+        return NULL;
+    }
+    tws_host_name_t *copy = (tws_host_name_t *) ckalloc(sizeof(tws_host_name_t) * num);
+    int j = 0;
+    for (int i = 0; i < num_entries; i++) {
+        if (i == insert_index) {
+            j++;
+        }
+        if (i == remove_index) {
+            continue;
+        }
+        copy[j].name_len = entries[i].name_len;
+        copy[j].name = ckalloc(entries[i].name_len + 1);
+        memcpy(copy[j].name, entries[i].name, entries[i].name_len + 1);
+        copy[j].ctx = entries[i].ctx;
+        copy[j].verify_mode = entries[i].verify_mode;
+        SSL_CTX_up_ref(copy[j].ctx);
+        j++;
+    }
+    return copy;
+}
+
+static void tws_FreeHostNames(tws_host_name_t *entries, int num_entries) {
+    for (int i = 0; i < num_entries; i++) {
+        ckfree(entries[i].name);
+        SSL_CTX_free(entries[i].ctx);
+    }
+    if (entries) {
+        ckfree((char *) entries);
+    }
+}
+
+static void tws_FreeHostNameTable(tws_host_name_table_t *table) {
+    tws_FreeHostNames(table->exact, table->num_exact);
+    tws_FreeHostNames(table->wildcard, table->num_wildcard);
+    ckfree((char *) table);
+}
+
+static void tws_UnregisterHostNamesReader(ClientData clientData) {
+    tws_host_names_reader_t *reader = (tws_host_names_reader_t *) clientData;
+    Tcl_MutexLock(&tws_HostNames_Mutex);
+    tws_host_names_reader_t **readerPtrPtr = &tws_HostNamesReaders;
+    while (*readerPtrPtr != reader) {
+        readerPtrPtr = &(*readerPtrPtr)->nextPtr;
+    }
+    *readerPtrPtr = reader->nextPtr;
+    Tcl_MutexUnlock(&tws_HostNames_Mutex);
+    ckfree((char *) reader);
+}
+
+// the reader of the calling thread, it is registered on the first lookup of the thread
+static tws_host_names_reader_t *tws_GetHostNamesReader() {
+    tws_host_names_thread_data_t *dataPtr = (tws_host_names_thread_data_t *) Tcl_GetThreadData(
+            &tws_HostNamesReaderKey, sizeof(tws_host_names_thread_data_t));
+    if (!dataPtr->reader) {
+        tws_host_names_reader_t *reader = (tws_host_names_reader_t *) ckalloc(sizeof(tws_host_names_reader_t));
+        reader->epoch = 0;
+        Tcl_MutexLock(&tws_HostNames_Mutex);
+        reader->nextPtr = tws_HostNamesReaders;
+        tws_HostNamesReaders = reader;
+        Tcl_MutexUnlock(&tws_HostNames_Mutex);
+        dataPtr->reader = reader;
+        Tcl_CreateThreadExitHandler(tws_UnregisterHostNamesReader, reader);
+    }
+    return dataPtr->reader;
+}
+
+// called with tws_HostNames_Mutex held, the newest retired table comes first
+static void tws_FreeRetiredHostNames() {
+    // a table that was retired before the oldest lookup in progress started is not read any more
+    unsigned long long min_epoch = ULLONG_MAX;
+    for (tws_host_names_reader_t *reader = tws_HostNamesReaders; reader; reader = reader->nextPtr) {
+        unsigned long long epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < min_epoch) {
+            min_epoch = epoch;
+        }
+    }
+
+    tws_host_name_table_t **prevPtrPtr = &tws_RetiredHostNames;
+    while (*prevPtrPtr && (*prevPtrPtr)->retired_epoch >= min_epoch) {
+        prevPtrPtr = &(*prevPtrPtr)->retiredNextPtr;
+    }
+    tws_host_name_table_t *table = *prevPtrPtr;
+    __atomic_store_n(prevPtrPtr, NULL, __ATOMIC_RELEASE);
+    while (table) {
+        tws_host_name_table_t *next_table = table->retiredNextPtr;
+        tws_FreeHostNameTable(table);
+        table = next_table;
+    }
+}
+
+// called with tws_HostNames_Mutex held
+static void tws_PublishHostNames(tws_host_name_table_t *table) {
+    tws_host_name_table_t *old_table = tws_HostNames;
+    __atomic_store_n(&tws_HostNames, table, __ATOMIC_SEQ_CST);
+    if (old_table) {
+        // the lookups that can still read the old table started in this epoch or before
+        old_table->retired_epoch = __atomic_fetch_add(&tws_HostNamesEpoch, 1, __ATOMIC_SEQ_CST);
+        old_table->retiredNextPtr = tws_RetiredHostNames;
+        __atomic_store_n(&tws_RetiredHostNames, old_table, __ATOMIC_RELEASE);
+    }
+    tws_FreeRetiredHostNames();
+}
+
+// called from the timer ticks of the conn threads, takes the mutex only when there are retired tables
+void tws_ReleaseRetiredHostNames() {
+    if (!__atomic_load_n(&tws_RetiredHostNames, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    Tcl_MutexLock(&tws_HostNames_Mutex);
+    tws_FreeRetiredHostNames();
+    Tcl_MutexUnlock(&tws_HostNames_Mutex);
+}
+
+// the table takes the reference of the caller to the context if the name is not registered yet
+int tws_RegisterHostName(const char *name, SSL_CTX *internal) {
+    char buf[TLSEXT_MAXLEN_host_name + 1];
+    Tcl_Size name_len = (Tcl_Size) strlen(name);
+    if (!tws_LowerHostName(name, name_len, buf)) {
+        return 0;
+    }
+    buf[name_len] = '\0';
+
+    int wildcard_p = name_len > 2 && buf[0] == '*' && buf[1] == '.';
+    const char *key = wildcard_p ? buf + 2 : buf;
+    Tcl_Size key_len = wildcard_p ? name_len - 2 : name_len;
+
+    Tcl_MutexLock(&tws_HostNames_Mutex);
+    tws_host_name_table_t *old_table = tws_HostNames;
+    tws_host_name_t *exact = old_table ? old_table->exact : NULL;
+    int num_exact = old_table ? old_table->num_exact : 0;
+    tws_host_name_t *wildcard = old_table ? old_table->wildcard : NULL;
+    int num_wildcard = old_table ? old_table->num_wildcard : 0;
+
+    int index = wildcard_p
+                ? tws_SearchHostName(wildcard, num_wildcard, key, key_len)
+                : tws_SearchHostName(exact, num_exact, key, key_len);
+    if (index >= 0) {
+        Tcl_MutexUnlock(&tws_HostNames_Mutex);
+        DBG2(printf("--> RegisterHostName: name=%s internal=%p already in\n", name, internal));
+        return 0;
+    }
+    index = -index - 1;
+
+    tws_host_name_table_t *table = (tws_host_name_table_t *) ckalloc(sizeof(tws_host_name_table_t));
+    table->retiredNextPtr = NULL;
+    table->exact = tws_CopyHostNames(exact, num_exact, wildcard_p ? -1 : index, -1, &table->num_exact);
+    table->wildcard = tws_CopyHostNames(wildcard, num_wildcard, wildcard_p ? index : -1, -1, &table->num_wildcard);
+
+    tws_host_name_t *entry = wildcard_p ? &table->wildcard[index] : &table->exact[index];
+    entry->name_len = key_len;
+    entry->name = ckalloc(key_len + 1);
+    memcpy(entry->name, key, key_len + 1);
+    entry->ctx = internal;
+    entry->verify_mode = SSL_CTX_get_verify_mode(internal);
+
+    tws_PublishHostNames(table);
+    Tcl_MutexUnlock(&tws_HostNames_Mutex);
+
+    DBG2(printf("--> RegisterHostName: name=%s internal=%p entered into\n", name, internal));
+    return 1;
+}
+
+// swaps the context of a registered host name, the table takes the reference of the caller
+// to the new context and the conns that switched to the old one keep theirs
+int tws_ReplaceHostName(const char *name, SSL_CTX *internal) {
+    char buf[TLSEXT_MAXLEN_host_name + 1];
+    Tcl_Size name_len = (Tcl_Size) strlen(name);
+    if (!tws_LowerHostName(name, name_len, buf)) {
+        return 0;
+    }
+    buf[name_len] = '\0';
+
+    int wildcard_p = name_len > 2 && buf[0] == '*' && buf[1] == '.';
+    const char *key = wildcard_p ? buf + 2 : buf;
+    Tcl_Size key_len = wildcard_p ? name_len - 2 : name_len;
+
+    Tcl_MutexLock(&tws_HostNames_Mutex);
+    tws_host_name_table_t *old_table = tws_HostNames;
+    if (!old_table) {
+        Tcl_MutexUnlock(&tws_HostNames_Mutex);
+        return 0;
+    }
+    int index = wildcard_p
+                ? tws_SearchHostName(old_table->wildcard, old_table->num_wildcard, key, key_len)
+                : tws_SearchHostName(old_table->exact, old_table->num_exact, key, key_len);
+    if (index < 0) {
+        Tcl_MutexUnlock(&tws_HostNames_Mutex);
+        return 0;
+    }
+
+    tws_host_name_table_t *table = (tws_host_name_table_t *) ckalloc(sizeof(tws_host_name_table_t));
+    table->retiredNextPtr = NULL;
+    table->exact = tws_CopyHostNames(old_table->exact, old_table->num_exact, -1, -1, &table->num_exact);
+    table->wildcard = tws_CopyHostNames(old_table->wildcard, old_table->num_wildcard, -1, -1, &table->num_wildcard);
+
+    tws_host_name_t *entry = wildcard_p ? &table->wildcard[index] : &table->exact[index];
+    SSL_CTX_free(entry->ctx);
+    entry->ctx = internal;
+    entry->verify_mode = SSL_CTX_get_verify_mode(internal);
+
+    tws_PublishHostNames(table);
+    Tcl_MutexUnlock(&tws_HostNames_Mutex);
+
+    DBG2(printf("--> ReplaceHostName: name=%s internal=%p\n", name, internal));
+    return 1;
+}
+
+int tws_UnregisterHostName(const char *name) {
+    char buf[TLSEXT_MAXLEN_host_name + 1];
+    Tcl_Size name_len = (Tcl_Size) strlen(name);
+    if (!tws_LowerHostName(name, name_len, buf)) {
+        return 0;
+    }
+    buf[name_len] = '\0';
+
+    int wildcard_p = name_len > 2 && buf[0] == '*' && buf[1] == '.';
+    const char *key = wildcard_p ? buf + 2 : buf;
+    Tcl_Size key_len = wildcard_p ? name_len - 2 : name_len;
+
+    Tcl_MutexLock(&tws_HostNames_Mutex);
+    tws_host_name_table_t *old_table = tws_HostNames;
+    if (!old_table) {
+        Tcl_MutexUnlock(&tws_HostNames_Mutex);
+        return 0;
+    }
+    int index = wildcard_p
+                ? tws_SearchHostName(old_table->wildcard, old_table->num_wildcard, key, key_len)
+                : tws_SearchHostName(old_table->exact, old_table->num_exact, key, key_len);
+    if (index < 0) {
+        Tcl_MutexUnlock(&tws_HostNames_Mutex);
+        return 0;
+    }
+
+    tws_host_name_table_t *table = (tws_host_name_table_t *) ckalloc(sizeof(tws_host_name_table_t));
+    table->retiredNextPtr = NULL;
+    table->exact = tws_CopyHostNames(old_table->exact, old_table->num_exact, -1, wildcard_p ? -1 : index,
+                                     &table->num_exact);
+    table->wildcard = tws_CopyHostNames(old_table->wildcard, old_table->num_wildcard, -1, wildcard_p ? index : -1,
+                                        &table->num_wildcard);
+    tws_PublishHostNames(table);
+    Tcl_MutexUnlock(&tws_HostNames_Mutex);
+
+    DBG2(printf("--> UnregisterHostName: name=%s\n", name));
+    return 1;
+}
+
+static const tws_host_name_t *tws_SearchHostNameTable(const tws_host_name_table_t *table, const char *buf, Tcl_Size name_len) {
+    int index = tws_SearchHostName(table->exact, table->num_exact, buf, name_len);
+    if (index >= 0) {
+        return &table->exact[index];
+    }
+
+    // "*.example.com" matches "www.example.com" but neither "example.com" nor "a.www.example.com"
+    const char *dot = memchr(buf, '.', name_len);
+    if (dot && dot > buf && dot + 1 < buf + name_len) {
+        const char *suffix = dot + 1;
+        index = tws_SearchHostName(table->wildcard, table->num_wildcard, suffix, buf + name_len - suffix);
+        if (index >= 0) {
+            return &table->wildcard[index];
+        }
+    }
+    return NULL;
+}
+
+// called on every handshake, the name is the server name of the ClientHello and it is not null-terminated.
+// Returns 1 with a reference to the context of the name, which the caller frees, and its verify mode.
+int tws_GetHostName(const char *name, Tcl_Size name_len, SSL_CTX **ctx_ptr, int *verify_mode_ptr) {
+    char buf[TLSEXT_MAXLEN_host_name];
+    if (!tws_LowerHostName(name, name_len, buf)) {
+        return 0;
+    }
+
+    // the table that is loaded after the epoch is stored is not freed until the epoch is cleared
+    tws_host_names_reader_t *reader = tws_GetHostNamesReader();
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&tws_HostNamesEpoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+
+    int found = 0;
+    tws_host_name_table_t *table = __atomic_load_n(&tws_HostNames, __ATOMIC_SEQ_CST);
+    const tws_host_name_t *host_name = table ? tws_SearchHostNameTable(table, buf, name_len) : NULL;
+    if (host_name) {
+        SSL_CTX_up_ref(host_name->ctx);
+        *ctx_ptr = host_name->ctx;
+        *verify_mode_ptr = host_name->verify_mode;
+        found = 1;
+    }
+
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    return found;
+}
+
+void tws_FreeSslContexts() {
+    Tcl_MutexLock(&tws_HostNames_Mutex);
+    tws_host_name_table_t *table = tws_HostNames;
+    __atomic_store_n(&tws_HostNames, NULL, __ATOMIC_RELEASE);
+    if (table) {
+        tws_FreeHostNameTable(table);
+    }
+    table = tws_RetiredHostNames;
+    __atomic_store_n(&tws_RetiredHostNames, NULL, __ATOMIC_RELEASE);
+    while (table) {
+        tws_host_name_table_t *next_table = table->retiredNextPtr;
+        tws_FreeHostNameTable(table);
+        table = next_table;
+    }
+    Tcl_MutexUnlock(&tws_HostNames_Mutex);
+}
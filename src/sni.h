@@ -0,0 +1,19 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_SNI_H
+#define TWEBSERVER_SNI_H
+
+#include "common.h"
+
+int tws_RegisterHostName(const char *name, SSL_CTX *internal);
+int tws_ReplaceHostName(const char *name, SSL_CTX *internal);
+int tws_UnregisterHostName(const char *name);
+int tws_GetHostName(const char *name, Tcl_Size name_len, SSL_CTX **ctx_ptr, int *verify_mode_ptr);
+void tws_ReleaseRetiredHostNames();
+void tws_FreeSslContexts();
+
+#endif //TWEBSERVER_SNI_H
@@ -0,0 +1,119 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "timer.h"
+
+// The wheel advances one tick every garbage_collection_interval_millis. It has an inner
+// level with one slot per tick and an outer level with one slot per TWS_TIMER_WHEEL_SLOTS
+// ticks. A conn in an outer slot is cascaded down to the inner level once the inner level
+// wraps around to it. Conns due further out than the outer level covers are parked in its
+// last slot. When the cascade reaches that slot, tws_InsertConnTimer parks them again, in
+// the inner level if they are due within TWS_TIMER_WHEEL_SLOTS ticks by then and in the
+// outer level otherwise, until they come due.
+
+#define TWS_TIMER_WHEEL_RANGE (TWS_TIMER_WHEEL_SLOTS * TWS_TIMER_WHEEL_OUTER_SLOTS)
+
+static void tws_LinkConnTimer(tws_conn_t **slot_ptr, tws_conn_t *conn) {
+    conn->timerSlotPtr = slot_ptr;
+    conn->timerPrevPtr = NULL;
+    conn->timerNextPtr = *slot_ptr;
+    if (*slot_ptr != NULL) {
+        (*slot_ptr)->timerPrevPtr = conn;
+    }
+    *slot_ptr = conn;
+}
+
+static void tws_InsertConnTimer(tws_timer_wheel_t *wheel, tws_conn_t *conn) {
+    long long delta = conn->timer_expires_tick - wheel->current_tick;
+    if (delta < TWS_TIMER_WHEEL_SLOTS) {
+        tws_LinkConnTimer(&wheel->slots[conn->timer_expires_tick % TWS_TIMER_WHEEL_SLOTS], conn);
+        return;
+    }
+
+    long long outer_tick = delta < TWS_TIMER_WHEEL_RANGE ? conn->timer_expires_tick
+                                                         : wheel->current_tick + TWS_TIMER_WHEEL_RANGE - 1;
+    tws_LinkConnTimer(&wheel->outer_slots[(outer_tick / TWS_TIMER_WHEEL_SLOTS) % TWS_TIMER_WHEEL_OUTER_SLOTS], conn);
+}
+
+void tws_InitTimerWheel(tws_timer_wheel_t *wheel, int tick_millis, long long now_millis) {
+    wheel->tick_millis = tick_millis;
+    wheel->base_millis = now_millis;
+    wheel->current_tick = 0;
+    wheel->tick_token = NULL;
+    for (int i = 0; i < TWS_TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i] = NULL;
+    }
+    for (int i = 0; i < TWS_TIMER_WHEEL_OUTER_SLOTS; i++) {
+        wheel->outer_slots[i] = NULL;
+    }
+}
+
+// Schedules the conn to expire at the tick that covers expires_millis. A conn that
+// is already scheduled to expire earlier is left as is, its deadline is checked
+// again when it comes due.
+void tws_AddConnTimer(tws_timer_wheel_t *wheel, tws_conn_t *conn, long long expires_millis) {
+    long long expires_tick = (expires_millis - wheel->base_millis + wheel->tick_millis - 1) / wheel->tick_millis;
+    if (expires_tick <= wheel->current_tick) {
+        // the slot of the current tick has been processed already
+        expires_tick = wheel->current_tick + 1;
+    }
+
+    if (conn->timerSlotPtr != NULL) {
+        if (conn->timer_expires_tick <= expires_tick) {
+            return;
+        }
+        tws_RemoveConnTimer(conn);
+    }
+
+    conn->timer_expires_tick = expires_tick;
+    tws_InsertConnTimer(wheel, conn);
+}
+
+void tws_RemoveConnTimer(tws_conn_t *conn) {
+    if (conn->timerSlotPtr == NULL) {
+        return;
+    }
+
+    if (conn->timerPrevPtr == NULL) {
+        *conn->timerSlotPtr = conn->timerNextPtr;
+    } else {
+        conn->timerPrevPtr->timerNextPtr = conn->timerNextPtr;
+    }
+    if (conn->timerNextPtr != NULL) {
+        conn->timerNextPtr->timerPrevPtr = conn->timerPrevPtr;
+    }
+
+    conn->timerSlotPtr = NULL;
+    conn->timerPrevPtr = NULL;
+    conn->timerNextPtr = NULL;
+}
+
+// Calls proc for every conn that is due by now_millis. The conn is no longer
+// scheduled when proc is called, so proc may schedule it again or free it.
+void tws_AdvanceTimerWheel(tws_timer_wheel_t *wheel, long long now_millis, tws_ConnTimerProc *proc) {
+    long long now_tick = (now_millis - wheel->base_millis) / wheel->tick_millis;
+
+    while (wheel->current_tick < now_tick) {
+        wheel->current_tick++;
+
+        int slot = (int) (wheel->current_tick % TWS_TIMER_WHEEL_SLOTS);
+        if (slot == 0) {
+            tws_conn_t **outer_slot_ptr = &wheel->outer_slots[(wheel->current_tick / TWS_TIMER_WHEEL_SLOTS) % TWS_TIMER_WHEEL_OUTER_SLOTS];
+            while (*outer_slot_ptr != NULL) {
+                tws_conn_t *conn = *outer_slot_ptr;
+                tws_RemoveConnTimer(conn);
+                tws_InsertConnTimer(wheel, conn);
+            }
+        }
+
+        tws_conn_t **slot_ptr = &wheel->slots[slot];
+        while (*slot_ptr != NULL) {
+            tws_conn_t *conn = *slot_ptr;
+            tws_RemoveConnTimer(conn);
+            proc(conn, now_millis);
+        }
+    }
+}
@@ -0,0 +1,19 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_TIMER_H
+#define TWEBSERVER_TIMER_H
+
+#include "common.h"
+
+typedef void (tws_ConnTimerProc)(tws_conn_t *conn, long long now_millis);
+
+void tws_InitTimerWheel(tws_timer_wheel_t *wheel, int tick_millis, long long now_millis);
+void tws_AddConnTimer(tws_timer_wheel_t *wheel, tws_conn_t *conn, long long expires_millis);
+void tws_RemoveConnTimer(tws_conn_t *conn);
+void tws_AdvanceTimerWheel(tws_timer_wheel_t *wheel, long long now_millis, tws_ConnTimerProc *proc);
+
+#endif //TWEBSERVER_TIMER_H
@@ -0,0 +1,648 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#include "uring.h"
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || !defined(TWS_HAVE_IO_URING)
+
+int tws_UringCreate(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    UNUSED(dataPtr);
+    UNUSED(accept_ctx);
+    return TCL_ERROR;
+}
+
+void tws_UringDelete(tws_thread_data_t *dataPtr) {
+    UNUSED(dataPtr);
+}
+
+void tws_RunUringEventLoop(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    UNUSED(dataPtr);
+    UNUSED(accept_ctx);
+}
+
+void tws_UringArmRead(tws_uring_t *uring, tws_conn_t *conn) {
+    UNUSED(uring);
+    UNUSED(conn);
+}
+
+void tws_UringArmWrite(tws_uring_t *uring, tws_conn_t *conn) {
+    UNUSED(uring);
+    UNUSED(conn);
+}
+
+void tws_UringRemoveConn(tws_uring_t *uring, tws_conn_t *conn) {
+    UNUSED(uring);
+    UNUSED(conn);
+}
+
+int tws_ReadUringConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
+    UNUSED(conn);
+    UNUSED(dsPtr);
+    UNUSED(size);
+    return TWS_ERROR;
+}
+
+#else
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "conn.h"
+#include "buffer.h"
+#include "return.h"
+
+// Accepts and, for plain HTTP, recvs go through the ring and are submitted by the
+// io_uring_enter call that waits for completions, so a request on a new connection takes
+// writev, shutdown, close and 1.6 io_uring_enter calls, see docs/benchmark.md. The accepts
+// are one-shot, re-arming one is an SQE in the next io_uring_enter and not a system call.
+// Responses are written with the write_fn of the conn, as with epoll, since an
+// IORING_OP_SEND would need the response to stay until its completion.
+#define URING_ENTRIES 256
+#define URING_NUM_ACCEPTS 8
+// must be a power of 2
+#define URING_NUM_BUFFERS 64
+#define URING_BUFFER_GROUP 0
+// how long the io_uring event loop waits for completions before running Tcl timers and events
+#define URING_TICK_MILLIS 10
+
+enum {
+    TWS_URING_OP_ACCEPT,
+    TWS_URING_OP_RECV,
+    TWS_URING_OP_POLLIN,
+    TWS_URING_OP_POLLOUT,
+    TWS_URING_OP_CANCEL,
+    TWS_URING_OP_WAKE,
+    TWS_URING_OP_BUFFERED
+};
+
+// the user data of a request holds the conn id in the upper 32 bits, the fd (or the accept slot) and the op
+#define URING_USER_DATA(id, fd, op) (((__u64) (id) << 32) | ((__u64) (fd) << 3) | (op))
+#define URING_USER_DATA_OP(data) ((int) ((data) & 7))
+#define URING_USER_DATA_FD(data) ((int) (((data) & 0xffffffff) >> 3))
+#define URING_USER_DATA_ID(data) ((unsigned int) ((data) >> 32))
+
+typedef struct {
+    struct sockaddr_in6 addr;
+    socklen_t addrlen;
+} tws_uring_accept_t;
+
+struct tws_uring_s {
+    int ring_fd;
+    void *ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned buf_size;
+    unsigned short buf_tail;
+
+    int server_fd;
+    int accepts_cancelled;
+    // the eventfd of the conn thread that the handshake threads write to, -1 for none
+    int wake_fd;
+    uint64_t wake_value;
+    tws_uring_accept_t accepts[URING_NUM_ACCEPTS];
+
+    // conns by fd, the conn id tells apart the completions of a conn whose fd was closed and reused
+    tws_conn_t **conns;
+    int conns_size;
+    unsigned int next_id;
+
+    // the recv completion without data (an error or the end of the stream) being dispatched,
+    // consumed by tws_ReadUringConnAsync
+    tws_conn_t *recv_conn;
+    int recv_res;
+};
+
+static int tws_UringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int tws_UringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int tws_UringRegister(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+// hands the queued requests over to the kernel and, unless wait_millis is negative,
+// waits up to wait_millis for at least one completion
+static int tws_UringSubmit(tws_uring_t *uring, int wait_millis) {
+    __atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (wait_millis < 0) {
+        return to_submit ? tws_UringEnter(uring->ring_fd, to_submit, 0, 0, NULL, 0) : 0;
+    }
+
+    struct __kernel_timespec ts = {0, wait_millis * 1000000LL};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (__u64) (uintptr_t) &ts;
+    return tws_UringEnter(uring->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                          sizeof(arg));
+}
+
+static struct io_uring_sqe *tws_UringGetSqe(tws_uring_t *uring) {
+    if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+        // the submission queue is full, the kernel has to take the requests first
+        if (tws_UringSubmit(uring, -1) < 0) {
+            fprintf(stderr, "UringGetSqe: io_uring_enter failed, errno: %d\n", errno);
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &uring->sqes[uring->sqe_tail & uring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sqe_tail++;
+    return sqe;
+}
+
+static void tws_UringProvideBuffer(tws_uring_t *uring, unsigned short bid) {
+    struct io_uring_buf *buf = &uring->buf_ring->bufs[uring->buf_tail & (URING_NUM_BUFFERS - 1)];
+    buf->addr = (__u64) (uintptr_t) (uring->buffers + (size_t) bid * uring->buf_size);
+    buf->len = uring->buf_size;
+    buf->bid = bid;
+    uring->buf_tail++;
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void tws_UringArmAccept(tws_uring_t *uring, int slot) {
+    struct io_uring_sqe *sqe = tws_UringGetSqe(uring);
+    if (sqe == NULL) {
+        return;
+    }
+
+    tws_uring_accept_t *accept_slot = &uring->accepts[slot];
+    accept_slot->addrlen = sizeof(accept_slot->addr);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = uring->server_fd;
+    sqe->addr = (__u64) (uintptr_t) &accept_slot->addr;
+    sqe->addr2 = (__u64) (uintptr_t) &accept_slot->addrlen;
+    // accepted sockets are non-blocking from the start, so tws_NewConn does not need fcntl
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = URING_USER_DATA(0, slot, TWS_URING_OP_ACCEPT);
+}
+
+// reads the eventfd with a request of its own, so that io_uring_enter returns once a handshake thread wrote to it
+static void tws_UringArmWake(tws_uring_t *uring) {
+    struct io_uring_sqe *sqe = tws_UringGetSqe(uring);
+    if (sqe == NULL) {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = uring->wake_fd;
+    sqe->addr = (__u64) (uintptr_t) &uring->wake_value;
+    sqe->len = sizeof(uring->wake_value);
+    sqe->user_data = URING_USER_DATA(0, 0, TWS_URING_OP_WAKE);
+}
+
+static void tws_UringCancelAccepts(tws_uring_t *uring) {
+    for (int slot = 0; slot < URING_NUM_ACCEPTS; slot++) {
+        struct io_uring_sqe *sqe = tws_UringGetSqe(uring);
+        if (sqe == NULL) {
+            return;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = URING_USER_DATA(0, slot, TWS_URING_OP_ACCEPT);
+        sqe->user_data = URING_USER_DATA(0, slot, TWS_URING_OP_CANCEL);
+    }
+    uring->accepts_cancelled = 1;
+}
+
+static void tws_UringAddConn(tws_uring_t *uring, tws_conn_t *conn) {
+    if (conn->uring_id) {
+        return;
+    }
+
+    if (conn->client >= uring->conns_size) {
+        int conns_size = uring->conns_size;
+        while (conn->client >= conns_size) {
+            conns_size *= 2;
+        }
+        uring->conns = (tws_conn_t **) ckrealloc((char *) uring->conns, conns_size * sizeof(tws_conn_t *));
+        memset(uring->conns + uring->conns_size, 0, (conns_size - uring->conns_size) * sizeof(tws_conn_t *));
+        uring->conns_size = conns_size;
+    }
+
+    conn->uring_id = uring->next_id++;
+    if (uring->next_id == 0) {
+        // zero means that the conn has not been added yet
+        uring->next_id = 1;
+    }
+    uring->conns[conn->client] = conn;
+}
+
+void tws_UringRemoveConn(tws_uring_t *uring, tws_conn_t *conn) {
+    if (conn->uring_id && conn->client < uring->conns_size && uring->conns[conn->client] == conn) {
+        uring->conns[conn->client] = NULL;
+    }
+    if (conn->uring_bid >= 0) {
+        // the bytes of the next request that were received along with this one
+        tws_UringProvideBuffer(uring, (unsigned short) conn->uring_bid);
+        conn->uring_bid = -1;
+        conn->uring_buf_length = 0;
+    }
+}
+
+void tws_UringArmRead(tws_uring_t *uring, tws_conn_t *conn) {
+    DBG2(printf("UringArmRead client: %d\n", conn->client));
+
+    struct io_uring_sqe *sqe = tws_UringGetSqe(uring);
+    if (sqe == NULL) {
+        return;
+    }
+
+    tws_UringAddConn(uring, conn);
+    sqe->fd = conn->client;
+    if (conn->uring_bid >= 0) {
+        // the conn still holds received bytes, e.g. a pipelined request, so it is readable
+        // right away, the no-op completes in order with the other completions of the ring
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = URING_USER_DATA(conn->uring_id, conn->client, TWS_URING_OP_BUFFERED);
+    } else if (conn->accept_ctx->option_http) {
+        // the kernel picks a buffer from the buffer ring once data arrives,
+        // so that conns waiting for data do not hold on to one
+        sqe->opcode = IORING_OP_RECV;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = URING_USER_DATA(conn->uring_id, conn->client, TWS_URING_OP_RECV);
+    } else {
+        // SSL_read reads from the socket itself, we only wait for it to become readable
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = URING_USER_DATA(conn->uring_id, conn->client, TWS_URING_OP_POLLIN);
+    }
+}
+
+void tws_UringArmWrite(tws_uring_t *uring, tws_conn_t *conn) {
+    DBG2(printf("UringArmWrite client: %d\n", conn->client));
+
+    struct io_uring_sqe *sqe = tws_UringGetSqe(uring);
+    if (sqe == NULL) {
+        return;
+    }
+
+    tws_UringAddConn(uring, conn);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->client;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = URING_USER_DATA(conn->uring_id, conn->client, TWS_URING_OP_POLLOUT);
+}
+
+int tws_ReadUringConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size) {
+    tws_thread_data_t *dataPtr = (tws_thread_data_t *) Tcl_GetThreadData(tws_GetThreadDataKey(), sizeof(tws_thread_data_t));
+    tws_uring_t *uring = dataPtr->uring;
+
+    if (conn->uring_bid < 0) {
+        if (uring->recv_conn != conn) {
+            // nothing received for this conn, tws_WaitForReadable arms a recv request
+            return TWS_AGAIN;
+        }
+        uring->recv_conn = NULL;
+
+        if (uring->recv_res < 0) {
+            DBG2(printf("recv error: %d\n", conn->client));
+            return TWS_ERROR;
+        }
+
+        DBG2(printf("peer closed connection %d\n", conn->client));
+        return TWS_DONE;
+    }
+
+    // never read past the bytes asked for, they belong to the next request
+    // and stay in the provided buffer until the next read
+    Tcl_Size bytes_to_read = size == 0 ? conn->uring_buf_length : MIN(size, conn->uring_buf_length);
+    long max_request_read_bytes = conn->accept_ctx->server->max_request_read_bytes - Tcl_DStringLength(&conn->inout_ds);
+    if (bytes_to_read > max_request_read_bytes) {
+        return TWS_ERROR;
+    }
+
+    // the kernel picked the provided buffer, copying out of it is the only copy
+    const char *buf = uring->buffers + (size_t) conn->uring_bid * uring->buf_size + conn->uring_buf_offset;
+    Tcl_Size total_read = 0;
+    while (total_read < bytes_to_read) {
+        Tcl_Size avail;
+        char *read_space = tws_ReserveReadSpace(dsPtr, bytes_to_read - total_read, &avail);
+        memcpy(read_space, buf + total_read, avail);
+        Tcl_DStringSetLength(dsPtr, Tcl_DStringLength(dsPtr) + avail);
+        total_read += avail;
+    }
+
+    conn->uring_buf_offset += bytes_to_read;
+    conn->uring_buf_length -= bytes_to_read;
+    if (conn->uring_buf_length == 0) {
+        tws_UringProvideBuffer(uring, (unsigned short) conn->uring_bid);
+        conn->uring_bid = -1;
+    }
+
+    if (size > 0 && bytes_to_read == size) {
+        return TWS_DONE;
+    }
+    return TWS_AGAIN;
+}
+
+static void tws_UringHandleAccept(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx, int slot, int res) {
+    tws_uring_t *uring = dataPtr->uring;
+
+    if (res < 0) {
+        if (res != -ECANCELED) {
+            fprintf(stderr, "Unable to accept\n");
+        }
+        if (!uring->accepts_cancelled) {
+            tws_UringArmAccept(uring, slot);
+        }
+        return;
+    }
+
+    if (dataPtr->terminate) {
+        close(res);
+        return;
+    }
+
+    // get the client IP address before the slot is reused
+    char client_ip[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &uring->accepts[slot].addr.sin6_addr, client_ip, sizeof(client_ip));
+    DBG2(printf("Client connected from %s\n", client_ip));
+
+    tws_UringArmAccept(uring, slot);
+    tws_HandleAcceptedConn(accept_ctx, res, client_ip);
+}
+
+static void tws_UringHandleConnCompletion(tws_uring_t *uring, __u64 user_data, int res, unsigned flags) {
+    int op = URING_USER_DATA_OP(user_data);
+    int fd = URING_USER_DATA_FD(user_data);
+    int has_buffer = flags & IORING_CQE_F_BUFFER;
+    unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+    tws_conn_t *conn = fd < uring->conns_size ? uring->conns[fd] : NULL;
+    if (conn == NULL || conn->uring_id != URING_USER_DATA_ID(user_data) || conn->shutdown) {
+        // the conn was shut down while the request was pending
+        if (has_buffer) {
+            tws_UringProvideBuffer(uring, bid);
+        }
+        return;
+    }
+
+    if (op == TWS_URING_OP_POLLOUT) {
+        tws_HandleWriteReady(conn);
+        // poll requests are one-shot, ask again if the write is still incomplete
+        if (!conn->shutdown && conn->write_pending) {
+            tws_UringArmWrite(uring, conn);
+        }
+        return;
+    }
+
+    // read requests are one-shot, tws_WaitForReadable and tws_CloseConn arm them again when needed
+    conn->created_file_handler_p = 0;
+
+    if (op == TWS_URING_OP_RECV) {
+        if (res == -ENOBUFS) {
+            // all buffers are taken by completions that we have not processed yet
+            conn->created_file_handler_p = 1;
+            tws_UringArmRead(uring, conn);
+            return;
+        }
+        if (res > 0 && has_buffer) {
+            // the conn holds on to the buffer until it has read all of it, see tws_ReadUringConnAsync
+            conn->uring_bid = bid;
+            conn->uring_buf_offset = 0;
+            conn->uring_buf_length = res;
+        } else {
+            if (has_buffer) {
+                tws_UringProvideBuffer(uring, bid);
+            }
+            uring->recv_conn = conn;
+            uring->recv_res = res;
+        }
+    }
+
+    tws_HandleConnReady(conn);
+
+    uring->recv_conn = NULL;
+}
+
+void tws_RunUringEventLoop(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    tws_uring_t *uring = dataPtr->uring;
+
+    while (!dataPtr->terminate || dataPtr->num_conns) {
+        if (dataPtr->terminate && !uring->accepts_cancelled) {
+            // the pending accept requests hold on to the listening socket
+            tws_UringCancelAccepts(uring);
+        }
+
+        if (tws_UringSubmit(uring, URING_TICK_MILLIS) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            fprintf(stderr, "RunUringEventLoop: io_uring_enter failed, errno: %d\n", errno);
+            break;
+        }
+
+        unsigned head = *uring->cq_head;
+        while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+            __u64 user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+            __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+            DBG2(printf("RunUringEventLoop - op: %d res: %d\n", URING_USER_DATA_OP(user_data), res));
+
+            switch (URING_USER_DATA_OP(user_data)) {
+                case TWS_URING_OP_ACCEPT:
+                    tws_UringHandleAccept(dataPtr, accept_ctx, URING_USER_DATA_FD(user_data), res);
+                    break;
+                case TWS_URING_OP_CANCEL:
+                    break;
+                case TWS_URING_OP_WAKE:
+                    // the Tcl events below pick up the conns that the handshake threads gave back
+                    if (res >= 0) {
+                        tws_UringArmWake(uring);
+                    } else if (res != -ECANCELED) {
+                        fprintf(stderr, "RunUringEventLoop: wake_fd read failed, res: %d\n", res);
+                    }
+                    break;
+                default:
+                    tws_UringHandleConnCompletion(uring, user_data, res, flags);
+            }
+        }
+
+        // run pending Tcl timers and the events that are still queued, e.g. freeing conns
+        while (Tcl_DoOneEvent(TCL_ALL_EVENTS | TCL_DONT_WAIT)) {
+        }
+    }
+}
+
+static int tws_UringSupportsOps(int ring_fd) {
+    int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_READ};
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *) ckalloc(probe_size);
+    memset(probe, 0, probe_size);
+
+    int supported = 0;
+    if (tws_UringRegister(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        supported = 1;
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                supported = 0;
+            }
+        }
+    }
+
+    ckfree((char *) probe);
+    return supported;
+}
+
+static void tws_UringFree(tws_uring_t *uring) {
+    if (uring->buffers) {
+        ckfree(uring->buffers);
+    }
+    if (uring->buf_ring) {
+        munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    if (uring->sqes) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->ring_ptr) {
+        munmap(uring->ring_ptr, uring->ring_size);
+    }
+    // closing the ring cancels the requests that are still pending
+    close(uring->ring_fd);
+    ckfree((char *) uring->conns);
+    ckfree((char *) uring);
+}
+
+int tws_UringCreate(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = tws_UringSetup(URING_ENTRIES, &params);
+    if (ring_fd < 0) {
+        fprintf(stderr, "UringCreate: io_uring_setup failed, errno: %d\n", errno);
+        return TCL_ERROR;
+    }
+
+    unsigned required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required_features) != required_features || !tws_UringSupportsOps(ring_fd)) {
+        fprintf(stderr, "UringCreate: io_uring does not support the required features\n");
+        close(ring_fd);
+        return TCL_ERROR;
+    }
+
+    tws_uring_t *uring = (tws_uring_t *) ckalloc(sizeof(tws_uring_t));
+    memset(uring, 0, sizeof(tws_uring_t));
+    uring->ring_fd = ring_fd;
+    uring->server_fd = accept_ctx->server_fd;
+    uring->next_id = 1;
+    uring->conns_size = 1024;
+    uring->conns = (tws_conn_t **) ckalloc(uring->conns_size * sizeof(tws_conn_t *));
+    memset(uring->conns, 0, uring->conns_size * sizeof(tws_conn_t *));
+
+    size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+    void *ring_ptr = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                          IORING_OFF_SQ_RING);
+    if (ring_ptr == MAP_FAILED) {
+        fprintf(stderr, "UringCreate: mmap of the rings failed\n");
+        goto error;
+    }
+    uring->ring_ptr = ring_ptr;
+    uring->ring_size = ring_size;
+
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        fprintf(stderr, "UringCreate: mmap of the submission queue entries failed\n");
+        goto error;
+    }
+    uring->sqes = (struct io_uring_sqe *) sqes;
+    uring->sqes_size = sqes_size;
+
+    char *ring = (char *) ring_ptr;
+    uring->sq_head = (unsigned *) (ring + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (ring + params.sq_off.tail);
+    uring->sq_array = (unsigned *) (ring + params.sq_off.array);
+    uring->sq_mask = *(unsigned *) (ring + params.sq_off.ring_mask);
+    uring->sq_entries = params.sq_entries;
+    uring->cq_head = (unsigned *) (ring + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (ring + params.cq_off.tail);
+    uring->cq_mask = *(unsigned *) (ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        uring->sq_array[i] = i;
+    }
+    uring->sqe_tail = *uring->sq_tail;
+
+    // the buffer ring has to be page aligned
+    uring->buf_ring_size = URING_NUM_BUFFERS * sizeof(struct io_uring_buf);
+    void *buf_ring = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        fprintf(stderr, "UringCreate: mmap of the buffer ring failed\n");
+        goto error;
+    }
+    uring->buf_ring = (struct io_uring_buf_ring *) buf_ring;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (__u64) (uintptr_t) buf_ring;
+    reg.ring_entries = URING_NUM_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (tws_UringRegister(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        fprintf(stderr, "UringCreate: registering the buffer ring failed, errno: %d\n", errno);
+        goto error;
+    }
+
+    uring->buf_size = (unsigned) accept_ctx->server->max_read_buffer_size;
+    uring->buffers = ckalloc((size_t) URING_NUM_BUFFERS * uring->buf_size);
+    for (unsigned short bid = 0; bid < URING_NUM_BUFFERS; bid++) {
+        tws_UringProvideBuffer(uring, bid);
+    }
+
+    for (int slot = 0; slot < URING_NUM_ACCEPTS; slot++) {
+        tws_UringArmAccept(uring, slot);
+    }
+    uring->wake_fd = accept_ctx->wake_fd;
+    if (uring->wake_fd >= 0) {
+        tws_UringArmWake(uring);
+    }
+
+    dataPtr->uring = uring;
+    return TCL_OK;
+
+    error:
+    tws_UringFree(uring);
+    return TCL_ERROR;
+}
+
+void tws_UringDelete(tws_thread_data_t *dataPtr) {
+    tws_UringFree(dataPtr->uring);
+    dataPtr->uring = NULL;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2024 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+
+#ifndef TWEBSERVER_URING_H
+#define TWEBSERVER_URING_H
+
+#include <tcl.h>
+#include "common.h"
+
+int tws_UringCreate(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx);
+void tws_UringDelete(tws_thread_data_t *dataPtr);
+void tws_RunUringEventLoop(tws_thread_data_t *dataPtr, tws_accept_ctx_t *accept_ctx);
+void tws_UringArmRead(tws_uring_t *uring, tws_conn_t *conn);
+void tws_UringArmWrite(tws_uring_t *uring, tws_conn_t *conn);
+void tws_UringRemoveConn(tws_uring_t *uring, tws_conn_t *conn);
+int tws_ReadUringConnAsync(tws_conn_t *conn, Tcl_DString *dsPtr, Tcl_Size size);
+
+#endif //TWEBSERVER_URING_H
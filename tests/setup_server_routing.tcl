@@ -2,6 +2,10 @@ package require twebserver
 
 set server_port 12345
 set http_server_port 1122
+set event_loop [expr { [llength $argv] > 0 ? [lindex $argv 0] : "tcl" }]
+set conn_timeout_millis [expr { [llength $argv] > 1 ? [lindex $argv 1] : 120000 }]
+set binary_body [expr { [llength $argv] > 2 ? [lindex $argv 2] : "base64" }]
+set tls_handshake_threads [expr { [llength $argv] > 3 ? [lindex $argv 3] : 0 }]
 
 set init_script {
     package require twebserver
@@ -12,8 +16,30 @@ set init_script {
     ::twebserver::add_route -prefix $router GET /asdf get_asdf_handler
     ::twebserver::add_route -strict $router GET /qwerty/:user_id/sayhi get_qwerty_handler
     ::twebserver::add_route -strict $router GET /addr get_addr_handler
+    ::twebserver::add_route -strict $router GET /conn-pool get_conn_pool_handler
     ::twebserver::add_route -strict $router POST /example post_example_handler
     ::twebserver::add_route -strict $router POST /form-example post_form_handler
+    ::twebserver::add_route -strict $router GET /accessors get_accessors_handler
+    ::twebserver::add_route -strict $router POST /binary-example post_binary_handler
+    ::twebserver::add_route -strict $router POST /body-file post_body_file_handler
+    ::twebserver::add_route -strict $router POST /form-files post_form_files_handler
+    ::twebserver::add_route -strict $router GET /info-tls get_info_tls_handler
+    ::twebserver::add_route -strict $router GET /early-data get_early_data_handler
+    ::twebserver::add_route -strict $router POST /early-data get_early_data_handler
+    ::twebserver::add_route -strict $router GET /file get_file_handler
+    ::twebserver::add_route -strict $router GET /file-body get_file_body_handler
+    ::twebserver::add_route -strict $router GET /repeat get_repeat_handler
+    ::twebserver::add_route -strict $router GET /stream get_stream_handler
+    ::twebserver::add_route -strict $router GET /stream-binary get_stream_binary_handler
+    ::twebserver::add_route -strict $router GET /reload-context get_reload_context_handler
+    ::twebserver::add_route -name order-param $router GET /order/:name get_route_name_handler
+    ::twebserver::add_route -name order-fixed -strict $router GET /order/fixed get_route_name_handler
+    ::twebserver::add_route -name order-prefix -prefix $router GET /order get_route_name_handler
+    ::twebserver::add_route -name mixed-case -nocase $router GET /Mixed/Case get_route_name_handler
+    ::twebserver::add_route -name member-profile -nocase $router GET /Members/:member_id/Profile get_route_name_handler
+    ::twebserver::add_route -strict $router GET {/regexp-count/(\d+)} get_regexp_count_handler
+    ::twebserver::add_route -name custom-patterns -strict $router GET {/custom/:a(\d+)/:b(\w+)} get_route_name_handler
+    ::twebserver::add_route -name optional-param $router GET /optional/:id? get_route_name_handler
     ::twebserver::add_route $router GET "*" catchall_handler
     ::twebserver::add_route $router POST "*" catchall_handler
 
@@ -44,6 +70,154 @@ set init_script {
         return $res
     }
 
+    proc get_accessors_handler {ctx req} {
+        set user_agent [::twebserver::get_header $req user-agent]
+        set x_test [::twebserver::get_header $req x-test 1]
+        set page [::twebserver::get_query_param $req page]
+        set tags [::twebserver::get_query_param $req tag 1]
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set req queryStringParameters page 3
+        set new_page [::twebserver::get_query_param $req page]
+        dict set res body "user-agent=$user_agent x-test=$x_test page=$page tags=$tags new-page=$new_page query=[dict get $req queryStringParameters]"
+        return $res
+    }
+
+    proc post_body_file_handler {ctx req} {
+        set body_file [dict get $req bodyFile]
+        set form [::twebserver::get_form $req]
+        set fields {}
+        dict for {name value} [dict get $form fields] {
+            lappend fields $name [string length $value]
+        }
+        set files {}
+        if { [dict exists $form fileRanges] } {
+            set fp [open $body_file rb]
+            dict for {filename range} [dict get $form fileRanges] {
+                lassign $range offset length
+                seek $fp $offset
+                lappend files $filename $length [string range [read $fp $length] 0 7]
+            }
+            close $fp
+        }
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body "bodyFile=$body_file size=[file size $body_file] body=[dict get $req body] fields=$fields files=$files"
+        return $res
+    }
+    proc post_form_files_handler {ctx req} {
+        set form [::twebserver::get_form $req]
+        set files {}
+        dict for {filename data} [dict get $form files] {
+            lappend files $filename [binary encode hex $data]
+        }
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body "fields=[dict get $form fields] files=$files"
+        return $res
+    }
+    proc post_binary_handler {ctx req} {
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        set is_binary [expr { [dict exists $req isBinary] ? " isBinary=[dict get $req isBinary]" : "" }]
+        dict set res body "isBase64Encoded=[dict get $req isBase64Encoded]$is_binary body=[dict get $req body]"
+        return $res
+    }
+
+    proc get_info_tls_handler {ctx req} {
+        set conn_info [::twebserver::info_conn [dict get $ctx conn]]
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body [concat [dict filter $conn_info key ktls_*] [::twebserver::info_tls]]
+        return $res
+    }
+
+    proc get_early_data_handler {ctx req} {
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body "earlyData=[expr { [dict exists $req earlyData] && [dict get $req earlyData] }]"
+        return $res
+    }
+
+    proc get_file_handler {ctx req} {
+        set mimetype [::twebserver::get_query_param $req mimetype]
+        set path [::twebserver::get_query_param $req path]
+        return [::twebserver::build_response -return_file 200 $mimetype $path]
+    }
+
+    proc get_file_body_handler {ctx req} {
+        set mimetype [::twebserver::get_query_param $req mimetype]
+        set path [::twebserver::get_query_param $req path]
+        set file_res [::twebserver::build_response -return_file 200 $mimetype $path]
+        set is_base64_encoded [expr { [dict exists $file_res isBase64Encoded] ? [dict get $file_res isBase64Encoded] : 0 }]
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body "isBase64Encoded=$is_base64_encoded body=[dict get $file_res body]"
+        return $res
+    }
+
+    proc get_repeat_handler {ctx req} {
+        set mimetype [::twebserver::get_query_param $req mimetype]
+        set text [::twebserver::get_query_param $req text]
+        set count [::twebserver::get_query_param $req count]
+        return [::twebserver::build_response 200 $mimetype [string repeat $text $count]]
+    }
+
+    proc get_stream_handler {ctx req} {
+        set conn [dict get $ctx conn]
+        set count [::twebserver::get_query_param $req count]
+        set line [string repeat x [::twebserver::get_query_param $req size]]
+        ::twebserver::stream_begin $conn [dict create statusCode 200 headers {Content-Type text/plain}]
+        stream_lines $conn $count $line 0
+    }
+
+    # writes the lines until stream_write asks to wait for the conn to drain
+    proc stream_lines {conn count line i} {
+        while { $i < $count } {
+            set more [::twebserver::stream_write $conn "$i $line\n"]
+            incr i
+            if { !$more } {
+                ::twebserver::stream_on_drain $conn [list stream_lines $conn $count $line $i]
+                return
+            }
+        }
+        ::twebserver::stream_end $conn
+    }
+
+    # the bytes 0 to 255 twice, once as a byte array and once as a string with -binary
+    proc get_stream_binary_handler {ctx req} {
+        set conn [dict get $ctx conn]
+        set bytes [list]
+        for {set i 0} {$i < 256} {incr i} {
+            lappend bytes $i
+        }
+        ::twebserver::stream_begin $conn [dict create statusCode 200 headers {Content-Type application/octet-stream}]
+        ::twebserver::stream_write $conn [binary format c* $bytes]
+        ::twebserver::stream_write -binary $conn [join [lmap i $bytes { format %c $i }] ""]
+        ::twebserver::stream_end $conn
+    }
+
+    proc get_route_name_handler {ctx req} {
+        set path_parameters [expr { [dict exists $req pathParameters] ? [dict get $req pathParameters] : "" }]
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body "route=[dict get $ctx route_name] path=[dict get $req path] pathParameters=$path_parameters"
+        return $res
+    }
+
+    proc get_regexp_count_handler {ctx req} {
+        set counts {}
+        foreach route [::twebserver::info_routes $::router] {
+            if { [dict get $route path] in {{/regexp-count/(\d+)} /Members/:member_id/Profile} } {
+                lappend counts "[dict get $route path]=[dict get $route regexp_exec_count]"
+            }
+        }
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body [join $counts " "]
+        return $res
+    }
+
     proc get_asdf_handler {ctx req} {
         dict set res statusCode 200
         dict set res headers {Content-Type text/plain}
@@ -72,14 +246,45 @@ set init_script {
         return $res
     }
 
+    proc get_reload_context_handler {ctx req} {
+        set hostname [::twebserver::get_query_param $req hostname]
+        set key [::twebserver::get_query_param $req key]
+        set cert [::twebserver::get_query_param $req cert]
+        set options [list]
+        set ocsp_file [::twebserver::get_query_param $req ocsp_file]
+        if { $ocsp_file ne {} } {
+            lappend options -ocsp_file $ocsp_file
+        }
+        if { [catch {::twebserver::reload_context {*}$options [dict get $ctx server] $hostname $key $cert} errmsg] } {
+            return [::twebserver::build_response 400 text/plain $errmsg]
+        }
+        return [::twebserver::build_response 200 text/plain "reloaded $hostname"]
+    }
+
+    proc get_conn_pool_handler {ctx req} {
+        dict set res statusCode 200
+        dict set res headers {Content-Type text/plain}
+        dict set res body [::twebserver::info_conn_pool]
+        return $res
+    }
+
 }
 
 set config_dict [dict create \
     read_timeout_millis 5000 \
+    conn_timeout_millis $conn_timeout_millis \
     gzip on \
     gzip_types [list text/plain application/json] \
     gzip_min_length 20 \
-    connect_timeout_millis 5000]
+    body_file_min_length 65536 \
+    binary_body $binary_body \
+    max_body_file_length 4194304 \
+    ktls 1 \
+    tls_handshake_threads $tls_handshake_threads \
+    tls_max_early_data 16384 \
+    ocsp_refresh_interval 1 \
+    connect_timeout_millis 5000 \
+    event_loop $event_loop]
 
 set server_handle [::twebserver::create_server -with_router $config_dict process_conn $init_script]
 
@@ -87,6 +292,8 @@ set dir [file dirname [info script]]
 set localhost_key [file join $dir "../certs/host1/key.pem"]
 set localhost_cert [file join $dir "../certs/host1/cert.pem"]
 ::twebserver::add_context $server_handle localhost $localhost_key $localhost_cert
+# a wildcard host name, it matches "www.localhost" but not "localhost" or "a.www.localhost"
+::twebserver::add_context $server_handle *.localhost $localhost_key $localhost_cert
 
 # the following requires www.example.com to be in /etc/hosts
 set cafile [file join $dir "../certs/ca/ca.crt"]